@@ -19,6 +19,7 @@
 #include <asp/Camera/RPCModelGen.h>
 #include <asp/Camera/RPCModel.h>
 #include <vw/Math/Geometry.h>
+#include <vw/Math/LinearAlgebra.h>
 
 using namespace vw;
 
@@ -70,6 +71,165 @@ namespace asp {
     return;
   }
 
+  RpcSolveLMA::RpcSolveLMA( const Vector<double>& normalizedGeodetics,
+                            const Vector<double>& normalizedPixels,
+                            double penaltyWeight
+                            ) :
+    m_normalizedPixels(normalizedPixels),
+    m_wt(penaltyWeight){
+
+    int numPts = normalizedGeodetics.size()/RPCModel::GEODETIC_COORD_SIZE;
+    m_terms.resize(numPts);
+    for (int i = 0; i < numPts; i++) {
+      Vector3 G = subvector(normalizedGeodetics, RPCModel::GEODETIC_COORD_SIZE*i,
+                            RPCModel::GEODETIC_COORD_SIZE);
+      m_terms[i] = RPCModel::calculate_terms(G);
+    }
+  }
+
+  Vector<double> RpcSolveLMA::penalty_factors() {
+
+    // There are 4*20 - 2 = 78 coefficients we optimize. Of those, 2
+    // are 0-th degree, 4*3 = 12 are 1st degree, and the rest, 78 - 12
+    // - 2 = 64 are higher degree.  Per Hartley, we'll add for each
+    // such coefficient c, a term K*c in the cost function vector,
+    // where K is a large number. This will penalize large values in
+    // the higher degree coefficients. Here is the factor multiplying
+    // K for each coefficient, in the order of packCoeffs().
+    Vector<int,20> coeff_order = RPCModel::get_coeff_order(); // This ranges from 1 to 3
+    RPCModel::CoeffVec num, den;
+    for (int i = 0; i < 20; i++)
+      num[i] = (i < 4) ? 0.0 : coeff_order[i] - 1;
+    den = num;
+    den[0] = 1; // Not packed, but must be set for the packing to be meaningful
+    Vector<double> factors;
+    packCoeffs(num, den, num, den, factors);
+    return factors;
+  }
+
+  RpcSolveLMA::result_type RpcSolveLMA::operator()( domain_type const& C ) const {
+
+    // The input is the RPC coefficients, packed in a vector.
+    // For each normalized geodetic, compute the normalized
+    // pixel value. This will be the output.
+
+    // Unpack all the RPC model coefficients from the input vector C
+    RPCModel::CoeffVec lineNum, lineDen, sampNum, sampDen;
+    unpackCoeffs(C, lineNum, lineDen, sampNum, sampDen);
+
+    // Initialize the output vector
+    int numPts = m_terms.size();
+    result_type result;
+    result.set_size(m_normalizedPixels.size());
+      
+    // Loop through each test point, and find the normalized pixel from the terms.
+    for (int i = 0; i < numPts; i++){
+      RPCModel::CoeffVec const& t = m_terms[i];
+      result[RPCModel::IMAGE_COORD_SIZE*i    ] = dot_prod(t, sampNum) / dot_prod(t, sampDen);
+      result[RPCModel::IMAGE_COORD_SIZE*i + 1] = dot_prod(t, lineNum) / dot_prod(t, lineDen);
+    }
+
+    // Add the penalization terms, attached to the end of the output vector.
+    int count = RPCModel::IMAGE_COORD_SIZE*numPts; 
+    Vector<double> factors = penalty_factors();
+    for (int i = 0; i < (int)C.size(); i++) {
+      if (factors[i] != 0)
+        result[count++] = m_wt*C[i]*factors[i];
+    }
+
+    VW_ASSERT((int)result.size() == count, vw::ArgumentErr() << "Book-keeping error.\n");
+
+    return result;
+  }
+
+  RpcSolveLMA::jacobian_type RpcSolveLMA::jacobian( domain_type const& C ) const {
+
+    RPCModel::CoeffVec lineNum, lineDen, sampNum, sampDen;
+    unpackCoeffs(C, lineNum, lineDen, sampNum, sampDen);
+
+    // The packed coefficients are lineNum, lineDen[1:], sampNum, sampDen[1:].
+    const int LINE_START = 0, SAMP_START = 39;
+
+    int numPts = m_terms.size();
+    jacobian_type J(m_normalizedPixels.size(), C.size()); // starts as zero
+    for (int i = 0; i < numPts; i++){
+      RPCModel::CoeffVec const& t = m_terms[i];
+      for (int coord = 0; coord < RPCModel::IMAGE_COORD_SIZE; coord++) {
+        // Sample is the first coordinate, then line
+        RPCModel::CoeffVec const& num = (coord == 0) ? sampNum : lineNum;
+        RPCModel::CoeffVec const& den = (coord == 0) ? sampDen : lineDen;
+        int start = (coord == 0) ? SAMP_START : LINE_START;
+        int row   = RPCModel::IMAGE_COORD_SIZE*i + coord;
+
+        // For the quotient q = num/den, dq/dnum = t/den, dq/dden = -q*t/den.
+        double inv_den = 1.0/dot_prod(t, den);
+        double q       = dot_prod(t, num)*inv_den;
+        for (int k = 0; k < 20; k++)
+          J(row, start + k) = t[k]*inv_den;
+        for (int k = 1; k < 20; k++)
+          J(row, start + 19 + k) = -q*t[k]*inv_den;
+      }
+    }
+
+    // The penalty terms are linear
+    int count = RPCModel::IMAGE_COORD_SIZE*numPts; 
+    Vector<double> factors = penalty_factors();
+    for (int i = 0; i < (int)C.size(); i++) {
+      if (factors[i] != 0)
+        J(count++, i) = m_wt*factors[i];
+    }
+
+    return J;
+  }
+
+  RpcSolveLMA::domain_type RpcSolveLMA::linear_solution() const {
+
+    // Multiplying by the denominator, each pixel value p satisfies
+    //   dot(t, num) - p * dot(t[1:], den[1:]) = p,
+    // which is linear in the 39 coefficients of its coordinate. The
+    // sample and line coordinates do not share any coefficients, so
+    // they are solved for separately, via the normal equations.
+    const int NUM_UNKNOWNS = 39;
+    int numPts = m_terms.size();
+    Vector<double> factors = penalty_factors();
+    Vector<double> C(RPCModel::NUM_RPC_COEFFS);
+
+    for (int coord = 0; coord < RPCModel::IMAGE_COORD_SIZE; coord++) {
+
+      // Sample is the first coordinate, then line
+      int start = (coord == 0) ? 39 : 0;
+
+      Matrix<double> A(NUM_UNKNOWNS, NUM_UNKNOWNS);
+      Vector<double> b(NUM_UNKNOWNS), row(NUM_UNKNOWNS);
+      for (int i = 0; i < numPts; i++) {
+        RPCModel::CoeffVec const& t = m_terms[i];
+        double p = m_normalizedPixels[RPCModel::IMAGE_COORD_SIZE*i + coord];
+        for (int k = 0; k < 20; k++)
+          row[k] = t[k];
+        for (int k = 1; k < 20; k++)
+          row[19 + k] = -p*t[k];
+        for (int r = 0; r < NUM_UNKNOWNS; r++) {
+          b[r] += row[r]*p;
+          for (int c = r; c < NUM_UNKNOWNS; c++)
+            A(r, c) += row[r]*row[c];
+        }
+      }
+
+      // Tikhonov regularization with the same penalty as in the full problem
+      for (int r = 0; r < NUM_UNKNOWNS; r++) {
+        double w = m_wt*factors[start + r];
+        A(r, r) += w*w;
+        for (int c = 0; c < r; c++)
+          A(r, c) = A(c, r);
+      }
+
+      // This handles rank deficiency, such as when all heights are the same.
+      subvector(C, start, NUM_UNKNOWNS) = math::least_squares(A, b);
+    }
+
+    return C;
+  }
+
   /// Print out a name followed by the vector of values
   void print_vec(std::string const& name, Vector<double> const& vals){
     std::cout.precision(16);
@@ -239,6 +399,23 @@ namespace asp {
     // for (size_t i = 0; i < startGuess.size(); i++) startGuess[i] = 0.0; // start with zero
     packCoeffs(line_num, line_den, samp_num, samp_den, startGuess);
 
+    // Also try the solution of the linearized problem, and start from
+    // whichever of the two fits better.
+    Vector<double> linearGuess;
+    try {
+      linearGuess = lma_model.linear_solution();
+    } catch (const std::exception& e) {
+      VW_OUT(DebugMessage, "asp") << "rpc_gen: linear solve failed: " << e.what() << std::endl;
+    }
+    if (linearGuess.size() == startGuess.size()) {
+      double start_error  = norm_2(lma_model.difference(lma_model(startGuess),  normalized_pixels));
+      double linear_error = norm_2(lma_model.difference(lma_model(linearGuess), normalized_pixels));
+      VW_OUT(DebugMessage, "asp") << "rpc_gen: affine and linearized guess errors: "
+                                  << start_error << ' ' << linear_error << std::endl;
+      if (linear_error == linear_error && linear_error < start_error)
+        startGuess = linearGuess;
+    }
+
     VW_OUT(DebugMessage, "asp") << "Initial guess for RPC coeffs: " << startGuess << std::endl;
     
     // Use the L-M solver to optimize the RPC model coefficient values.
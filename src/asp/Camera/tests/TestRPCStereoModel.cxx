@@ -29,6 +29,7 @@
 #include <asp/Camera/LinescanDGModel.h>
 #include <asp/Camera/RPCModel.h>
 #include <asp/Camera/RPCStereoModel.h>
+#include <asp/Camera/RPCModelGen.h>
 #include <asp/Core/StereoSettings.h>
 #include <xercesc/util/PlatformUtils.hpp>
 
@@ -105,6 +106,71 @@ TEST(RPCModel, rpb) {
 #endif
 }
 
+TEST(RPCModelGen, FitKnownModel) {
+
+  // A mildly rational model in normalized coordinates
+  RPCModel::CoeffVec line_num, line_den, samp_num, samp_den;
+  line_num[0] = 0.01; line_num[1] = 0.2;  line_num[2] = 0.9; line_num[3] = 0.05;
+  line_num[4] = 0.01; line_num[8] = 0.002;
+  samp_num[0] = -0.02; samp_num[1] = 1.1; samp_num[2] = -0.1; samp_num[3] = 0.03;
+  samp_num[7] = 0.003;
+  line_den[0] = 1; line_den[1] = 0.001; line_den[3] = -0.002;
+  samp_den[0] = 1; samp_den[2] = 0.002;
+
+  // Sample it on a grid
+  const int N = 7;
+  int num_pts = N*N*N;
+  Vector<double> normalized_geodetics(RPCModel::GEODETIC_COORD_SIZE*num_pts);
+  Vector<double> normalized_pixels(RPCModel::IMAGE_COORD_SIZE*num_pts
+                                   + RpcSolveLMA::NUM_PENALTY_TERMS);
+  for (size_t i = 0; i < normalized_pixels.size(); i++)
+    normalized_pixels[i] = 0.0;
+  int count = 0;
+  for (int i = 0; i < N; i++) {
+    for (int j = 0; j < N; j++) {
+      for (int k = 0; k < N; k++) {
+        Vector3 G(-1 + 2.0*i/(N-1), -1 + 2.0*j/(N-1), -1 + 2.0*k/(N-1));
+        subvector(normalized_geodetics, RPCModel::GEODETIC_COORD_SIZE*count,
+                  RPCModel::GEODETIC_COORD_SIZE) = G;
+        subvector(normalized_pixels, RPCModel::IMAGE_COORD_SIZE*count,
+                  RPCModel::IMAGE_COORD_SIZE)
+          = RPCModel::normalized_geodetic_to_normalized_pixel(G, line_num, line_den,
+                                                              samp_num, samp_den);
+        count++;
+      }
+    }
+  }
+
+  // The analytic Jacobian must agree with a numerical one
+  RpcSolveLMA lma_model(normalized_geodetics, normalized_pixels, 0.1);
+  Vector<double> C;
+  packCoeffs(line_num, line_den, samp_num, samp_den, C);
+  Matrix<double> J = lma_model.jacobian(C);
+  double h = 1e-7;
+  for (int c = 0; c < (int)C.size(); c++) {
+    Vector<double> C2 = C;
+    C2[c] += h;
+    Vector<double> diff = (lma_model(C2) - lma_model(C))/h;
+    for (int r = 0; r < (int)diff.size(); r++)
+      EXPECT_NEAR(J(r, c), diff[r], 1e-5);
+  }
+
+  // With no penalty the fit must reproduce the pixels
+  RPCModel::CoeffVec out_line_num, out_line_den, out_samp_num, out_samp_den;
+  gen_rpc(0.0, "", normalized_geodetics, normalized_pixels,
+          Vector3(1, 1, 1), Vector3(), Vector2(1, 1), Vector2(),
+          out_line_num, out_line_den, out_samp_num, out_samp_den);
+  for (int p = 0; p < num_pts; p++) {
+    Vector3 G = subvector(normalized_geodetics, RPCModel::GEODETIC_COORD_SIZE*p,
+                          RPCModel::GEODETIC_COORD_SIZE);
+    Vector2 pix = RPCModel::normalized_geodetic_to_normalized_pixel(G, out_line_num, out_line_den,
+                                                                    out_samp_num, out_samp_den);
+    Vector2 expected = subvector(normalized_pixels, RPCModel::IMAGE_COORD_SIZE*p,
+                                 RPCModel::IMAGE_COORD_SIZE);
+    EXPECT_VECTOR_NEAR(pix, expected, 1e-8);
+  }
+}
+
 TEST(RPCXML, ReadRPC) {
   xercesc::XMLPlatformUtils::Initialize();
 
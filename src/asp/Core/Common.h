@@ -29,6 +29,7 @@
 #include <boost/filesystem/path.hpp>
 #include <boost/shared_ptr.hpp>
 #include <vw/Core/StringUtils.h>
+#include <vw/Core/Thread.h>
 #include <vw/Image/ImageIO.h>
 #include <vw/FileIO/DiskImageResourceGDAL.h>
 #include <vw/FileIO/DiskImageView.h>
@@ -38,7 +39,9 @@
 #include <vw/Image/ImageViewRef.h>
 #include <vw/Cartography/GeoReference.h>
 #include <vw/Cartography/GeoReferenceUtils.h>
+#include <limits>
 #include <map>
+#include <sstream>
 #include <string>
 
 namespace asp {
@@ -156,6 +159,10 @@ namespace asp {
   // Note: We use this constant in the python code as well
   const std::string ASP_POINT_OFFSET_TAG_STR = "POINT_OFFSET";
 
+  /// String we use in ASP written point cloud files to indicate that the
+  ///  points were saved as integers, in multiples of this value.
+  const std::string ASP_POINT_SCALE_TAG_STR = "POINT_SCALE";
+
   // Specialized functions for reading/writing images with a shift.
   // The shift is meant to bring the pixel values closer to origin,
   // with goal of saving the pixels as float instead of double.
@@ -203,6 +210,50 @@ namespace asp {
   }
 
 
+  /// Number of pixels which did not fit in int32 when quantized. It is
+  /// shared by all the copies of the quantizing functor.
+  struct QuantizeOverflowCount {
+    vw::Mutex   mutex;
+    vw::uint64  count;
+    QuantizeOverflowCount(): count(0) {}
+  };
+
+  /// Divide pixels by given quantum and round to the nearest integer.
+  /// Casting the result to int32 stores a value within half a quantum
+  /// of the original. A pixel with any value outside the int32 range is
+  /// set to zero, which marks an invalid point, and is counted.
+  template <class VecT>
+  struct QuantizeImagePixels: public vw::ReturnFixedType<VecT> {
+    double m_quantum;
+    boost::shared_ptr<QuantizeOverflowCount> m_overflow;
+    QuantizeImagePixels(double quantum,
+                        boost::shared_ptr<QuantizeOverflowCount> overflow):
+      m_quantum(quantum), m_overflow(overflow){
+      VW_ASSERT( m_quantum > 0.0,
+                 vw::ArgumentErr() << "Quantum must be positive.");
+    }
+    VecT operator() (VecT const& pt) const {
+      VecT result = round(pt/m_quantum);
+      for (size_t it = 0; it < result.size(); it++) {
+        if (double(result[it]) < double(std::numeric_limits<vw::int32>::min()) ||
+            double(result[it]) > double(std::numeric_limits<vw::int32>::max())) {
+          vw::Mutex::Lock lock(m_overflow->mutex);
+          m_overflow->count++;
+          return VecT();
+        }
+      }
+      return result;
+    }
+  };
+  template <class ImageT>
+  vw::UnaryPerPixelView<ImageT, QuantizeImagePixels<typename ImageT::pixel_type> >
+  inline quantize_image_pixels( vw::ImageViewBase<ImageT> const& image,
+                                double quantum,
+                                boost::shared_ptr<QuantizeOverflowCount> overflow ) {
+    return vw::UnaryPerPixelView<ImageT, QuantizeImagePixels<typename ImageT::pixel_type> >
+      ( image.impl(), QuantizeImagePixels<typename ImageT::pixel_type>(quantum, overflow) );
+  }
+
   /// To help with compression, round to about 1mm, but
   /// use for rounding a number with few digits in binary.
   const double APPROX_ONE_MM = 1.0/1024.0;
@@ -250,6 +301,40 @@ namespace asp {
                                std::map<std::string, std::string>() );
 
 
+  /// Block write image while subtracting a given value from all
+  /// pixels and saving the result as int32 multiples of the rounding
+  /// error, with horizontal differencing before compression. Neighboring
+  /// points differ by small integers, so this compresses much better than
+  /// float. Read such images with read_asp_point_cloud().
+  template <class ImageT>
+  void block_write_compact_gdal_image(const std::string &filename,
+                                      vw::Vector3 const& shift,
+                                      double rounding_error,
+                                      vw::ImageViewBase<ImageT> const& image,
+                                      bool has_georef,
+                                      vw::cartography::GeoReference const& georef,
+                                      bool has_nodata, double nodata,
+                                      vw::cartography::GdalWriteOptions const& opt,
+                                      vw::ProgressCallback const& progress_callback
+                                      = vw::ProgressCallback::dummy_instance(),
+                                      std::map<std::string, std::string> const& keywords =
+                                      std::map<std::string, std::string>() );
+
+  /// Single-threaded version of block_write_compact_gdal_image().
+  template <class ImageT>
+  void write_compact_gdal_image(const std::string &filename,
+                                vw::Vector3 const& shift,
+                                double rounding_error,
+                                vw::ImageViewBase<ImageT> const& image,
+                                bool has_georef,
+                                vw::cartography::GeoReference const& georef,
+                                bool has_nodata, double nodata,
+                                vw::cartography::GdalWriteOptions const& opt,
+                                vw::ProgressCallback const& progress_callback
+                                = vw::ProgressCallback::dummy_instance(),
+                                std::map<std::string, std::string> const& keywords =
+                                std::map<std::string, std::string>() );
+
   /// Often times, we'd like to save an image to disk by using big
   /// blocks, for performance reasons, then re-write it with desired blocks.
   template <class ImageT>
@@ -93,6 +93,110 @@ namespace asp {
     }
   }
 
+  // Keywords and options for writing a point cloud as integers. The
+  // quantum is a power of 2 unless user-specified, so it prints exactly.
+  inline void compact_write_settings(vw::Vector3 const& shift, double quantum,
+                                     vw::cartography::GdalWriteOptions const& opt,
+                                     std::map<std::string, std::string> const& keywords,
+                                     vw::cartography::GdalWriteOptions & local_opt,
+                                     std::map<std::string, std::string> & local_keywords) {
+    std::ostringstream os;
+    os.precision(17);
+    os << quantum;
+    local_keywords = keywords;
+    local_keywords[ASP_POINT_OFFSET_TAG_STR] = vw::vec_to_str(shift);
+    local_keywords[ASP_POINT_SCALE_TAG_STR]  = os.str();
+
+    // Horizontal differencing of the integers before compression
+    local_opt = opt;
+    local_opt.gdal_options["PREDICTOR"] = "2";
+  }
+
+  // Report the points which were too far from the shift to be saved
+  // as integers, and hence were saved as invalid.
+  inline void report_compact_overflow(std::string const& filename, double quantum,
+                                      QuantizeOverflowCount const& overflow) {
+    if (overflow.count == 0)
+      return;
+    vw::vw_out(vw::WarningMessage)
+      << overflow.count << " points in " << filename << " are more than "
+      << quantum * double(std::numeric_limits<vw::int32>::max())
+      << " meters from " << ASP_POINT_OFFSET_TAG_STR
+      << " and were saved as invalid. Increase point-cloud-rounding-error "
+      << "to keep them.\n";
+  }
+
+  // Block write image while subtracting a given value from all pixels
+  // and saving the result as int32 multiples of the rounding error.
+  template <class ImageT>
+  void block_write_compact_gdal_image(const std::string &filename,
+                                      vw::Vector3 const& shift,
+                                      double rounding_error,
+                                      vw::ImageViewBase<ImageT> const& image,
+                                      bool has_georef,
+                                      vw::cartography::GeoReference const& georef,
+                                      bool has_nodata, double nodata,
+                                      vw::cartography::GdalWriteOptions const& opt,
+                                      vw::ProgressCallback const& progress_callback,
+                                      std::map<std::string, std::string> const& keywords) {
+
+    if (norm_2(shift) > 0){
+
+      double quantum = get_rounding_error(shift, rounding_error);
+      vw::cartography::GdalWriteOptions local_opt;
+      std::map<std::string, std::string> local_keywords;
+      compact_write_settings(shift, quantum, opt, keywords, local_opt, local_keywords);
+
+      boost::shared_ptr<QuantizeOverflowCount> overflow(new QuantizeOverflowCount);
+      block_write_gdal_image(filename,
+                             vw::channel_cast<vw::int32>
+                             (quantize_image_pixels(subtract_shift(image.impl(), shift),
+                                                    quantum, overflow)),
+                             has_georef, georef, has_nodata, nodata,
+                             local_opt, progress_callback, local_keywords);
+      report_compact_overflow(filename, quantum, *overflow);
+
+    }else{
+      block_write_gdal_image(filename, image, has_georef, georef,
+                             has_nodata, nodata, opt,
+                             progress_callback, keywords);
+    }
+  }
+
+  // Single-threaded version of block_write_compact_gdal_image().
+  template <class ImageT>
+  void write_compact_gdal_image(const std::string &filename,
+                                vw::Vector3 const& shift,
+                                double rounding_error,
+                                vw::ImageViewBase<ImageT> const& image,
+                                bool has_georef,
+                                vw::cartography::GeoReference const& georef,
+                                bool has_nodata, double nodata,
+                                vw::cartography::GdalWriteOptions const& opt,
+                                vw::ProgressCallback const& progress_callback,
+                                std::map<std::string, std::string> const& keywords) {
+
+    if (norm_2(shift) > 0){
+
+      double quantum = get_rounding_error(shift, rounding_error);
+      vw::cartography::GdalWriteOptions local_opt;
+      std::map<std::string, std::string> local_keywords;
+      compact_write_settings(shift, quantum, opt, keywords, local_opt, local_keywords);
+
+      boost::shared_ptr<QuantizeOverflowCount> overflow(new QuantizeOverflowCount);
+      write_gdal_image(filename,
+                       vw::channel_cast<vw::int32>
+                       (quantize_image_pixels(subtract_shift(image.impl(), shift),
+                                              quantum, overflow)),
+                       has_georef, georef, has_nodata, nodata,
+                       local_opt, progress_callback, local_keywords);
+      report_compact_overflow(filename, quantum, *overflow);
+    }else{
+      write_gdal_image(filename, image, has_georef, georef,
+                       has_nodata, nodata, opt, progress_callback, keywords);
+    }
+  }
+
   // Often times, we'd like to save an image to disk by using big
   // blocks, for performance reasons, then re-write it with desired blocks.
   template <class ImageT>
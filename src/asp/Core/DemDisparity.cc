@@ -30,6 +30,7 @@
 #include <vw/InterestPoint/MatrixIO.h>
 #include <asp/Core/StereoSettings.h>
 #include <asp/Core/DemDisparity.h>
+#include <asp/Core/DemHeightPyramid.h>
 
 #include <boost/filesystem/operations.hpp>
 namespace fs = boost::filesystem;
@@ -49,7 +50,7 @@ namespace asp {
     boost::shared_ptr<camera::CameraModel> m_left_camera_model;
     boost::shared_ptr<camera::CameraModel> m_right_camera_model;
     bool            m_do_align;
-    Matrix<double>  m_align_left_matrix, m_align_right_matrix;
+    HomographyTransform m_align_left_trans, m_align_right_trans;
     int             m_pixel_sample;
     ImageView<PixelMask<Vector2i> > & m_disparity_spread;
 
@@ -71,8 +72,8 @@ namespace asp {
        m_left_camera_model(left_camera_model),
        m_right_camera_model(right_camera_model),
        m_do_align(do_align),
-       m_align_left_matrix(align_left_matrix),
-       m_align_right_matrix(align_right_matrix),
+       m_align_left_trans(align_left_matrix),
+       m_align_right_trans(align_right_matrix),
        m_pixel_sample(pixel_sample),
        m_disparity_spread(disparity_spread){}
 
@@ -136,7 +137,7 @@ namespace asp {
         Vector2 left_fullres_pix = elem_quot(left_lowres_pix, m_downsample_scale);
         if (m_do_align){
           // Need to go to the image pixel in the untransformed image
-          left_fullres_pix = HomographyTransform(m_align_left_matrix).reverse(left_fullres_pix);
+          left_fullres_pix = m_align_left_trans.reverse(left_fullres_pix);
         }
 
         bool has_intersection;
@@ -173,6 +174,11 @@ namespace asp {
       GeoReference georef_crop = crop(m_dem_georef, dem_box);
       ImageView <PixelMask<float> > dem_crop = crop(m_dem, dem_box);
 
+      // Rays are intersected with the DEM crop by marching through its
+      // min/max height pyramid. Where that fails, use the iterative
+      // solver, which also handles cameras below the DEM top.
+      DemHeightPyramid dem_pyramid(dem_crop);
+
       // Compute the DEM disparity. Use one in every 'm_pixel_sample' pixels.
 
       for (int row = bbox.min().y(); row < bbox.max().y(); row++){
@@ -189,7 +195,7 @@ namespace asp {
           Vector2 left_fullres_pix = elem_quot(left_lowres_pix, m_downsample_scale);
           if (m_do_align){
             // Need to go to the image pixel in the untransformed image
-            left_fullres_pix = HomographyTransform(m_align_left_matrix).reverse(left_fullres_pix);
+            left_fullres_pix = m_align_left_trans.reverse(left_fullres_pix);
           }
 
           bool has_intersection;
@@ -200,15 +206,19 @@ namespace asp {
           } catch (...) {
             continue;
           }
-          Vector3 xyz = camera_pixel_to_dem_xyz(left_camera_ctr, left_camera_vec,
-                                                dem_crop, georef_crop,
-                                                treat_nodata_as_zero,
-                                                has_intersection,
-                                                height_error_tol, max_abs_tol,
-                                                max_rel_tol, num_max_iter,
-                                                prev_xyz
-                                                );
-          if ( !has_intersection || xyz == Vector3() ) continue;
+          Vector3 xyz;
+          if (!march_ray_to_dem(left_camera_ctr, left_camera_vec, dem_pyramid,
+                                georef_crop, height_error_tol, xyz)) {
+            xyz = camera_pixel_to_dem_xyz(left_camera_ctr, left_camera_vec,
+                                          dem_crop, georef_crop,
+                                          treat_nodata_as_zero,
+                                          has_intersection,
+                                          height_error_tol, max_abs_tol,
+                                          max_rel_tol, num_max_iter,
+                                          prev_xyz
+                                          );
+            if ( !has_intersection || xyz == Vector3() ) continue;
+          }
           prev_xyz = xyz;
 
           // Since our DEM is only known approximately, the true
@@ -231,7 +241,7 @@ namespace asp {
               continue;
             }
             if (m_do_align){
-              right_fullres_pix = HomographyTransform(m_align_right_matrix).forward(right_fullres_pix);
+              right_fullres_pix = m_align_right_trans.forward(right_fullres_pix);
             }
 
             Vector2 right_lowres_pix = elem_prod(right_fullres_pix, m_downsample_scale);
@@ -0,0 +1,303 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Core/DemHeightPyramid.h>
+
+#include <vw/Cartography/GeoReferenceUtils.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace vw;
+using namespace vw::cartography;
+
+namespace {
+
+  /// The DEM pixel and the height above the datum of a point
+  Vector3 dem_pixel_and_height(Vector3 const& xyz, GeoReference const& georef) {
+    Vector3 llh = georef.datum().cartesian_to_geodetic(xyz);
+    Vector2 pix = georef.lonlat_to_pixel(subvector(llh, 0, 2));
+    return Vector3(pix[0], pix[1], llh[2]);
+  }
+
+  /// The height of a point above the DEM. Returns false if the DEM
+  /// cannot be interpolated below it.
+  bool height_above_dem(Vector3 const& xyz, asp::DemHeightPyramid const& pyramid,
+                        GeoReference const& georef, double & height) {
+    Vector3 pix_ht = dem_pixel_and_height(xyz, georef);
+    double dem_height = 0.0;
+    if (!pyramid.height(pix_ht[0], pix_ht[1], dem_height))
+      return false;
+    height = pix_ht[2] - dem_height;
+    return true;
+  }
+
+} // end anonymous namespace
+
+asp::DemHeightPyramid::DemHeightPyramid(ImageView<PixelMask<float> > const& dem):
+  m_dem(dem) {
+
+  if (dem.cols() < 2 || dem.rows() < 2)
+    return;
+
+  const float big = std::numeric_limits<float>::max();
+  ImageView<Vector2f> level(dem.cols() - 1, dem.rows() - 1);
+  for (int row = 0; row < level.rows(); row++) {
+    for (int col = 0; col < level.cols(); col++) {
+      Vector2f range(big, -big);
+      bool valid = true;
+      for (int r = row; r <= row + 1; r++) {
+        for (int c = col; c <= col + 1; c++) {
+          PixelMask<float> const& h = dem(c, r);
+          valid = valid && is_valid(h);
+          range[0] = std::min(range[0], h.child());
+          range[1] = std::max(range[1], h.child());
+        }
+      }
+      level(col, row) = valid ? range : Vector2f(big, -big);
+    }
+  }
+  m_levels.push_back(level);
+
+  while (level.cols() > 1 || level.rows() > 1) {
+    ImageView<Vector2f> coarse((level.cols() + 1)/2, (level.rows() + 1)/2);
+    for (int row = 0; row < coarse.rows(); row++) {
+      for (int col = 0; col < coarse.cols(); col++) {
+        Vector2f range(big, -big);
+        for (int r = 2*row; r < std::min(2*row + 2, level.rows()); r++) {
+          for (int c = 2*col; c < std::min(2*col + 2, level.cols()); c++) {
+            range[0] = std::min(range[0], level(c, r)[0]);
+            range[1] = std::max(range[1], level(c, r)[1]);
+          }
+        }
+        coarse(col, row) = range;
+      }
+    }
+    m_levels.push_back(coarse);
+    level = coarse;
+  }
+}
+
+bool asp::DemHeightPyramid::height(double x, double y, double & h) const {
+  if (m_levels.empty())
+    return false;
+  if (x < 0 || y < 0 || x > m_dem.cols() - 1 || y > m_dem.rows() - 1)
+    return false;
+  int col = std::min((int)floor(x), m_levels[0].cols() - 1);
+  int row = std::min((int)floor(y), m_levels[0].rows() - 1);
+  if (m_levels[0](col, row)[0] > m_levels[0](col, row)[1])
+    return false;
+  h = cell_height(col, row, x, y);
+  return true;
+}
+
+bool asp::DemHeightPyramid::intersect(Vector3 const& beg, Vector3 const& end,
+                                      double & s_hit) const {
+
+  if (empty())
+    return false;
+
+  // Clip the segment to the extent of the DEM
+  Vector3 d = end - beg;
+  double s0 = 0.0, s1 = 1.0;
+  int lim[] = {m_levels[0].cols(), m_levels[0].rows()};
+  for (int k = 0; k < 2; k++) {
+    if (d[k] == 0.0) {
+      if (beg[k] < 0 || beg[k] > lim[k])
+        return false;
+      continue;
+    }
+    double sa = (0.0    - beg[k]) / d[k];
+    double sb = (lim[k] - beg[k]) / d[k];
+    s0 = std::max(s0, std::min(sa, sb));
+    s1 = std::min(s1, std::max(sa, sb));
+  }
+  if (s0 > s1)
+    return false;
+
+  // Walk the cells the ray crosses. Skip any cell whose max height
+  // is below the ray there, going to a coarser level after that,
+  // and otherwise go to a finer level. At level 0 solve exactly.
+  const double eps = 1e-9;
+  const int top = m_levels.size() - 1;
+  int level = top;
+  double s = s0;
+  while (s <= s1) {
+
+    ImageView<Vector2f> const& cells = m_levels[level];
+    int cell_size = 1 << level;
+    double x = beg[0] + s*d[0], y = beg[1] + s*d[1];
+    int col = std::max(0, std::min((int)floor(x / cell_size), cells.cols() - 1));
+    int row = std::max(0, std::min((int)floor(y / cell_size), cells.rows() - 1));
+
+    // Where the ray exits this cell
+    double s_exit = s1;
+    if (d[0] > 0) s_exit = std::min(s_exit, ((col + 1)*cell_size - beg[0]) / d[0]);
+    if (d[0] < 0) s_exit = std::min(s_exit, ( col     *cell_size - beg[0]) / d[0]);
+    if (d[1] > 0) s_exit = std::min(s_exit, ((row + 1)*cell_size - beg[1]) / d[1]);
+    if (d[1] < 0) s_exit = std::min(s_exit, ( row     *cell_size - beg[1]) / d[1]);
+    s_exit = std::max(s_exit, s);
+
+    Vector2f range = cells(col, row);
+    double ray_min = std::min(beg[2] + s*d[2], beg[2] + s_exit*d[2]);
+    if (range[0] > range[1] || ray_min > range[1]) {
+      s = s_exit + eps;
+      level = std::min(level + 1, top);
+      continue;
+    }
+
+    if (level > 0) {
+      level--;
+      continue;
+    }
+
+    if (cell_intersect(col, row, beg, d, s, s_exit, s_hit))
+      return true;
+
+    s = s_exit + eps;
+  }
+
+  return false;
+}
+
+double asp::DemHeightPyramid::cell_height(int col, int row, double x, double y) const {
+  double wx = x - col, wy = y - row;
+  double h00 = m_dem(col, row    ).child(), h10 = m_dem(col + 1, row    ).child();
+  double h01 = m_dem(col, row + 1).child(), h11 = m_dem(col + 1, row + 1).child();
+  return (1 - wy) * ((1 - wx)*h00 + wx*h10) + wy * ((1 - wx)*h01 + wx*h11);
+}
+
+double asp::DemHeightPyramid::cell_residual(int col, int row, Vector3 const& beg,
+                                            Vector3 const& d, double s) const {
+  return beg[2] + s*d[2] - cell_height(col, row, beg[0] + s*d[0], beg[1] + s*d[1]);
+}
+
+// The height of the ray above the DEM is quadratic in s within a
+// cell, so it can dip below the DEM and come back up. In that case
+// search up to the dip.
+bool asp::DemHeightPyramid::cell_intersect(int col, int row, Vector3 const& beg,
+                                           Vector3 const& d, double sa, double sb,
+                                           double & s_hit) const {
+  double f0 = cell_residual(col, row, beg, d, sa);
+  if (f0 <= 0) {
+    s_hit = sa;
+    return true;
+  }
+
+  double fm = cell_residual(col, row, beg, d, (sa + sb)/2.0);
+  double f1 = cell_residual(col, row, beg, d, sb);
+
+  // Fit f(u) = a*u^2 + b*u + f0, with u = 0 at sa and u = 1 at sb
+  double a = 2.0*f1 + 2.0*f0 - 4.0*fm;
+  double b = 4.0*fm - 3.0*f0 - f1;
+  double u_min = (a > 0) ? -b/(2.0*a) : 1.0;
+  if (u_min > 0 && u_min < 1 && a*u_min*u_min + b*u_min + f0 <= 0)
+    sb = sa + u_min*(sb - sa);
+  else if (f1 > 0)
+    return false;
+
+  // Bisect, keeping the ray above the DEM at sa and below it at sb
+  for (int iter = 0; iter < 40; iter++) {
+    double sm = (sa + sb)/2.0;
+    if (cell_residual(col, row, beg, d, sm) > 0)
+      sa = sm;
+    else
+      sb = sm;
+  }
+  s_hit = sb;
+  return true;
+}
+
+bool asp::march_ray_to_dem(Vector3 const& camera_ctr, Vector3 const& camera_vec,
+                           DemHeightPyramid const& pyramid, GeoReference const& georef,
+                           double height_error_tol, Vector3 & xyz) {
+
+  if (pyramid.empty())
+    return false;
+
+  // The ray can hit the DEM only between the ellipsoids through the
+  // lowest and highest DEM points. Find where it crosses them.
+  Datum const& datum = georef.datum();
+  double h_top = pyramid.max_height() + height_error_tol;
+  double h_bot = pyramid.min_height() - height_error_tol;
+  if (datum.cartesian_to_geodetic(camera_ctr)[2] <= h_top)
+    return false;
+  Vector3 top = datum_intersection(datum.semi_major_axis() + h_top,
+                                   datum.semi_minor_axis() + h_top, camera_ctr, camera_vec);
+  Vector3 bot = datum_intersection(datum.semi_major_axis() + h_bot,
+                                   datum.semi_minor_axis() + h_bot, camera_ctr, camera_vec);
+  if (top == Vector3() || bot == Vector3())
+    return false;
+  double t_top = dot_prod(top - camera_ctr, camera_vec);
+  double t_bot = dot_prod(bot - camera_ctr, camera_vec);
+  if (t_bot <= t_top)
+    return false;
+
+  // March along pieces of the ray which are short enough to be
+  // nearly linear in DEM pixel and height coordinates.
+  const double MAX_PIECE_PIXELS = 32.0;
+  const int    MAX_NUM_PIECES   = 1000;
+  Vector3 beg = dem_pixel_and_height(camera_ctr + t_top*camera_vec, georef);
+  Vector3 end = dem_pixel_and_height(camera_ctr + t_bot*camera_vec, georef);
+  int num_pieces = std::max(1, (int)ceil(norm_2(subvector(end - beg, 0, 2))/MAX_PIECE_PIXELS));
+  if (num_pieces > MAX_NUM_PIECES)
+    return false;
+
+  double t_hit = -1.0, t_beg = t_top;
+  Vector3 piece_beg = beg;
+  for (int k = 1; k <= num_pieces; k++) {
+    double t_end = t_top + (t_bot - t_top)*k/num_pieces;
+    Vector3 piece_end = (k == num_pieces) ? end :
+      dem_pixel_and_height(camera_ctr + t_end*camera_vec, georef);
+    double s = 0.0;
+    if (pyramid.intersect(piece_beg, piece_end, s)) {
+      t_hit = t_beg + s*(t_end - t_beg);
+      break;
+    }
+    piece_beg = piece_end;
+    t_beg     = t_end;
+  }
+  if (t_hit < 0)
+    return false;
+
+  // Undo any error from the linearization with a few secant steps
+  double r_hit = 0.0;
+  if (!height_above_dem(camera_ctr + t_hit*camera_vec, pyramid, georef, r_hit))
+    return false;
+  if (std::abs(r_hit) > height_error_tol) {
+    const int MAX_ITER = 5;
+    double t_prev = t_hit - height_error_tol, r_prev = 0.0;
+    if (!height_above_dem(camera_ctr + t_prev*camera_vec, pyramid, georef, r_prev))
+      return false;
+    for (int iter = 0; iter < MAX_ITER && std::abs(r_hit) > height_error_tol; iter++) {
+      if (r_hit == r_prev)
+        return false;
+      double t_next = t_hit - r_hit*(t_hit - t_prev)/(r_hit - r_prev);
+      t_prev = t_hit;
+      r_prev = r_hit;
+      t_hit  = t_next;
+      if (!height_above_dem(camera_ctr + t_hit*camera_vec, pyramid, georef, r_hit))
+        return false;
+    }
+    if (std::abs(r_hit) > height_error_tol)
+      return false;
+  }
+
+  xyz = camera_ctr + t_hit*camera_vec;
+  return true;
+}
@@ -0,0 +1,91 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file DemHeightPyramid.h
+///
+/// Intersect rays with a DEM through a min/max pyramid of its heights.
+
+#ifndef __ASP_CORE_DEM_HEIGHT_PYRAMID_H__
+#define __ASP_CORE_DEM_HEIGHT_PYRAMID_H__
+
+#include <vw/Image/ImageView.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Cartography/GeoReference.h>
+
+#include <vector>
+
+namespace asp {
+
+  /// A min/max pyramid over the bilinear patches of a DEM, for finding
+  /// quickly where a ray first goes below the DEM. A level 0 cell (i, j)
+  /// spans the DEM pixels from (i, j) to (i+1, j+1) and stores the min
+  /// and max of their heights. It is empty if any of them is invalid, as
+  /// the DEM cannot be interpolated there. Each cell at level k+1 stores
+  /// the range of the 2x2 cells under it at level k. The DEM is not
+  /// copied, so it must outlive the pyramid.
+  class DemHeightPyramid {
+    vw::ImageView<vw::PixelMask<float> > const& m_dem;
+    std::vector<vw::ImageView<vw::Vector2f> >   m_levels;
+
+  public:
+    DemHeightPyramid(vw::ImageView<vw::PixelMask<float> > const& dem);
+
+    /// True if the DEM has no cell which can be interpolated
+    bool empty() const {
+      return m_levels.empty() || min_height() > max_height();
+    }
+    double min_height() const { return m_levels.back()(0, 0)[0]; }
+    double max_height() const { return m_levels.back()(0, 0)[1]; }
+
+    /// Bilinearly interpolate the DEM height at a given pixel.
+    /// Returns false if outside the DEM or next to invalid pixels.
+    bool height(double x, double y, double & h) const;
+
+    /// Find where a ray segment goes below the DEM for the first time.
+    /// The segment goes from 'beg' to 'end', which are (col, row, height)
+    /// triplets, and the ray is assumed linear in these in between.
+    /// Return the hit position as a fraction of the segment length.
+    bool intersect(vw::Vector3 const& beg, vw::Vector3 const& end, double & s_hit) const;
+
+  private:
+
+    /// Bilinear interpolation within a cell with valid corners
+    double cell_height(int col, int row, double x, double y) const;
+
+    /// Height of the ray above the DEM within a cell
+    double cell_residual(int col, int row, vw::Vector3 const& beg, vw::Vector3 const& d,
+                         double s) const;
+
+    /// Find where the ray goes below the DEM within a level 0 cell, if
+    /// it does so for s in [sa, sb].
+    bool cell_intersect(int col, int row, vw::Vector3 const& beg, vw::Vector3 const& d,
+                        double sa, double sb, double & s_hit) const;
+  };
+
+  /// Intersect a ray with a DEM by marching through its height pyramid.
+  /// The georef is the DEM's. Returns false if the ray misses the DEM,
+  /// or if this approach is not applicable, such as when the camera is
+  /// below the DEM top.
+  bool march_ray_to_dem(vw::Vector3 const& camera_ctr, vw::Vector3 const& camera_vec,
+                        DemHeightPyramid const& pyramid,
+                        vw::cartography::GeoReference const& georef,
+                        double height_error_tol, vw::Vector3 & xyz);
+
+} // end namespace asp
+
+#endif // __ASP_CORE_DEM_HEIGHT_PYRAMID_H__
@@ -0,0 +1,182 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+#include <asp/Core/DistanceTransform.h>
+
+#include <vw/Core/Exception.h>
+#include <vw/Core/Settings.h>
+#include <vw/Core/ThreadPool.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+using namespace vw;
+
+namespace {
+
+  // For each column in [m_beg, m_end), find the vertical distance to the
+  // nearest source, capped at m_cap. The rows are visited in order, with
+  // all columns in the range processed at once, to walk memory sequentially.
+  class ColumnDistanceTask: public Task, private boost::noncopyable {
+    ImageView<uint8> const& m_sources;
+    ImageView<float>      & m_dist;
+    int m_beg, m_end;
+    float m_cap;
+  public:
+    ColumnDistanceTask(ImageView<uint8> const& sources, ImageView<float> & dist,
+                       int beg, int end, float cap):
+      m_sources(sources), m_dist(dist), m_beg(beg), m_end(end), m_cap(cap) {}
+
+    void operator()() {
+      int rows = m_sources.rows();
+
+      // Top to bottom
+      for (int col = m_beg; col < m_end; col++)
+        m_dist(col, 0) = (m_sources(col, 0) != 0) ? 0.0f : m_cap;
+      for (int row = 1; row < rows; row++) {
+        for (int col = m_beg; col < m_end; col++) {
+          m_dist(col, row) = (m_sources(col, row) != 0) ? 0.0f :
+            std::min(m_dist(col, row - 1) + 1.0f, m_cap);
+        }
+      }
+
+      // Bottom to top
+      for (int row = rows - 2; row >= 0; row--) {
+        for (int col = m_beg; col < m_end; col++)
+          m_dist(col, row) = std::min(m_dist(col, row), m_dist(col, row + 1) + 1.0f);
+      }
+    }
+  };
+
+  // Combine the vertical distances along each row in [m_beg, m_end).
+  // With g the vertical distance, the squared distance at column q is
+  // the lower envelope of the parabolas (q - p)^2 + g(p)^2.
+  class RowDistanceTask: public Task, private boost::noncopyable {
+    ImageView<float> & m_dist;
+    int m_beg, m_end;
+    double m_max_dist;
+
+    // The abscissa where the parabolas with vertices at q and p intersect
+    static double intersection(std::vector<double> const& f, int q, int p) {
+      return ((f[q] + double(q) * q) - (f[p] + double(p) * p)) / (2.0 * (q - p));
+    }
+
+  public:
+    RowDistanceTask(ImageView<float> & dist, int beg, int end, double max_dist):
+      m_dist(dist), m_beg(beg), m_end(end), m_max_dist(max_dist) {}
+
+    void operator()() {
+      int cols = m_dist.cols();
+      std::vector<double> f(cols), z(cols + 1);
+      std::vector<int>    v(cols);
+      const double inf = std::numeric_limits<double>::max();
+
+      for (int row = m_beg; row < m_end; row++) {
+        for (int col = 0; col < cols; col++) {
+          double g = m_dist(col, row);
+          f[col] = g * g;
+        }
+
+        // Find the parabolas in the lower envelope. v has their
+        // vertices, and z the boundaries between them.
+        int k = 0;
+        v[0] = 0;
+        z[0] = -inf;
+        z[1] = inf;
+        for (int q = 1; q < cols; q++) {
+          // Intersection with the last parabola. As z[0] is -inf, this
+          // loop stops at k = 0 at the latest.
+          double s = intersection(f, q, v[k]);
+          while (s <= z[k]) {
+            k--;
+            s = intersection(f, q, v[k]);
+          }
+          k++;
+          v[k]     = q;
+          z[k]     = s;
+          z[k + 1] = inf;
+        }
+
+        // Evaluate the envelope
+        k = 0;
+        for (int q = 0; q < cols; q++) {
+          while (z[k + 1] < q)
+            k++;
+          int p = v[k];
+          double d = std::sqrt(double(q - p) * (q - p) + f[p]);
+          m_dist(q, row) = std::min(d, m_max_dist);
+        }
+      }
+    }
+  };
+
+} // end anonymous namespace
+
+namespace asp {
+
+void euclidean_distance_transform(ImageView<uint8> const& sources,
+                                  double max_dist,
+                                  ImageView<float> & dist,
+                                  int num_threads) {
+
+  if (max_dist <= 0)
+    vw_throw(ArgumentErr() << "The maximum distance must be positive.\n");
+
+  int cols = sources.cols(), rows = sources.rows();
+  dist.set_size(cols, rows);
+  if (cols == 0 || rows == 0)
+    return;
+
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+  num_threads = std::max(num_threads, 1);
+
+  // Vertical distances beyond this cannot make the result less than
+  // max_dist, so store them capped, to keep the arithmetic exact.
+  float cap = std::ceil(max_dist) + 1.0;
+
+  // Use a few more tasks than threads, for load balancing
+  int num_tasks = 4 * num_threads;
+
+  {
+    FifoWorkQueue queue(num_threads);
+    int chunk = std::max(1, (cols + num_tasks - 1) / num_tasks);
+    for (int beg = 0; beg < cols; beg += chunk) {
+      boost::shared_ptr<ColumnDistanceTask>
+        task(new ColumnDistanceTask(sources, dist, beg, std::min(beg + chunk, cols), cap));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+
+  {
+    FifoWorkQueue queue(num_threads);
+    int chunk = std::max(1, (rows + num_tasks - 1) / num_tasks);
+    for (int beg = 0; beg < rows; beg += chunk) {
+      boost::shared_ptr<RowDistanceTask>
+        task(new RowDistanceTask(dist, beg, std::min(beg + chunk, rows), max_dist));
+      queue.add_task(task);
+    }
+    queue.join_all();
+  }
+}
+
+} // end namespace asp
@@ -0,0 +1,44 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file DistanceTransform.h
+///
+/// An exact Euclidean distance transform over a whole image.
+
+#ifndef __ASP_CORE_DISTANCE_TRANSFORM_H__
+#define __ASP_CORE_DISTANCE_TRANSFORM_H__
+
+#include <vw/Image/ImageView.h>
+
+namespace asp {
+
+  /// For each pixel, find the Euclidean distance to the nearest pixel
+  /// where 'sources' is nonzero. Distances are exact up to 'max_dist',
+  /// and larger ones, including when there are no sources, are set to
+  /// 'max_dist'. This is the separable algorithm of Felzenszwalb and
+  /// Huttenlocher, run first over columns then over rows, each pass
+  /// split among threads. If num_threads is not positive, use the VW
+  /// default.
+  void euclidean_distance_transform(vw::ImageView<vw::uint8> const& sources,
+                                    double max_dist,
+                                    vw::ImageView<float> & dist,
+                                    int num_threads = 0);
+
+} // end namespace asp
+
+#endif // __ASP_CORE_DISTANCE_TRANSFORM_H__
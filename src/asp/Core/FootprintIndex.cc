@@ -0,0 +1,104 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <asp/Core/FootprintIndex.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace vw;
+
+namespace {
+  // A footprint covering more cells than this is kept in a separate list
+  const int64 MAX_CELLS_PER_FOOTPRINT = 1024;
+}
+
+namespace asp {
+
+FootprintIndex::FootprintIndex(std::vector<BBox2> const& footprints, double cell_size):
+  m_cell_size(cell_size) {
+
+  if (m_cell_size <= 0.0) {
+    std::vector<double> sizes;
+    for (size_t i = 0; i < footprints.size(); i++) {
+      if (!footprints[i].empty())
+        sizes.push_back(std::max(footprints[i].width(), footprints[i].height()));
+    }
+    m_cell_size = 1.0;
+    if (!sizes.empty()) {
+      std::sort(sizes.begin(), sizes.end());
+      m_cell_size = sizes[sizes.size()/2];
+    }
+  }
+  m_cell_size = std::max(m_cell_size, 1.0);
+
+  for (size_t i = 0; i < footprints.size(); i++) {
+    if (footprints[i].empty())
+      continue;
+    int64 col0, row0, col1, row1;
+    cell_range(footprints[i], col0, row0, col1, row1);
+    if ((col1 - col0 + 1) * (row1 - row0 + 1) > MAX_CELLS_PER_FOOTPRINT) {
+      m_large.push_back(i);
+      continue;
+    }
+    for (int64 row = row0; row <= row1; row++)
+      for (int64 col = col0; col <= col1; col++)
+        m_cells[CellT(col, row)].push_back(i);
+  }
+}
+
+void FootprintIndex::cell_range(BBox2 const& box, int64 & col0, int64 & row0,
+                                int64 & col1, int64 & row1) const {
+  col0 = int64(floor(box.min().x() / m_cell_size));
+  row0 = int64(floor(box.min().y() / m_cell_size));
+  col1 = int64(floor(box.max().x() / m_cell_size));
+  row1 = int64(floor(box.max().y() / m_cell_size));
+}
+
+std::vector<int> FootprintIndex::candidates(BBox2 const& box) const {
+
+  std::vector<int> result = m_large;
+  if (box.empty())
+    return std::vector<int>();
+
+  int64 col0, row0, col1, row1;
+  cell_range(box, col0, row0, col1, row1);
+  if ((col1 - col0 + 1) * (row1 - row0 + 1) <= int64(m_cells.size())) {
+    // Look up each cell the box covers
+    for (int64 row = row0; row <= row1; row++) {
+      for (int64 col = col0; col <= col1; col++) {
+        CellMapT::const_iterator it = m_cells.find(CellT(col, row));
+        if (it != m_cells.end())
+          result.insert(result.end(), it->second.begin(), it->second.end());
+      }
+    }
+  } else {
+    // The box is big, so it is faster to go over the occupied cells
+    for (CellMapT::const_iterator it = m_cells.begin(); it != m_cells.end(); it++) {
+      if (it->first.first  >= col0 && it->first.first  <= col1 &&
+          it->first.second >= row0 && it->first.second <= row1)
+        result.insert(result.end(), it->second.begin(), it->second.end());
+    }
+  }
+
+  std::sort(result.begin(), result.end());
+  result.erase(std::unique(result.begin(), result.end()), result.end());
+  return result;
+}
+
+} // end namespace asp
@@ -0,0 +1,67 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+/// \file FootprintIndex.h
+///
+/// A spatial index over the footprints of many images in a common
+/// output domain, for mosaicking tools which need to find the few
+/// images intersecting each output tile.
+
+#ifndef __ASP_CORE_FOOTPRINT_INDEX_H__
+#define __ASP_CORE_FOOTPRINT_INDEX_H__
+
+#include <vw/Core/FundamentalTypes.h>
+#include <vw/Math/BBox.h>
+#include <map>
+#include <vector>
+
+namespace asp {
+
+  /// Buckets footprints into the cells of a uniform grid, storing only
+  /// the cells which are occupied. Finding the footprints which may
+  /// intersect a box then costs time proportional to the cells the box
+  /// covers and the footprints found, rather than to the total number of
+  /// footprints. The result is a superset of the intersecting footprints,
+  /// so callers should still do their own test.
+  class FootprintIndex {
+  public:
+    FootprintIndex(): m_cell_size(1.0) {}
+
+    /// If cell_size is not positive, use the median footprint size.
+    FootprintIndex(std::vector<vw::BBox2> const& footprints, double cell_size = 0.0);
+
+    /// Indices of the footprints which may intersect the given box, in
+    /// increasing order.
+    std::vector<int> candidates(vw::BBox2 const& box) const;
+
+  private:
+    typedef std::pair<vw::int64, vw::int64> CellT; // column and row of a grid cell
+    typedef std::map<CellT, std::vector<int> > CellMapT;
+
+    double   m_cell_size;
+    CellMapT m_cells;
+    std::vector<int> m_large; // footprints spanning too many cells, always returned
+
+    /// The range of grid cells covered by a box
+    void cell_range(vw::BBox2 const& box, vw::int64 & col0, vw::int64 & row0,
+                    vw::int64 & col1, vw::int64 & row1) const;
+  };
+
+} // end namespace asp
+
+#endif // __ASP_CORE_FOOTPRINT_INDEX_H__
@@ -57,37 +57,35 @@ namespace asp {
     // Watch out for errors thrown when projecting into the camera
     try{
 
-      // Intersect the interest point pixel with the datum
-      Vector3 p0 = cartography::datum_intersection( datum, cam_ip, feature );
+      // Find the ray once and intersect it with the datum. This
+      // saves a pixel_to_vector() call compared to intersecting
+      // straight from the camera, which matters for ISIS and
+      // linescan cameras where each such call is expensive.
+      Vector3 ctr = cam_ip->camera_center  ( feature );
+      Vector3 dir = cam_ip->pixel_to_vector( feature );
+      Vector3 p0  = cartography::datum_intersection( datum, ctr, dir );
 
       if (p0 == Vector3()){ // No intersection
         success = false;
         return Vector3();
       }
 
-      Vector3 p1  = p0 + 10*cam_ip->pixel_to_vector( feature ); // Extend the point below the datum
+      Vector3 p1  = p0 + 10*dir; // Extend the point below the datum
       Vector2 ep0 = cam_obj->point_to_pixel( p0 ); // Project the intersection and extension into the other camera
       Vector2 ep1 = cam_obj->point_to_pixel( p1 );
-      Matrix<double> matrix( 2, 3 );
-      select_col( matrix, 2 ) = Vector2(1,1);
-      matrix(0,0) = ep0.x();
-      matrix(0,1) = ep0.y();
-      matrix(1,0) = ep1.x();
-      matrix(1,1) = ep1.y();
-
-      if (matrix != matrix){ // Got back NaN values. Can't proceed.
-        success = false;
-        return Vector3();
-      }
 
-      // If the input matrix is bad this can result in some weird errors!
-      Matrix<double> nsp = nullspace( matrix );
-      if (nsp.cols() <= 0 || nsp.rows() <= 0){ // Failed to find the nullspace
+      // The line through two points in homogeneous coordinates is
+      // their cross product. Normalize it the same way the nullspace
+      // of the 2x3 matrix of these points would be normalized.
+      Vector3 line = cross_prod( Vector3(ep0.x(), ep0.y(), 1), Vector3(ep1.x(), ep1.y(), 1) );
+      double  len  = norm_2( line );
+      if (line != line || len <= 0 || norm_2( subvector( line, 0, 2 ) ) <= 0){
+        // Got back NaN values or the projections coincide. Can't proceed.
         success = false;
         return Vector3();
       }
 
-      return select_col(nsp,0);
+      return line / len;
 
     } catch (std::exception const& e) {
       // Turn this off, it can be verbose
@@ -112,71 +110,92 @@ namespace asp {
       norm_2( subvector( line, 0, 2 ) );
   }
 
+  // Local class definition -----
+  // Find the epipolar lines for a contiguous range of interest points
+  // in the first image. All of the camera work for matching happens
+  // here, so it is done exactly once per interest point, and the
+  // matching tasks below never touch the camera models.
+  class EpipolarLineTask : public Task, private boost::noncopyable {
+    typedef ip::InterestPointList::const_iterator IPListIter;
+    IPListIter                      m_start, m_end;
+    camera::CameraModel            *m_cam1, *m_cam2;
+    cartography::Datum const&       m_datum;
+    std::vector<Vector3>::iterator  m_lines;
+    std::vector<char>::iterator     m_valid;
+  public:
+    EpipolarLineTask( IPListIter start, IPListIter end,
+                      camera::CameraModel* cam1,
+                      camera::CameraModel* cam2,
+                      cartography::Datum const& datum,
+                      std::vector<Vector3>::iterator lines,
+                      std::vector<char>::iterator valid ) :
+      m_start(start), m_end(end), m_cam1(cam1), m_cam2(cam2),
+      m_datum(datum), m_lines(lines), m_valid(valid) {}
+
+    void operator()() {
+      for ( IPListIter ip = m_start; ip != m_end; ip++ ) {
+        bool found_epipolar = false;
+        *m_lines++ = EpipolarLinePointMatcher::epipolar_line( Vector2( ip->x, ip->y ), m_datum,
+                                                              m_cam1, m_cam2, found_epipolar );
+        *m_valid++ = found_epipolar;
+      }
+    }
+  }; // End class EpipolarLineTask -------------------
+
   // Local class definition -----
   class EpipolarLineMatchTask : public Task, private boost::noncopyable {
     typedef ip::InterestPointList::const_iterator IPListIter;
-    bool                            m_single_threaded_camera;
     bool                            m_use_uchar_tree;
     math::FLANNTree<float        >& m_tree_float;
     math::FLANNTree<unsigned char>& m_tree_uchar;
     IPListIter                      m_start, m_end;
-    ip::InterestPointList const&    m_ip_other;
-    camera::CameraModel            *m_cam1, *m_cam2;
+    std::vector<Vector2> const&     m_ip_other;
+    std::vector<Vector3>::const_iterator m_lines;
+    std::vector<char>::const_iterator    m_valid;
     EpipolarLinePointMatcher const& m_matcher;
-    Mutex&                          m_camera_mutex;
     std::vector<size_t>::iterator   m_output;
   public:
-    EpipolarLineMatchTask( bool single_threaded_camera,
-                           bool use_uchar_tree,
+    EpipolarLineMatchTask( bool use_uchar_tree,
                            math::FLANNTree<float        >& tree_float,
                            math::FLANNTree<unsigned char>& tree_uchar,
                            ip::InterestPointList::const_iterator start,
                            ip::InterestPointList::const_iterator end,
-                           ip::InterestPointList const& ip2,
-                           camera::CameraModel* cam1,
-                           camera::CameraModel* cam2,
+                           std::vector<Vector2> const& ip2_coords,
+                           std::vector<Vector3>::const_iterator lines,
+                           std::vector<char>::const_iterator valid,
                            EpipolarLinePointMatcher const& matcher,
-                           Mutex& camera_mutex,
                            std::vector<size_t>::iterator output ) :
-      m_single_threaded_camera(single_threaded_camera),
       m_use_uchar_tree(use_uchar_tree), m_tree_float(tree_float), m_tree_uchar(tree_uchar),
-      m_start(start), m_end(end), m_ip_other(ip2),
-      m_cam1(cam1), m_cam2(cam2),
-      m_matcher( matcher ), m_camera_mutex(camera_mutex), m_output(output) {}
+      m_start(start), m_end(end), m_ip_other(ip2_coords),
+      m_lines(lines), m_valid(valid),
+      m_matcher( matcher ), m_output(output) {}
 
     void operator()() {
 
       const size_t NUM_MATCHES_TO_FIND = 10;
       Vector<int   > indices  (NUM_MATCHES_TO_FIND);
       Vector<double> distances(NUM_MATCHES_TO_FIND);
+      vw::Vector<unsigned char> uchar_descriptor;
 
-      for ( IPListIter ip = m_start; ip != m_end; ip++ ) {
-        Vector2 ip_org_coord = Vector2( ip->x, ip->y );
-        Vector3 line_eq;
+      // Use FLANN tree to find the N nearest neighbors according to the IP region descriptor?
+      std::vector<std::pair<float,int> > kept_indices;
+      kept_indices.reserve(NUM_MATCHES_TO_FIND);
 
-        // Find the equation that describes the epipolar line
-        bool found_epipolar = false;
-        if (m_single_threaded_camera){
-          // ISIS camera is single-threaded
-          Mutex::Lock lock( m_camera_mutex );
-          line_eq = m_matcher.epipolar_line( ip_org_coord, m_matcher.m_datum, m_cam1, m_cam2, found_epipolar);
-        }else{
-          line_eq = m_matcher.epipolar_line( ip_org_coord, m_matcher.m_datum, m_cam1, m_cam2, found_epipolar);
-        }
+      for ( IPListIter ip = m_start; ip != m_end; ip++, m_lines++, m_valid++ ) {
 
-        if (!found_epipolar) {
+        // The epipolar line was precomputed by EpipolarLineTask
+        Vector3 const& line_eq = *m_lines;
+        if (!*m_valid) {
           *m_output++ = (size_t)(-1); // Failed to find a match, return a flag!
           continue; // Skip to the next IP
         }
 
-        // Use FLANN tree to find the N nearest neighbors according to the IP region descriptor?
-        std::vector<std::pair<float,int> > kept_indices;
-        kept_indices.reserve(NUM_MATCHES_TO_FIND);
+        kept_indices.clear();
 
         // Call the correct FLANN tree for the matching type
         size_t num_matches_valid = 0;
         if (m_use_uchar_tree) {
-          vw::Vector<unsigned char> uchar_descriptor(ip->descriptor.size());
+          uchar_descriptor.set_size(ip->descriptor.size());
           for (size_t i=0; i<ip->descriptor.size(); ++i)
             uchar_descriptor[i] = static_cast<unsigned char>(ip->descriptor[i]);
           num_matches_valid = m_tree_uchar.knn_search( uchar_descriptor, indices, distances, NUM_MATCHES_TO_FIND );
@@ -199,25 +218,15 @@ namespace asp {
         double small_epipolar_threshold = m_matcher.m_epipolar_threshold;
         double large_epipolar_threshold = small_epipolar_threshold + EPIPOLAR_BAND_EXPANSION;
         for ( size_t i = 0; i < num_matches_valid; i++ ) {
-          IPListIter ip2_it = m_ip_other.begin();
-          std::advance( ip2_it, indices[i] );
-
-          if (found_epipolar){
-            Vector2 ip2_org_coord = Vector2( ip2_it->x, ip2_it->y );
-            double  line_distance = m_matcher.distance_point_line( line_eq, ip2_org_coord );
-            if ( line_distance < large_epipolar_threshold ) {
-              if ( line_distance < small_epipolar_threshold )
-                kept_indices.push_back( std::pair<float,int>( distances[i], indices[i] ) );
-              else // In between thresholds
-                kept_indices.push_back( std::pair<float,int>( distances[i], -1 ) );
-            }
-            else {
-              Vector2 ip1_coord( ip->x, ip->y );
-              //double normDist = norm_2(ip1_coord - ip2_org_coord);
-              //vw_out() << "Discarding match between " << ip1_coord << " and " << ip2_org_coord
-              //        << " because distance is " << line_distance << " and threshold is "
-              //        << m_matcher.m_epipolar_threshold << " norm dist = " << normDist<<"\n";
-            }
+          // Random access into the packed coordinates, rather than
+          // walking the interest point list to each candidate.
+          Vector2 const& ip2_org_coord = m_ip_other[indices[i]];
+          double  line_distance = m_matcher.distance_point_line( line_eq, ip2_org_coord );
+          if ( line_distance < large_epipolar_threshold ) {
+            if ( line_distance < small_epipolar_threshold )
+              kept_indices.push_back( std::pair<float,int>( distances[i], indices[i] ) );
+            else // In between thresholds
+              kept_indices.push_back( std::pair<float,int>( distances[i], -1 ) );
           }
         } // End loop for match prunining
 
@@ -256,6 +265,55 @@ namespace asp {
     // Build the output indices
     output_indices.resize(ip1_size);
 
+    // Jobs set to 2x the number of cores. This is just incase all jobs are not equal.
+    // The total number of interest points will be divided up among the jobs.
+    size_t number_of_jobs = vw_settings().default_num_threads() * 2;
+#if __APPLE__
+    // Fix due to OpenBLAS crashing and/or giving different results
+    // each time. May need to be revisited.
+    number_of_jobs = std::min(int(vw_settings().default_num_threads()), 1);
+    vw_out() << "\t    Using " << number_of_jobs << " thread(s) for matching.\n";
+#endif
+    
+    // Robustness fix
+    if (ip1_size < number_of_jobs)
+      number_of_jobs = ip1_size;
+
+    // First pass: find the ray and epipolar line of every interest
+    // point in the first image, all at once. With a single-threaded
+    // camera this is done serially, without taking a lock per point.
+    std::vector<Vector3> lines(ip1_size);
+    std::vector<char>    valid(ip1_size, false);
+    if (m_single_threaded_camera) {
+      EpipolarLineTask line_task(ip1.begin(), ip1.end(), cam1, cam2, m_datum,
+                                 lines.begin(), valid.begin());
+      line_task();
+    } else {
+      FifoWorkQueue line_queue;
+      IPListIter start_it = ip1.begin();
+      size_t start_index = 0;
+      for ( size_t i = 0; i < number_of_jobs; i++ ) {
+        size_t end_index = (i + 1 == number_of_jobs) ? ip1_size : start_index + ip1_size / number_of_jobs;
+        IPListIter end_it = start_it;
+        std::advance( end_it, end_index - start_index );
+        boost::shared_ptr<Task>
+          line_task( new EpipolarLineTask( start_it, end_it, cam1, cam2, m_datum,
+                                           lines.begin() + start_index,
+                                           valid.begin() + start_index ) );
+        line_queue.add_task( line_task );
+        start_it    = end_it;
+        start_index = end_index;
+      }
+      line_queue.join_all();
+    }
+
+    // Pack the coordinates of the second image's interest points so
+    // that candidates returned by the tree can be looked up directly.
+    std::vector<Vector2> ip2_coords;
+    ip2_coords.reserve(ip2_size);
+    for (IPListIter it = ip2.begin(); it != ip2.end(); it++)
+      ip2_coords.push_back(Vector2(it->x, it->y));
+
     // Set up FLANNTree objects of all the different types we may need.
     math::FLANNTree<float>         kd_float;
     math::FLANNTree<unsigned char> kd_uchar;
@@ -276,47 +334,25 @@ namespace asp {
     vw_out(InfoMessage,"interest_point") << "FLANN-Tree created. Searching...\n";
 
     FifoWorkQueue matching_queue; // Create a thread pool object
-    Mutex camera_mutex;
-
-    // Jobs set to 2x the number of cores. This is just incase all jobs are not equal.
-    // The total number of interest points will be divided up among the jobs.
-    size_t number_of_jobs = vw_settings().default_num_threads() * 2;
-#if __APPLE__
-    // Fix due to OpenBLAS crashing and/or giving different results
-    // each time. May need to be revisited.
-    number_of_jobs = std::min(int(vw_settings().default_num_threads()), 1);
-    vw_out() << "\t    Using " << number_of_jobs << " thread(s) for matching.\n";
-#endif
-    
-    // Robustness fix
-    if (ip1_size < number_of_jobs)
-      number_of_jobs = ip1_size;
 
     // Get input and output iterators
     IPListIter start_it = ip1.begin();
-    std::vector<size_t>::iterator output_it = output_indices.begin();
+    size_t start_index = 0;
 
-    for ( size_t i = 0; i < number_of_jobs - 1; i++ ) { // For each job...
+    for ( size_t i = 0; i < number_of_jobs; i++ ) { // For each job...
       // Update iterators and launch the job.
+      size_t end_index = (i + 1 == number_of_jobs) ? ip1_size : start_index + ip1_size / number_of_jobs;
       IPListIter end_it = start_it;
-      std::advance( end_it, ip1_size / number_of_jobs );
+      std::advance( end_it, end_index - start_index );
       boost::shared_ptr<Task>
-        match_task( new EpipolarLineMatchTask( m_single_threaded_camera,
-                    use_uchar_FLANN, kd_float, kd_uchar,
-                    start_it, end_it,
-                    ip2, cam1, cam2, *this,
-                    camera_mutex, output_it ) );
+        match_task( new EpipolarLineMatchTask( use_uchar_FLANN, kd_float, kd_uchar,
+                    start_it, end_it, ip2_coords,
+                    lines.begin() + start_index, valid.begin() + start_index,
+                    *this, output_indices.begin() + start_index ) );
       matching_queue.add_task( match_task );
-      start_it = end_it;
-      std::advance( output_it, ip1_size / number_of_jobs );
+      start_it    = end_it;
+      start_index = end_index;
     }
-    boost::shared_ptr<Task>
-      match_task( new EpipolarLineMatchTask( m_single_threaded_camera,
-                  use_uchar_FLANN, kd_float, kd_uchar,
-                  start_it, ip1.end(),
-                  ip2, cam1, cam2, *this,
-                  camera_mutex, output_it ) );
-    matching_queue.add_task( match_task );
     matching_queue.join_all(); // Wait for all the jobs to finish.
   }
 
@@ -36,6 +36,8 @@
 #include <boost/dll.hpp>
 #include <limits>
 #include <cctype>
+#include <fstream>
+#include <sstream>
 
 using namespace vw;
 namespace fs = boost::filesystem;
@@ -50,6 +52,8 @@ namespace asp {
   // also by creating ip from D_sub. If cannot find enough such ip,
   // expand the box a little. Don't try too hard though, as then we
   // end up with too many outliers which can't be filtered easily.
+  // Also return the ip matched over the full images which are in
+  // both windows, with the global alignment applied to them.
   void estimate_right_trans_crop_win(ASPGlobalOptions        const & opt,
                                      std::string             const & left_unaligned_file,
                                      std::string             const & right_unaligned_file,
@@ -57,7 +61,9 @@ namespace asp {
                                      vw::HomographyTransform const & right_global_trans,
                                      ImageViewRef<PixelGray<float>>  right_globally_aligned_image,
                                      BBox2i                  const & left_trans_crop_win, 
-                                     BBox2i                        & right_trans_crop_win) {
+                                     BBox2i                        & right_trans_crop_win,
+                                     std::vector<vw::ip::InterestPoint> & left_global_ip,
+                                     std::vector<vw::ip::InterestPoint> & right_global_ip) {
 
     vw_out() << "\t--> Reading unaligned interest points.\n";
     std::vector<vw::ip::InterestPoint> left_unaligned_ip, right_unaligned_ip;
@@ -143,6 +149,178 @@ namespace asp {
     right_trans_crop_win.crop(bounding_box(right_globally_aligned_image));
   
     //vw_out() << "Right image crop window: " << right_trans_crop_win << std::endl;
+
+    left_global_ip.clear();
+    right_global_ip.clear();
+    for (size_t i = 0; i < left_unaligned_ip.size(); i++) {
+      Vector2 left_pt  = left_global_trans.forward(Vector2(left_unaligned_ip[i].x,
+                                                           left_unaligned_ip[i].y));
+      Vector2 right_pt = right_global_trans.forward(Vector2(right_unaligned_ip[i].x,
+                                                            right_unaligned_ip[i].y));
+      if (!left_trans_crop_win.contains(left_pt) || !right_trans_crop_win.contains(right_pt))
+        continue;
+      left_global_ip.push_back(left_unaligned_ip[i]);
+      right_global_ip.push_back(right_unaligned_ip[i]);
+      left_global_ip.back().x  = left_pt.x();
+      left_global_ip.back().y  = left_pt.y();
+      right_global_ip.back().x = right_pt.x();
+      right_global_ip.back().y = right_pt.y();
+    }
+  }
+
+  // Check if the given ip, in the coordinates of the given window,
+  // cover it well enough to find the local alignment from them
+  // alone. Split the window into a grid and require a few ip in each
+  // cell. This fails on windows with some no-data, which is fine, as
+  // then ip detection is still done as before.
+  bool ip_cover_window(std::vector<vw::ip::InterestPoint> const& ip, BBox2i const& win) {
+
+    int grid_size = 4, min_ip_per_cell = 3;
+    if (win.width() < grid_size || win.height() < grid_size)
+      return false;
+    
+    std::vector<int> count(grid_size * grid_size, 0);
+    for (size_t i = 0; i < ip.size(); i++) {
+      int col = int(ip[i].x * grid_size / win.width());
+      int row = int(ip[i].y * grid_size / win.height());
+      if (col < 0 || row < 0 || col >= grid_size || row >= grid_size)
+        continue;
+      count[row * grid_size + col]++;
+    }
+
+    for (size_t i = 0; i < count.size(); i++) {
+      if (count[i] < min_ip_per_cell)
+        return false;
+    }
+    return true;
+  }
+
+  // The results of local alignment for a tile are saved, so that a
+  // rerun for the same tile can skip it if its inputs did not change.
+  std::string local_alignment_cache_file(ASPGlobalOptions const& opt) {
+    return opt.out_prefix + "-local-alignment.txt";
+  }
+
+  // The settings which affect local alignment, to save with it. These
+  // are the options of its own steps, of interest point detection and
+  // matching, of reading D_sub, and of the cameras used to filter the
+  // interest points.
+  std::string local_alignment_settings(std::string const& session_name,
+                                       int max_tile_size,
+                                       vw::cartography::Datum const& datum) {
+    std::ostringstream os;
+    os.precision(17);
+    os << session_name << ' ' << max_tile_size << ' '
+       << stereo_settings().ip_per_tile << ' '
+       << stereo_settings().ip_per_image << ' '
+       << stereo_settings().local_alignment_threshold << ' '
+       << stereo_settings().alignment_num_ransac_iterations << ' '
+       << stereo_settings().outlier_removal_params[0] << ' '
+       << stereo_settings().outlier_removal_params[1] << ' '
+       << stereo_settings().disparity_range_expansion_percent << ' '
+       << stereo_settings().ip_matching_method << ' '
+       << stereo_settings().num_scales << ' '
+       << stereo_settings().ip_nodata_radius << ' '
+       << stereo_settings().ip_normalize_tiles << ' '
+       << stereo_settings().skip_image_normalization << ' '
+       << stereo_settings().ip_uniqueness_thresh << ' '
+       << stereo_settings().min_triangulation_angle << ' '
+       << stereo_settings().use_least_squares << ' '
+       << stereo_settings().skip_low_res_disparity_comp << ' '
+       << stereo_settings().left_image_crop_win << ' '
+       << stereo_settings().right_image_crop_win << ' '
+       << datum.semi_major_axis() << ' ' << datum.semi_minor_axis() << ' '
+       << stereo_settings().bundle_adjust_prefix;
+    return os.str();
+  }
+  
+  // Read the saved local alignment. Return false if it is missing,
+  // stale, or was found for a different tile or with other settings.
+  bool read_local_alignment_cache(ASPGlobalOptions const& opt,
+                                  std::vector<std::string> const& input_files,
+                                  std::string const& settings,
+                                  BBox2i const& tile_crop_win,
+                                  BBox2i             & left_trans_crop_win,
+                                  BBox2i             & right_trans_crop_win,
+                                  Matrix<double>     & left_local_mat,
+                                  Matrix<double>     & right_local_mat,
+                                  Vector2i           & local_trans_aligned_size,
+                                  int                & min_disp,
+                                  int                & max_disp) {
+
+    std::string cache_file = local_alignment_cache_file(opt);
+    if (!fs::exists(cache_file))
+      return false;
+
+    // The cache must be newer than the data it was made from
+    std::time_t cache_time = fs::last_write_time(cache_file);
+    for (size_t i = 0; i < input_files.size(); i++) {
+      if (!fs::exists(input_files[i]) || fs::last_write_time(input_files[i]) > cache_time)
+        return false;
+    }
+    
+    std::ifstream ifs(cache_file.c_str());
+    std::string cached_settings;
+    std::getline(ifs, cached_settings);
+    Vector4 tile_win, left_win, right_win;
+    ifs >> tile_win[0] >> tile_win[1] >> tile_win[2] >> tile_win[3];
+    ifs >> left_win[0] >> left_win[1] >> left_win[2] >> left_win[3];
+    ifs >> right_win[0] >> right_win[1] >> right_win[2] >> right_win[3];
+    Matrix<double> left_mat(3, 3), right_mat(3, 3);
+    for (int row = 0; row < 3; row++)
+      for (int col = 0; col < 3; col++)
+        ifs >> left_mat(row, col);
+    for (int row = 0; row < 3; row++)
+      for (int col = 0; col < 3; col++)
+        ifs >> right_mat(row, col);
+    Vector2i aligned_size;
+    int cached_min_disp = 0, cached_max_disp = 0;
+    ifs >> aligned_size[0] >> aligned_size[1] >> cached_min_disp >> cached_max_disp;
+    if (!ifs)
+      return false;
+
+    if (cached_settings != settings ||
+        BBox2i(tile_win[0], tile_win[1], tile_win[2], tile_win[3]) != tile_crop_win)
+      return false;
+
+    left_trans_crop_win  = BBox2i(left_win[0], left_win[1], left_win[2], left_win[3]);
+    right_trans_crop_win = BBox2i(right_win[0], right_win[1], right_win[2], right_win[3]);
+    left_local_mat       = left_mat;
+    right_local_mat      = right_mat;
+    local_trans_aligned_size = aligned_size;
+    min_disp             = cached_min_disp;
+    max_disp             = cached_max_disp;
+    
+    return true;
+  }
+
+  void write_local_alignment_cache(ASPGlobalOptions const& opt,
+                                   std::string const& settings,
+                                   BBox2i const& tile_crop_win,
+                                   BBox2i             const& left_trans_crop_win,
+                                   BBox2i             const& right_trans_crop_win,
+                                   Matrix<double>     const& left_local_mat,
+                                   Matrix<double>     const& right_local_mat,
+                                   Vector2i           const& local_trans_aligned_size,
+                                   int min_disp, int max_disp) {
+
+    std::string cache_file = local_alignment_cache_file(opt);
+    std::ofstream ofs(cache_file.c_str());
+    ofs.precision(17);
+    ofs << settings << "\n";
+    BBox2i wins[3] = {tile_crop_win, left_trans_crop_win, right_trans_crop_win};
+    for (int it = 0; it < 3; it++)
+      ofs << wins[it].min().x() << ' ' << wins[it].min().y() << ' '
+          << wins[it].width()   << ' ' << wins[it].height()  << "\n";
+    Matrix<double> const* mats[2] = {&left_local_mat, &right_local_mat};
+    for (int it = 0; it < 2; it++) {
+      for (int row = 0; row < 3; row++)
+        for (int col = 0; col < 3; col++)
+          ofs << (*mats[it])(row, col) << ' ';
+      ofs << "\n";
+    }
+    ofs << local_trans_aligned_size[0] << ' ' << local_trans_aligned_size[1] << ' '
+        << min_disp << ' ' << max_disp << "\n";
   }
 
   // Unalign the ip, filter them using the cameras, align them back,
@@ -258,50 +436,26 @@ namespace asp {
   }
   
   
-  // Algorithm to perform local alignment. Approach:
-  //  - Given the global interest points and the left crop window, find
-  //    the right crop window.
-  //  - Crop the globally aligned images to these crop windows and find
-  //    the interest points for the crops
-  //  - Use the interest points to find the local alignment
-  //  - Apply the composition of the global and local alignment to the
-  //    original unaligned images to find the locally aligned images
-  //  - Save the locally aligned images to disk
-  //  - Estimate the search range for the locally aligned images
-
-  void local_alignment(// Inputs
-                       ASPGlobalOptions        const & opt,
-                       std::string             const & session_name,
-                       int                             max_tile_size,
-                       vw::BBox2i              const & tile_crop_win,
-                       bool                            write_nodata,
-                       vw::camera::CameraModel const * left_camera_model,
-                       vw::camera::CameraModel const * right_camera_model,
-                       vw::cartography::Datum  const & datum,
-                       // Outputs        
-                       vw::BBox2i                    & left_trans_crop_win,
-                       vw::BBox2i                    & right_trans_crop_win,
-                       vw::Matrix<double>            & left_local_mat,
-                       vw::Matrix<double>            & right_local_mat,
-                       std::string                   & left_aligned_file,
-                       std::string                   & right_aligned_file,
-                       int                           & min_disp,
-                       int                           & max_disp) {
-  
-    // Read the unaligned images
-    std::string left_unaligned_file = opt.in_file1;
-    std::string right_unaligned_file = opt.in_file2;
-
-    // TODO(oalexan1): Not sure if parallel_stereo won't strip the
-    // crop win information.
-    bool crop_left  = (stereo_settings().left_image_crop_win  != BBox2i(0, 0, 0, 0));
-    bool crop_right = (stereo_settings().right_image_crop_win != BBox2i(0, 0, 0, 0));
-    if (crop_left) 
-      left_unaligned_file = opt.out_prefix + "-L-cropped.tif";
-    if (crop_right) 
-      right_unaligned_file = opt.out_prefix + "-R-cropped.tif";
-
-    // Read the globally aligned images and alignment transforms
+  // Find the local alignment of a tile and the disparity search range
+  // for the locally aligned images. See local_alignment() for the
+  // approach.
+  void find_local_alignment(// Inputs
+                            ASPGlobalOptions        const & opt,
+                            std::string             const & left_unaligned_file,
+                            std::string             const & right_unaligned_file,
+                            int                             max_tile_size,
+                            vw::BBox2i              const & tile_crop_win,
+                            vw::camera::CameraModel const * left_camera_model,
+                            vw::camera::CameraModel const * right_camera_model,
+                            vw::cartography::Datum  const & datum,
+                            // Outputs        
+                            vw::BBox2i                    & left_trans_crop_win,
+                            vw::BBox2i                    & right_trans_crop_win,
+                            vw::Matrix<double>            & left_local_mat,
+                            vw::Matrix<double>            & right_local_mat,
+                            vw::Vector2i                  & local_trans_aligned_size,
+                            int                           & min_disp,
+                            int                           & max_disp) {
   
     std::string left_globally_aligned_file = opt.out_prefix + "-L.tif";
     std::string right_globally_aligned_file = opt.out_prefix + "-R.tif";
@@ -352,23 +506,40 @@ namespace asp {
     // Estimate the region in the right image corresponding
     // to left_trans_crop_win based on ip in the current box and
     // also by creating ip from D_sub.
+    std::vector<vw::ip::InterestPoint> left_local_ip, right_local_ip;
     estimate_right_trans_crop_win(opt,
                                   left_unaligned_file, right_unaligned_file,
                                   left_global_trans, right_global_trans,  
                                   right_globally_aligned_image,  
-                                  left_trans_crop_win, right_trans_crop_win);
+                                  left_trans_crop_win, right_trans_crop_win,
+                                  left_local_ip, right_local_ip);
+
+    // Make the ip matched over the full images be relative to the tile
+    for (size_t i = 0; i < left_local_ip.size(); i++) {
+      left_local_ip[i].x  -= left_trans_crop_win.min().x();
+      left_local_ip[i].y  -= left_trans_crop_win.min().y();
+      right_local_ip[i].x -= right_trans_crop_win.min().x();
+      right_local_ip[i].y -= right_trans_crop_win.min().y();
+    }
 
-    // Redo ip matching in the current tile. It should be more accurate after alignment
-    // and cropping
-    std::vector<vw::ip::InterestPoint> left_local_ip, right_local_ip;
-    detect_match_ip(left_local_ip, right_local_ip,
-                    crop(left_globally_aligned_image, left_trans_crop_win),
-                    crop(right_globally_aligned_image, right_trans_crop_win), 
-                    stereo_settings().ip_per_tile,  
-                    "", "", // do not save any results to disk  
-                    left_nodata_value, right_nodata_value,
-                    "" // do not save any match file to disk
-                    );
+    // If those ip cover the tile well, use them. Otherwise redo ip
+    // matching in the current tile. It should be more accurate after
+    // alignment and cropping.
+    if (ip_cover_window(left_local_ip, left_trans_crop_win)) {
+      vw_out() << "\t--> Using " << left_local_ip.size()
+               << " interest points from the full images for this tile.\n";
+    } else {
+      left_local_ip.clear();
+      right_local_ip.clear();
+      detect_match_ip(left_local_ip, right_local_ip,
+                      crop(left_globally_aligned_image, left_trans_crop_win),
+                      crop(right_globally_aligned_image, right_trans_crop_win), 
+                      stereo_settings().ip_per_tile,  
+                      "", "", // do not save any results to disk  
+                      left_nodata_value, right_nodata_value,
+                      "" // do not save any match file to disk
+                      );
+    }
 
 #if DEBUG_ALIGNMENT 
     {
@@ -399,19 +570,10 @@ namespace asp {
     }
 #endif
     
-    // The matrices which take care of the crop to the current tile
-    Matrix<double> left_crop_mat  = math::identity_matrix<3>();
-    Matrix<double> right_crop_mat = math::identity_matrix<3>();
-
-    left_crop_mat (0, 2) = -left_trans_crop_win.min().x();
-    left_crop_mat (1, 2) = -left_trans_crop_win.min().y();
-    right_crop_mat(0, 2) = -right_trans_crop_win.min().x();
-    right_crop_mat(1, 2) = -right_trans_crop_win.min().y();
-
     // Find the local alignment
     std::vector<size_t> ip_inlier_indices;
     bool crop_to_shared_area = false;
-    Vector2i local_trans_aligned_size =
+    local_trans_aligned_size =
       affine_epipolar_rectification(left_trans_crop_win.size(), right_trans_crop_win.size(),
                                     stereo_settings().local_alignment_threshold,
                                     stereo_settings().alignment_num_ransac_iterations,
@@ -419,6 +581,162 @@ namespace asp {
                                     crop_to_shared_area,
                                     left_local_mat, right_local_mat, &ip_inlier_indices);
 
+    Vector2 outlier_removal_params = stereo_settings().outlier_removal_params;
+
+    // Filter outliers using cameras among the ip in the tile which have the global alignment
+    // applied to them. 
+    if (outlier_removal_params[0] < 100.0)
+      filter_ip_using_cameras(opt, outlier_removal_params,  
+                              left_global_trans, right_global_trans,  
+                              left_trans_crop_win, right_trans_crop_win,  
+                              left_camera_model, right_camera_model, datum,
+                              // These get modified
+                              left_local_ip, right_local_ip, ip_inlier_indices);
+
+    // Apply the local alignment transform to ip in the tile
+    std::vector<vw::ip::InterestPoint> left_trans_local_ip;
+    std::vector<vw::ip::InterestPoint> right_trans_local_ip;
+    apply_transforms_to_ip(left_local_ip, right_local_ip, ip_inlier_indices,  
+                           left_local_mat, right_local_mat,  
+                           // Outputs
+                           left_trans_local_ip, right_trans_local_ip);
+
+    // Filter outliers among locally aligned ip, this can reduce the search range
+
+    if (outlier_removal_params[0] < 100.0)
+      asp::filter_ip_by_disparity(outlier_removal_params[0], outlier_removal_params[1],
+                                  left_trans_local_ip, right_trans_local_ip);
+    
+    //  Find the disparity search range
+    BBox2 disp_range;
+    for (size_t it = 0; it < left_trans_local_ip.size(); it++) {
+      Vector2 left_pt (left_trans_local_ip [it].x, left_trans_local_ip [it].y);
+      Vector2 right_pt(right_trans_local_ip[it].x, right_trans_local_ip[it].y);
+      disp_range.grow(right_pt - left_pt);
+    }
+    
+#if DEBUG_ALIGNMENT
+    std::string local_aligned_match_filename
+      = vw::ip::match_filename(opt.out_prefix, "left-aligned-tile.tif",
+                               "right-aligned-tile.tif");
+    vw_out() << "Writing match file: " << local_aligned_match_filename << "\n";
+    vw::ip::write_binary_match_file(local_aligned_match_filename, left_trans_local_ip,
+                                    right_trans_local_ip);
+#endif
+    
+    // Expand the disparity search range a bit
+    double disp_width = disp_range.width();
+    double disp_extra = disp_width * stereo_settings().disparity_range_expansion_percent / 100.0;
+    
+    min_disp = floor(disp_range.min().x() - disp_extra/2.0);
+    max_disp = ceil(disp_range.max().x() + disp_extra/2.0);
+  }
+  
+  // Algorithm to perform local alignment. Approach:
+  //  - Given the global interest points and the left crop window, find
+  //    the right crop window.
+  //  - Crop the globally aligned images to these crop windows and find
+  //    the interest points for the crops, unless the global interest
+  //    points cover the crop well enough
+  //  - Use the interest points to find the local alignment
+  //  - Estimate the search range for the locally aligned images
+  //  - Apply the composition of the global and local alignment to the
+  //    original unaligned images to find the locally aligned images
+  //  - Save the locally aligned images to disk, if asked to. They are
+  //    needed only by external programs, or for debugging.
+  // All but the last two steps are skipped if this tile was aligned
+  // before with the same inputs and settings.
+
+  void local_alignment(// Inputs
+                       ASPGlobalOptions        const & opt,
+                       std::string             const & session_name,
+                       int                             max_tile_size,
+                       vw::BBox2i              const & tile_crop_win,
+                       bool                            write_aligned_images,
+                       bool                            write_nodata,
+                       vw::camera::CameraModel const * left_camera_model,
+                       vw::camera::CameraModel const * right_camera_model,
+                       vw::cartography::Datum  const & datum,
+                       // Outputs        
+                       vw::BBox2i                    & left_trans_crop_win,
+                       vw::BBox2i                    & right_trans_crop_win,
+                       vw::Matrix<double>            & left_local_mat,
+                       vw::Matrix<double>            & right_local_mat,
+                       vw::ImageView<float>          & left_trans_clip,
+                       vw::ImageView<float>          & right_trans_clip,
+                       std::string                   & left_aligned_file,
+                       std::string                   & right_aligned_file,
+                       int                           & min_disp,
+                       int                           & max_disp) {
+  
+    // Read the unaligned images
+    std::string left_unaligned_file = opt.in_file1;
+    std::string right_unaligned_file = opt.in_file2;
+
+    // TODO(oalexan1): Not sure if parallel_stereo won't strip the
+    // crop win information.
+    bool crop_left  = (stereo_settings().left_image_crop_win  != BBox2i(0, 0, 0, 0));
+    bool crop_right = (stereo_settings().right_image_crop_win != BBox2i(0, 0, 0, 0));
+    if (crop_left) 
+      left_unaligned_file = opt.out_prefix + "-L-cropped.tif";
+    if (crop_right) 
+      right_unaligned_file = opt.out_prefix + "-R-cropped.tif";
+
+    // If this tile was aligned before from the same data, reuse that
+    std::vector<std::string> input_files;
+    input_files.push_back(opt.out_prefix + "-L.tif");
+    input_files.push_back(opt.out_prefix + "-R.tif");
+    input_files.push_back(opt.out_prefix + "-align-L.exr");
+    input_files.push_back(opt.out_prefix + "-align-R.exr");
+    input_files.push_back(vw::ip::match_filename(opt.out_prefix,
+                                                 left_unaligned_file, right_unaligned_file));
+    input_files.push_back(opt.out_prefix + "-D_sub.tif"); // the crop window and ip come from it
+    // The cameras used to filter the ip. If a camera file name is
+    // empty, the camera is stored in the image.
+    std::string cam_files[2] = {opt.cam_file1, opt.cam_file2};
+    std::string in_files [2] = {opt.in_file1,  opt.in_file2 };
+    for (int it = 0; it < 2; it++) {
+      std::string cam_file = cam_files[it].empty() ? in_files[it] : cam_files[it];
+      if (fs::exists(cam_file))
+        input_files.push_back(cam_file);
+    }
+    std::string settings = local_alignment_settings(session_name, max_tile_size, datum);
+    Vector2i local_trans_aligned_size;
+    if (read_local_alignment_cache(opt, input_files, settings, tile_crop_win,
+                                   left_trans_crop_win, right_trans_crop_win,
+                                   left_local_mat, right_local_mat,
+                                   local_trans_aligned_size,
+                                   min_disp, max_disp)) {
+      vw_out() << "\t--> Using the saved local alignment: "
+               << local_alignment_cache_file(opt) << "\n";
+    } else {
+      find_local_alignment(opt, left_unaligned_file, right_unaligned_file,
+                           max_tile_size, tile_crop_win,
+                           left_camera_model, right_camera_model, datum,
+                           left_trans_crop_win, right_trans_crop_win,
+                           left_local_mat, right_local_mat,
+                           local_trans_aligned_size, min_disp, max_disp);
+      write_local_alignment_cache(opt, settings, tile_crop_win,
+                                  left_trans_crop_win, right_trans_crop_win,
+                                  left_local_mat, right_local_mat,
+                                  local_trans_aligned_size,
+                                  min_disp, max_disp);
+    }
+
+    Matrix<double> left_global_mat  = math::identity_matrix<3>();
+    Matrix<double> right_global_mat = math::identity_matrix<3>();
+    read_matrix(left_global_mat, opt.out_prefix + "-align-L.exr");
+    read_matrix(right_global_mat, opt.out_prefix + "-align-R.exr");
+
+    // The matrices which take care of the crop to the current tile
+    Matrix<double> left_crop_mat  = math::identity_matrix<3>();
+    Matrix<double> right_crop_mat = math::identity_matrix<3>();
+
+    left_crop_mat (0, 2) = -left_trans_crop_win.min().x();
+    left_crop_mat (1, 2) = -left_trans_crop_win.min().y();
+    right_crop_mat(0, 2) = -right_trans_crop_win.min().x();
+    right_crop_mat(1, 2) = -right_trans_crop_win.min().y();
+
     // Combination of global alignment, crop to current tile, and local alignment
     Matrix<double> combined_left_mat  = left_local_mat * left_crop_mat * left_global_mat;
     Matrix<double> combined_right_mat = right_local_mat * right_crop_mat * right_global_mat;
@@ -494,27 +812,33 @@ namespace asp {
     // gracefully. It could not be found in reasonable time where the
     // abort was happening.
     
-    ImageView<float> left_trans_clip
-      = apply_mask(left_aligned_image, nan_nodata); 
-    ImageView<float> right_trans_clip
+    left_trans_clip = apply_mask(left_aligned_image, nan_nodata); 
+    right_trans_clip
       = apply_mask(crop
                    (edge_extend(right_aligned_image,
                                 ValueEdgeExtension<PixelMask<float>>(nodata_mask)),
                     bounding_box(left_aligned_image)), // note the left bounding box
                    nan_nodata);
+
+    left_aligned_file  = opt.out_prefix + "-left-aligned-tile.tif";
+    right_aligned_file = opt.out_prefix + "-right-aligned-tile.tif";
+    if (!write_aligned_images) {
+      // Wipe any stale copies, so they are not mistaken for current ones
+      if (fs::exists(left_aligned_file))
+        fs::remove(left_aligned_file);
+      if (fs::exists(right_aligned_file))
+        fs::remove(right_aligned_file);
+      return;
+    }
     
     // Write the locally aligned images to disk
     vw::cartography::GeoReference georef;
     bool has_georef = false, has_aligned_nodata = write_nodata;
-    std::string left_tile = "left-aligned-tile.tif";
-    std::string right_tile = "right-aligned-tile.tif";
-    left_aligned_file = opt.out_prefix + "-" + left_tile; 
     vw_out() << "\t--> Writing: " << left_aligned_file << "\n";
     block_write_gdal_image(left_aligned_file, left_trans_clip,
                            has_georef, georef,
                            has_aligned_nodata, nan_nodata, opt,
                            TerminalProgressCallback("asp","\t  Left:  "));
-    right_aligned_file = opt.out_prefix + "-" + right_tile;
     vw_out() << "\t--> Writing: " << right_aligned_file << "\n";
     block_write_gdal_image(right_aligned_file,
                            right_trans_clip,
@@ -522,55 +846,6 @@ namespace asp {
                            has_aligned_nodata, nan_nodata, opt,
                            TerminalProgressCallback("asp","\t  Right:  "));
     
-    Vector2 outlier_removal_params = stereo_settings().outlier_removal_params;
-
-    // Filter outliers using cameras among the ip in the tile which have the global alignment
-    // applied to them. 
-    if (outlier_removal_params[0] < 100.0)
-      filter_ip_using_cameras(opt, outlier_removal_params,  
-                              left_global_trans, right_global_trans,  
-                              left_trans_crop_win, right_trans_crop_win,  
-                              left_camera_model, right_camera_model, datum,
-                              // These get modified
-                              left_local_ip, right_local_ip, ip_inlier_indices);
-
-    // Apply the local alignment transform to ip in the tile
-    std::vector<vw::ip::InterestPoint> left_trans_local_ip;
-    std::vector<vw::ip::InterestPoint> right_trans_local_ip;
-    apply_transforms_to_ip(left_local_ip, right_local_ip, ip_inlier_indices,  
-                           left_local_mat, right_local_mat,  
-                           // Outputs
-                           left_trans_local_ip, right_trans_local_ip);
-
-    // Filter outliers among locally aligned ip, this can reduce the search range
-
-    if (outlier_removal_params[0] < 100.0)
-      asp::filter_ip_by_disparity(outlier_removal_params[0], outlier_removal_params[1],
-                                  left_trans_local_ip, right_trans_local_ip);
-    
-    //  Find the disparity search range
-    BBox2 disp_range;
-    for (size_t it = 0; it < left_trans_local_ip.size(); it++) {
-      Vector2 left_pt (left_trans_local_ip [it].x, left_trans_local_ip [it].y);
-      Vector2 right_pt(right_trans_local_ip[it].x, right_trans_local_ip[it].y);
-      disp_range.grow(right_pt - left_pt);
-    }
-    
-#if DEBUG_ALIGNMENT
-    std::string local_aligned_match_filename
-      = vw::ip::match_filename(opt.out_prefix, left_tile, right_tile);
-    vw_out() << "Writing match file: " << local_aligned_match_filename << "\n";
-    vw::ip::write_binary_match_file(local_aligned_match_filename, left_trans_local_ip,
-                                    right_trans_local_ip);
-#endif
-    
-    // Expand the disparity search range a bit
-    double disp_width = disp_range.width();
-    double disp_extra = disp_width * stereo_settings().disparity_range_expansion_percent / 100.0;
-    
-    min_disp = floor(disp_range.min().x() - disp_extra/2.0);
-    max_disp = ceil(disp_range.max().x() + disp_extra/2.0);
-
     return;
   }
 
@@ -1106,8 +1381,8 @@ namespace asp {
   }
 
   // Call the OpenCV BM or SGBM algorithm
-  void call_opencv_bm_or_sgbm(std::string const& left_file,
-                              std::string const& right_file,
+  void call_opencv_bm_or_sgbm(vw::ImageView<float> const& left,
+                              vw::ImageView<float> const& right,
                               std::string const& mode, // bm or a flavor of sgbm 
                               int block_size,
                               int min_disp,
@@ -1125,9 +1400,6 @@ namespace asp {
                               // Output
                               vw::ImageView<float> & out_disp) {
     
-    DiskImageView<float> left(left_file);
-    DiskImageView<float> right(right_file);
-
     cv::Mat left_cv, right_cv;
     asp::formScaledByteCVImage(left, left_cv);
     asp::formScaledByteCVImage(right, right_cv);
@@ -1241,16 +1513,18 @@ namespace asp {
       }
     }
 
-    // Write the disparity to disk
-    vw::cartography::GeoReference georef;
-    bool   has_georef = false;
-    bool   has_nodata = true;
-    vw_out() << "Writing: " << disparity_file << "\n";
-    vw::cartography::block_write_gdal_image(disparity_file, asp_disp,
-                                            has_georef, georef,
-                                            has_nodata, nan, opt,
-                                            TerminalProgressCallback
-                                            ("asp", "\t--> Disparity :"));
+    // Write the disparity to disk, if desired
+    if (disparity_file != "") {
+      vw::cartography::GeoReference georef;
+      bool   has_georef = false;
+      bool   has_nodata = true;
+      vw_out() << "Writing: " << disparity_file << "\n";
+      vw::cartography::block_write_gdal_image(disparity_file, asp_disp,
+                                              has_georef, georef,
+                                              has_nodata, nan, opt,
+                                              TerminalProgressCallback
+                                              ("asp", "\t--> Disparity :"));
+    }
 
 
     // Assign the disparity to the output variable (this should not do a copy).
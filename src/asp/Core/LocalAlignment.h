@@ -42,12 +42,15 @@ namespace asp {
   //  - Given the global interest points and the left crop window, find
   //    the right crop window.
   //  - Crop the globally aligned images to these crop windows and find
-  //    the interest points for the crops
+  //    the interest points for the crops, unless the global interest
+  //    points cover the crop well enough
   //  - Use the interest points to find the local alignment
+  //  - Estimate the search range for the locally aligned images
   //  - Apply the composition of the global and local alignment to the
   //    original unaligned images to find the locally aligned images
-  //  - Save the locally aligned images to disk
-  //  - Estimate the search range for the locally aligned images
+  //  - Save the locally aligned images to disk, if write_aligned_images
+  //    is true. Otherwise they are only returned in memory, with NaN
+  //    as no-data.
 
   class ASPGlobalOptions; // forward declaration
   
@@ -56,6 +59,7 @@ namespace asp {
                        std::string      const & session_name,
                        int                      max_tile_size,
                        vw::BBox2i       const & tile_crop_win,
+                       bool                     write_aligned_images,
                        bool                     write_nodata,
                        vw::camera::CameraModel const * left_camera_model,
                        vw::camera::CameraModel const * right_camera_model,
@@ -65,6 +69,8 @@ namespace asp {
                        vw::BBox2i         & right_trans_crop_win,
                        vw::Matrix<double> & left_local_mat,
                        vw::Matrix<double> & right_local_mat,
+                       vw::ImageView<float> & left_aligned_image,
+                       vw::ImageView<float> & right_aligned_image,
                        std::string        & left_aligned_file,
                        std::string        & right_aligned_file,
                        int                & min_disp,
@@ -118,9 +124,10 @@ namespace asp {
                                  std::string & env_vars,
                                  std::map<std::string, std::string> & env_vars_map);
 
-  // Call the OpenCV BM or SGBM algorithm
-  void call_opencv_bm_or_sgbm(std::string const& left_file,
-                              std::string const& right_file,
+  // Call the OpenCV BM or SGBM algorithm on images in memory, with NaN
+  // as no-data. Save the disparity only if disparity_file is not empty.
+  void call_opencv_bm_or_sgbm(vw::ImageView<float> const& left,
+                              vw::ImageView<float> const& right,
                               std::string const& mode, // bm or a flavor of sgbm 
                               int block_size,
                               int min_disp,
@@ -18,10 +18,18 @@
 
 #include <asp/Core/MedianFilter.h>
 #include <vw/Math/Vector.h>
+#include <vw/Core/Exception.h>
+
+#include <boost/math/special_functions/fpclassify.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <vector>
 
 using namespace vw;
 
-uint8 find_median_in_histogram(Vector<int, CALC_PIXEL_NUM_VALS> histogram,
+uint8 vw::find_median_in_histogram(Vector<int, CALC_PIXEL_NUM_VALS> histogram,
                                int kernSize) {
   int acc = 0;
   int acc_limit = kernSize * kernSize / 2;
@@ -39,3 +47,223 @@ uint8 find_median_in_histogram(Vector<int, CALC_PIXEL_NUM_VALS> histogram,
 
   return i;
 }
+
+namespace {
+
+  // The quantization levels are split into coarse bins of fine bins.
+  const int NUM_COARSE = 64;
+  const int NUM_FINE   = 64;
+  const int NUM_LEVELS = NUM_COARSE * NUM_FINE;
+
+  // A valid value and its pixel
+  struct PixelVal {
+    float val;
+    int   col, row;
+    bool operator<(PixelVal const& other) const { return val < other.val; }
+  };
+
+  // Given the sorted valid values, find the lower edges of at most
+  // NUM_LEVELS levels.
+  void find_levels(std::vector<float> const& sorted_vals, std::vector<float> & edges) {
+
+    edges.clear();
+
+    std::vector<float> distinct = sorted_vals;
+    distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+    if (distinct.size() <= size_t(NUM_LEVELS)) {
+      // One level per distinct value
+      edges = distinct;
+      return;
+    }
+
+    // Levels holding about the same number of values, so the precision is
+    // highest where the values are dense and outliers do not affect it.
+    size_t num_vals = sorted_vals.size();
+    for (int level = 0; level < NUM_LEVELS; level++) {
+      float edge = sorted_vals[size_t(level) * num_vals / NUM_LEVELS];
+      if (edges.empty() || edge > edges.back())
+        edges.push_back(edge);
+    }
+  }
+
+  // Find the value of the given rank, counting from 0, among the pixels
+  // of a level which are in the window. The level's pixels are sorted
+  // by value, so scan them in order, counting those in the window.
+  float select_in_level(PixelVal const* beg, PixelVal const* end,
+                        int col, int row, int half, int rank) {
+    if (beg->val == (end - 1)->val)
+      return beg->val; // a single value, as when there are few distinct values
+    for (PixelVal const* it = beg; it != end; it++) {
+      if (std::abs(it->col - col) <= half && std::abs(it->row - row) <= half) {
+        if (rank == 0)
+          return it->val;
+        rank--;
+      }
+    }
+    vw_throw(LogicErr() << "percentile_filter: The level histogram is inconsistent.\n");
+    return 0.0f;
+  }
+
+  // Add or remove a level from the histograms of a column
+  inline void update_column(std::vector<uint16> & col_coarse, std::vector<uint16> & col_fine,
+                            int col, int level, int delta) {
+    col_coarse[size_t(col) * NUM_COARSE + level / NUM_FINE] += delta;
+    col_fine  [size_t(col) * NUM_LEVELS + level           ] += delta;
+  }
+
+} // end anonymous namespace
+
+void asp::percentile_filter(ImageView<PixelMask<float> > const& input,
+                            int kernel_size, double percentile,
+                            ImageView<PixelMask<float> > & output) {
+
+  if (kernel_size < 1 || kernel_size > std::numeric_limits<uint16>::max())
+    vw_throw(ArgumentErr() << "percentile_filter: Invalid kernel size: "
+             << kernel_size << ".\n");
+  if (percentile < 0.0 || percentile > 1.0)
+    vw_throw(ArgumentErr() << "percentile_filter: The percentile must be between 0 and 1.\n");
+
+  int nc = input.cols(), nr = input.rows(); // shorten
+  output = copy(input);
+
+  // Quantize the valid values. Invalid pixels get level -1.
+  std::vector<PixelVal> pixel_vals;
+  for (int col = 0; col < nc; col++) {
+    for (int row = 0; row < nr; row++) {
+      if (is_valid(input(col, row)) && boost::math::isfinite(input(col, row).child())) {
+        PixelVal pv = {input(col, row).child(), col, row};
+        pixel_vals.push_back(pv);
+      }
+    }
+  }
+  if (pixel_vals.empty())
+    return;
+  std::sort(pixel_vals.begin(), pixel_vals.end());
+
+  std::vector<float> vals(pixel_vals.size());
+  for (size_t i = 0; i < pixel_vals.size(); i++)
+    vals[i] = pixel_vals[i].val;
+  std::vector<float> edges;
+  find_levels(vals, edges);
+
+  // Where the pixels of each level start in pixel_vals
+  std::vector<size_t> level_beg(edges.size() + 1, vals.size());
+  for (size_t level = 0; level < edges.size(); level++)
+    level_beg[level] = std::lower_bound(vals.begin(), vals.end(), edges[level]) - vals.begin();
+  vals.clear();
+
+  ImageView<int16> levels(nc, nr);
+  for (int col = 0; col < nc; col++) {
+    for (int row = 0; row < nr; row++) {
+      levels(col, row) = -1;
+      if (is_valid(input(col, row)) && boost::math::isfinite(input(col, row).child()))
+        levels(col, row) = std::upper_bound(edges.begin(), edges.end(),
+                                            input(col, row).child()) - edges.begin() - 1;
+    }
+  }
+
+  // Per-column histograms of the rows in the current window
+  int half = kernel_size / 2;
+  std::vector<uint16> col_coarse(size_t(nc) * NUM_COARSE, 0);
+  std::vector<uint16> col_fine  (size_t(nc) * NUM_LEVELS, 0);
+  for (int row = 0; row < std::min(half, nr); row++) {
+    for (int col = 0; col < nc; col++) {
+      if (levels(col, row) >= 0)
+        update_column(col_coarse, col_fine, col, levels(col, row), 1);
+    }
+  }
+
+  // Window histograms. A fine bin is brought up to date only when the
+  // search lands in its coarse bin, and fine_beg/fine_end record the
+  // columns it currently covers (fine_beg < 0 means it must be rebuilt).
+  std::vector<int> coarse(NUM_COARSE), fine(NUM_LEVELS);
+  std::vector<int> fine_beg(NUM_COARSE), fine_end(NUM_COARSE);
+
+  for (int row = 0; row < nr; row++) {
+
+    // Slide the column histograms down
+    int add_row = row + half, rem_row = row - half - 1;
+    for (int col = 0; col < nc; col++) {
+      if (add_row < nr && levels(col, add_row) >= 0)
+        update_column(col_coarse, col_fine, col, levels(col, add_row), 1);
+      if (rem_row >= 0 && levels(col, rem_row) >= 0)
+        update_column(col_coarse, col_fine, col, levels(col, rem_row), -1);
+    }
+
+    std::fill(coarse.begin(), coarse.end(), 0);
+    std::fill(fine_beg.begin(), fine_beg.end(), -1);
+    int count = 0;
+    for (int col = 0; col < std::min(half, nc); col++) {
+      for (int b = 0; b < NUM_COARSE; b++) {
+        coarse[b] += col_coarse[size_t(col) * NUM_COARSE + b];
+        count     += col_coarse[size_t(col) * NUM_COARSE + b];
+      }
+    }
+
+    for (int col = 0; col < nc; col++) {
+
+      // Slide the window to the right
+      int add_col = col + half, rem_col = col - half - 1;
+      if (add_col < nc) {
+        for (int b = 0; b < NUM_COARSE; b++) {
+          coarse[b] += col_coarse[size_t(add_col) * NUM_COARSE + b];
+          count     += col_coarse[size_t(add_col) * NUM_COARSE + b];
+        }
+      }
+      if (rem_col >= 0) {
+        for (int b = 0; b < NUM_COARSE; b++) {
+          coarse[b] -= col_coarse[size_t(rem_col) * NUM_COARSE + b];
+          count     -= col_coarse[size_t(rem_col) * NUM_COARSE + b];
+        }
+      }
+
+      if (levels(col, row) < 0)
+        continue; // count is positive below, as the center is counted
+
+      // Find the coarse bin holding the value of the wanted rank
+      int rank = std::min(count - 1, int(percentile * count));
+      int b = 0;
+      while (rank >= coarse[b]) {
+        rank -= coarse[b];
+        b++;
+      }
+
+      // Bring its fine bins up to date with the current window
+      int beg = std::max(col - half, 0), end = std::min(col + half, nc - 1);
+      int * fine_b = &fine[size_t(b) * NUM_FINE];
+      if (fine_beg[b] < 0 || (beg - fine_beg[b]) + (end - fine_end[b]) > end - beg + 1) {
+        std::fill(fine_b, fine_b + NUM_FINE, 0);
+        for (int c = beg; c <= end; c++) {
+          uint16 const* h = &col_fine[size_t(c) * NUM_LEVELS + size_t(b) * NUM_FINE];
+          for (int f = 0; f < NUM_FINE; f++)
+            fine_b[f] += h[f];
+        }
+      } else {
+        for (int c = fine_beg[b]; c < beg; c++) {
+          uint16 const* h = &col_fine[size_t(c) * NUM_LEVELS + size_t(b) * NUM_FINE];
+          for (int f = 0; f < NUM_FINE; f++)
+            fine_b[f] -= h[f];
+        }
+        for (int c = fine_end[b] + 1; c <= end; c++) {
+          uint16 const* h = &col_fine[size_t(c) * NUM_LEVELS + size_t(b) * NUM_FINE];
+          for (int f = 0; f < NUM_FINE; f++)
+            fine_b[f] += h[f];
+        }
+      }
+      fine_beg[b] = beg;
+      fine_end[b] = end;
+
+      int f = 0;
+      while (rank >= fine_b[f]) {
+        rank -= fine_b[f];
+        f++;
+      }
+
+      // The histograms only give the level, so find the exact value in it
+      int level = b * NUM_FINE + f;
+      output(col, row) = PixelMask<float>(select_in_level(&pixel_vals[level_beg[level]],
+                                                          &pixel_vals[0] + level_beg[level + 1],
+                                                          col, row, half, rank));
+    }
+  }
+}
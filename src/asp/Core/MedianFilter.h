@@ -31,6 +31,9 @@
 #include <vw/Image/ImageView.h>
 #include <vw/Image/EdgeExtension.h>
 #include <vw/Image/PerPixelAccessorViews.h>
+#include <vw/Image/PixelMask.h>
+#include <vw/Image/PixelTypeInfo.h>
+#include <vw/Image/Manipulation.h>
 
 namespace vw {
 
@@ -142,4 +145,53 @@ namespace vw {
 
 }
 
+namespace asp {
+
+  /// Replace each valid pixel with the given percentile (0.5 is the
+  /// median) of the valid pixels in the kernel_size x kernel_size window
+  /// centered at it, with the window clipped at the image boundary.
+  /// Invalid pixels are left as they are. The values are quantized into
+  /// 4096 levels holding about as many input pixels each, and the window
+  /// slides over per-column histograms with a coarse and a lazily updated
+  /// fine level (Perreault and Hebert, 2007). That gives the level holding
+  /// the wanted rank, and the exact value is then picked among the
+  /// level's pixels in the window, so the result does not depend on the
+  /// quantization.
+  void percentile_filter(vw::ImageView<vw::PixelMask<float> > const& input,
+                         int kernel_size, double percentile,
+                         vw::ImageView<vw::PixelMask<float> > & output);
+
+  /// Filter each channel of a masked disparity (or other masked vector
+  /// image) with percentile_filter(). Pixel validity is preserved.
+  template <class PixelT>
+  void disparity_percentile_filter(vw::ImageView<PixelT> const& disp,
+                                   vw::ImageView<PixelT>      & output,
+                                   int kernel_size, double percentile = 0.5) {
+
+    output = vw::copy(disp);
+    if (kernel_size <= 1)
+      return;
+
+    const int num_channels = vw::CompoundNumChannels<typename PixelT::child_type>::value;
+    vw::ImageView<vw::PixelMask<float> > channel(disp.cols(), disp.rows()), filtered;
+    for (int ch = 0; ch < num_channels; ch++) {
+      for (int col = 0; col < disp.cols(); col++) {
+        for (int row = 0; row < disp.rows(); row++) {
+          channel(col, row) = vw::PixelMask<float>(disp(col, row).child()[ch]);
+          if (!is_valid(disp(col, row)))
+            channel(col, row).invalidate();
+        }
+      }
+      percentile_filter(channel, kernel_size, percentile, filtered);
+      for (int col = 0; col < disp.cols(); col++) {
+        for (int row = 0; row < disp.rows(); row++) {
+          if (is_valid(disp(col, row)))
+            output(col, row).child()[ch] = filtered(col, row).child();
+        }
+      }
+    }
+  }
+
+} // end namespace asp
+
 #endif // __MEDIAN_FILTER_H__
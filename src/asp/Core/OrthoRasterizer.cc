@@ -36,6 +36,7 @@
 
 #include <asp/Core/SoftwareRenderer.h>
 #include <asp/Core/PointUtils.h>
+#include <asp/Core/MedianFilter.h>
 #include <boost/foreach.hpp>
 #include <boost/math/special_functions/next.hpp>
 #include <asp/Core/OrthoRasterizer.h>
@@ -273,33 +274,29 @@ namespace asp{
     if (half <= 0 || thresh <= 0)
       return;
 
-    int nc = image.cols(), nr = image.rows(); // shorten
     double nan = std::numeric_limits<double>::quiet_NaN();
 
-    ImageView<Vector3> image_out = copy(image);
-
+    // Find the median heights with a sliding histogram, whose cost does
+    // not grow with the window size.
+    ImageView< PixelMask<float> > heights(image.cols(), image.rows()), median;
     for (int col = 0; col < image.cols(); col++){
       for (int row = 0; row < image.rows(); row++){
-
+        heights(col, row) = PixelMask<float>(image(col, row).z());
         if (boost::math::isnan(image(col, row).z()))
-          continue;
+          heights(col, row).invalidate();
+      }
+    }
+    asp::percentile_filter(heights, 2*half + 1, 0.5, median);
 
-        std::vector<double> vals;
-        for (int c = std::max(col-half, 0); c <= std::min(col+half, nc-1); c++){
-          for (int r = std::max(row-half, 0); r <= std::min(row+half, nr-1); r++){
-            if (boost::math::isnan(image(c, r).z()))
-              continue;
-            vals.push_back(image(c, r).z());
-          }
-        }
-        double median = vw::math::destructive_median(vals);
-        if (fabs(median - image(col, row).z()) > thresh){
-          image_out(col, row).z() = nan;
+    for (int col = 0; col < image.cols(); col++){
+      for (int row = 0; row < image.rows(); row++){
+        if (!is_valid(median(col, row)))
+          continue;
+        if (fabs(median(col, row).child() - image(col, row).z()) > thresh){
+          image(col, row).z() = nan;
         }
       }
     }
-
-    image = copy(image_out);
   }
 
   // TODO: This function should live somewhere else!
@@ -374,7 +371,7 @@ namespace asp{
    size_t *num_invalid_pixels, vw::Mutex *count_mutex,
    const ProgressCallback& progress):
     // Ensure all members are initiated, even if to temporary values
-    m_point_image(point_image), m_texture(ImageView<float>(1,1)),
+    m_point_image(point_image), m_points_are_filtered(false),
     m_bbox(BBox3()), m_snapped_bbox(BBox3()), m_spacing(0.0), m_default_spacing(0.0),
     m_default_spacing_x(0.0), m_default_spacing_y(0.0),
     m_search_radius_factor(search_radius_factor),
@@ -594,6 +591,25 @@ namespace asp{
     return outbox;
   }
 
+  ImageView<Vector3> OrthoRasterizerView::filtered_points(BBox2i const& block) const {
+
+    // Pull a copy of the input image in memory.  Expand the image
+    // to be able to see a bit beyond when filling holes.
+    BBox2i biased_block = block;
+    int bias = m_median_filter_params[0]/2 + m_erode_len;
+    biased_block.expand(bias);
+    biased_block.crop(vw::bounding_box(m_point_image));
+    ImageView<Vector3> point_copy = crop(m_point_image, biased_block);
+
+    remove_outliers(point_copy, m_error_image, m_error_cutoff, biased_block);
+    filter_by_median(point_copy, m_median_filter_params);
+    erode_image(point_copy, m_erode_len);
+
+    // Crop back to the area of interest
+    ImageView<Vector3> block_points = crop(point_copy, block - biased_block.min());
+    return block_points;
+  }
+
   /// \cond INTERNAL
   OrthoRasterizerView::prerasterize_type OrthoRasterizerView::prerasterize( BBox2i const& bbox )
     const {
@@ -606,17 +622,26 @@ namespace asp{
     // Used to find which polygons are actually in the draw space.
     BBox3 local_3d_bbox = pixel_to_point_bbox(bbox_1);
 
-    ImageView<float > render_buffer;
-    ImageView<double> d_buffer, weights;
+    // One render buffer, or one grid and its weights, for each texture.
+    // These are sized before the renderers and grids which point to them
+    // are created.
+    int num_textures = m_textures.size();
+    std::vector< ImageView<float > > render_buffers(num_textures);
+    std::vector< ImageView<double> > d_buffers(num_textures), weights(num_textures);
     if (m_use_surface_sampling){
-      render_buffer.set_size(bbox_1.width(), bbox_1.height());
+      for (int k = 0; k < num_textures; k++)
+        render_buffers[k].set_size(bbox_1.width(), bbox_1.height());
     }
 
     // Setup a software renderer and the orthographic view matrix
-    vw::stereo::SoftwareRenderer renderer(bbox_1.width(), bbox_1.height(),
-                                          &render_buffer(0,0) );
-    renderer.Ortho2D(local_3d_bbox.min().x(), local_3d_bbox.max().x(),
-                     local_3d_bbox.min().y(), local_3d_bbox.max().y());
+    std::vector< boost::shared_ptr<vw::stereo::SoftwareRenderer> > renderers(num_textures);
+    for (int k = 0; k < num_textures; k++){
+      renderers[k] = boost::shared_ptr<vw::stereo::SoftwareRenderer>
+        (new vw::stereo::SoftwareRenderer(bbox_1.width(), bbox_1.height(),
+                                          &render_buffers[k](0,0)));
+      renderers[k]->Ortho2D(local_3d_bbox.min().x(), local_3d_bbox.max().x(),
+                            local_3d_bbox.min().y(), local_3d_bbox.max().y());
+    }
 
     // Given a DEM grid point, search for cloud points within the
     // circular region of radius equal to grid size. As such, a
@@ -629,14 +654,18 @@ namespace asp{
       search_radius = std::max(m_spacing, m_default_spacing);
     else
       search_radius = m_spacing*m_search_radius_factor;
-    asp::Point2Grid point2grid(bbox_1.width(),
-                               bbox_1.height(),
-                               d_buffer, weights,
-                               local_3d_bbox.min().x(),
-                               local_3d_bbox.min().y(),
-                               m_spacing, m_default_spacing,
-                               search_radius, m_sigma_factor,
-                               m_filter, m_percentile);
+    std::vector< boost::shared_ptr<asp::Point2Grid> > point2grids(num_textures);
+    for (int k = 0; k < num_textures; k++){
+      point2grids[k] = boost::shared_ptr<asp::Point2Grid>
+        (new asp::Point2Grid(bbox_1.width(),
+                             bbox_1.height(),
+                             d_buffers[k], weights[k],
+                             local_3d_bbox.min().x(),
+                             local_3d_bbox.min().y(),
+                             m_spacing, m_default_spacing,
+                             search_radius, m_sigma_factor,
+                             m_filter, m_percentile));
+    }
     
     // Set up the default color value
     double min_val = 0.0;
@@ -651,14 +680,16 @@ namespace asp{
 
     std::valarray<float> vertices(10), intensities(5);
 
-    if (m_use_surface_sampling){
-      static const int NUM_COLOR_COMPONENTS  = 1;  // We only need gray scale
-      static const int NUM_VERTEX_COMPONENTS = 2; // DEMs are 2D
-      renderer.Clear(min_val);
-      renderer.SetVertexPointer(NUM_VERTEX_COMPONENTS, &vertices[0]);
-      renderer.SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[0]);
-    }else{
-      point2grid.Clear(min_val);
+    for (int k = 0; k < num_textures; k++){
+      if (m_use_surface_sampling){
+        static const int NUM_COLOR_COMPONENTS  = 1;  // We only need gray scale
+        static const int NUM_VERTEX_COMPONENTS = 2; // DEMs are 2D
+        renderers[k]->Clear(min_val);
+        renderers[k]->SetVertexPointer(NUM_VERTEX_COMPONENTS, &vertices[0]);
+        renderers[k]->SetColorPointer(NUM_COLOR_COMPONENTS, &intensities[0]);
+      }else{
+        point2grids[k]->Clear(min_val);
+      }
     }
 
     // For each block in the DEM space intersecting local_3d_bbox,
@@ -694,12 +725,10 @@ namespace asp{
         vw::Mutex::Lock lock(*m_count_mutex);
         (*m_num_invalid_pixels) += bbox.width()*bbox.height();
       }
-      
-      if (m_use_surface_sampling){
-        return prerasterize_type( render_buffer, BBox2i(-bbox_1.min().x(), -bbox_1.min().y(), cols(), rows()) );
-      }else{
-        return prerasterize_type( d_buffer,      BBox2i(-bbox_1.min().x(), -bbox_1.min().y(), cols(), rows()) );
-      }
+
+      ImageView<pixel_type> empty(bbox_1.width(), bbox_1.height(), num_textures);
+      fill(empty, pixel_type(min_val));
+      return prerasterize_type( empty, BBox2i(-bbox_1.min().x(), -bbox_1.min().y(), cols(), rows()) );
     }
 
     // This is very important. When doing surface sampling, for each
@@ -713,98 +742,104 @@ namespace asp{
       block.max() += Vector2i(d, d);
       block.crop(vw::bounding_box(m_point_image));
 
-      // Pull a copy of the input image in memory.  Expand the image
-      // to be able to see a bit beyond when filling holes.
-      BBox2i biased_block = block;
-      int bias = m_median_filter_params[0]/2 + m_erode_len;
-      biased_block.expand(bias);
-      biased_block.crop(vw::bounding_box(m_point_image));
-      ImageView<Vector3> point_copy = crop(m_point_image, biased_block);
-
-      remove_outliers(point_copy, m_error_image, m_error_cutoff, biased_block);
-      filter_by_median(point_copy, m_median_filter_params);
-      erode_image(point_copy, m_erode_len);
-
-      // Crop back to the area of interest
-      point_copy = crop(point_copy, block - biased_block.min());
-
-      ImageView<float> texture_copy = crop(m_texture, block );
-
-      typedef ImageView<Vector3>::pixel_accessor PointAcc;
-      PointAcc row_acc = point_copy.origin();
-      for ( int32 row = 0; row < point_copy.rows()-d; ++row ) {
-        PointAcc point_ul = row_acc;
-
-        for ( int32 col = 0; col < point_copy.cols()-d; ++col ) {
-
-          PointAcc point_ur = point_ul; point_ur.next_col();
-          PointAcc point_ll = point_ul; point_ll.next_row();
-          PointAcc point_lr = point_ul; point_lr.advance(1,1);
-
-          if (m_use_surface_sampling){
-
-            // This loop rasterizes a quad indexed by the upper left.
-            if ( !boost::math::isnan((*point_ul).z()) &&
-                 !boost::math::isnan((*point_lr).z()) ) {
-
-              vertices[0] = (*point_ul).x(); // UL
-              vertices[1] = (*point_ul).y();
-              vertices[2] = (*point_ll).x(); // LL
-              vertices[3] = (*point_ll).y();
-              vertices[4] = (*point_lr).x(); // LR
-              vertices[5] = (*point_lr).y();
-              vertices[6] = (*point_ur).x(); // UR
-              vertices[7] = (*point_ur).y();
-              vertices[8] = (*point_ul).x(); // UL
-              vertices[9] = (*point_ul).y();
-
-              intensities[0] = texture_copy(col,  row);
-              intensities[1] = texture_copy(col,row+1);
-              intensities[2] = texture_copy(col+1,  row+1);
-              intensities[3] = texture_copy(col+1,row);
-              intensities[4] = texture_copy(col,row);
-
-              if ( !boost::math::isnan((*point_ll).z()) ) {
-                // triangle 1 is: UL LL LR
-                renderer.DrawPolygon(0, 3);
+      ImageView<Vector3> point_copy;
+      if (m_points_are_filtered)
+        point_copy = crop(m_point_image, block);
+      else
+        point_copy = filtered_points(block);
+
+      // The point cloud block is filtered once above and shared by all
+      // textures below.
+      for (int k = 0; k < num_textures; k++){
+
+        ImageView<float> texture_copy = crop(m_textures[k], block );
+
+        typedef ImageView<Vector3>::pixel_accessor PointAcc;
+        PointAcc row_acc = point_copy.origin();
+        for ( int32 row = 0; row < point_copy.rows()-d; ++row ) {
+          PointAcc point_ul = row_acc;
+
+          for ( int32 col = 0; col < point_copy.cols()-d; ++col ) {
+
+            PointAcc point_ur = point_ul; point_ur.next_col();
+            PointAcc point_ll = point_ul; point_ll.next_row();
+            PointAcc point_lr = point_ul; point_lr.advance(1,1);
+
+            if (m_use_surface_sampling){
+
+              // This loop rasterizes a quad indexed by the upper left.
+              if ( !boost::math::isnan((*point_ul).z()) &&
+                   !boost::math::isnan((*point_lr).z()) ) {
+
+                vertices[0] = (*point_ul).x(); // UL
+                vertices[1] = (*point_ul).y();
+                vertices[2] = (*point_ll).x(); // LL
+                vertices[3] = (*point_ll).y();
+                vertices[4] = (*point_lr).x(); // LR
+                vertices[5] = (*point_lr).y();
+                vertices[6] = (*point_ur).x(); // UR
+                vertices[7] = (*point_ur).y();
+                vertices[8] = (*point_ul).x(); // UL
+                vertices[9] = (*point_ul).y();
+
+                intensities[0] = texture_copy(col,  row);
+                intensities[1] = texture_copy(col,row+1);
+                intensities[2] = texture_copy(col+1,  row+1);
+                intensities[3] = texture_copy(col+1,row);
+                intensities[4] = texture_copy(col,row);
+
+                if ( !boost::math::isnan((*point_ll).z()) ) {
+                  // triangle 1 is: UL LL LR
+                  renderers[k]->DrawPolygon(0, 3);
+                }
+                if ( !boost::math::isnan((*point_ur).z()) ) {
+                  // triangle 2 is: LR, UR, UL
+                  renderers[k]->DrawPolygon(2, 3);
+                }
               }
-              if ( !boost::math::isnan((*point_ur).z()) ) {
-                // triangle 2 is: LR, UR, UL
-                renderer.DrawPolygon(2, 3);
+
+            }else{
+              // The new engine
+              if ( !boost::math::isnan(point_copy(col, row).z()) &&
+                   local_3d_bbox.contains(point_copy(col, row))){
+                point2grids[k]->AddPoint(point_copy(col, row).x(),
+                                         point_copy(col, row).y(),
+                                         texture_copy(col,  row));
               }
             }
-
-          }else{
-            // The new engine
-            if ( !boost::math::isnan(point_copy(col, row).z()) &&
-                 local_3d_bbox.contains(point_copy(col, row))){
-              point2grid.AddPoint(point_copy(col, row).x(),
-                                  point_copy(col, row).y(),
-                                  texture_copy(col,  row));
-            }
-          }
-          point_ul.next_col();
-        } // End column loop
-        row_acc.next_row();
-      } // End row loop
+            point_ul.next_col();
+          } // End column loop
+          row_acc.next_row();
+        } // End row loop
+      } // End texture loop
 
     }
 
-    if (!m_use_surface_sampling)
-      point2grid.normalize();
+    if (!m_use_surface_sampling){
+      for (int k = 0; k < num_textures; k++)
+        point2grids[k]->normalize();
+    }
 
     // The software renderer returns an image which will render
-    // upside down in most image formats, so we correct that here.
+    // upside down in most image formats, so we correct that here,
+    // while putting each texture in its own plane.
     // We also introduce transparent pixels into the result where necessary.
-    // TODO: Here can do flipping in place.
-    ImageView< PixelGray<float> > result;
-    if (m_use_surface_sampling)
-      result = flip_vertical(render_buffer);
-    else
-      result = flip_vertical(d_buffer);
+    ImageView< PixelGray<float> > result(bbox_1.width(), bbox_1.height(), num_textures);
+    int nr = result.rows();
+    for (int k = 0; k < num_textures; k++){
+      for (int r=0; r<nr; ++r) {
+        for (int c=0; c<result.cols(); ++c) {
+          if (m_use_surface_sampling)
+            result(c, r, k) = render_buffers[k](c, nr-1-r);
+          else
+            result(c, r, k) = d_buffers[k](c, nr-1-r);
+        }
+      }
+    }
 
     // Loop through result here and count up how many pixels have been
-    // changed from the default value.
+    // changed from the default value. The first texture is the one
+    // which matters here.
     size_t num_unset = 0;
     for (int r=0; r<result.rows(); ++r) {
       for (int c=0; c<result.cols(); ++c) {
@@ -812,7 +847,7 @@ namespace asp{
         Vector2i pix = Vector2(c, r) + bbox_1.min();
         if (bbox.contains(pix)) {
           //  Ignore the pixels in the temporary extension of bbox.
-          if (result(c,r) == min_val)
+          if (result(c,r,0) == min_val)
             ++num_unset;
         }
       }
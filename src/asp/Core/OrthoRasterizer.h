@@ -45,7 +45,8 @@ namespace asp{
   class OrthoRasterizerView:
     public ImageViewBase<OrthoRasterizerView> {
     ImageViewRef<Vector3> m_point_image;
-    ImageViewRef<float>   m_texture;
+    bool                  m_points_are_filtered; // if filtered_points() was already applied
+    std::vector< ImageViewRef<float> > m_textures; // one output plane for each
     BBox3   m_bbox, m_snapped_bbox; // bounding box of point cloud
     double  m_spacing;         // point cloud units (usually m or deg) per pixel
     double  m_default_spacing; // if user did not specify spacing
@@ -117,17 +118,26 @@ namespace asp{
     /// to point image pixels.
     template <class TextureViewT>
     void set_texture(TextureViewT texture) {
+      m_textures.clear();
+      add_texture(texture);
+    }
+
+    /// Rasterize one more texture in the same pass, as the next plane of
+    /// the output. The point cloud is then read, filtered, and binned
+    /// only once for all textures. Same requirements as for set_texture().
+    template <class TextureViewT>
+    void add_texture(TextureViewT texture) {
       VW_ASSERT(texture.impl().cols() == m_point_image.cols() &&
                 texture.impl().rows() == m_point_image.rows(),
       ArgumentErr() << "Orthorasterizer: set_texture() failed."
                     << " Texture dimensions must match point image dimensions.");
-      m_texture = channel_cast<float>(channels_to_planes(texture.impl()));
+      m_textures.push_back(channel_cast<float>(channels_to_planes(texture.impl())));
     }
 
     inline int32 cols() const {return (int)round((fabs(m_snapped_bbox.max().x() - m_snapped_bbox.min().x()) / m_spacing)) + 1;}
     inline int32 rows() const {return (int)round((fabs(m_snapped_bbox.max().y() - m_snapped_bbox.min().y()) / m_spacing)) + 1;}
 
-    inline int32 planes() const { return 1; }
+    inline int32 planes() const { return m_textures.size(); }
 
     inline pixel_accessor origin() const { return pixel_accessor(*this); }
 
@@ -187,9 +197,58 @@ namespace asp{
     ImageViewRef<Vector3> get_point_image() { return m_point_image; }
     
     void set_point_image(ImageViewRef<Vector3> point_image) {m_point_image = point_image;}
+
+    /// Remove outliers from, median-filter, and erode the points in the
+    /// given block of the point image, as is done before binning them.
+    ImageView<Vector3> filtered_points(BBox2i const& block) const;
+
+    /// Use a point image to which filtered_points() was already applied,
+    /// such as one saved from a PointFilterView, so that it is not
+    /// filtered again for each output spacing.
+    void set_filtered_point_image(ImageViewRef<Vector3> point_image) {
+      m_point_image         = point_image;
+      m_points_are_filtered = true;
+    }
     
   };
 
+  /// The point image of an OrthoRasterizerView, with its outlier
+  /// removal, median filter, and erosion applied tile by tile.
+  class PointFilterView: public ImageViewBase<PointFilterView> {
+    OrthoRasterizerView const& m_rasterizer;
+    ImageViewRef<Vector3>      m_point_image;
+  public:
+    typedef Vector3 pixel_type;
+    typedef const Vector3 result_type;
+    typedef ProceduralPixelAccessor<PointFilterView> pixel_accessor;
+
+    PointFilterView(OrthoRasterizerView & rasterizer):
+      m_rasterizer(rasterizer), m_point_image(rasterizer.get_point_image()) {}
+
+    inline int32 cols  () const { return m_point_image.cols(); }
+    inline int32 rows  () const { return m_point_image.rows(); }
+    inline int32 planes() const { return 1; }
+
+    inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+    inline result_type operator()( int /*i*/, int /*j*/, int /*p*/=0 ) const {
+      vw_throw(NoImplErr() << "PointFilterView::operator()(...) is not implemented.");
+      return pixel_type();
+    }
+
+    /// \cond INTERNAL
+    typedef CropView<ImageView<pixel_type> > prerasterize_type;
+    prerasterize_type prerasterize( BBox2i const& bbox ) const {
+      return prerasterize_type(m_rasterizer.filtered_points(bbox),
+                               BBox2i(-bbox.min().x(), -bbox.min().y(), cols(), rows()));
+    }
+
+    template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
+      vw::rasterize( prerasterize(bbox), dest, bbox );
+    }
+    /// \endcond
+  };
+
   /// Snaps the coordinates of a BBox to a grid spacing
   template <size_t N>
   void snap_bbox(const double spacing, BBox<double, N> &bbox ) {
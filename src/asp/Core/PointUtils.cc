@@ -25,6 +25,7 @@
 #include <asp/Core/PointUtils.h>
 #include <vw/Cartography/Chipper.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
 #include <boost/math/special_functions/fpclassify.hpp>
 #include <boost/math/special_functions/next.hpp>
 
@@ -1117,6 +1118,45 @@ std::string asp::prefix_from_pointcloud_filename(std::string const& filename) {
   return result;
 }
 
+namespace asp {
+  
+  // Grow the bounding box of the valid points in one block of a cloud
+  class PointCloudBBoxTask: public vw::Task, private boost::noncopyable {
+    vw::ImageViewRef<vw::Vector3> const& m_point_image;
+    vw::BBox2i                           m_block;
+    bool                                 m_is_geodetic;
+    vw::BBox3                          & m_result;
+    vw::Mutex                          & m_mutex;
+    vw::ProgressCallback const         & m_progress;
+    double                               m_inc_amt;
+  public:
+    PointCloudBBoxTask(vw::ImageViewRef<vw::Vector3> const& point_image,
+                       vw::BBox2i const& block, bool is_geodetic,
+                       vw::BBox3 & result, vw::Mutex & mutex,
+                       vw::ProgressCallback const& progress, double inc_amt):
+      m_point_image(point_image), m_block(block), m_is_geodetic(is_geodetic),
+      m_result(result), m_mutex(mutex), m_progress(progress), m_inc_amt(inc_amt) {}
+    
+    void operator()() {
+      vw::ImageView<vw::Vector3> points = crop(m_point_image, m_block);
+      vw::BBox3 local_bbox;
+      for (int row = 0; row < points.rows(); row++) {
+        for (int col = 0; col < points.cols(); col++) {
+          vw::Vector3 const& pt = points(col, row);
+          if ( (!m_is_geodetic && pt != vw::Vector3()) ||
+               (m_is_geodetic  &&  !boost::math::isnan(pt.z())) )
+            local_bbox.grow(pt);
+        }
+      }
+      
+      vw::Mutex::Lock lock(m_mutex);
+      m_result.grow(local_bbox);
+      m_progress.report_incremental_progress(m_inc_amt);
+    }
+  };
+  
+} // end namespace asp
+
 // Compute bounding box of the given cloud. If is_geodetic is false,
 // that means a cloud of raw xyz cartesian values, then Vector3()
 // signifies no-data. If is_geodetic is true, no-data is suggested
@@ -1128,15 +1168,19 @@ vw::BBox3 asp::pointcloud_bbox(vw::ImageViewRef<vw::Vector3> const& point_image,
   vw::vw_out() << "Computing the point cloud bounding box.\n";
   vw::TerminalProgressCallback progress_bar("asp", "\t--> ");
 
-  for (int row=0; row < point_image.rows(); ++row ) {
-    progress_bar.report_fractional_progress(row, point_image.rows());
-    for (int col=0; col < point_image.cols(); ++col ) {
-      vw::Vector3 pt = point_image(col, row);
-      if ( (!is_geodetic && pt != vw::Vector3()) ||
-           (is_geodetic  &&  !boost::math::isnan(pt.z())) )
-        result.grow(pt);
-    }
+  // Rasterize the cloud in blocks, in parallel, rather than pixel by pixel
+  int block_size = vw::vw_settings().default_tile_size();
+  std::vector<vw::BBox2i> blocks = subdivide_bbox(point_image, block_size, block_size);
+  vw::FifoWorkQueue queue(vw::vw_settings().default_num_threads());
+  vw::Mutex mutex;
+  double inc_amt = 1.0 / std::max(double(blocks.size()), 1.0);
+  for (size_t it = 0; it < blocks.size(); it++) {
+    boost::shared_ptr<vw::Task>
+      task(new PointCloudBBoxTask(point_image, blocks[it], is_geodetic,
+                                  result, mutex, progress_bar, inc_amt));
+    queue.add_task(task);
   }
+  queue.join_all();
   progress_bar.report_finished();
 
   return result;
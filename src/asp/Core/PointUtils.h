@@ -375,10 +375,21 @@ vw::ImageViewRef< vw::Vector<double, m> > read_asp_point_cloud(std::string const
     shift = vw::str_to_vec<vw::Vector3>(shift_str);
   }
 
+  // If the points were saved as integers, find the value of one unit
+  double scale = 0.0;
+  std::string scale_str;
+  if (vw::cartography::read_header_string(*rsrc.get(), asp::ASP_POINT_SCALE_TAG_STR, scale_str)){
+    scale = atof(scale_str.c_str());
+  }
+
   // Read the first m channels
   vw::ImageViewRef< vw::Vector<double, m> > out_image
     = vw::read_channels<m, double>(filename, 0);
 
+  // Undo the quantization. This keeps invalid (zero) points as zero.
+  if (scale > 0.0)
+    out_image = out_image * scale;
+
   // Add the shift back to the first several channels.
   if (shift != vw::Vector3())
     out_image = subtract_shift(out_image, -shift);
@@ -244,6 +244,7 @@ namespace asp {
     bool   use_least_squares;                 // Use a more rigorous triangulation
     bool   save_double_precision_point_cloud; // Save final point cloud in double precision rather than bringing the points closer to origin and saving as float (marginally more precision at 2x the storage).
     double point_cloud_rounding_error;        // How much to round the output point cloud values
+    bool   compact_point_cloud;               // Save the point cloud as integer multiples of the rounding error
     bool   compute_point_cloud_center_only;   // Only compute the center of triangulated point cloud and exit.
     bool   skip_point_cloud_center_comp;
     bool   unalign_disparity;                 // Compute disparity between unaligned images
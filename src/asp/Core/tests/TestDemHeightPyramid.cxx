@@ -0,0 +1,128 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/DemHeightPyramid.h>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+  // A uniform number in [0, 1), the same on all platforms
+  double uniform(boost::mt19937 & gen) {
+    return gen() / 4294967296.0;
+  }
+}
+
+TEST( DemHeightPyramid, IntersectMatchesBruteForce ) {
+
+  boost::mt19937 gen(5);
+  int num_trials = 100, num_hits = 0;
+  for (int trial = 0; trial < num_trials; trial++) {
+
+    // A wavy DEM with noise and a few invalid pixels
+    int cols = 5 + int(uniform(gen)*60), rows = 5 + int(uniform(gen)*60);
+    ImageView<PixelMask<float> > dem(cols, rows);
+    double fx = uniform(gen)*0.3, fy = uniform(gen)*0.3;
+    for (int row = 0; row < rows; row++) {
+      for (int col = 0; col < cols; col++) {
+        dem(col, row) = PixelMask<float>(50*sin(fx*col)*cos(fy*row) + 20*uniform(gen));
+        if (uniform(gen) < 0.03)
+          dem(col, row).invalidate();
+      }
+    }
+    DemHeightPyramid pyramid(dem);
+
+    // A descending segment, which may start or end outside the DEM
+    double beg_x = uniform(gen)*(cols + 20) - 10, beg_y = uniform(gen)*(rows + 20) - 10;
+    double end_x = uniform(gen)*(cols + 20) - 10, end_y = uniform(gen)*(rows + 20) - 10;
+    Vector3 beg(beg_x, beg_y, 100), end(end_x, end_y, -100);
+    double s_hit = -1.0;
+    bool hit = pyramid.intersect(beg, end, s_hit);
+
+    // Sample the segment densely to find where it first goes below the DEM
+    int num_samples = 200000;
+    bool brute_hit = false;
+    double brute_s = -1.0;
+    for (int k = 0; k <= num_samples; k++) {
+      double s = double(k)/num_samples, dem_height = 0.0;
+      Vector3 pt = beg + s*(end - beg);
+      if (pyramid.height(pt[0], pt[1], dem_height) && pt[2] <= dem_height) {
+        brute_hit = true;
+        brute_s   = s;
+        break;
+      }
+    }
+
+    ASSERT_EQ(brute_hit, hit) << "Trial " << trial;
+    if (hit) {
+      EXPECT_NEAR(brute_s, s_hit, 2e-5) << "Trial " << trial;
+      num_hits++;
+    }
+  }
+
+  // Make sure both outcomes were exercised
+  EXPECT_GT(num_hits, 0);
+  EXPECT_LT(num_hits, num_trials);
+}
+
+TEST( DemHeightPyramid, MarchRayToFlatDem ) {
+
+  cartography::GeoReference georef;
+  georef.set_geographic();
+  georef.set_well_known_geogcs("D_MARS");
+  Matrix3x3 affine;
+  affine(0,0) = 0.01;  // 100 pix/degree
+  affine(1,1) = -0.01; // 100 pix/degree
+  affine(2,2) = 1;
+  affine(0,2) = 30;    // 30 deg east
+  affine(1,2) = -35;   // 35 deg south
+  georef.set_transform(affine);
+
+  double dem_height = 50.0;
+  ImageView<PixelMask<float> > dem(100, 100);
+  for (int row = 0; row < dem.rows(); row++)
+    for (int col = 0; col < dem.cols(); col++)
+      dem(col, row) = PixelMask<float>(dem_height);
+  DemHeightPyramid pyramid(dem);
+  ASSERT_FALSE(pyramid.empty());
+
+  // Look from above at a slant towards a point on the DEM
+  cartography::Datum const& datum = georef.datum();
+  Vector2 lonlat = georef.pixel_to_lonlat(Vector2(40.3, 55.7));
+  Vector3 ground = datum.geodetic_to_cartesian(Vector3(lonlat[0], lonlat[1], dem_height));
+  Vector3 camera_ctr = datum.geodetic_to_cartesian(Vector3(lonlat[0] + 0.1, lonlat[1] - 0.05,
+                                                           20000.0));
+  Vector3 camera_vec = normalize(ground - camera_ctr);
+
+  double height_error_tol = 1e-3;
+  Vector3 xyz;
+  ASSERT_TRUE(march_ray_to_dem(camera_ctr, camera_vec, pyramid, georef,
+                               height_error_tol, xyz));
+  EXPECT_LT(norm_2(xyz - ground), 0.01);
+
+  // Looking away from the DEM, or from below its top, gives no answer
+  EXPECT_FALSE(march_ray_to_dem(camera_ctr, -camera_vec, pyramid, georef,
+                                height_error_tol, xyz));
+  Vector3 low_ctr = datum.geodetic_to_cartesian(Vector3(lonlat[0], lonlat[1], 10.0));
+  EXPECT_FALSE(march_ray_to_dem(low_ctr, camera_vec, pyramid, georef,
+                                height_error_tol, xyz));
+}
@@ -0,0 +1,65 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/DistanceTransform.h>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace vw;
+using namespace asp;
+
+TEST( DistanceTransform, MatchesBruteForce ) {
+
+  int cols = 37, rows = 29;
+  ImageView<uint8> sources(cols, rows);
+  for (int col = 0; col < cols; col++)
+    for (int row = 0; row < rows; row++)
+      sources(col, row) = ((col * 7 + row * 13) % 53 == 0);
+
+  double max_dist = 6.5;
+  ImageView<float> dist;
+  euclidean_distance_transform(sources, max_dist, dist, 3);
+  ASSERT_EQ(cols, dist.cols());
+  ASSERT_EQ(rows, dist.rows());
+
+  for (int col = 0; col < cols; col++) {
+    for (int row = 0; row < rows; row++) {
+      double best = max_dist;
+      for (int col2 = 0; col2 < cols; col2++) {
+        for (int row2 = 0; row2 < rows; row2++) {
+          if (sources(col2, row2) != 0)
+            best = std::min(best, std::sqrt(double(col - col2) * (col - col2) +
+                                            double(row - row2) * (row - row2)));
+        }
+      }
+      EXPECT_NEAR(best, dist(col, row), 1e-5);
+    }
+  }
+}
+
+TEST( DistanceTransform, NoSources ) {
+  ImageView<uint8> sources(10, 4);
+  fill(sources, 0);
+  ImageView<float> dist;
+  euclidean_distance_transform(sources, 3.0, dist);
+  for (int col = 0; col < dist.cols(); col++)
+    for (int row = 0; row < dist.rows(); row++)
+      EXPECT_EQ(3.0f, dist(col, row));
+}
@@ -0,0 +1,55 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/FootprintIndex.h>
+
+using namespace vw;
+using namespace asp;
+
+TEST( FootprintIndex, Candidates ) {
+
+  // A row of overlapping frames, as when mosaicking camera images,
+  // plus one frame far away from the others.
+  std::vector<BBox2> footprints;
+  for (int i = 0; i < 100; i++)
+    footprints.push_back(BBox2(i * 90.0, 0.0, 100.0, 100.0));
+  footprints.push_back(BBox2(50000.0, 50000.0, 10.0, 10.0));
+
+  FootprintIndex index(footprints);
+
+  // The result must contain every intersecting footprint
+  for (int k = 0; k < 50; k++) {
+    BBox2 box(k * 211.0 - 30.0, 40.0 + k, 64.0, 64.0);
+    std::vector<int> cand = index.candidates(box);
+    EXPECT_TRUE(std::is_sorted(cand.begin(), cand.end()));
+    for (size_t i = 0; i < footprints.size(); i++) {
+      if (footprints[i].intersects(box))
+        EXPECT_TRUE(std::binary_search(cand.begin(), cand.end(), int(i)));
+    }
+    // Only nearby footprints should be returned
+    EXPECT_LT(cand.size(), 10u);
+  }
+
+  std::vector<int> cand = index.candidates(BBox2(50001.0, 50001.0, 2.0, 2.0));
+  ASSERT_EQ(1u, cand.size());
+  EXPECT_EQ(100, cand[0]);
+
+  EXPECT_TRUE(index.candidates(BBox2(-500.0, -500.0, 10.0, 10.0)).empty());
+  EXPECT_TRUE(FootprintIndex().candidates(BBox2(0.0, 0.0, 10.0, 10.0)).empty());
+}
@@ -68,3 +68,37 @@ TEST( InterestPointMatching, DatumIntersection ) {
   }
 
 }
+
+TEST( InterestPointMatching, EpipolarLine ) {
+
+  // Two synthetic cameras looking at the same area from different positions
+  camera::PinholeModel model1( Vector3(-414653.934175,-2305310.05912,-6759174.5439),
+                               Quat(-0.0794638597818,-0.0396316037899,-0.40945443655,-0.907998840691).rotation_matrix(),
+                               1.65e6, 1.65e6, 17500, 17500,
+                               Vector3(1,0,0), Vector3(0,1,0), Vector3(0,0,1));
+  camera::PinholeModel model2( Vector3(-404653.934175,-2315310.05912,-6759174.5439),
+                               Quat(-0.0794638597818,-0.0396316037899,-0.40945443655,-0.907998840691).rotation_matrix(),
+                               1.65e6, 1.65e6, 17500, 17500,
+                               Vector3(1,0,0), Vector3(0,1,0), Vector3(0,0,1));
+
+  cartography::Datum datum("WGS84");
+  for ( size_t i = 0; i < 35000; i+= 5000 ) {
+    for ( size_t j = 0; j < 35000; j+= 5000 ) {
+      Vector2 meas( i, j );
+
+      bool success = false;
+      Vector3 line = EpipolarLinePointMatcher::epipolar_line( meas, datum, &model1, &model2, success );
+      ASSERT_TRUE( success );
+      EXPECT_NEAR( 1.0, norm_2( line ), 1e-8 );
+
+      // Any point along the ray of this pixel must project onto the line
+      Vector3 ctr = model1.camera_center( meas );
+      Vector3 dir = model1.pixel_to_vector( meas );
+      Vector3 pos = cartography::datum_intersection( datum, &model1, meas );
+      EXPECT_NEAR( 0, EpipolarLinePointMatcher::distance_point_line
+                   ( line, model2.point_to_pixel( pos ) ), 1e-3 );
+      EXPECT_NEAR( 0, EpipolarLinePointMatcher::distance_point_line
+                   ( line, model2.point_to_pixel( ctr + 0.999 * norm_2( pos - ctr ) * dir ) ), 1e-3 );
+    }
+  }
+}
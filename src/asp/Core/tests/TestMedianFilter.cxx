@@ -0,0 +1,104 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Core/MedianFilter.h>
+
+#include <algorithm>
+
+using namespace vw;
+using namespace asp;
+
+// Brute-force percentile of the valid pixels in the clipped window
+float window_percentile(ImageView< PixelMask<float> > const& img,
+                        int col, int row, int half, double percentile) {
+  std::vector<float> vals;
+  for (int c = std::max(col-half, 0); c <= std::min(col+half, img.cols()-1); c++) {
+    for (int r = std::max(row-half, 0); r <= std::min(row+half, img.rows()-1); r++) {
+      if (is_valid(img(c, r)))
+        vals.push_back(img(c, r).child());
+    }
+  }
+  std::sort(vals.begin(), vals.end());
+  int count = vals.size();
+  return vals[std::min(count - 1, int(percentile * count))];
+}
+
+TEST( MedianFilter, PercentileFilter ) {
+
+  // With few distinct values the result must be exact
+  ImageView< PixelMask<float> > img(37, 23), out;
+  for (int col = 0; col < img.cols(); col++) {
+    for (int row = 0; row < img.rows(); row++) {
+      img(col, row) = PixelMask<float>(float((col * 7 + row * 13) % 29) - 10.5);
+      if ((col * row) % 5 == 1)
+        img(col, row).invalidate();
+    }
+  }
+
+  const int kernel_sizes[] = {1, 4, 9};
+  const double percentiles[] = {0.0, 0.25, 0.5, 1.0};
+  for (int k = 0; k < 3; k++) {
+    for (int p = 0; p < 4; p++) {
+      percentile_filter(img, kernel_sizes[k], percentiles[p], out);
+      for (int col = 0; col < img.cols(); col++) {
+        for (int row = 0; row < img.rows(); row++) {
+          ASSERT_EQ(is_valid(img(col, row)), is_valid(out(col, row)));
+          if (!is_valid(img(col, row)))
+            continue;
+          EXPECT_EQ(window_percentile(img, col, row, kernel_sizes[k]/2, percentiles[p]),
+                    out(col, row).child());
+        }
+      }
+    }
+  }
+
+  EXPECT_THROW(percentile_filter(img, 0, 0.5, out), ArgumentErr);
+  EXPECT_THROW(percentile_filter(img, 3, 1.5, out), ArgumentErr);
+}
+
+TEST( MedianFilter, PercentileFilterManyValues ) {
+
+  // Many more distinct values than quantization levels. The result must
+  // still be the exact order statistic.
+  ImageView< PixelMask<float> > img(150, 120), out;
+  for (int col = 0; col < img.cols(); col++) {
+    for (int row = 0; row < img.rows(); row++) {
+      img(col, row) = PixelMask<float>(0.37f * col + 0.11f * row +
+                                       float((col * 7919 + row * 104729) % 1000) / 1000.0f);
+      if ((col * 31 + row * 17) % 10 == 0)
+        img(col, row).invalidate();
+    }
+  }
+
+  const int kernel_sizes[] = {4, 9, 31};
+  const double percentiles[] = {0.0, 0.5, 1.0};
+  for (int k = 0; k < 3; k++) {
+    for (int p = 0; p < 3; p++) {
+      percentile_filter(img, kernel_sizes[k], percentiles[p], out);
+      for (int col = 0; col < img.cols(); col++) {
+        for (int row = 0; row < img.rows(); row++) {
+          if (!is_valid(img(col, row)))
+            continue;
+          ASSERT_EQ(window_percentile(img, col, row, kernel_sizes[k]/2, percentiles[p]),
+                    out(col, row).child()) << col << " " << row;
+        }
+      }
+    }
+  }
+}
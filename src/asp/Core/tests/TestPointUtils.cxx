@@ -152,3 +152,76 @@ TEST( PointUtils, PcdReader ) {
 }
 
 
+// Write two tiles of a cloud as integers, mosaic them in a VRT the way
+// parallel_stereo does, and make sure the points read back correctly.
+// A point too far from the shift to fit in int32 must come back invalid.
+TEST( PointUtils, CompactPointCloudMosaic ) {
+
+  Vector3 shift(-1234567.125, 5432109.5, 987654.25);
+  double quantum = get_rounding_error(shift, 0.0);
+
+  int cols = 4, rows = 2;
+  ImageView<Vector3> cloud(2*cols, rows);
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < 2*cols; col++)
+      cloud(col, row) = shift + Vector3(1000.123*col, -50.456*row, 3.789*(col + row));
+  }
+  cloud(1, 1)        = Vector3();                       // invalid point
+  cloud(cols + 2, 0) = shift + Vector3(0, 0, 3.0e+6);   // outlier, beyond int32 range
+
+  vw::cartography::GdalWriteOptions opt;
+  vw::cartography::GeoReference georef;
+  for (int tile = 0; tile < 2; tile++) {
+    std::ostringstream os;
+    os << "compact_tile" << tile << ".tif";
+    asp::write_compact_gdal_image(os.str(), shift, 0.0,
+                                  crop(cloud, BBox2i(tile*cols, 0, cols, rows)),
+                                  false, georef, false, 0, opt);
+  }
+
+  // Copy the metadata from one tile, as parallel_stereo does
+  std::string offset_str, scale_str;
+  boost::shared_ptr<vw::DiskImageResource> rsrc
+    (new vw::DiskImageResourceGDAL("compact_tile0.tif"));
+  ASSERT_TRUE(vw::cartography::read_header_string(*rsrc.get(), ASP_POINT_OFFSET_TAG_STR,
+                                                  offset_str));
+  ASSERT_TRUE(vw::cartography::read_header_string(*rsrc.get(), ASP_POINT_SCALE_TAG_STR,
+                                                  scale_str));
+
+  std::ofstream vrt("compact_mosaic.vrt");
+  vrt << "<VRTDataset rasterXSize=\"" << 2*cols << "\" rasterYSize=\"" << rows << "\">\n";
+  vrt << "  <Metadata>\n";
+  vrt << "    <MDI key=\"" << ASP_POINT_OFFSET_TAG_STR << "\">" << offset_str << "</MDI>\n";
+  vrt << "    <MDI key=\"" << ASP_POINT_SCALE_TAG_STR  << "\">" << scale_str  << "</MDI>\n";
+  vrt << "  </Metadata>\n";
+  for (int b = 1; b <= 3; b++) {
+    vrt << "  <VRTRasterBand dataType=\"Int32\" band=\"" << b << "\">\n";
+    for (int tile = 0; tile < 2; tile++) {
+      vrt << "    <SimpleSource>\n";
+      vrt << "       <SourceFilename relativeToVRT=\"1\">compact_tile" << tile
+          << ".tif</SourceFilename>\n";
+      vrt << "       <SourceBand>" << b << "</SourceBand>\n";
+      vrt << "       <SrcRect xOff=\"0\" yOff=\"0\" xSize=\"" << cols << "\" ySize=\""
+          << rows << "\"/>\n";
+      vrt << "       <DstRect xOff=\"" << tile*cols << "\" yOff=\"0\" xSize=\"" << cols
+          << "\" ySize=\"" << rows << "\"/>\n";
+      vrt << "    </SimpleSource>\n";
+    }
+    vrt << "  </VRTRasterBand>\n";
+  }
+  vrt << "</VRTDataset>\n";
+  vrt.close();
+
+  ImageView<Vector3> mosaic = asp::read_asp_point_cloud<3>("compact_mosaic.vrt");
+  ASSERT_EQ(2*cols, mosaic.cols());
+  ASSERT_EQ(rows,   mosaic.rows());
+  for (int row = 0; row < rows; row++) {
+    for (int col = 0; col < 2*cols; col++) {
+      if (cloud(col, row) == Vector3() || (col == cols + 2 && row == 0)) {
+        EXPECT_EQ(Vector3(), mosaic(col, row));
+        continue;
+      }
+      EXPECT_VECTOR_NEAR(cloud(col, row), mosaic(col, row), quantum);
+    }
+  }
+}
@@ -42,6 +42,11 @@
 // interpolate the camera position/orientation in the sbet nav
 // file. Combine with the camera intrinsics tsai file passed on input,
 // and write down the camera intrinsics + extrinsics tsai file.
+//
+// The text nav file is parsed once and a binary copy of it is saved
+// as sbet_20111012.txt.bin. Later runs read that copy instead, as long
+// as the text file has not changed. The cameras are generated in
+// parallel, with each thread handling a range of frames.
 
 #include <asp/Core/Macros.h>
 #include <asp/Core/StereoSettings.h>
@@ -50,8 +55,14 @@
 #include <vw/Math/Matrix.h>
 #include <vw/Camera/PinholeModel.h>
 #include <vw/Camera/Extrinsics.h>
+#include <vw/Core/ThreadPool.h>
+#include <boost/iostreams/device/mapped_file.hpp>
 #include <ctime>
 #include <stdlib.h>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <algorithm>
 
 // Turn off warnings from eigen
 #if defined(__GNUC__) || defined(__GNUG__)
@@ -248,7 +259,8 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
   general_options.add_options()
     ("input-cam",      po::value(&opt.input_cam)->default_value(""), 
                        "The input camera file from where to read the intrinsics.")
-    ("nav-file",       po::value(&opt.nav_file)->default_value(""), "The nav file, in text format.")
+    ("nav-file",       po::value(&opt.nav_file)->default_value(""),
+                       "The nav file, in text format. A binary copy is cached next to it, with the .bin extension appended.")
     ("time-offset",    po::value(&opt.time_offset)->default_value(0.0),
                        "Time offset to be added to the navigation file timestamps.")
     ("output-folder",  po::value(&opt.output_folder)->default_value(""), 
@@ -311,10 +323,19 @@ void handle_arguments( int argc, char *argv[], Options& opt ) {
 
 
 /**
-  Class which loads an Icebridge nav file in chunks and provides an interpolator
-   for each chunk.
+  Columnar copy of an Icebridge nav file, with each record's time,
+  GCC position, and roll/pitch/heading stored in separate arrays
+  sorted by time. The text file is parsed only once. The parsed data
+  is saved next to it as a binary file, and later runs memory-map
+  that file instead. Interpolators can be built for any time window.
+
+  The cache is used if the text file's size, modification time (which
+  may have a resolution of one second), and a hash of its first and
+  last few kilobytes still match. An edit in the middle of the file
+  which keeps its size, made within the same second, goes unnoticed;
+  delete the .bin file in that case.
 */
-class ScrollingNavInterpolator {
+class NavStore {
 public:
 
   // TODO: Is the rotation interpolation method ok?  It is the only
@@ -322,154 +343,226 @@ public:
   typedef vw::camera::LagrangianInterpolationVarTime PosInterpType;
   typedef vw::camera::LagrangianInterpolationVarTime RotInterpType;
 
-  // Open the file
-  ScrollingNavInterpolator(std::string const& path, Datum const& datum_in)
-    : m_datum(datum_in) {
-    m_input_stream.open(path.c_str());
-    
-    // Load the nav file in chunks of this size
-    const size_t INTERPOLATE_CHUNK_LENGTH  = 10000;
-    const size_t INTERPOLATE_CHUNK_OVERLAP = 1000; // Overlap between chunks
-    m_chunk_length  = INTERPOLATE_CHUNK_LENGTH;
-    m_chunk_overlap = INTERPOLATE_CHUNK_OVERLAP;
-    
-    // Init vectors to a fixed size
-    m_time_vector.resize(INTERPOLATE_CHUNK_LENGTH);
-    m_loc_vector.resize (INTERPOLATE_CHUNK_LENGTH);
-    m_rot_vector.resize (INTERPOLATE_CHUNK_LENGTH);
-    
-    m_first_chunk = true;
-  }
-  
-  ~ScrollingNavInterpolator() {
-    m_input_stream.close();
-  }
+  enum Column {NAV_TIME = 0, NAV_X, NAV_Y, NAV_Z, NAV_ROLL, NAV_PITCH, NAV_HEADING,
+               NUM_NAV_COLUMNS};
 
-  /// Set up the next interpolator
-  /// - Returns false if the end of the file was reached
-  bool load_next_chunk(boost::shared_ptr<PosInterpType> &pos_interpolator_ptr,
-                       boost::shared_ptr<PosInterpType> &rot_interpolator_ptr) {
+  /// Load the nav file, using the binary cache if it is still current.
+  NavStore(std::string const& path, Datum const& datum) {
 
-    if (m_input_stream.bad())
-      return false;
-  
-    size_t index = 0;
-    
-    if (!m_first_chunk) {
-      // Copy N values from the end of the vectors to the beginning
-      const size_t end_index = m_chunk_length - m_chunk_overlap;
-      for (index=0; index<m_chunk_overlap; ++index) {
-        m_time_vector[index] = m_time_vector[end_index+index];
-        m_loc_vector [index] = m_loc_vector [end_index+index];
-        m_rot_vector [index] = m_rot_vector [end_index+index];
-      }
+    std::string cache_path = path + ".bin";
+    uint64 source_size  = fs::file_size(path);
+    int64  source_mtime = static_cast<int64>(fs::last_write_time(path));
+    uint64 source_hash  = hash_ends(path, source_size);
+
+    if (read_cache(cache_path, source_size, source_mtime, source_hash)) {
+      vw_out() << "Read " << size() << " nav records from " << cache_path << std::endl;
+      return;
     }
-    else
-      m_first_chunk = false;
-    
-    // Populate rest of the vectors by reading from the file
-    double  time;
-    Vector3 loc, angles;
-    while (read_next_line(time, loc, angles)){
-      m_time_vector[index] = time;
-      m_loc_vector [index] = loc;
-      m_rot_vector [index] = angles;
-      ++index;
-      if (index == m_chunk_length)
-        break;
+
+    read_text(path, datum);
+    vw_out() << "Read " << size() << " nav records from " << path << std::endl;
+
+    // Failing to write the cache only costs time on the next run
+    try {
+      write_cache(cache_path, source_size, source_mtime, source_hash);
+    } catch (std::exception const& e) {
+      vw_out(WarningMessage) << "Could not write " << cache_path << ": " << e.what() << std::endl;
     }
-    
-    // If we hit the end of the file just return false, hopefully no camera
-    //  data is right at the end of the file!
-    if (index < m_chunk_length)
-      return false;
-  
-    // Set up the interpolator
-    const int INTERP_RADIUS = 4;  
+  }
+
+  size_t size() const { return m_columns[NAV_TIME].size(); }
+
+  double start_time() const { return m_columns[NAV_TIME].front(); }
+  double end_time  () const { return m_columns[NAV_TIME].back (); }
+
+  /// Build interpolators which are valid over the time range [t0, t1].
+  void make_interpolators(double t0, double t1,
+                          boost::shared_ptr<PosInterpType> &pos_interpolator_ptr,
+                          boost::shared_ptr<RotInterpType> &rot_interpolator_ptr) const {
+
+    // Pad the window so the interpolator has enough samples at its ends
+    const int    INTERP_RADIUS = 4;
+    const size_t PAD           = INTERP_RADIUS + 1;
+
+    std::vector<double> const& times = m_columns[NAV_TIME];
+    size_t beg = std::lower_bound(times.begin(), times.end(), t0) - times.begin();
+    size_t end = std::upper_bound(times.begin(), times.end(), t1) - times.begin();
+    beg = (beg > PAD) ? beg - PAD : 0;
+    end = std::min(end + PAD, times.size());
+
+    std::vector<double > time_vector(times.begin() + beg, times.begin() + end);
+    std::vector<Vector3> loc_vector (end - beg), rot_vector(end - beg);
+    for (size_t i = beg; i < end; i++) {
+      loc_vector[i - beg] = Vector3(m_columns[NAV_X   ][i], m_columns[NAV_Y    ][i],
+                                    m_columns[NAV_Z   ][i]);
+      rot_vector[i - beg] = Vector3(m_columns[NAV_ROLL][i], m_columns[NAV_PITCH][i],
+                                    m_columns[NAV_HEADING][i]);
+    }
+
     pos_interpolator_ptr = boost::shared_ptr<PosInterpType>(
-          new PosInterpType(m_loc_vector, m_time_vector, INTERP_RADIUS));
+          new PosInterpType(loc_vector, time_vector, INTERP_RADIUS));
     rot_interpolator_ptr = boost::shared_ptr<RotInterpType>(
-          new RotInterpType(m_rot_vector, m_time_vector, INTERP_RADIUS));
-              
-    return true;
-  }
-  
-  /// Return the time boundaries of the current interpolator
-  void get_time_boundaries(double &start, double &end) const {
-    start = m_time_vector.front();
-    end   = m_time_vector.back ();
+          new RotInterpType(rot_vector, time_vector, INTERP_RADIUS));
   }
 
-  /// Load a target location vector.
-  void set_target_locs(std::vector<Vector3> const& target_locs) {
-    m_target_loc_vector = target_locs;
-    m_target_distance_vector.resize(m_target_loc_vector.size());
-    m_target_time_vector.resize    (m_target_loc_vector.size());
-    for (size_t i=0; i<m_target_distance_vector.size(); ++i) {
-      m_target_distance_vector[i] = 999999999;
-      m_target_time_vector    [i] = -1;
+  /// Find the nav record whose position is closest to the given location.
+  void find_closest_record(Vector3 const& target_loc,
+                           double & best_time, double & best_distance) const {
+    best_distance = std::numeric_limits<double>::max();
+    best_time     = -1;
+    for (size_t i = 0; i < size(); i++) {
+      double dx = m_columns[NAV_X][i] - target_loc[0];
+      double dy = m_columns[NAV_Y][i] - target_loc[1];
+      double dz = m_columns[NAV_Z][i] - target_loc[2];
+      double distance = dx*dx + dy*dy + dz*dz;
+      if (distance < best_distance) {
+        best_distance = distance;
+        best_time     = m_columns[NAV_TIME][i];
+      }
     }
-  }
-  /// Get target location vector closest times.
-  void get_target_times(std::vector<double> &target_time_vector,
-                        std::vector<double> &target_distance_vector) const {
-    target_time_vector     = m_target_time_vector;
-    target_distance_vector = m_target_distance_vector;
+    best_distance = sqrt(best_distance);
   }
 
 private:
 
-  bool                 m_first_chunk;
-  const Datum          m_datum;
-  std::vector<double > m_time_vector;
-  std::vector<Vector3> m_loc_vector;
-  std::vector<Vector3> m_rot_vector;
-  size_t               m_chunk_length;
-  size_t               m_chunk_overlap;
-  std::ifstream        m_input_stream;
-  
-  /// Search for these locations in the entire file!
-  std::vector<Vector3> m_target_loc_vector;
-  std::vector<double > m_target_distance_vector;
-  std::vector<double > m_target_time_vector;
+  std::vector<double> m_columns[NUM_NAV_COLUMNS];
+
+  /// Header of the binary cache file. It is followed by the columns,
+  /// each one having num_records doubles.
+  struct CacheHeader {
+    char   magic[8];
+    uint64 num_records;
+    uint64 source_size;
+    int64  source_mtime;
+    uint64 source_hash;
+  };
+
+  static const char* cache_magic() { return "ASPNAV02"; }
+
+  /// FNV-1a hash of the first and last few kilobytes of a file, where
+  /// its first and last records are, to tell if it was changed.
+  static uint64 hash_ends(std::string const& path, uint64 file_size) {
+    const uint64 END_SIZE = 4096;
+    std::ifstream input_stream(path.c_str(), std::ios::binary);
+    std::vector<char> buf;
+    uint64 hash = 14695981039346656037ULL;
+    if (file_size == 0)
+      return hash;
+    uint64 starts[2] = {0, file_size - std::min(file_size, END_SIZE)};
+    for (int k = 0; k < 2; k++) {
+      buf.resize(std::min(file_size, END_SIZE));
+      input_stream.seekg(starts[k]);
+      input_stream.read(&buf[0], buf.size());
+      buf.resize(input_stream.gcount());
+      input_stream.clear();
+      for (size_t i = 0; i < buf.size(); i++) {
+        hash ^= static_cast<unsigned char>(buf[i]);
+        hash *= 1099511628211ULL;
+      }
+    }
+    return hash;
+  }
 
+  /// Parse the text nav file
+  void read_text(std::string const& path, Datum const& datum) {
+    std::ifstream input_stream(path.c_str());
+    if (!input_stream)
+      vw_throw( ArgumentErr() << "Could not open nav file: " << path << "\n" );
 
-  /// Read and parse the next line in the file
-  bool read_next_line(double &time, Vector3& loc, Vector3& rot) {
-    // Try to read the line
     std::string line;
-    if (!getline(m_input_stream, line))
+    double time, lat, lon, alt, roll, pitch, heading;
+    while (getline(input_stream, line)) {
+      scan_line(line, time, lat, lon, alt, roll, pitch, heading);
+      Vector3 loc = datum.geodetic_to_cartesian(Vector3(lon, lat, alt));
+
+      // The interpolators need increasing times
+      if (size() > 0 && time <= m_columns[NAV_TIME].back()) {
+        vw_out(WarningMessage) << "Skipping nav record whose time is not after the "
+                               << "previous one: " << line << std::endl;
+        continue;
+      }
+
+      m_columns[NAV_TIME   ].push_back(time   );
+      m_columns[NAV_X      ].push_back(loc[0] );
+      m_columns[NAV_Y      ].push_back(loc[1] );
+      m_columns[NAV_Z      ].push_back(loc[2] );
+      m_columns[NAV_ROLL   ].push_back(roll   );
+      m_columns[NAV_PITCH  ].push_back(pitch  );
+      m_columns[NAV_HEADING].push_back(heading);
+    }
+
+    if (size() == 0)
+      vw_throw( ArgumentErr() << "No records found in nav file: " << path << "\n" );
+  }
+
+  /// Memory-map the binary cache and copy the columns from it. Returns
+  /// false if the cache is missing, corrupt, or older than the text file.
+  bool read_cache(std::string const& cache_path, uint64 source_size, int64 source_mtime,
+                  uint64 source_hash) {
+    if (!fs::exists(cache_path))
       return false;
 
-    // Parse the line
-    double lat, lon, alt, roll, pitch, heading;
-    scan_line(line, time, lat, lon, alt, roll, pitch, heading);
-    Vector3 llh(lon, lat, alt);
-    loc = m_datum.geodetic_to_cartesian(llh);
-    rot[0] = roll;
-    rot[1] = pitch;
-    rot[2] = heading;
-    
-    // Compare this position to target locations if they exist.
-    if (!m_target_loc_vector.empty())
-      update_target_locs(loc, time);
-    
+    boost::iostreams::mapped_file_source mapped;
+    try {
+      mapped.open(cache_path);
+    } catch (...) {
+      return false;
+    }
+
+    CacheHeader header;
+    if (mapped.size() < sizeof(header))
+      return false;
+    memcpy(&header, mapped.data(), sizeof(header));
+    if (memcmp(header.magic, cache_magic(), sizeof(header.magic)) != 0 ||
+        header.source_size  != source_size                             ||
+        header.source_mtime != source_mtime                            ||
+        header.source_hash  != source_hash                             ||
+        header.num_records  == 0                                       ||
+        mapped.size() != sizeof(header) +
+                         NUM_NAV_COLUMNS * header.num_records * sizeof(double))
+      return false;
+
+    const double* data = reinterpret_cast<const double*>(mapped.data() + sizeof(header));
+    for (int col = 0; col < NUM_NAV_COLUMNS; col++) {
+      m_columns[col].assign(data, data + header.num_records);
+      data += header.num_records;
+    }
     return true;
   }
-  
-  /// Check if this location is the best match to any target locations.
-  void update_target_locs(Vector3 loc, double time) {
-    // For each target, record the time and distance if this is the best match.
-    for (size_t i=0; i<m_target_loc_vector.size(); ++i) {
-      double distance = norm_2(loc - m_target_loc_vector[i]);
-      if (distance < m_target_distance_vector[i]) {
-        m_target_distance_vector[i] = distance;
-        m_target_time_vector    [i] = time;
+
+  /// Write the binary cache. It is written to a temporary file first
+  /// so that runs sharing the same nav file never see a partial cache.
+  /// The temporary file is removed if writing fails.
+  void write_cache(std::string const& cache_path, uint64 source_size, int64 source_mtime,
+                   uint64 source_hash) const {
+
+    CacheHeader header;
+    memcpy(header.magic, cache_magic(), sizeof(header.magic));
+    header.num_records  = size();
+    header.source_size  = source_size;
+    header.source_mtime = source_mtime;
+    header.source_hash  = source_hash;
+
+    fs::path tmp_path = fs::unique_path(cache_path + ".%%%%-%%%%");
+    try {
+      {
+        std::ofstream out(tmp_path.string().c_str(), std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (int col = 0; col < NUM_NAV_COLUMNS; col++)
+          out.write(reinterpret_cast<const char*>(&m_columns[col][0]),
+                    m_columns[col].size() * sizeof(double));
+        if (!out)
+          vw_throw( IOErr() << "Failed writing " << tmp_path.string() );
       }
-    } // End loop through targets
+      fs::rename(tmp_path, cache_path);
+    } catch (...) {
+      boost::system::error_code ec;
+      fs::remove(tmp_path, ec);
+      throw;
+    }
   }
 
-}; // End class ScrollingNavInterpolator
+}; // End class NavStore
 
 
 /// Pretty-print a rotation matrix.
@@ -486,11 +579,11 @@ void print_matrix(Matrix3x3 const& m) {
 /// Helper function to write out the camera model once we have the position and pose.
 /// - This also adds the important row-direction flip from the camera to the image.
 void write_output_camera(Vector3 const& center, Matrix3x3 const& pose,
-                         std::string const& input_cam, 
+                         PinholeModel const& input_model,
                          std::string const& output_camera) {
                          
-  // Load the reference pinhole model, update it, and write it out to disk.
-  PinholeModel camera_model(input_cam);
+  // Copy the reference pinhole model, update it, and write it out to disk.
+  PinholeModel camera_model(input_model);
   camera_model.set_camera_center(center);
   camera_model.set_camera_pose(pose);
   //vw_out() << "Writing: " << output_camera << std::endl;
@@ -513,6 +606,225 @@ void write_output_camera(Vector3 const& center, Matrix3x3 const& pose,
   camera_model.write(output_camera);
 }
 
+/// Estimate the camera pose from the flight direction at the camera
+/// position, the aircraft roll and pitch, and the camera mounting.
+Matrix3x3 estimate_camera_pose(Vector3 const& gcc_interp,
+                               Vector3 const& gcc_interp_forward,
+                               Vector3 const& gcc_interp_backward,
+                               double roll, double pitch,
+                               int camera_mounting, Datum const& datum) {
+
+  /*
+    For some reason the heading interpolated from the navigation data is about 30 degrees
+    off from what is expected by looking at the flight path.  The roll and pitch values are
+    consistent with what is stored in the Icebridge-provided ortho files (the heading is not 
+    provided).  What has proven to work the best so far is to estimate the camera pose 
+    including the heading just by using the flight path, and then to apply the pitch and roll
+    to that matrix.  The best order to apply the pitch and roll has been determined by seeing 
+    which one map-projects closest to the lidar data.
+  */
+
+  // From the points ahead and behind get two flight direction vectors and take the mean.
+  Vector3 dir1 = gcc_interp_forward - gcc_interp;
+  Vector3 dir2 = gcc_interp - gcc_interp_backward;
+  Vector3 xDir = (dir1 + dir2) / 2.0;
+
+  // The Z vector is straight down from the camera to the ground.
+  Vector3 llh_ground = datum.cartesian_to_geodetic(gcc_interp);
+  llh_ground[2] = 0;
+  Vector3 gcc_ground = datum.geodetic_to_cartesian(llh_ground);
+  Vector3 zDir = gcc_ground - gcc_interp;
+
+  // Normalize the vectors
+  xDir = xDir / norm_2(xDir);
+  zDir = zDir / norm_2(zDir);
+
+  // The Y vector is the cross product of the two established vectors
+  Vector3 yDir = cross_prod(zDir, xDir);
+
+  // Hack to allow testing of whether rotation is applied before axis change.
+  // - The rotations appear to take affect BEFORE the camera mounting (ie they are aircraft rotations)
+  // - Once we are satisfied this is always true, remove the option not to do this.
+  if (camera_mounting > 0) {
+    Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
+                                  xDir[1], yDir[1], zDir[1],
+                                  xDir[2], yDir[2], zDir[2]);
+    Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
+    Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
+    Matrix3x3 M       = rotation_matrix_gcc*M_pitch*M_roll; // Pre-apply rotation.
+    xDir  = Vector3(M(0,0), M(1,0), M(2,0)); // Restore axes
+    yDir  = Vector3(M(0,1), M(1,1), M(2,1));
+    zDir  = Vector3(M(0,2), M(1,2), M(2,2));
+    roll  = 0; // Set to zero so that these rotations are not applied twice
+    pitch = 0;
+  }
+
+  // Account for the camera mounting direction relative to aircraft motion.
+  Vector3 vTemp;
+  switch(abs(camera_mounting)) {
+  case 1: // Left forwards
+    xDir = xDir * -1.0;
+    yDir = yDir * -1.0;
+    break;
+  case 2: // Top forwards
+    vTemp = xDir;
+    xDir = -1.0*yDir;
+    yDir = vTemp;
+    break;
+  case 3: // Bottom forwards
+    vTemp = xDir;
+    xDir = yDir;
+    yDir = -1.0*vTemp;
+    break;
+  default: break; // Right forwards, the default.
+  }
+
+  // Pack into a rotation matrix
+  Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
+                                xDir[1], yDir[1], zDir[1],
+                                xDir[2], yDir[2], zDir[2]);
+
+  Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
+  Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
+
+  // Without documentation it is very difficult to determine
+  // which of these rotation orders is correct!
+  // - Could be neither since the yaw rotation is already baked in.
+  //Matrix3x3 M1 = M_pitch*M_roll*rotation_matrix_gcc; // <-- off
+  //Matrix3x3 M2 = M_roll*M_pitch*rotation_matrix_gcc; // <-- off
+  Matrix3x3 M3 = rotation_matrix_gcc*M_pitch*M_roll; // <-- Best
+  //Matrix3x3 M4 = rotation_matrix_gcc*M_roll*M_pitch; // <-- Ok
+
+  return M3;
+}
+
+/// Write the cameras for a range of frames. Each task builds its own
+/// interpolators covering just the time span of its frames.
+class CameraRangeTask : public vw::Task, private boost::noncopyable {
+  NavStore            const& m_nav;
+  Options             const& m_opt;
+  PinholeModel        const& m_input_model;
+  std::vector<double> const& m_frame_times;
+  size_t m_beg, m_end;
+
+  // Note how these are aliases
+  Mutex  & m_progress_mutex;
+  size_t & m_num_processed;
+
+public:
+  CameraRangeTask(NavStore const& nav, Options const& opt, PinholeModel const& input_model,
+                  std::vector<double> const& frame_times, size_t beg, size_t end,
+                  Mutex & progress_mutex, size_t & num_processed):
+    m_nav(nav), m_opt(opt), m_input_model(input_model), m_frame_times(frame_times),
+    m_beg(beg), m_end(end), m_progress_mutex(progress_mutex),
+    m_num_processed(num_processed) {}
+
+  void operator()() {
+
+    const double POSE_TIME_DELTA    = 0.1; // Look this far ahead/behind to determine direction
+    const double NAV_TIME_BOUNDARY  = 1.0; // Require this much interpolation time
+    const size_t PRINT_INTERVAL     = 200; // Print progress every N files
+
+    Datum datum_wgs84("WGS84");
+    const boost::filesystem::path output_dir(m_opt.output_folder);
+
+    // Find the time span of the frames which can be interpolated
+    double min_time = std::numeric_limits<double>::max();
+    double max_time = -min_time;
+    for (size_t file_index = m_beg; file_index < m_end; file_index++) {
+      double ortho_time = m_frame_times[file_index];
+      if (ortho_time < m_nav.start_time() + NAV_TIME_BOUNDARY) {
+        vw_out() << "Too early to interpolate position for file "
+                 << m_opt.image_files[file_index] << std::endl;
+        continue;
+      }
+      if (ortho_time > m_nav.end_time() - NAV_TIME_BOUNDARY) {
+        vw_out() << "Too late to interpolate position for file "
+                 << m_opt.image_files[file_index] << std::endl;
+        continue;
+      }
+      min_time = std::min(min_time, ortho_time);
+      max_time = std::max(max_time, ortho_time);
+    }
+    if (min_time > max_time)
+      return; // Nothing to do
+
+    boost::shared_ptr<NavStore::PosInterpType> pos_interpolator_ptr;
+    boost::shared_ptr<NavStore::RotInterpType> rot_interpolator_ptr;
+    m_nav.make_interpolators(min_time - NAV_TIME_BOUNDARY, max_time + NAV_TIME_BOUNDARY,
+                             pos_interpolator_ptr, rot_interpolator_ptr);
+
+    for (size_t file_index = m_beg; file_index < m_end; file_index++) {
+
+      double ortho_time = m_frame_times[file_index];
+      if (ortho_time < min_time || ortho_time > max_time)
+        continue; // Already reported above
+
+      std::string const& orthoimage_path = m_opt.image_files[file_index];
+      boost::filesystem::path camera_file(m_opt.camera_files[file_index]);
+      boost::filesystem::path output_camera_path = output_dir / camera_file;
+
+      // Try to interpolate this ortho position
+      Vector3 gcc_interp, rot_interp, gcc_interp_forward, gcc_interp_backward;
+      try{
+        gcc_interp = pos_interpolator_ptr->operator()(ortho_time);
+        rot_interp = rot_interpolator_ptr->operator()(ortho_time);
+
+        // Get a point ahead of and behind the frame location
+        gcc_interp_forward  = pos_interpolator_ptr->operator()(ortho_time+POSE_TIME_DELTA);
+        gcc_interp_backward = pos_interpolator_ptr->operator()(ortho_time-POSE_TIME_DELTA);
+      } catch(...){
+        vw_out() << "Failed to interpolate position for file " << orthoimage_path << std::endl;
+        continue;
+      }
+
+      if (gcc_interp_forward == gcc_interp_backward) {
+        vw_out() << "Failed to estimate pose for file " << orthoimage_path << std::endl;
+        continue;
+      }
+
+      double roll  = rot_interp[0];
+      double pitch = rot_interp[1];
+      Matrix3x3 pose = estimate_camera_pose(gcc_interp, gcc_interp_forward,
+                                            gcc_interp_backward, roll, pitch,
+                                            m_opt.camera_mounting, datum_wgs84);
+      write_output_camera(gcc_interp, pose, m_input_model, output_camera_path.string());
+
+      // Update progress
+      Mutex::Lock lock(m_progress_mutex);
+      ++m_num_processed;
+      if (m_num_processed % PRINT_INTERVAL == 0)
+        vw_out() << m_num_processed << " files processed.\n";
+    }
+  }
+}; // End class CameraRangeTask
+
+/// Find the nav record closest to each of a range of target camera
+/// positions, for estimating the time offset.
+class ClosestRecordTask : public vw::Task, private boost::noncopyable {
+  NavStore             const& m_nav;
+  std::vector<Vector3> const& m_target_locs;
+  size_t m_target_index;
+
+  // Note how these are aliases
+  std::vector<double> & m_matched_times;
+  std::vector<double> & m_best_distances;
+
+public:
+  ClosestRecordTask(NavStore const& nav, std::vector<Vector3> const& target_locs,
+                    size_t target_index,
+                    std::vector<double> & matched_times,
+                    std::vector<double> & best_distances):
+    m_nav(nav), m_target_locs(target_locs), m_target_index(target_index),
+    m_matched_times(matched_times), m_best_distances(best_distances) {}
+
+  void operator()() {
+    m_nav.find_closest_record(m_target_locs[m_target_index],
+                              m_matched_times [m_target_index],
+                              m_best_distances[m_target_index]);
+  }
+}; // End class ClosestRecordTask
+
 // ================================================================================
 
 int main(int argc, char* argv[]) {
@@ -531,20 +843,17 @@ int main(int argc, char* argv[]) {
     char* temp = (char*)TZ_UTC.c_str();
     putenv(temp);
 
-
-    // Print progress every N files
-    const size_t PRINT_INTERVAL = 200;
-  
     const boost::filesystem::path output_dir(opt.output_folder);
   
-    // Initialize the nav interpolator
+    // Load the nav data
     std::cout << "Opening input stream: " << opt.nav_file << std::endl;
-    ScrollingNavInterpolator interpLoader(opt.nav_file, datum_wgs84);
+    NavStore nav(opt.nav_file, datum_wgs84);
 
-    // Load target camera positions if desired
-    std::vector<Vector3> target_locations;
-    std::vector<double > target_times;
     if (opt.detect_offset) {
+
+      // Load target camera positions
+      std::vector<Vector3> target_locations;
+      std::vector<double > target_times;
       std::cout << "Reading target locations...\n";
       const size_t num_targets = opt.camera_files.size();
       target_locations.reserve(num_targets);
@@ -559,361 +868,71 @@ int main(int argc, char* argv[]) {
         } catch(...) {
         } // Just skip cameras that we can't read in.
       }
-      interpLoader.set_target_locs(target_locations);
       std::cout << "Done loading " << target_locations.size() << " target locations.\n";
-    } // End target loading condition
-
-    boost::shared_ptr<ScrollingNavInterpolator::PosInterpType> pos_interpolator_ptr;
-    boost::shared_ptr<ScrollingNavInterpolator::RotInterpType> rot_interpolator_ptr;
-    double start, end;
-  
-    const double POSE_TIME_DELTA     = 0.1; // Look this far ahead/behind to determine direction
-    const double CHUNK_TIME_BOUNDARY = 1.0; // Require this much interpolation time
-    size_t file_index = 0;
-    const size_t num_files = opt.image_files.size();
-
-    // Keep loading chunks until the nav data catches up with the images
-    double ortho_time=0;
-    while (interpLoader.load_next_chunk(pos_interpolator_ptr, rot_interpolator_ptr)) {
-
-      // Get the time boundaries of the current chunk
-      interpLoader.get_time_boundaries(start, end);  
-
-      //std::cout << "Time range: " << start << " ---- " << end << std::endl;
 
-      // When detecting offsets all we want to do is loop through the nav file.
-      if (opt.detect_offset)
-        continue;
-
-      // Loop through ortho files until we need to advance the nav chunk
-      while (file_index < num_files) {
-
-        // Get the next input and output paths
-        std::string             orthoimage_path = opt.image_files [file_index];
-        boost::filesystem::path camera_file(opt.camera_files[file_index]);
-        boost::filesystem::path output_camera_path = output_dir / camera_file;
-      
-        // Get time for this frame
-        if (ortho_time == 0) {
-          ortho_time = gps_seconds(orthoimage_path) - opt.time_offset;
-          //vw_out() << orthoimage_path << " -> gps_time = " << ortho_time << std::endl;
-        }
-
-        // If this ortho is too far ahead in time, move on to the next nav chunk.
-        if (ortho_time > end - CHUNK_TIME_BOUNDARY)
-          break; // Don't advance file_index
-
-        // If this ortho is too early in time, move on to the next ortho file.
-        if (ortho_time < start + CHUNK_TIME_BOUNDARY) {
-          vw_out() << "Too early to interpolate position for file " << orthoimage_path << std::endl;
-          ++file_index;
-          ortho_time = 0;
-          continue;
-        }
-
-        // Try to interpolate this ortho position
-        Vector3 gcc_interp, rot_interp;
-        try{
-          gcc_interp = pos_interpolator_ptr->operator()(ortho_time);
-          rot_interp = rot_interpolator_ptr->operator()(ortho_time);
-        } catch(...){
-          vw_out() << "Failed to interpolate position for file " << orthoimage_path << std::endl;
-          ++file_index;
-          ortho_time = 0;
-          continue;
-        }
-        Vector3 llh_interp = datum_wgs84.cartesian_to_geodetic(gcc_interp);
-      
-        double roll    = rot_interp[0];
-        double pitch   = rot_interp[1];
-        //double heading = rot_interp[2];
-        //vw_out() << "For file " << orthoimage_path << " computed LLH " << llh_interp << std::endl;
-        //vw_out() << "Roll    = " << roll    <<" = "<< roll*180/3.14159<< std::endl;
-        //vw_out() << "Pitch   = " << pitch   <<" = "<< pitch*180/3.14159<< std::endl;
-        //vw_out() << "Heading = " << heading << std::endl;
-
-        //std::cout << "Ortho time  = " << ortho_time << std::endl;
-        //vw_out() << "llh = " << llh_interp << std::endl;
-      
-        // Now estimate the rotation information
-
-        /*
-          For some reason the heading interpolated from the navigation data is about 30 degrees
-          off from what is expected by looking at the flight path.  The roll and pitch values are
-          consistent with what is stored in the Icebridge-provided ortho files (the heading is not 
-          provided).  What has proven to work the best so far is to estimate the camera pose 
-          including the heading just by using the flight path, and then to apply the pitch and roll
-          to that matrix.  The best order to apply the pitch and roll has been determined by seeing 
-          which one map-projects closest to the lidar data.
-        */
-      
-        // Get a point ahead of and behind the frame location
-        Vector3 gcc_interp_forward  = pos_interpolator_ptr->operator()(ortho_time+POSE_TIME_DELTA);
-        Vector3 gcc_interp_backward = pos_interpolator_ptr->operator()(ortho_time-POSE_TIME_DELTA);
-      
-        if (gcc_interp_forward == gcc_interp_backward) {
-          vw_out() << "Failed to estimate pose for file " << orthoimage_path << std::endl;
-          ++file_index;
-          ortho_time = 0;
-          continue;
-        }
-      
-        // From these points get two flight direction vectors and take the mean.
-        Vector3 dir1 = gcc_interp_forward - gcc_interp;
-        Vector3 dir2 = gcc_interp - gcc_interp_backward;
-        Vector3 xDir = (dir1 + dir2) / 2.0;
-     
-        // The Z vector is straight down from the camera to the ground.
-        Vector3 llh_ground = llh_interp;
-        llh_ground[2] = 0;
-        Vector3 gcc_ground = datum_wgs84.geodetic_to_cartesian(llh_ground);
-        Vector3 zDir = gcc_ground - gcc_interp;
-      
-        // Normalize the vectors
-        xDir = xDir / norm_2(xDir);
-        zDir = zDir / norm_2(zDir);
-      
-        // The Y vector is the cross product of the two established vectors
-        Vector3 yDir = cross_prod(zDir, xDir);
-
-        // Hack to allow testing of whether rotation is applied before axis change.
-        // - The rotations appear to take affect BEFORE the camera mounting (ie they are aircraft rotations)
-        // - Once we are satisfied this is always true, remove the option not to do this.
-        if (opt.camera_mounting > 0) {
-          Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
-                                        xDir[1], yDir[1], zDir[1],
-                                        xDir[2], yDir[2], zDir[2]);
-          Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
-          Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
-          Matrix3x3 M       = rotation_matrix_gcc*M_pitch*M_roll; // Pre-apply rotation.
-          xDir  = Vector3(M(0,0), M(1,0), M(2,0)); // Restore axes
-          yDir  = Vector3(M(0,1), M(1,1), M(2,1));
-          zDir  = Vector3(M(0,2), M(1,2), M(2,2));
-          roll  = 0; // Set to zero so that these rotations are not applied twice
-          pitch = 0;
+      // Search the whole nav file for each target
+      std::vector<double> matched_times (target_locations.size());
+      std::vector<double> best_distances(target_locations.size());
+      {
+        FifoWorkQueue queue;
+        for (size_t i = 0; i < target_locations.size(); i++) {
+          boost::shared_ptr<ClosestRecordTask>
+            task(new ClosestRecordTask(nav, target_locations, i,
+                                       matched_times, best_distances));
+          queue.add_task(task);
         }
+        queue.join_all();
+      }
 
-        // Account for the camera mounting direction relative to aircraft motion.
-        Vector3 vTemp;
-        switch(abs(opt.camera_mounting)) {
-        case 1: // Left forwards
-          xDir = xDir * -1.0;
-          yDir = yDir * -1.0;
-          break;
-        case 2: // Top forwards
-          vTemp = xDir;
-          xDir = -1.0*yDir;
-          yDir = vTemp;
-          break;
-        case 3: // Bottom forwards
-          vTemp = xDir;
-          xDir = yDir;
-          yDir = -1.0*vTemp;
-          break;
-        default: break; // Right forwards, the default.
-        }
-      
-        // Pack into a rotation matrix
-        Matrix3x3 rotation_matrix_gcc(xDir[0], yDir[0], zDir[0],
-                                      xDir[1], yDir[1], zDir[1],
-                                      xDir[2], yDir[2], zDir[2]);
-      
-        // TODO: ENU or NED?
-        //Matrix3x3 ned_matrix = datum_wgs84.lonlat_to_ned_matrix(Vector2(llh_interp[0], llh_interp[1]));
-        //Matrix3x3 enu_matrix(ned_matrix(0,1), ned_matrix(0,0), -ned_matrix(0,2),
-        //                     ned_matrix(1,1), ned_matrix(1,0), -ned_matrix(1,2),
-        //                     ned_matrix(2,1), ned_matrix(2,0), -ned_matrix(2,2));
-
-        //Vector3 north(ned_matrix(0,0), ned_matrix(1,0), ned_matrix(2,0));
-        //double angle = acos(dot_prod(xDir, north) / (norm_2(north)*norm_2(xDir)));
-      
-        //std::cout << "Nav, est, diff, cam: " << heading <<", "<< angle << ", "<< fabs(heading)-angle << ", " << camera_file <<  std::endl;
-
-
-        //std::cout << "gcc = " << gcc_interp << std::endl;
-        //std::cout << "xDir = " << xDir << std::endl;
-        //std::cout << "yDir = " << yDir << std::endl;
-        //std::cout << "zDir = " << zDir << std::endl;
-      
-        //std::cout << std::endl << "Estimate based matrix " << std::endl;
-        //print_matrix(rotation_matrix_gcc);
-      
-        // TODO: Clean all this up once we are satisfied with it!
-      
-        Matrix3x3 M_roll  = get_rotation_matrix_roll (roll);
-        Matrix3x3 M_pitch = get_rotation_matrix_pitch(pitch);
-
-        //std::cout << "M_roll, M_pitch:\n";
-        //print_matrix(M_roll ); std::cout << std::endl;
-        //print_matrix(M_pitch); std::cout << std::endl;
-      
-        // Without documentation it is very difficult to determine
-        // which of these rotation orders is correct!
-        // - Could be neither since the yaw rotation is already baked in.
-        //Matrix3x3 M1 = M_pitch*M_roll*rotation_matrix_gcc; // <-- off
-        //Matrix3x3 M2 = M_roll*M_pitch*rotation_matrix_gcc; // <-- off
-        Matrix3x3 M3 = rotation_matrix_gcc*M_pitch*M_roll; // <-- Best
-        //Matrix3x3 M4 = rotation_matrix_gcc*M_roll*M_pitch; // <-- Ok
-      
-        //std::cout << "Modified matrices:\n";
-        //print_matrix(M1); std::cout << std::endl;
-        //print_matrix(M2); std::cout << std::endl;
-        //print_matrix(M3); std::cout << std::endl;
-        //print_matrix(M4); std::cout << std::endl;
-
-        //std::string var_path = output_camera_path.string() + "_";
-        //write_output_camera(gcc_interp, rotation_matrix_gcc, opt.input_cam, var_path + "M0.tsai");
-        //write_output_camera(gcc_interp, M1, opt.input_cam, var_path + "M1.tsai");
-        //write_output_camera(gcc_interp, M2, opt.input_cam, var_path + "M2.tsai");
-        //write_output_camera(gcc_interp, M3, opt.input_cam, var_path + "M3.tsai");
-        //write_output_camera(gcc_interp, M4, opt.input_cam, var_path + "batch_06420_06421_2M4.tsai");
-
-        write_output_camera(gcc_interp, M3,
-                            opt.input_cam, output_camera_path.string());
-
-        //std::cout << std::endl << "NED matrix " << std::endl;
-        //print_matrix(ned_matrix);
-
-        //std::cout << std::endl << "ENU matrix " << std::endl;
-        //std::cout << enu_matrix << std::endl << std::endl;
-        /*
-          double yaw = -3.14159 / 2;
-          Matrix3x3 My90 = get_rotation_matrix_yaw(yaw);
-      
-          for (int p=0; p<0; ++p) {
-          Matrix3x3 rotation_matrix_gcc_2 = get_look_rotation_matrix(heading, pitch, roll, p);
-
-
-          std::cout << std::endl << "Angle based matrix " << p << std::endl;
-          std::cout << ned_matrix * rotation_matrix_gcc_2 << std::endl;
-
-          //std::cout << std::endl << "Angle based matrix 90 1" << p << std::endl;
-          //std::cout << My90*(ned_matrix * rotation_matrix_gcc_2) << std::endl;
-        
-          std::cout << std::endl << "Angle based matrix 90 2 " << p << std::endl;
-          std::cout << (ned_matrix * rotation_matrix_gcc_2)*My90 << std::endl;  
-        
-        
-          std::cout << std::endl << "Angle based matrix ALT" << p << std::endl;
-          std::cout << rotation_matrix_gcc_2*ned_matrix << std::endl;
-        
-          //std::cout << std::endl << "Angle based matrix ALT 90 1" << p << std::endl;
-          //std::cout << My90*(rotation_matrix_gcc_2*ned_matrix) << std::endl;
-        
-          std::cout << std::endl << "Angle based matrix ALT 90 2 " << p << std::endl;
-          std::cout << (rotation_matrix_gcc_2*ned_matrix)*My90 << std::endl;        
-
-          std::cout << "------------\n";
-
-
-          std::cout << std::endl << "Angle based matrix " << p << std::endl;
-          std::cout << enu_matrix * rotation_matrix_gcc_2 << std::endl;
-
-          //std::cout << std::endl << "Angle based matrix 90 1" << p << std::endl;
-          //std::cout << My90*(enu_matrix * rotation_matrix_gcc_2) << std::endl;
-        
-          std::cout << std::endl << "Angle based matrix 90 2" << p << std::endl;
-          std::cout << (enu_matrix * rotation_matrix_gcc_2)*My90 << std::endl;  
-        
-        
-          std::cout << std::endl << "Angle based matrix ALT" << p << std::endl;
-          std::cout << rotation_matrix_gcc_2*enu_matrix << std::endl;
-        
-          //std::cout << std::endl << "Angle based matrix ALT 90 1" << p << std::endl;
-          //std::cout << My90*(rotation_matrix_gcc_2*enu_matrix) << std::endl;
-        
-          std::cout << std::endl << "Angle based matrix ALT 90 2" << p << std::endl;
-          std::cout << (rotation_matrix_gcc_2*enu_matrix)*My90 << std::endl;        
-
-        
-          }
-          std::cout << std::endl << std::endl;
-        */
-        //write_output_camera(gcc_interp, rotation_matrix_gcc,
-        //                    opt.input_cam, output_camera_path.string());
-
-
-        // Update progress
-        if (file_index % PRINT_INTERVAL == 0)
-          vw_out() << file_index << " files processed.\n";
-
-        ++file_index;
-        ortho_time = 0;
-
-      } // End loop through ortho files
-    
-    } // End loop through nav batches
-  
-    vw_out() << "Finished looping through the nav file.\n";
-    /*
-    
-    // TODO: The camera position needs to be interpolated from the several nearest lines!
-    
-    Vector3 xyz;
-    Quat rot, look, ned;
-    
-    // Try out different rotation orders
-    for (int rot_order = 5; rot_order <= 5; rot_order++) {
-    
-    // Process the navigation information from this line
-    parse_camera_pose(curr_line, xyz, look, ned, 
-    lon, lat, alt, roll, pitch, heading, rot_order);
-
-    vw_out() << "Got GCC coord: " << xyz << std::endl;
-
-    // This is highly confusing, but apparently we need to keep
-    // the original longitude when computing the ned matrix that
-    // transforms from the coordinate system with orgin at the
-    // center of the Earth to the North-East-Down coordinate
-    // system that was obtained from the starting image, rather
-    // than modifying it as we move over new points over the Earth surface.
-    if (lon0 == BIG_NUMBER){
-    // First value for these variables.
-    lon0 = lon;
-    }
-    //ned = Quat(datum_wgs84.lonlat_to_ned_matrix(Vector2(lon0, lat)));
-
-    Quat rotation_matrix_gcc = inverse(ned)*inverse(look);
-      
-    // Update the input pinhole model and write it out to disk.
-    input_pinhole_model.set_camera_center(xyz);
-    input_pinhole_model.set_camera_pose(rotation_matrix_gcc);
-    vw_out() << "Writing: " << output_camera_path << std::endl;
-    input_pinhole_model.write(output_camera_path);
-      
-    } // End rot_order loop
-  
-    // Update progress
-    if (i % PRINT_INTERVAL == 0)
-    vw_out() << i << " files completed.\n";
-    
-    } // End loop through input files
-  
-    */
-  
-    if (opt.detect_offset) {
       std::cout << "Getting target results...\n";
       // Compute the mean difference between the target camera time and the matched time
       //  and print the results.
-      std::vector<double> matched_times, best_distances;
-      interpLoader.get_target_times(matched_times, best_distances);
-      const size_t num_targets = target_times.size();
       double mean_offset = 0, mean_dist = 0;
-      for (size_t i=0; i<num_targets; ++i) {
+      for (size_t i=0; i<target_times.size(); ++i) {
         double diff = matched_times[i] - target_times[i];
         mean_offset += diff;
         mean_dist   += best_distances[i];
         std::cout << "Offset: " << diff << ", dist = " << best_distances[i]
                   << ", time = " << matched_times[i] << std::endl;
       }
-      mean_offset /= static_cast<double>(num_targets);
-      mean_dist   /= static_cast<double>(num_targets);
+      mean_offset /= static_cast<double>(target_times.size());
+      mean_dist   /= static_cast<double>(target_times.size());
       std::cout << "Computed mean nav time offset: " << mean_offset << std::endl;
       std::cout << "Computed mean nav distance   : " << mean_dist   << std::endl;
+
+      return 0;
+    }
+
+    // Get the time for each frame. This is done here rather than in
+    // the tasks since gps_seconds() is not thread-safe.
+    const size_t num_files = opt.image_files.size();
+    std::vector<double> frame_times(num_files);
+    for (size_t file_index = 0; file_index < num_files; file_index++)
+      frame_times[file_index] = gps_seconds(opt.image_files[file_index]) - opt.time_offset;
+
+    // Load the reference camera once, each output camera is a copy of it
+    PinholeModel input_model(opt.input_cam);
+
+    // Process the frames in ranges, in parallel. Since the frames are
+    // sorted, each range covers a short span of the nav data.
+    const size_t FRAMES_PER_TASK = 100;
+    Mutex  progress_mutex;
+    size_t num_processed = 0;
+    {
+      FifoWorkQueue queue;
+      for (size_t beg = 0; beg < num_files; beg += FRAMES_PER_TASK) {
+        size_t end = std::min(beg + FRAMES_PER_TASK, num_files);
+        boost::shared_ptr<CameraRangeTask>
+          task(new CameraRangeTask(nav, opt, input_model, frame_times, beg, end,
+                                   progress_mutex, num_processed));
+        queue.add_task(task);
+      }
+      queue.join_all();
     }
   
+    vw_out() << "Finished looping through the nav file.\n";
+  
   } ASP_STANDARD_CATCHES;
 
   return 0;
 }
-  
@@ -448,6 +448,10 @@ int main(int argc, char *argv[]) {
     int found_last = 0;
     int nvar_mult = 0;
 
+    // Fully buffer the output, as it can be millions of short lines
+    static char stdout_buffer[1 << 20];
+    setvbuf(stdout, stdout_buffer, _IOFBF, sizeof(stdout_buffer));
+
     printData(word_format, 'h', NULL); // Print headers
     
     
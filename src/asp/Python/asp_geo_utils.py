@@ -136,6 +136,13 @@ def getImageGeoInfo(imagePath, getStats=True):
     except:
         pass # In most cases this line will not be present
 
+    # If the point cloud was saved as integers, this is the value of one unit
+    try:
+        pointScaleLine = asp_string_utils.getLineAfterText(textOutput, 'POINT_SCALE=') # Tag name must be synced with C++ code
+        outputDict['point_scale'] = float(pointScaleLine.strip())
+    except:
+        pass # Present only for compact point clouds
+
     # TODO: Currently this does not find much information, and there
     #       is another function in image_utils dedicated to returning statistics.
     if getStats:
@@ -157,11 +164,11 @@ def getImageGeoInfo(imagePath, getStats=True):
             # Get the type string
             bandLine = asp_string_utils.getLineAfterText(textOutput, bandString)
             typePos  = bandLine.find('Type=')
-            commaPos = bandLine.find(',')
-            typeName = bandLine[typePos+5:commaPos-1]
+            commaPos = bandLine.find(',', typePos)
+            typeName = bandLine[typePos+5:commaPos].strip()
             bandInfo['type'] = typeName
         
-            outputDict['band_info'] = bandInfo
+            outputDict['band_info'].append(bandInfo)
         
             band = band + 1 # Move on to the next band
         
@@ -462,10 +469,16 @@ def build_vrt( fullImageSize, tileLocs, tilePaths, outputPath ):
     num_bands = len(gdalInfo['band_info'])
     data_type = gdalInfo['band_info'][0]['type']
 
-    # This special metadata value is only used for ASP stereo point cloud files!    
+    # These special metadata values are only used for ASP stereo point cloud files!
+    # Without POINT_SCALE the integers in a compact cloud would be read as meters.
     if 'point_offset' in gdalInfo:
-        f.write("  <Metadata>\n    <MDI key=\"" + 'POINT_OFFSET' + "\">" +
-                gdalInfo['point_offset'][0] + "</MDI>\n  </Metadata>\n")
+        f.write("  <Metadata>\n")
+        f.write("    <MDI key=\"" + 'POINT_OFFSET' + "\">" +
+                " ".join([repr(v) for v in gdalInfo['point_offset']]) + "</MDI>\n")
+        if 'point_scale' in gdalInfo:
+            f.write("    <MDI key=\"" + 'POINT_SCALE' + "\">" +
+                    repr(gdalInfo['point_scale']) + "</MDI>\n")
+        f.write("  </Metadata>\n")
       
 
     # Write each band
@@ -480,7 +493,7 @@ def build_vrt( fullImageSize, tileLocs, tilePaths, outputPath ):
             ## Replace missing tile paths with the good tile we found earlier
             #if not os.path.isfile(filename): filename = goodFilename
 
-            relative = os.path.relpath(filename, outputPath) # Relative path from the output file to the input tile
+            relative = os.path.relpath(filename, outputFolder) # Relative path from the output folder to the input tile
             f.write("    <SimpleSource>\n")
             f.write("       <SourceFilename relativeToVRT=\"1\">%s</SourceFilename>\n" % relative) # Write relative path
             f.write("       <SourceBand>%i</SourceBand>\n" % b)
@@ -36,6 +36,7 @@
 #include <Eigen/Dense>
 
 #include <random>
+#include <map>
 #include <algorithm>
 #include <iterator>
 #include <iostream>
@@ -85,8 +86,100 @@ void find_projection(// Inputs
   }
 }
 
-// This is not used for now, it could be used to make the logic
-// of processing mask boundary points multi-threaded.
+// A view of the DEM which keeps the tiles read so far in a small
+// local cache, so that a thread sampling the DEM many times in a
+// neighborhood does not go through the shared, locked cache of the
+// disk image each time. Not thread-safe, each thread needs its own.
+class DemTileCacheView: public ImageViewBase<DemTileCacheView> {
+
+  typedef PixelMask<float> PixelT;
+
+  struct TileCache {
+    typedef std::pair<int, int> KeyT; // tile column and row
+    struct Entry {
+      ImageView<PixelT> tile;
+      long long int     last_use;
+    };
+    std::map<KeyT, Entry> tiles;
+    long long int         num_uses;
+    TileCache(): num_uses(0) {}
+  };
+  
+  ImageViewRef<PixelT>           m_dem;
+  int                            m_tile_size;
+  int                            m_max_tiles;
+  boost::shared_ptr<TileCache>   m_cache; // shared among copies of this view
+  
+public:
+  DemTileCacheView(ImageViewRef<PixelT> dem, int tile_size, int max_tiles):
+    m_dem(dem), m_tile_size(tile_size), m_max_tiles(max_tiles),
+    m_cache(new TileCache) {}
+  
+  typedef PixelT pixel_type;
+  typedef PixelT result_type;
+  typedef ProceduralPixelAccessor<DemTileCacheView> pixel_accessor;
+
+  inline int32 cols() const { return m_dem.cols(); }
+  inline int32 rows() const { return m_dem.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor(*this, 0, 0); }
+
+  inline pixel_type operator()(int32 col, int32 row, int32/*p*/ = 0) const {
+
+    if (col < 0 || row < 0 || col >= cols() || row >= rows()) {
+      pixel_type invalid_pix;
+      invalid_pix.invalidate();
+      return invalid_pix;
+    }
+    
+    TileCache & cache = *m_cache;
+    TileCache::KeyT key(col / m_tile_size, row / m_tile_size);
+    cache.num_uses++;
+    
+    auto it = cache.tiles.find(key);
+    if (it == cache.tiles.end()) {
+
+      // Evict the least recently used tile if the cache is full
+      if ((int)cache.tiles.size() >= m_max_tiles) {
+        auto oldest = cache.tiles.begin();
+        for (auto it2 = cache.tiles.begin(); it2 != cache.tiles.end(); it2++) {
+          if (it2->second.last_use < oldest->second.last_use)
+            oldest = it2;
+        }
+        cache.tiles.erase(oldest);
+      }
+      
+      BBox2i tile_box(key.first * m_tile_size, key.second * m_tile_size,
+                      m_tile_size, m_tile_size);
+      tile_box.crop(bounding_box(m_dem));
+      it = cache.tiles.insert(std::make_pair(key, TileCache::Entry())).first;
+      it->second.tile = crop(m_dem, tile_box);
+    }
+    
+    it->second.last_use = cache.num_uses;
+    return it->second.tile(col - key.first * m_tile_size, row - key.second * m_tile_size);
+  }
+
+  typedef DemTileCacheView prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& /*bbox*/) const { return *this; }
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i const& bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+// The points found by a MaskBoundaryTask
+struct MaskBoundaryPoints {
+  std::vector<Eigen::Vector3d> point_vec;
+  std::vector<vw::Vector3>     llh_vec;
+  std::vector<vw::Vector2>     used_vertices;
+};
+
+// Find the mask boundary points in a vertical strip of the mask, and
+// shoot rays from them to the DEM. Each task writes to its own
+// buffers, merged at the end, so no locking is needed, and it samples
+// the DEM through its own tile cache.
 class MaskBoundaryTask : public vw::Task, private boost::noncopyable {
   vw::BBox2i m_bbox; // Region of image we're working in
 
@@ -97,11 +190,11 @@ class MaskBoundaryTask : public vw::Task, private boost::noncopyable {
   vw::cartography::GeoReference         m_dem_georef;
   ImageViewRef<PixelMask<float>>        m_masked_dem;
   
-  // Note how all of these are aliases
-  Mutex                        & m_mutex;
-  std::vector<Eigen::Vector3d> & m_point_vec;
-  std::vector<vw::Vector3>     & m_llh_vec;
-  std::vector<vw::Vector2>     & m_used_vertices;
+  // Note how these are aliases
+  MaskBoundaryPoints             & m_points;
+  Mutex                          & m_progress_mutex;
+  vw::TerminalProgressCallback   & m_tpc;
+  double                           m_inc_amount;
   
 public:
   MaskBoundaryTask(vw::BBox2i                            bbox,
@@ -111,110 +204,125 @@ public:
                    vw::cartography::GeoReference const & shape_georef,
                    vw::cartography::GeoReference const & dem_georef,
                    ImageViewRef<PixelMask<float>>        masked_dem,
-                   Mutex                               & mutex,
-                   std::vector<Eigen::Vector3d>        & point_vec,
-                   std::vector<vw::Vector3>            & llh_vec,
-                   std::vector<vw::Vector2>            & used_vertices):
+                   MaskBoundaryPoints                  & points,
+                   Mutex                               & progress_mutex,
+                   vw::TerminalProgressCallback        & tpc,
+                   double                                inc_amount):
     m_bbox(bbox), m_mask(mask), m_mask_nodata_val(mask_nodata_val),
     m_camera_model(camera_model), m_shape_georef(shape_georef),
     m_dem_georef(dem_georef), m_masked_dem(masked_dem),
-    m_mutex(mutex), m_point_vec(point_vec),
-    m_llh_vec(llh_vec), m_used_vertices(used_vertices) {}
+    m_points(points), m_progress_mutex(progress_mutex),
+    m_tpc(tpc), m_inc_amount(inc_amount) {}
   
   void operator()() {
 
-    // Grow the box by 1 pixel as we need to look at the immediate neighbors
-    BBox2i extra_box = m_bbox;
-    extra_box.expand(1); 
-    extra_box.crop(bounding_box(m_mask));
-
-    std::cout << "--extra box " << extra_box << std::endl;
-
-    // Make a local copy of the tile
-    ImageView<float> mask_tile = crop(m_mask, extra_box);
+    // Find the boundary pixels, that is, the pixels above threshold
+    // which have neighbors no more than the threshold. Do this in
+    // chunks of rows, to not load the whole strip in memory.
+    std::vector<Vector2i> boundary_pix;
+    int chunk_rows = 1024;
+    for (int beg_row = m_bbox.min().y(); beg_row < m_bbox.max().y(); beg_row += chunk_rows) {
 
-    for (int col = 0; col < mask_tile.cols(); col++) {
-      for (int row = 0; row < mask_tile.rows(); row++) {
+      BBox2i chunk_box(m_bbox.min().x(), beg_row, m_bbox.width(),
+                       std::min(chunk_rows, m_bbox.max().y() - beg_row));
+      
+      // Grow the box by 1 pixel as we need to look at the immediate neighbors
+      BBox2i extra_box = chunk_box;
+      extra_box.expand(1); 
+      extra_box.crop(bounding_box(m_mask));
+
+      // Classify the pixels in a local copy of the tile. Neighbors
+      // outside the image count as being above threshold.
+      ImageView<float> mask_tile = crop(m_mask, extra_box);
+      int cols = mask_tile.cols(), rows = mask_tile.rows();
+      ImageView<uint8> above(cols + 2, rows + 2);
+      fill(above, 1);
+      for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++)
+          above(col + 1, row + 1) = (mask_tile(col, row) > m_mask_nodata_val);
+      }
 
-        // Look at pixels above threshold which have neighbors <= threshold
-        if (mask_tile(col, row) <= m_mask_nodata_val) 
-          continue;
+      // Erode with the 4-neighborhood and keep what was removed
+      ImageView<uint8> is_boundary(cols, rows);
+      for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+          uint8 eroded = above(col + 1, row + 1) & above(col,     row + 1) &
+                         above(col + 2, row + 1) & above(col + 1, row    ) &
+                         above(col + 1, row + 2);
+          is_boundary(col, row) = above(col + 1, row + 1) & (eroded ^ 1);
+        }
+      }
 
-        // The four neighbors
-        int col_vals[4] = {-1, 0, 0, 1};
-        int row_vals[4] = {0, -1, 1, 0};
-          
-        bool border_pix = false;
-        for (int it = 0; it < 4; it++) {
-            
-          int icol = col + col_vals[it];
-          int irow = row + row_vals[it];
-
-          if (icol < 0 || irow < 0 || icol >= mask_tile.cols() || irow >= mask_tile.rows()) 
+      for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+          if (!is_boundary(col, row))
             continue;
-            
-          if (mask_tile(icol, irow) <= m_mask_nodata_val) {
-            border_pix = true;
-            break;
-          }
+          // Only work on pixels in the current box (earlier had a
+          // bigger box to be able to examine neighbors).
+          Vector2i pix = Vector2i(col, row) + extra_box.min();
+          if (chunk_box.contains(pix))
+            boundary_pix.push_back(pix);
         }
-          
-        if (!border_pix) 
-          continue;
-
-        // Create the pixel in the full image coordinates
-        Vector2 pix = Vector2(col, row) + extra_box.min();
-
-        // Only work on pixels in the current box (earlier had a
-        // bigger box to be able to examine neighbors).
-        if (!m_bbox.contains(pix))
-          continue;
-        
-        // The ray going to the ground
-        // Here we assume that the camera model is thread-safe, which is
-        // true for all cameras except ISIS, and this code will be used
-        // on Earth only.
-        Vector3 cam_ctr = m_camera_model->camera_center(pix);
-        Vector3 cam_dir = m_camera_model->pixel_to_vector(pix);
-
-        // Intersect the ray going from the given camera pixel with a DEM.
-        bool treat_nodata_as_zero = false;
-        bool has_intersection = false;
-        double height_error_tol = 0.001; // in meters
-        double max_abs_tol = 1e-14;
-        double max_rel_tol = 1e-14;
-        int num_max_iter = 100;
-        Vector3 xyz_guess(0, 0, 0);
-        Vector3 xyz = vw::cartography::camera_pixel_to_dem_xyz
-          (cam_ctr, cam_dir, m_masked_dem,
-           m_dem_georef, treat_nodata_as_zero,
-           has_intersection, height_error_tol, max_abs_tol, max_rel_tol, 
-           num_max_iter, xyz_guess);
-          
-        if (!has_intersection) 
-          continue;
-
-        Vector3 llh = m_dem_georef.datum().cartesian_to_geodetic(xyz);
-
-        Eigen::Vector3d eigen_xyz;
-        for (size_t coord = 0; coord < 3; coord++) 
-          eigen_xyz[coord] = xyz[coord];
+      }
+    }
 
-        // TODO(oalexan1): This is fragile due to the 360 degree
-        // uncertainty in latitude
-        Vector2 proj_pt = m_shape_georef.lonlat_to_point(Vector2(llh[0], llh[1]));
+    // Process the pixels column by column, as done before this was
+    // multi-threaded, so the points come out in the same order.
+    std::sort(boundary_pix.begin(), boundary_pix.end(),
+              [](Vector2i const& a, Vector2i const& b) {
+                return a.x() < b.x() || (a.x() == b.x() && a.y() < b.y());
+              });
+
+    // Sample the DEM through a local tile cache
+    int dem_tile_size = 256, max_dem_tiles = 64;
+    ImageViewRef<PixelMask<float>> local_dem
+      = DemTileCacheView(m_masked_dem, dem_tile_size, max_dem_tiles);
+    
+    for (size_t it = 0; it < boundary_pix.size(); it++) {
+      
+      Vector2 pix(boundary_pix[it].x(), boundary_pix[it].y());
 
-        {
-          // Need to make sure to lock the shared resource
-          Mutex::Lock lock(m_mutex);
-          m_point_vec.push_back(eigen_xyz);
-          m_used_vertices.push_back(proj_pt);
-          m_llh_vec.push_back(llh);
-        }
-      }
+      // The ray going to the ground
+      // Here we assume that the camera model is thread-safe, which is
+      // true for all cameras except ISIS, and this code will be used
+      // on Earth only.
+      Vector3 cam_ctr = m_camera_model->camera_center(pix);
+      Vector3 cam_dir = m_camera_model->pixel_to_vector(pix);
+      
+      // Intersect the ray going from the given camera pixel with a DEM.
+      bool treat_nodata_as_zero = false;
+      bool has_intersection = false;
+      double height_error_tol = 0.001; // in meters
+      double max_abs_tol = 1e-14;
+      double max_rel_tol = 1e-14;
+      int num_max_iter = 100;
+      Vector3 xyz_guess(0, 0, 0);
+      Vector3 xyz = vw::cartography::camera_pixel_to_dem_xyz
+        (cam_ctr, cam_dir, local_dem,
+         m_dem_georef, treat_nodata_as_zero,
+         has_intersection, height_error_tol, max_abs_tol, max_rel_tol, 
+         num_max_iter, xyz_guess);
+      
+      if (!has_intersection) 
+        continue;
+      
+      Vector3 llh = m_dem_georef.datum().cartesian_to_geodetic(xyz);
       
+      Eigen::Vector3d eigen_xyz;
+      for (size_t coord = 0; coord < 3; coord++) 
+        eigen_xyz[coord] = xyz[coord];
+      
+      // TODO(oalexan1): This is fragile due to the 360 degree
+      // uncertainty in latitude
+      Vector2 proj_pt = m_shape_georef.lonlat_to_point(Vector2(llh[0], llh[1]));
+      
+      m_points.point_vec.push_back(eigen_xyz);
+      m_points.used_vertices.push_back(proj_pt);
+      m_points.llh_vec.push_back(llh);
     }
-    
+
+    Mutex::Lock lock(m_progress_mutex);
+    m_tpc.report_incremental_progress(m_inc_amount);
   }
   
 };
@@ -239,116 +347,44 @@ void find_points_at_mask_boundary(ImageViewRef<float> mask,
   llh_vec.clear();
   used_vertices.clear();
 
-#if 0
-
-  // For some reason parallel processing is slower than serial processing.
-  // Likely it is because the DEM is shared. Need extra heuristics to cut
-  // that one as appropriate for each task.
-  
-  // Subdivide the box for parallel processing
-  int block_size = vw::vw_settings().default_tile_size();
-  FifoWorkQueue queue(vw_settings().default_num_threads());
-  std::vector<BBox2i> bboxes = subdivide_bbox(mask, block_size, block_size);
-  
-  for (size_t it = 0; it < bboxes.size(); it++) {
-    std::cout << "Box is " << bboxes[it] << std::endl;
-  }
-
-  Mutex mutex;
-  for (size_t it = 0; it < bboxes.size(); it++) {
-    boost::shared_ptr<MaskBoundaryTask>
-      task(new MaskBoundaryTask(bboxes[it],  mask, mask_nodata_val, camera_model,
-                                shape_georef, dem_georef, masked_dem, mutex,
-                                point_vec, llh_vec, used_vertices));
-    queue.add_task(task);
-  }
-  
-  queue.join_all();
-  
-#else
-
-  // Let the mask boundary be the mask pixels whose value
-  // is above threshold and which border pixels whose values
-  // is not above threshold.
-  // TODO(oalexan1): Make this multi-threaded.
-
   vw_out() << "Processing points at mask boundary.\n";
   vw::TerminalProgressCallback tpc("asp", "\t--> ");
-  double inc_amount = 1.0 / mask.cols();
   tpc.report_progress(0);
 
-  for (int col = 0; col < mask.cols(); col++) {
-    for (int row = 0; row < mask.rows(); row++) {
-
-      // Look at pixels above threshold which have neighbors <= threshold
-      if (mask(col, row) <= mask_nodata_val) 
-        continue;
-
-      // The four neighbors
-      int col_vals[4] = {-1, 0, 0, 1};
-      int row_vals[4] = {0, -1, 1, 0};
-          
-      bool border_pix = false;
-      for (int it = 0; it < 4; it++) {
-            
-        int icol = col + col_vals[it];
-        int irow = row + row_vals[it];
-
-        if (icol < 0 || irow < 0 || icol >= mask.cols() || irow >= mask.rows()) 
-          continue;
-            
-        if (mask(icol, irow) <= mask_nodata_val) {
-          border_pix = true;
-          break;
-        }
-      }
-          
-      if (!border_pix) 
-        continue;
-
-      // The ray going to the ground
-      Vector2 pix(col, row);
-      Vector3 cam_ctr = camera_model->camera_center(pix);
-      Vector3 cam_dir = camera_model->pixel_to_vector(pix);
-
-      // Intersect the ray going from the given camera pixel with a DEM.
-      bool treat_nodata_as_zero = false;
-      bool has_intersection = false;
-      double height_error_tol = 0.001; // in meters
-      double max_abs_tol = 1e-14;
-      double max_rel_tol = 1e-14;
-      int num_max_iter = 100;
-      Vector3 xyz_guess(0, 0, 0);
-      Vector3 xyz = vw::cartography::camera_pixel_to_dem_xyz
-        (cam_ctr, cam_dir, masked_dem,
-         dem_georef, treat_nodata_as_zero,
-         has_intersection, height_error_tol, max_abs_tol, max_rel_tol, 
-         num_max_iter, xyz_guess);
-          
-      if (!has_intersection) 
-        continue;
-
-      Vector3 llh = dem_georef.datum().cartesian_to_geodetic(xyz);
-
-      Eigen::Vector3d eigen_xyz;
-      for (size_t coord = 0; coord < 3; coord++) 
-        eigen_xyz[coord] = xyz[coord];
-
-      // TODO(oalexan1): This is fragile due to the 360 degree
-      // uncertainty in latitude
-      Vector2 proj_pt = shape_georef.lonlat_to_point(Vector2(llh[0], llh[1]));
-          
-      point_vec.push_back(eigen_xyz);
-      used_vertices.push_back(proj_pt);
-      llh_vec.push_back(llh);
+  // Split the mask into vertical strips, a few more than the threads
+  // for load balancing. Merging the results of the strips in order
+  // gives the points in the same order as a column-by-column pass.
+  int num_threads = vw_settings().default_num_threads();
+  int num_strips = std::min(mask.cols(), 4 * num_threads);
+  int strip_width = std::max(1, (mask.cols() + num_strips - 1) / std::max(num_strips, 1));
+  std::vector<BBox2i> strips;
+  for (int beg_col = 0; beg_col < mask.cols(); beg_col += strip_width)
+    strips.push_back(BBox2i(beg_col, 0, std::min(strip_width, mask.cols() - beg_col),
+                            mask.rows()));
+
+  std::vector<MaskBoundaryPoints> strip_points(strips.size());
+  Mutex progress_mutex;
+  {
+    FifoWorkQueue queue(num_threads);
+    for (size_t it = 0; it < strips.size(); it++) {
+      boost::shared_ptr<MaskBoundaryTask>
+        task(new MaskBoundaryTask(strips[it], mask, mask_nodata_val, camera_model,
+                                  shape_georef, dem_georef, masked_dem,
+                                  strip_points[it], progress_mutex, tpc,
+                                  1.0 / strips.size()));
+      queue.add_task(task);
     }
-
-    tpc.report_incremental_progress(inc_amount);
+    queue.join_all();
   }
-
   tpc.report_finished();
-  
-#endif
+
+  for (size_t it = 0; it < strip_points.size(); it++) {
+    MaskBoundaryPoints const& pts = strip_points[it];
+    point_vec.insert(point_vec.end(), pts.point_vec.begin(), pts.point_vec.end());
+    llh_vec.insert(llh_vec.end(), pts.llh_vec.begin(), pts.llh_vec.end());
+    used_vertices.insert(used_vertices.end(), pts.used_vertices.begin(),
+                         pts.used_vertices.end());
+  }
   
   // See if to select a subset
   int num_pts = point_vec.size();
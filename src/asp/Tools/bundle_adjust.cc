@@ -128,6 +128,7 @@ void add_reprojection_residual_block(Vector2 const& observation, Vector2 const&
     double* distortion = param_storage.get_intrinsic_distortion_ptr(camera_index);
 
     boost::shared_ptr<CeresBundleModelBase> wrapper;
+    ceres::CostFunction* cost_function = NULL;
 
     if (opt.camera_type == BaCameraType_Pinhole) {
 
@@ -135,7 +136,11 @@ void add_reprojection_residual_block(Vector2 const& observation, Vector2 const&
         boost::dynamic_pointer_cast<PinholeModel>(camera_model);
       if (pinhole_model.get() == 0)
         vw::vw_throw(vw::ArgumentErr() << "Tried to add pinhole block with non-pinhole camera.");
-      wrapper.reset(new PinholeBundleModel(pinhole_model));
+      boost::shared_ptr<PinholeBundleModel> pinhole_wrapper(new PinholeBundleModel(pinhole_model));
+      wrapper = pinhole_wrapper;
+
+      // The pinhole error computes most of its own derivatives.
+      cost_function = PinholeReprojectionError::Create(observation, pixel_sigma, pinhole_wrapper);
 
     } else { // Optical bar
 
@@ -145,10 +150,9 @@ void add_reprojection_residual_block(Vector2 const& observation, Vector2 const&
         vw::vw_throw( vw::ArgumentErr() << "Tried to add optical bar block with "
                       << "non-optical bar camera.");
       wrapper.reset(new OpticalBarBundleModel(bar_model));
+      cost_function = BaReprojectionError::Create(observation, pixel_sigma, wrapper);
     }
 
-    ceres::CostFunction* cost_function =
-      BaReprojectionError::Create(observation, pixel_sigma, wrapper);
     problem.AddResidualBlock(cost_function, loss_function, point, camera, 
                             center, focus, distortion);
 
@@ -1222,6 +1226,7 @@ int do_ba_ceres_one_pass(Options             & opt,
   options.max_num_iterations                = opt.num_iterations;
   options.max_num_consecutive_invalid_steps = std::max(5, opt.num_iterations/5); // try hard
   options.minimizer_progress_to_stdout      = true;
+  options.check_gradients                   = opt.check_gradients;
 
   if (opt.single_threaded_cameras)
     options.num_threads = 1;
@@ -1796,6 +1801,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
     
     ("save-intermediate-cameras", po::value(&opt.save_intermediate_cameras)->default_value(false)->implicit_value(true),
      "Save the values for the cameras at each iteration.")
+    ("check-gradients", po::value(&opt.check_gradients)->default_value(false)->implicit_value(true),
+     "Compare the derivatives of the cost functions with numerical ones at each iteration, and stop if they disagree. This is slow and meant for debugging.")
     ("apply-initial-transform-only", po::value(&opt.apply_initial_transform_only)->default_value(false)->implicit_value(true),
      "Apply to the cameras the transform given by --initial-transform. No iterations, GCP loading, or image matching takes place.");
   general_options.add(vw::cartography::GdalWriteOptionsDescription(opt));
@@ -70,7 +70,7 @@ struct Options : public vw::cartography::GdalWriteOptions {
   bool   save_intermediate_cameras, approximate_pinhole_intrinsics,
     disable_pinhole_gcp_init, transform_cameras_using_gcp, fix_gcp_xyz, solve_intrinsics,
     ip_normalize_tiles, ip_debug_images, stop_after_stats, stop_after_matching, skip_matching, match_first_to_last,
-    apply_initial_transform_only;
+    apply_initial_transform_only, check_gradients;
   BACameraType camera_type;
   std::string datum_str, camera_position_file, initial_transform_file,
     csv_format_str, csv_proj4_str, reference_terrain, disparity_list,
@@ -109,7 +109,8 @@ struct Options : public vw::cartography::GdalWriteOptions {
              rotation_weight(0), translation_weight(0), overlap_exponent(0), 
              robust_threshold(0), min_matches(0),
              num_iterations(0), overlap_limit(0), save_intermediate_cameras(false),
-             fix_gcp_xyz(false), solve_intrinsics(false), camera_type(BaCameraType_Other),
+             fix_gcp_xyz(false), solve_intrinsics(false), check_gradients(false),
+             camera_type(BaCameraType_Other),
              semi_major(0), semi_minor(0), position_filter_dist(-1),
              num_ba_passes(2), max_num_reference_points(-1),
              datum(vw::cartography::Datum(UNSPECIFIED_DATUM, "User Specified Spheroid",
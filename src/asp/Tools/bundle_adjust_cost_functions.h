@@ -45,6 +45,7 @@
 
 #include <ceres/ceres.h>
 #include <ceres/loss_function.h>
+#include <ceres/rotation.h>
 
 #if defined(__GNUC__) || defined(__GNUG__)
 #if LOCAL_GCC_VERSION >= 40600
@@ -103,8 +104,9 @@ public:
   }
 
   /// Read in all of the parameters and generate an output pixel observation.
+  /// - There is one pointer per parameter block, in the order of get_block_sizes().
   /// - Throws if the point does not project in to the camera.
-  virtual vw::Vector2 evaluate(std::vector<double const*> const param_blocks) const = 0;
+  virtual vw::Vector2 evaluate(double const* const* param_blocks) const = 0;
   
 }; // End class CeresBundleModelBase
 
@@ -127,7 +129,7 @@ public:
   virtual int num_parameter_blocks() const {return 2;}
 
   /// Read in all of the parameters and compute the residuals.
-  virtual vw::Vector2 evaluate(std::vector<double const*> const param_blocks) const {
+  virtual vw::Vector2 evaluate(double const* const* param_blocks) const {
 
     double const* raw_point = param_blocks[0];
     double const* raw_pose  = param_blocks[1];
@@ -192,7 +194,7 @@ public:
   }
 
   /// Read in all of the parameters and compute the residuals.
-  virtual vw::Vector2 evaluate(std::vector<double const*> const param_blocks) const {
+  virtual vw::Vector2 evaluate(double const* const* param_blocks) const {
 
     double const* raw_point  = param_blocks[0];
     double const* raw_pose   = param_blocks[1];
@@ -205,6 +207,26 @@ public:
     Vector3          point(raw_point[0], raw_point[1], raw_point[2]);
     CameraAdjustment correction(raw_pose);
 
+    vw::camera::PinholeModel cam = make_camera(correction.position(),
+                                               correction.pose().rotation_matrix(),
+                                               raw_center, raw_focus, raw_lens);
+
+    try {
+      // Project the point into the camera.
+      Vector2 pixel = cam.point_to_pixel_no_check(point);
+      return pixel;
+    } catch(...){
+    }
+
+    // Do not allow one bad pixel value to ruin the whole problem
+    return vw::Vector2(g_big_pixel_value, g_big_pixel_value);
+  }
+
+  /// Duplicate the input camera model with the pose, focus, center, and lens updated.
+  vw::camera::PinholeModel make_camera(Vector3 const& position, Matrix3x3 const& rotation,
+                                       double const* raw_center, double const* raw_focus,
+                                       double const* raw_lens) const {
+
     // We actually solve for scale factors for intrinsic values, so multiply them
     //  by the original intrinsic values to get the updated values.
     double center_x = raw_center[0] * m_underlying_camera->point_offset()[0];
@@ -220,23 +242,11 @@ public:
       lens[i] *= raw_lens[i];
     distortion->set_distortion_parameters(lens);
 
-    // Duplicate the input camera model with the pose, focus, center, and lens updated.
-    vw::camera::PinholeModel cam(correction.position(),
-                                 correction.pose().rotation_matrix(),
-                                 focus, focus, // focal lengths
-                                 center_x, center_y, // pixel offsets
-                                 distortion.get(),
-                                 m_underlying_camera->pixel_pitch());
-
-    try {
-      // Project the point into the camera.
-      Vector2 pixel = cam.point_to_pixel_no_check(point);
-      return pixel;
-    } catch(...){
-    }
-
-    // Do not allow one bad pixel value to ruin the whole problem
-    return vw::Vector2(g_big_pixel_value, g_big_pixel_value);
+    return vw::camera::PinholeModel(position, rotation,
+                                    focus, focus, // focal lengths
+                                    center_x, center_y, // pixel offsets
+                                    distortion.get(),
+                                    m_underlying_camera->pixel_pitch());
   }
 
 private:
@@ -280,7 +290,7 @@ public:
   }
 
   /// Read in all of the parameters and compute the residuals.
-  virtual vw::Vector2 evaluate(std::vector<double const*> const param_blocks) const {
+  virtual vw::Vector2 evaluate(double const* const* param_blocks) const {
 
     double const* raw_point  = param_blocks[0];
     double const* raw_pose   = param_blocks[1];
@@ -352,7 +362,6 @@ struct BaReprojectionError {
                       boost::shared_ptr<CeresBundleModelBase> camera_wrapper):
     m_observation(observation),
     m_pixel_sigma(pixel_sigma),
-    m_num_param_blocks(camera_wrapper->num_parameter_blocks()),
     m_camera_wrapper(camera_wrapper)
     {}
 
@@ -363,14 +372,8 @@ struct BaReprojectionError {
     //std::cout << "For observation " << m_observation << std::endl;
 
     try {
-      // Unpack the parameter blocks
-      std::vector<double const*> param_blocks(m_num_param_blocks);
-      for (size_t i=0; i<m_num_param_blocks; ++i) {
-        param_blocks[i] = parameters[i];
-      }
-
       // Use the camera model wrapper to handle all of the parameter blocks.
-      Vector2 prediction = m_camera_wrapper->evaluate(param_blocks);
+      Vector2 prediction = m_camera_wrapper->evaluate(parameters);
 
       //std::cout << "Got prediction " << prediction << std::endl;
 
@@ -427,12 +430,168 @@ struct BaReprojectionError {
 private:
   Vector2 m_observation;     ///< The pixel observation for this camera/point pair.
   Vector2 m_pixel_sigma;
-  size_t  m_num_param_blocks;
   boost::shared_ptr<CeresBundleModelBase> m_camera_wrapper; ///< Pointer to the camera model object.
 
 }; // End class BaReprojectionError
 
 
+/// The same error as BaReprojectionError for pinhole cameras, but supplying
+/// its own derivatives instead of having Ceres difference the whole camera,
+/// which takes a new camera per parameter.
+/// - The projection factors as pixel = G(R^T (P - C)), where G projects a point
+///   in camera coordinates using only the intrinsics.
+/// - The derivatives of R^T (P - C) with respect to the point and the pose
+///   are exact. The 2x3 derivative of G is found by central differences on
+///   one camera built per evaluation.
+/// - The intrinsics are differenced numerically, and only when they are
+///   being solved for.
+class PinholeReprojectionError: public ceres::CostFunction {
+public:
+  PinholeReprojectionError(Vector2 const& observation, Vector2 const& pixel_sigma,
+                           boost::shared_ptr<PinholeBundleModel> camera_wrapper):
+    m_observation(observation),
+    m_pixel_sigma(pixel_sigma),
+    m_camera_wrapper(camera_wrapper) {
+
+    set_num_residuals(PIXEL_SIZE);
+    std::vector<int> block_sizes = camera_wrapper->get_block_sizes();
+    for (size_t i=0; i<block_sizes.size(); ++i)
+      mutable_parameter_block_sizes()->push_back(block_sizes[i]);
+  }
+
+  virtual bool Evaluate(double const* const* parameters, double* residuals,
+                        double** jacobians) const {
+
+    double const* raw_point  = parameters[0];
+    double const* raw_pose   = parameters[1];
+    double const* raw_center = parameters[2];
+    double const* raw_focus  = parameters[3];
+    double const* raw_lens   = parameters[4];
+
+    // Move the point to camera coordinates, carrying the derivatives with respect
+    // to the point (0-2), the camera position (3-5), and the axis-angle rotation (6-8).
+    // The rotation is from camera to world, so the inverse is the negated axis-angle.
+    typedef ceres::Jet<double, 9> JetT;
+    JetT offset[3], axis_angle[3], cam_pt[3];
+    for (int i = 0; i < 3; i++) {
+      offset    [i] = JetT(raw_point[i], i) - JetT(raw_pose[i], 3 + i);
+      axis_angle[i] = -JetT(raw_pose[3 + i], 6 + i);
+    }
+    ceres::AngleAxisRotatePoint(axis_angle, offset, cam_pt);
+    Vector3 cam_xyz(cam_pt[0].a, cam_pt[1].a, cam_pt[2].a);
+
+    // The camera with the current intrinsics, sitting at the origin.
+    vw::camera::PinholeModel cam
+      = m_camera_wrapper->make_camera(Vector3(), vw::math::identity_matrix<3>(),
+                                      raw_center, raw_focus, raw_lens);
+
+    Vector2 pixel;
+    if (!project(cam, cam_xyz, pixel)) {
+      // Do not allow one bad pixel value to ruin the whole problem
+      pixel = Vector2(g_big_pixel_value, g_big_pixel_value);
+      residuals[0] = (pixel[0] - m_observation[0])/m_pixel_sigma[0];
+      residuals[1] = (pixel[1] - m_observation[1])/m_pixel_sigma[1];
+      if (jacobians != NULL) {
+        for (int b = 0; b < num_parameter_blocks(); b++) {
+          if (jacobians[b] != NULL)
+            std::fill(jacobians[b], jacobians[b] + PIXEL_SIZE * parameter_block_sizes()[b], 0.0);
+        }
+      }
+      return true;
+    }
+
+    residuals[0] = (pixel[0] - m_observation[0])/m_pixel_sigma[0]; // Input units are pixels
+    residuals[1] = (pixel[1] - m_observation[1])/m_pixel_sigma[1];
+
+    if (jacobians == NULL)
+      return true;
+
+    // Derivative of the pixel with respect to the point in camera coordinates.
+    Matrix<double, 2, 3> pixel_deriv;
+    double step = std::max(1e-7 * norm_2(cam_xyz), 1e-10);
+    for (int c = 0; c < 3; c++) {
+      Vector3 plus = cam_xyz, minus = cam_xyz;
+      plus[c] += step;
+      minus[c] -= step;
+      Vector2 pixel_plus, pixel_minus;
+      if (!project(cam, plus, pixel_plus) || !project(cam, minus, pixel_minus)) {
+        pixel_deriv = Matrix<double, 2, 3>();
+        break;
+      }
+      pixel_deriv(0, c) = (pixel_plus[0] - pixel_minus[0]) / (2.0 * step);
+      pixel_deriv(1, c) = (pixel_plus[1] - pixel_minus[1]) / (2.0 * step);
+    }
+
+    // Chain rule for the point block and the pose block.
+    for (int b = 0; b < 2; b++) {
+      if (jacobians[b] == NULL)
+        continue;
+      int block_size  = parameter_block_sizes()[b];
+      int jet_offset  = (b == 0) ? 0 : 3;
+      for (int r = 0; r < int(PIXEL_SIZE); r++) {
+        for (int c = 0; c < block_size; c++) {
+          double val = 0.0;
+          for (int k = 0; k < 3; k++)
+            val += pixel_deriv(r, k) * cam_pt[k].v[jet_offset + c];
+          jacobians[b][r * block_size + c] = val / m_pixel_sigma[r];
+        }
+      }
+    }
+
+    // Forward differences for the intrinsics, which are all scale factors near one.
+    double const* intrinsics[3] = {raw_center, raw_focus, raw_lens};
+    for (int b = 2; b < 5; b++) {
+      if (jacobians[b] == NULL)
+        continue;
+      int block_size = parameter_block_sizes()[b];
+      std::vector<double> block(parameters[b], parameters[b] + block_size);
+      double const* perturbed[3] = {intrinsics[0], intrinsics[1], intrinsics[2]};
+      perturbed[b - 2] = &block[0];
+      for (int c = 0; c < block_size; c++) {
+        double delta = 1e-6 * std::max(std::abs(block[c]), 1.0);
+        block[c] += delta;
+        vw::camera::PinholeModel perturbed_cam
+          = m_camera_wrapper->make_camera(Vector3(), vw::math::identity_matrix<3>(),
+                                          perturbed[0], perturbed[1], perturbed[2]);
+        Vector2 pixel_plus;
+        bool good = project(perturbed_cam, cam_xyz, pixel_plus);
+        block[c] = parameters[b][c];
+        for (int r = 0; r < int(PIXEL_SIZE); r++)
+          jacobians[b][r * block_size + c]
+            = good ? (pixel_plus[r] - pixel[r]) / (delta * m_pixel_sigma[r]) : 0.0;
+      }
+    }
+
+    return true;
+  }
+
+  // Factory to hide the construction of the CostFunction object from the client code.
+  static ceres::CostFunction* Create(Vector2 const& observation,
+                                     Vector2 const& pixel_sigma,
+                                     boost::shared_ptr<PinholeBundleModel> camera_wrapper){
+    return new PinholeReprojectionError(observation, pixel_sigma, camera_wrapper);
+  }
+
+private:
+
+  /// Project a point in camera coordinates, returning false on failure.
+  static bool project(vw::camera::PinholeModel const& cam, Vector3 const& cam_xyz,
+                      Vector2 & pixel) {
+    try {
+      pixel = cam.point_to_pixel_no_check(cam_xyz);
+    } catch(...){
+      return false;
+    }
+    return true;
+  }
+
+  Vector2 m_observation;     ///< The pixel observation for this camera/point pair.
+  Vector2 m_pixel_sigma;
+  boost::shared_ptr<PinholeBundleModel> m_camera_wrapper;
+
+}; // End class PinholeReprojectionError
+
+
 
 
 /// A ceres cost function. Here we float two pinhole camera's
@@ -468,8 +627,8 @@ struct BaDispXyzError {
       unpack_residual_pointers(parameters, left_param_blocks, right_param_blocks);
 
       // Get pixel projection in both cameras.
-      Vector2 left_prediction  = m_left_camera_wrapper->evaluate (left_param_blocks );
-      Vector2 right_prediction = m_right_camera_wrapper->evaluate(right_param_blocks);
+      Vector2 left_prediction  = m_left_camera_wrapper->evaluate (&left_param_blocks [0]);
+      Vector2 right_prediction = m_right_camera_wrapper->evaluate(&right_param_blocks[0]);
 
       // See how consistent that is with the observed disparity.
       bool good_ans = true;
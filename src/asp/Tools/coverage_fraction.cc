@@ -52,7 +52,7 @@ ImageViewRef<double> error_norm(std::string const& pc_file){
 
   typedef Vector<double, num_ch > PixelInT;
   typedef Vector<double, num_ech> PixelErrT;
-  vw::ImageViewRef<PixelInT> I = vw::DiskImageView<PixelInT>(pc_file);
+  vw::ImageViewRef<PixelInT> I = asp::read_asp_point_cloud<num_ch>(pc_file);
 
   ImageViewRef<PixelErrT> error_channels =
     select_channels<num_ech, num_ch, double>(I, beg_ech);
@@ -41,17 +41,84 @@ using namespace vw;
 using namespace vw::cartography;
 using namespace std;
 
+// Need to carefully wrap lonlat to the [0, 360) x [-90, 90) box.
+// Note that lon = 25, lat = 91 is the same as lon = 180 + 25, lat = 89
+// as we go through the North pole and show up on the other side.
+inline void wrap_lonlat(Vector2 & lonlat) {
+  
+  // TODO: Does the GeoRef class handle this now?
+  while ( fabs(lonlat[1]) > 90.0 ){
+    if ( lonlat[1] > 90.0 ){
+      lonlat[1] = 180.0 - lonlat[1];
+      lonlat[0] += 180.0;
+    }
+    if ( lonlat[1] < -90.0 ){
+      lonlat[1] = -180.0 - lonlat[1];
+      lonlat[0] += 180.0;
+    }
+  }
+  while( lonlat[0] <   0.0  ) lonlat[0] += 360.0;
+  while( lonlat[0] >= 360.0 ) lonlat[0] -= 360.0;
+}
+
+/// Bicubic interpolation into the in-memory geoid at the given pixel.
+/// This gives the same result as interpolating into
+/// create_mask(geoid, nodata) with BicubicInterpolation and
+/// ZeroEdgeExtension, but it reads the 16 samples straight from the
+/// buffer rather than going through an ImageViewRef and masked pixel
+/// arithmetic for each of them. Return false if any sample is outside
+/// the geoid or is no-data.
+inline bool interp_geoid(ImageView<float> const& geoid, double nodata,
+                         double x, double y, double & val) {
+
+  double fx = floor(x), fy = floor(y);
+  int col = int(fx) - 1, row = int(fy) - 1;
+  if (col < 0 || row < 0 || col + 3 >= geoid.cols() || row + 3 >= geoid.rows())
+    return false;
+
+  // The Catmull-Rom weights of the four samples in each direction
+  double wx[4], wy[4];
+  double t = x - fx;
+  wx[0] = 0.5*((2.0 - t)*t - 1.0)*t;
+  wx[1] = 0.5*((3.0*t - 5.0)*t*t + 2.0);
+  wx[2] = 0.5*((4.0 - 3.0*t)*t + 1.0)*t;
+  wx[3] = 0.5*(t - 1.0)*t*t;
+  t = y - fy;
+  wy[0] = 0.5*((2.0 - t)*t - 1.0)*t;
+  wy[1] = 0.5*((3.0*t - 5.0)*t*t + 2.0);
+  wy[2] = 0.5*((4.0 - 3.0*t)*t + 1.0)*t;
+  wy[3] = 0.5*(t - 1.0)*t*t;
+
+  val = 0.0;
+  for (int r = 0; r < 4; r++) {
+    float const* ptr = &geoid(col, row + r);
+    double row_val = 0.0;
+    for (int c = 0; c < 4; c++) {
+      double v = ptr[c];
+      if (v == nodata || std::isnan(v))
+        return false;
+      row_val += wx[c]*v;
+    }
+    val += wy[r]*row_val;
+  }
+  
+  return true;
+}
+
 /// Image view which adds or subtracts the ellipsoid/geoid difference
-///  from elevations in a DEM image.
+///  from elevations in a DEM image. The adjustment is found a tile at
+///  a time, so the DEM is read once per tile and the geoid is sampled
+///  directly from memory.
 template <class ImageT>
 class DemGeoidView : public ImageViewBase<DemGeoidView<ImageT> >
 {
   ImageT                m_img; ///< The DEM
   GeoReference   const& m_georef;
   bool                  m_is_egm2008;
-  vector<double>                   const& m_egm2008_grid; ///< Special variable storing EGM2008 data
-  ImageViewRef<PixelMask<double> > const& m_geoid; ///< Interpolation view of the geoid
-  GeoReference                     const& m_geoid_georef;
+  vector<double>        const& m_egm2008_grid; ///< Special variable storing EGM2008 data
+  ImageView<float>      const& m_geoid; ///< The geoid, in memory
+  double                m_geoid_nodata_val;
+  GeoReference          const& m_geoid_georef;
   bool     m_reverse_adjustment; ///< If true, convert from orthometric height to geoid height
   double   m_correction;
   double   m_nodata_val;
@@ -65,12 +132,13 @@ public:
 
   DemGeoidView(ImageT const& img, GeoReference const& georef,
                bool is_egm2008, vector<double> const& egm2008_grid,
-               ImageViewRef<PixelMask<double> > const& geoid,
+               ImageView<float> const& geoid, double geoid_nodata_val,
                GeoReference const& geoid_georef, bool reverse_adjustment,
                double correction, double nodata_val):
     m_img(img), m_georef(georef),
     m_is_egm2008(is_egm2008), m_egm2008_grid(egm2008_grid),
-    m_geoid(geoid), m_geoid_georef(geoid_georef),
+    m_geoid(geoid), m_geoid_nodata_val(geoid_nodata_val),
+    m_geoid_georef(geoid_georef),
     m_reverse_adjustment(reverse_adjustment),
     m_correction(correction),
     m_nodata_val(nodata_val){}
@@ -82,8 +150,14 @@ public:
   inline pixel_accessor origin() const { return pixel_accessor(*this); }
 
   inline result_type operator()( size_t col, size_t row, size_t p=0 ) const {
+    vw_throw(NoImplErr() << "DemGeoidView::operator()(...) is not implemented");
+    return result_type();
+  }
 
-    if ( m_img(col, row, p) == m_nodata_val )
+  /// Adjust a single height, given the pixel location
+  inline result_type adjust(double height_above_ellipsoid, size_t col, size_t row) const {
+
+    if ( height_above_ellipsoid == m_nodata_val )
       return m_nodata_val; // Skip invalid pixels
 
     Vector2 lonlat = m_georef.pixel_to_lonlat(Vector2(col, row));
@@ -93,25 +167,7 @@ public:
     //lonlat[0] = -152;   lonlat[1] = 66;   // Alaska
     //lonlat[0] = -155.5; lonlat[1] = 19.5; // Hawaii
 
-    // TODO: Does the GeoRef class handle this now?
-
-    // Need to carefully wrap lonlat to the [0, 360) x [-90, 90) box.
-    // Note that lon = 25, lat = 91 is the same as lon = 180 + 25, lat = 89
-    // as we go through the North pole and show up on the other side.
-    while ( fabs(lonlat[1]) > 90.0 ){
-      if ( lonlat[1] > 90.0 ){
-        lonlat[1] = 180.0 - lonlat[1];
-        lonlat[0] += 180.0;
-      }
-      if ( lonlat[1] < -90.0 ){
-        lonlat[1] = -180.0 - lonlat[1];
-        lonlat[0] += 180.0;
-      }
-    }
-    while( lonlat[0] <   0.0  ) lonlat[0] += 360.0;
-    while( lonlat[0] >= 360.0 ) lonlat[0] -= 360.0;
-
-
+    wrap_lonlat(lonlat);
 
     result_type geoid_height = 0.0;
     if (m_is_egm2008){
@@ -123,16 +179,12 @@ public:
     }else{
       // Use our own interpolation into the geoid image
       Vector2  pix = m_geoid_georef.lonlat_to_pixel(lonlat);
-      PixelMask<double> interp_val = m_geoid(pix[0], pix[1]);
-      if (!is_valid(interp_val))
+      if (!interp_geoid(m_geoid, m_geoid_nodata_val, pix[0], pix[1], geoid_height))
         return m_nodata_val;
-      geoid_height = interp_val.child();
     }
 
     geoid_height += m_correction;
 
-    result_type height_above_ellipsoid = m_img(col, row, p);
-
     // Compute height above the geoid
     // - See the note in the main program about the formula below
     if (m_reverse_adjustment)
@@ -142,12 +194,19 @@ public:
   }
 
   /// \cond INTERNAL
-  typedef DemGeoidView<typename ImageT::prerasterize_type> prerasterize_type;
+  typedef CropView<ImageView<result_type> > prerasterize_type;
   inline prerasterize_type prerasterize( BBox2i const& bbox ) const {
-    return prerasterize_type( m_img.prerasterize(bbox), m_georef,
-                              m_is_egm2008, m_egm2008_grid,
-                              m_geoid, m_geoid_georef, m_reverse_adjustment,
-                              m_correction, m_nodata_val );
+
+    // Read the DEM tile once, then adjust it row by row
+    ImageView<result_type> tile = crop(m_img, bbox);
+    for (int row = 0; row < tile.rows(); row++) {
+      double * ptr = &tile(0, row);
+      for (int col = 0; col < tile.cols(); col++)
+        ptr[col] = adjust(ptr[col], bbox.min().x() + col, bbox.min().y() + row);
+    }
+    
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
+                             cols(), rows());
   }
   template <class DestT> inline void rasterize( DestT const& dest, BBox2i const& bbox ) const {
     vw::rasterize( prerasterize(bbox), dest, bbox );
@@ -160,12 +219,12 @@ template <class ImageT>
 DemGeoidView<ImageT>
 dem_geoid( ImageViewBase<ImageT> const& img, GeoReference const& georef,
            bool is_egm2008, vector<double> & egm2008_grid,
-           ImageViewRef<PixelMask<double> > const& geoid,
+           ImageView<float> const& geoid, double geoid_nodata_val,
            GeoReference const& geoid_georef, bool reverse_adjustment,
            double correction, double nodata_val) {
   return DemGeoidView<ImageT>( img.impl(), georef,
                                is_egm2008, egm2008_grid,
-                               geoid, geoid_georef,
+                               geoid, geoid_nodata_val, geoid_georef,
                                reverse_adjustment, correction, nodata_val );
 }
 
@@ -444,19 +503,13 @@ int main( int argc, char *argv[] ) {
                              << "axis lengths differ.\n";
     }
 
-    // Put an interpolation and mask wrapper around the input geoid file
-    ImageViewRef<PixelMask<double> > geoid
-      = interpolate(create_mask( pixel_cast<double>(geoid_img), 
-                                 geoid_nodata_val ),
-                    BicubicInterpolation(), ZeroEdgeExtension());
-
     //vw_out() << "Input DEM georef: " << dem_georef << std::endl;
     //vw_out() << "Geoid georef: " << geoid_georef << std::endl;
 
     // Set up conversion image view
     ImageViewRef<double> adj_dem = dem_geoid(dem_img, dem_georef,
                                              is_egm2008, egm2008_grid,
-                                             geoid, geoid_georef,
+                                             geoid_img, geoid_nodata_val, geoid_georef,
                                              reverse_adjustment, major_correction, dem_nodata_val);
 
     string adj_dem_file = opt.out_prefix + "-adj.tif";
@@ -45,6 +45,7 @@
 #include <vw/Image/InpaintView.h>
 #include <vw/Image/Algorithms2.h>
 #include <vw/Image/Filter.h>
+#include <vw/Image/BlockRasterize.h>
 #include <vw/Cartography/GeoTransform.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
@@ -366,6 +367,176 @@ std::string tile_suffix(Options const& opt){
   return ans;
 }
 
+typedef PixelGrayA<double> DoubleGrayA;
+
+/// Invalidate the values no more than --nodata-threshold, if set, and
+/// fill holes. The first channel has the heights. This is applied both
+/// when computing the weights and the heights to blend, so that the
+/// two agree on which pixels are valid.
+void prepare_dem(Options const& opt, double nodata_value, ImageView<DoubleGrayA> & dem){
+
+  if (!boost::math::isnan(opt.nodata_threshold)) {
+    for (int col = 0; col < dem.cols(); col++) {
+      for (int row = 0; row < dem.rows(); row++) {
+        if (dem(col, row)[0] <= nodata_value) {
+          dem(col, row)[0] = nodata_value;
+        }
+      }
+    }
+  }
+
+  // Fill holes. This happens in the expanded tile, to ensure we catch
+  // holes which are partially outside the tile being processed.
+  if (opt.hole_fill_len > 0){
+    dem = apply_mask(vw::fill_holes_grass
+                     (create_mask(select_channel(dem, 0), nodata_value),
+                      opt.hole_fill_len),
+                     nodata_value);
+  }
+}
+
+/// Compute the blending weights of a DEM clip already passed through
+/// prepare_dem(). With priority blending the blur and the exponent are
+/// applied later, to the weights of the combined output tile.
+ImageView<double> compute_dem_weights(Options const& opt, int bias, double nodata_value,
+                                      ImageView<DoubleGrayA> const& dem){
+
+  // Compute linear weights
+  ImageView<double> local_wts = grassfire(notnodata(select_channel(dem, 0), nodata_value),
+                                          opt.no_border_blend);
+  if (opt.use_centerline_weights) {
+    // Erode based on grassfire weights, and then overwrite the grassfire
+    // weights with centerline weights
+    ImageView<DoubleGrayA> dem2 = copy(dem);
+    for (int col = 0; col < dem2.cols(); col++) {
+      for (int row = 0; row < dem2.rows(); row++) {
+        if (local_wts(col, row) <= opt.erode_len) {
+          dem2(col, row) = DoubleGrayA(nodata_value);
+        }
+      }
+    }
+    // TODO: Generalize this modification and move it to VW!!!
+    centerline_weights2
+      (create_mask_less_or_equal(select_channel(dem2, 0), nodata_value),
+       local_wts, -1.0);
+  } // End centerline weights case
+
+  // If we don't limit the weights from above, we will have tiling
+  // artifacts, as in different blocks the weights grow to different
+  // heights since they are cropped to different regions. This is done
+  // for priority blending as well. The bias is at least the erosion
+  // length plus three times the priority blending length, and
+  // weights beyond that are only compared against the latter.
+  for (int col = 0; col < local_wts.cols(); col++) {
+    for (int row = 0; row < local_wts.rows(); row++) {
+      local_wts(col, row) = std::min(local_wts(col, row), double(bias));
+    }
+  }
+
+  // Erode. We already did that if centerline weights are used.
+  if (!opt.use_centerline_weights){
+    int max_cutoff = max_pixel_value(local_wts);
+    int min_cutoff = opt.erode_len;
+    if (max_cutoff <= min_cutoff)
+      max_cutoff = min_cutoff + 1; // precaution
+    local_wts = clamp(local_wts - min_cutoff, 0.0, max_cutoff - min_cutoff);
+  }
+
+  bool use_priority_blend = (opt.priority_blending_len > 0);
+
+  // Blur the weights. If priority blending length is on, we'll do the blur later,
+  // after weights from different DEMs are combined.
+  if (opt.weights_blur_sigma > 0 && !use_priority_blend)
+    blur_weights(local_wts, opt.weights_blur_sigma);
+
+  // Raise to the power. Note that when priority blending length is positive, we
+  // delay this process.
+  if (opt.weights_exp != 1 && !use_priority_blend) {
+    for (int col = 0; col < local_wts.cols(); col++){
+      for (int row = 0; row < local_wts.rows(); row++){
+        if (local_wts(col, row) > 0)
+          local_wts(col, row) = pow(local_wts(col, row), opt.weights_exp);
+      }
+    }
+  }
+
+  return local_wts;
+}
+
+/// The blending weights of one input DEM, in the pixel domain of that
+/// DEM. Each block is computed from the DEM grown by the bias, so the
+/// result does not depend on how the DEM is split into blocks. This is
+/// meant to be wrapped in a block cache, so that the weights of each
+/// part of a DEM are found once, rather than for every output tile
+/// (itself grown by the bias) which overlaps that part.
+class DemWeightsView: public ImageViewBase<DemWeightsView>{
+  Options                 const& m_opt;    // alias
+  DiskImageManager<RealT>      & m_imgMgr; // alias
+  int                            m_dem_index, m_bias;
+  double                         m_nodata_value;
+  BBox2i                         m_dem_pixel_box;
+  GeoTransform                   m_geotrans; // to the output mosaic pixels
+
+public:
+  DemWeightsView(Options                const& opt,
+                 DiskImageManager<RealT>     & imgMgr,
+                 int dem_index, int bias, double nodata_value,
+                 BBox2i                 const& dem_pixel_box,
+                 GeoTransform           const& geotrans):
+    m_opt(opt), m_imgMgr(imgMgr), m_dem_index(dem_index), m_bias(bias),
+    m_nodata_value(nodata_value), m_dem_pixel_box(dem_pixel_box),
+    m_geotrans(geotrans) {}
+
+  // Boilerplate
+  typedef double     pixel_type;
+  typedef pixel_type result_type;
+  typedef ProceduralPixelAccessor<DemWeightsView> pixel_accessor;
+  inline int cols  () const { return m_dem_pixel_box.width(); }
+  inline int rows  () const { return m_dem_pixel_box.height(); }
+  inline int planes() const { return 1; }
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double/*i*/, double/*j*/, int/*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "DemWeightsView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i bbox) const {
+
+    BBox2i in_box = bbox;
+    in_box.expand(m_bias + BilinearInterpolation::pixel_buffer + 1);
+    in_box.crop(m_dem_pixel_box);
+
+    // Grassfire likes to have width of at least 2. Such a DEM will
+    // not contribute to the mosaic anyway.
+    if (in_box.width() <= 1 || in_box.height() <= 1) {
+      ImageView<double> local_wts(bbox.width(), bbox.height());
+      fill(local_wts, 0.0);
+      return prerasterize_type(local_wts, -bbox.min().x(), -bbox.min().y(),
+                               cols(), rows());
+    }
+
+    // The handle manager wants the region of interest in output pixels
+    ImageViewRef<double> disk_dem
+      = pixel_cast<double>(m_imgMgr.get_handle(m_dem_index,
+                                               m_geotrans.forward_bbox(in_box)));
+    ImageView<DoubleGrayA> dem = crop(disk_dem, in_box);
+    m_imgMgr.release(m_dem_index);
+
+    prepare_dem(m_opt, m_nodata_value, dem);
+    ImageView<double> local_wts = compute_dem_weights(m_opt, m_bias, m_nodata_value, dem);
+
+    return prerasterize_type(local_wts, -in_box.min().x(), -in_box.min().y(),
+                             cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+}; // End class DemWeightsView
+
 /// Class that does the actual image processing work
 class DemMosaicView: public ImageViewBase<DemMosaicView>{
   int m_cols, m_rows, m_bias;
@@ -375,6 +546,7 @@ class DemMosaicView: public ImageViewBase<DemMosaicView>{
   GeoReference                   m_out_georef;
   vector<double>          const& m_nodata_values;    // alias
   vector<BBox2i>          const& m_dem_pixel_bboxes; // alias
+  vector< ImageViewRef<double> > const& m_dem_weights; // alias, cached weights per DEM
   long long int                & m_num_valid_pixels; // alias, to populate on output
   vw::Mutex                    & m_count_mutex;      // alias, a lock for m_num_valid_pixels
 
@@ -386,12 +558,14 @@ public:
                 GeoReference           const& out_georef,
                 vector<double>         const& nodata_values,
                 vector<BBox2i>         const& dem_pixel_bboxes,
+                vector< ImageViewRef<double> > const& dem_weights,
                 long long int               & num_valid_pixels,
                 vw::Mutex                   & count_mutex):
     m_cols(cols), m_rows(rows), m_bias(bias), m_opt(opt),
     m_imgMgr(imgMgr), m_georefs(georefs),
     m_out_georef(out_georef), m_nodata_values(nodata_values),
-    m_dem_pixel_bboxes(dem_pixel_bboxes), m_num_valid_pixels(num_valid_pixels),
+    m_dem_pixel_bboxes(dem_pixel_bboxes), m_dem_weights(dem_weights),
+    m_num_valid_pixels(num_valid_pixels),
     m_count_mutex(count_mutex) {
 
     // How many valid pixels we will have
@@ -399,7 +573,8 @@ public:
     
     if (imgMgr.size() != georefs.size()       ||
         imgMgr.size() != nodata_values.size() ||
-        imgMgr.size() != dem_pixel_bboxes.size())
+        imgMgr.size() != dem_pixel_bboxes.size() ||
+        imgMgr.size() != dem_weights.size())
       vw_throw(ArgumentErr() << "Inputs expected to have the same size do not.\n");
 
     // Sanity check, see if datums differ, then the tool won't work
@@ -460,7 +635,6 @@ public:
     // We will do all computations in double precision, regardless
     // of the precision of the inputs, for increased accuracy.
     // - The image data buffers are initialized here
-    typedef PixelGrayA<double> DoubleGrayA;
     ImageView<double> tile   (bbox.width(), bbox.height()); // the output tile (in most cases)
     ImageView<double> weights(bbox.width(), bbox.height()); // accumulated weights (in most cases)
     fill( tile, m_opt.out_nodata_value );
@@ -520,7 +694,6 @@ public:
     }
 
     ImageView<double> first_dem;
-    ImageView<double> local_wts_orig;
 
     // Loop through all input DEMs
     for (int dem_iter = 0; dem_iter < (int)m_imgMgr.size(); dem_iter++){
@@ -572,16 +745,8 @@ public:
       // If the nodata_threshold is specified, all values no more than this
       // will be invalidated.
       double nodata_value = m_nodata_values[dem_iter];
-      if (!boost::math::isnan(m_opt.nodata_threshold)) {
+      if (!boost::math::isnan(m_opt.nodata_threshold))
         nodata_value = m_opt.nodata_threshold;
-        for (int col = 0; col < dem.cols(); col++) {
-          for (int row = 0; row < dem.rows(); row++) {
-            if (dem(col, row)[0] <= nodata_value) {
-              dem(col, row)[0] = nodata_value;
-            }
-          }
-        }
-      }
 
       if (m_opt.first_dem_as_reference && dem_iter == 0) {
         //TODO: Should be a function!
@@ -595,15 +760,10 @@ public:
         }
       }
 
-      // Fill holes. This happens here, in the expanded tile, to
-      // ensure we catch holes which are partially outside the tile
-      // being processed.
-      if (m_opt.hole_fill_len > 0){
-        dem = apply_mask(vw::fill_holes_grass
-                         (create_mask(select_channel(dem, 0), nodata_value),
-                          m_opt.hole_fill_len),
-                         nodata_value);
-      }
+      // Apply the threshold and fill holes. This happens here, in the
+      // expanded tile, to ensure we catch holes which are partially
+      // outside the tile being processed.
+      prepare_dem(m_opt, nodata_value, dem);
 
       // Mark the handle to the image as not in use, though we still
       // keep that image file open, for increased performance, unless
@@ -615,63 +775,9 @@ public:
         continue;
       }
 
-      // Compute linear weights
-      ImageView<double> local_wts = grassfire(notnodata(select_channel(dem, 0), nodata_value),
-                                              m_opt.no_border_blend);
-      local_wts_orig = local_wts;
-      if (m_opt.use_centerline_weights) {
-        // Erode based on grassfire weights, and then overwrite the grassfire
-        // weights with centerline weights
-        ImageView<DoubleGrayA> dem2 = copy(dem);
-        for (int col = 0; col < dem2.cols(); col++) {
-          for (int row = 0; row < dem2.rows(); row++) {
-            if (local_wts(col, row) <= m_opt.erode_len) {
-              dem2(col, row) = DoubleGrayA(nodata_value);
-            }
-          }
-        }
-        // TODO: Generalize this modification and move it to VW!!!
-        centerline_weights2
-                (create_mask_less_or_equal(select_channel(dem2, 0), nodata_value),
-                 local_wts, -1.0);
-      } // End centerline weights case
-
-      // If we don't limit the weights from above, we will have tiling artifacts,
-      // as in different tiles the weights grow to different heights since
-      // they are cropped to different regions. for priority blending length,
-      // we'll do this process later, as the bbox is obtained differently in that case.
-      if (!use_priority_blend) {
-        for (int col = 0; col < local_wts.cols(); col++) {
-          for (int row = 0; row < local_wts.rows(); row++) {
-            local_wts(col, row) = std::min(local_wts(col, row), double(m_bias));
-          }
-        }
-      }
-
-      // Erode. We already did that if centerline weights are used.
-      if (!m_opt.use_centerline_weights){
-        int max_cutoff = max_pixel_value(local_wts);
-        int min_cutoff = m_opt.erode_len;
-        if (max_cutoff <= min_cutoff)
-          max_cutoff = min_cutoff + 1; // precaution
-        local_wts = clamp(local_wts - min_cutoff, 0.0, max_cutoff - min_cutoff);
-      }
-      
-      // Blur the weights. If priority blending length is on, we'll do the blur later,
-      // after weights from different DEMs are combined.
-      if (m_opt.weights_blur_sigma > 0 && !use_priority_blend)
-        blur_weights(local_wts, m_opt.weights_blur_sigma);
-
-      // Raise to the power. Note that when priority blending length is positive, we
-      // delay this process.
-      if (m_opt.weights_exp != 1 && !use_priority_blend) {
-        for (int col = 0; col < dem.cols(); col++){
-          for (int row = 0; row < dem.rows(); row++){
-            if (local_wts(col, row) > 0)
-              local_wts(col, row) = pow(local_wts(col, row), m_opt.weights_exp);
-          }
-        }
-      }
+      // Fetch the weights. They are computed once per block of this
+      // DEM and cached, rather than redone for each output tile.
+      ImageView<double> local_wts = crop(m_dem_weights[dem_iter], in_box);
 
 #if 0
       // Dump the weights
@@ -1709,6 +1815,7 @@ int main( int argc, char *argv[] ) {
     vector<GeoReference>    georefs;
     std::vector<string>     loaded_dems;
     DiskImageManager<RealT> imgMgr;
+    vector< ImageViewRef<double> > dem_weights;
 
     BBox2i output_dem_box = BBox2i(0, 0, cols, rows); // output DEM box
     
@@ -1776,6 +1883,16 @@ int main( int argc, char *argv[] ) {
       nodata_values.push_back(curr_nodata_value);
       georefs.push_back(georef);
       loaded_dem_pixel_bboxes.push_back(dem_pixel_box);
+
+      // The blending weights of this DEM. These are cached in blocks
+      // as big as the output blocks, so the per-block overhead due to
+      // the bias is about the same, and a block is reused by all the
+      // output blocks it overlaps while it stays in the cache.
+      int dem_index = (int)loaded_dems.size() - 1;
+      dem_weights.push_back(block_cache(DemWeightsView(opt, imgMgr, dem_index, bias,
+                                                       curr_nodata_value, dem_pixel_box,
+                                                       geotrans),
+                                        Vector2i(block_size, block_size), 0));
     } // End loop through DEM files
 
     // If there are 17 tiles, let them be tile-00, ..., tile-16.
@@ -1813,7 +1930,7 @@ int main( int argc, char *argv[] ) {
         = crop(DemMosaicView(cols, rows, bias, opt,
                              imgMgr, georefs,
                              mosaic_georef, nodata_values,
-                             loaded_dem_pixel_bboxes,
+                             loaded_dem_pixel_bboxes, dem_weights,
                              num_valid_pixels, count_mutex),
                tile_box);
       GeoReference crop_georef = crop(mosaic_georef, tile_box.min().x(),
@@ -17,10 +17,14 @@
 
 
 #include <asp/Core/PointUtils.h>
+#include <vw/Core/Thread.h>
 #include <vw/FileIO/DiskImageView.h>
 #include <vw/Cartography/GeoTransform.h>
 #include <vw/Cartography/PointImageManipulation.h>
 
+#include <set>
+#include <tuple>
+
 
 using std::endl;
 using std::string;
@@ -33,25 +37,282 @@ using namespace vw::cartography;
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
-// Function to convert a masked geodetic vector to a masked altitude vector
-class MGeodeticToMAltitude : public ReturnFixedType<PixelMask<double> > {
+/// Statistics of the differences, accumulated while they are computed,
+/// so the output need not be read back. The median, NMAD, and
+/// percentiles are found from a histogram with the given bin size, so
+/// they are accurate to within half a bin.
+class DiffStats {
 public:
-  PixelMask<double> operator()(PixelMask<Vector3> const& v) const {
-    if (!is_valid(v)) {
-      return PixelMask<double>();
+  DiffStats(double bin_size): m_bin_size(bin_size), m_count(0),
+                              m_mean(0.0), m_m2(0.0),
+                              m_min(std::numeric_limits<double>::max()),
+                              m_max(-std::numeric_limits<double>::max()) {}
+  
+  /// Add a value, updating the mean and the sum of squared deviations
+  /// from it with Welford's method, which keeps precision even when
+  /// the mean is large compared to the spread.
+  void add(double diff) {
+    m_count++;
+    double delta = diff - m_mean;
+    m_mean += delta/m_count;
+    m_m2   += delta*(diff - m_mean);
+    m_min = std::min(m_min, diff);
+    m_max = std::max(m_max, diff);
+    m_hist[bin(diff)]++;
+  }
+
+  /// Add the statistics of another set of values, such as of a tile,
+  /// combining the means and squared deviations as in Chan et al.
+  void merge(DiffStats const& other) {
+    if (other.m_count == 0)
+      return;
+    double delta = other.m_mean - m_mean;
+    double count = double(m_count) + double(other.m_count);
+    m_mean += delta*other.m_count/count;
+    m_m2   += other.m_m2 + delta*delta*double(m_count)*double(other.m_count)/count;
+    m_count += other.m_count;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+    for (HistIter it = other.m_hist.begin(); it != other.m_hist.end(); it++)
+      m_hist[it->first] += it->second;
+  }
+
+  size_t count() const { return m_count; }
+  
+  double mean() const {
+    return m_mean;
+  }
+  
+  double stddev() const {
+    if (m_count == 0)
+      return 0.0;
+    return std::sqrt(m_m2/m_count);
+  }
+
+  /// The value below which the given fraction of the differences fall
+  double percentile(double fraction) const {
+    if (m_count == 0)
+      return 0.0;
+    size_t rank = std::min(size_t(fraction*m_count), m_count - 1), cum = 0;
+    for (HistIter it = m_hist.begin(); it != m_hist.end(); it++) {
+      cum += it->second;
+      if (cum > rank)
+        return clamp(center(it->first));
     }
-    return PixelMask<double>(v.child()[2]);
+    return m_max;
   }
+
+  /// 1.4826 * median(abs(X - median(X)))
+  double nmad() const {
+    if (m_count == 0)
+      return 0.0;
+    double median = percentile(0.5);
+    std::vector<std::pair<double, size_t>> devs;
+    devs.reserve(m_hist.size());
+    for (HistIter it = m_hist.begin(); it != m_hist.end(); it++)
+      devs.push_back(std::make_pair(std::abs(clamp(center(it->first)) - median), it->second));
+    std::sort(devs.begin(), devs.end());
+    size_t rank = m_count/2, cum = 0;
+    for (size_t it = 0; it < devs.size(); it++) {
+      cum += devs[it].second;
+      if (cum > rank)
+        return 1.4826 * devs[it].first;
+    }
+    return 0.0;
+  }
+
+  void print(std::ostream & os, std::string const& prefix) const {
+    double min_val = (m_count > 0) ? m_min : 0.0, max_val = (m_count > 0) ? m_max : 0.0;
+    os << prefix << "Max difference:       " << max_val           << std::endl;
+    os << prefix << "Min difference:       " << min_val           << std::endl;
+    os << prefix << "Mean difference:      " << mean()            << std::endl;
+    os << prefix << "StdDev of difference: " << stddev()          << std::endl;
+    os << prefix << "Median difference:    " << percentile(0.5)   << std::endl;
+    os << prefix << "NMAD of difference:   " << nmad()            << std::endl;
+    os << prefix << "5th percentile:       " << percentile(0.05)  << std::endl;
+    os << prefix << "95th percentile:      " << percentile(0.95)  << std::endl;
+  }
+  
+private:
+  typedef std::map<vw::int64, size_t>::const_iterator HistIter;
+
+  vw::int64 bin(double val) const { return vw::int64(floor(val/m_bin_size + 0.5)); }
+  double center(vw::int64 b) const { return b*m_bin_size; }
+  double clamp(double val) const { return std::min(std::max(val, m_min), m_max); }
+  
+  double m_bin_size;
+  size_t m_count;
+  double m_mean, m_m2, m_min, m_max;
+  std::map<vw::int64, size_t> m_hist;
 };
 
-// Function to mask NaN pixels 
-class MaskNaN : public ReturnFixedType<PixelMask<double> > {
+/// The statistics of the difference, to which each tile is added when
+/// it is done. The boxes of the tiles added so far are remembered, so
+/// if a tile is rasterized again it is not counted twice.
+class TileDiffStats {
 public:
-  PixelMask<double> operator()(PixelMask<double> const& v) const {
-    if (!is_valid(v) || std::isnan(v.child())) {
-      return PixelMask<double>();
+  TileDiffStats(double bin_size): m_stats(bin_size), m_area(0.0) {}
+
+  /// Add the statistics of a tile. Can be called from multiple threads.
+  void add(BBox2i const& bbox, DiffStats const& tile_stats) {
+    vw::Mutex::Lock lock(m_mutex);
+    TileKey key(bbox.min().x(), bbox.min().y(), bbox.max().x(), bbox.max().y());
+    if (!m_done.insert(key).second)
+      return;
+    m_stats.merge(tile_stats);
+    m_area += double(bbox.width()) * double(bbox.height());
+  }
+
+  /// The statistics of all tiles, after checking that the tiles cover
+  /// an image of the given size exactly.
+  DiffStats const& stats(Vector2i const& image_size) const {
+    double image_area = double(image_size.x()) * double(image_size.y());
+    if (m_area != image_area)
+      vw_throw(LogicErr() << "The difference tiles cover " << m_area << " pixels rather than "
+               << image_area << ".\n");
+    return m_stats;
+  }
+
+private:
+  typedef std::tuple<int, int, int, int> TileKey;
+  DiffStats          m_stats;
+  double             m_area;
+  std::set<TileKey>  m_done;
+  vw::Mutex          m_mutex;
+};
+
+// The differences are binned at 1 mm to find the median and percentiles
+const double g_stats_bin_size = 1e-3;
+
+/// Bilinear interpolation into a DEM tile whose upper-left corner is
+/// at the given offset. As when interpolating into a masked image
+/// with no-data outside, the result is invalid if any of the four
+/// samples is outside the tile, is no-data, or is NaN.
+inline bool interp_dem_height(ImageView<double> const& dem, Vector2i const& offset,
+                              double nodata, Vector2 const& pix, double & val) {
+  
+  double x = pix[0] - offset[0], y = pix[1] - offset[1];
+  if (!(x >= 0 && y >= 0)) // also catches NaN
+    return false;
+  int c = int(floor(x)), r = int(floor(y));
+  if (c + 1 >= dem.cols() || r + 1 >= dem.rows())
+    return false;
+
+  double v[4] = {dem(c, r), dem(c + 1, r), dem(c, r + 1), dem(c + 1, r + 1)};
+  for (int k = 0; k < 4; k++) {
+    if (v[k] == nodata || std::isnan(v[k]))
+      return false;
+  }
+  
+  double dx = x - c, dy = y - r;
+  val = (1.0 - dy)*((1.0 - dx)*v[0] + dx*v[1]) + dy*((1.0 - dx)*v[2] + dx*v[3]);
+  return true;
+}
+
+/// The difference of two DEMs over the pixels of the first one in
+/// crop_box, with the second one interpolated bilinearly. Each tile
+/// reads the region of each DEM it needs once. If the map from the
+/// first DEM's pixels to the second's is affine, it is applied
+/// directly rather than going through the projections per pixel. The
+/// statistics of the differences are accumulated in the same pass,
+/// with each tile added to a TileDiffStats when it is done.
+template <class ImageT>
+class DemDiffView: public ImageViewBase<DemDiffView<ImageT> > {
+  ImageT              m_dem1, m_dem2;
+  double              m_dem1_nodata, m_dem2_nodata, m_out_nodata;
+  BBox2i              m_crop_box;
+  GeoTransform const& m_gt;     // from the second DEM's pixels to the first
+  bool                m_use_affine;
+  Vector2             m_origin, m_dx, m_dy; // the affine map, if used
+  bool                m_use_absolute;
+  TileDiffStats     & m_stats;  // alias
+
+public:
+  DemDiffView(ImageT const& dem1, ImageT const& dem2,
+              double dem1_nodata, double dem2_nodata, double out_nodata,
+              BBox2i const& crop_box, GeoTransform const& gt,
+              bool use_affine, bool use_absolute, TileDiffStats & stats):
+    m_dem1(dem1), m_dem2(dem2), m_dem1_nodata(dem1_nodata),
+    m_dem2_nodata(dem2_nodata), m_out_nodata(out_nodata),
+    m_crop_box(crop_box), m_gt(gt), m_use_affine(use_affine),
+    m_use_absolute(use_absolute), m_stats(stats) {
+    
+    Vector2 corner = m_crop_box.min();
+    m_origin = m_gt.reverse(corner);
+    m_dx     = m_gt.reverse(corner + Vector2(1, 0)) - m_origin;
+    m_dy     = m_gt.reverse(corner + Vector2(0, 1)) - m_origin;
+  }
+
+  typedef double pixel_type;
+  typedef double result_type;
+  typedef ProceduralPixelAccessor<DemDiffView> pixel_accessor;
+
+  inline int32 cols  () const { return m_crop_box.width(); }
+  inline int32 rows  () const { return m_crop_box.height(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor(*this); }
+
+  inline result_type operator()( double/*i*/, double/*j*/, int32/*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "DemDiffView::operator()(...) is not implemented");
+    return result_type();
+  }
+
+  /// Where a pixel of the first DEM lands in the second one
+  inline Vector2 dem2_pix(Vector2 const& pix1) const {
+    if (m_use_affine) {
+      Vector2 d = pix1 - Vector2(m_crop_box.min());
+      return m_origin + d[0]*m_dx + d[1]*m_dy;
+    }
+    return m_gt.reverse(pix1);
+  }
+  
+  typedef CropView<ImageView<result_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    ImageView<result_type> tile(bbox.width(), bbox.height());
+    fill(tile, m_out_nodata);
+
+    // The box in the first DEM, and the part of the second one it sees
+    BBox2i box1 = bbox + m_crop_box.min();
+    BBox2i box2 = grow_bbox_to_int(m_gt.reverse_bbox(box1));
+    box2.expand(BilinearInterpolation::pixel_buffer + 1);
+    box2.crop(bounding_box(m_dem2));
+    DiffStats tile_stats(g_stats_bin_size);
+    if (box2.empty()) {
+      m_stats.add(bbox, tile_stats); // no differences, but the tile is done
+      return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+    }
+    
+    ImageView<double> dem1_tile = crop(m_dem1, box1);
+    ImageView<double> dem2_tile = crop(m_dem2, box2);
+
+    for (int row = 0; row < tile.rows(); row++) {
+      for (int col = 0; col < tile.cols(); col++) {
+        double h1 = dem1_tile(col, row);
+        if (h1 == m_dem1_nodata || std::isnan(h1))
+          continue;
+        
+        Vector2 pix1(col + box1.min().x(), row + box1.min().y());
+        double h2 = 0.0;
+        if (!interp_dem_height(dem2_tile, box2.min(), m_dem2_nodata, dem2_pix(pix1), h2))
+          continue;
+
+        double diff = h1 - h2;
+        if (m_use_absolute)
+          diff = std::abs(diff);
+        tile(col, row) = diff;
+        tile_stats.add(diff);
+      }
     }
-    return v;
+    m_stats.add(bbox, tile_stats);
+    
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i const& bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
   }
 };
 
@@ -162,29 +423,41 @@ void dem2dem_diff(Options& opt){
 
   if (crop_box.empty()) 
     vw_throw(ArgumentErr() << "The two DEMs do not have a common area.\n");
-    
-  ImageViewRef<PixelMask<double> > dem2_trans =
-    per_pixel_filter(crop(geo_transform
-                          (per_pixel_filter(dem_to_geodetic
-                                            (create_mask(dem2_disk_image_view, dem2_nodata),
-                                             dem2_georef),
-                                            MGeodeticToMAltitude()),
-                           dem2_georef, dem1_georef,
-                           ValueEdgeExtension<PixelMask<double> >(PixelMask<double>())),
-                          crop_box), MaskNaN());
-  
-  ImageViewRef<double> difference;
-  if (opt.use_absolute) {
-    difference =
-      apply_mask(abs(crop(create_mask(dem1_disk_image_view, dem1_nodata), crop_box) - dem2_trans),
-                 opt.nodata_value);
-  } else {
-    difference =
-      apply_mask(crop(create_mask(dem1_disk_image_view, dem1_nodata), crop_box) - dem2_trans,
-                 opt.nodata_value);
+
+  // Rounding the corner and the size separately can go one pixel past
+  // the first DEM, so crop to it.
+  BBox2i pix_box(round(crop_box.min().x()), round(crop_box.min().y()),
+                 round(crop_box.width()), round(crop_box.height()));
+  pix_box.crop(bounding_box(dem1_disk_image_view));
+  if (pix_box.empty()) 
+    vw_throw(ArgumentErr() << "The two DEMs do not have a common area.\n");
+
+  // If the DEMs are in the same projection, the map between their
+  // pixels is affine. Verify that on the boundary and the center of
+  // the box before relying on it.
+  bool use_affine = (dem1_georef.overall_proj4_str() == dem2_georef.overall_proj4_str());
+  if (use_affine) {
+    Vector2 corner = pix_box.min();
+    Vector2 origin = gt.reverse(corner);
+    Vector2 dx = gt.reverse(corner + Vector2(1, 0)) - origin;
+    Vector2 dy = gt.reverse(corner + Vector2(0, 1)) - origin;
+    for (int i = 0; i <= 2 && use_affine; i++) {
+      for (int j = 0; j <= 2 && use_affine; j++) {
+        Vector2 d(i*pix_box.width()/2.0, j*pix_box.height()/2.0);
+        Vector2 diff = gt.reverse(corner + d) - (origin + d[0]*dx + d[1]*dy);
+        if (!(norm_2(diff) < 1e-3))
+          use_affine = false;
+      }
+    }
   }
+  
+  TileDiffStats tile_stats(g_stats_bin_size);
+  ImageViewRef<double> difference
+    = DemDiffView<DiskImageView<double>>(dem1_disk_image_view, dem2_disk_image_view,
+                                         dem1_nodata, dem2_nodata, opt.nodata_value,
+                                         pix_box, gt, use_affine, opt.use_absolute, tile_stats);
     
-  GeoReference crop_georef = crop(dem1_georef, crop_box);
+  GeoReference crop_georef = crop(dem1_georef, pix_box);
     
   std::string output_file = opt.output_prefix + "-diff.tif";
   vw_out() << "Writing difference file: " << output_file << "\n";
@@ -207,6 +480,8 @@ void dem2dem_diff(Options& opt){
     block_write_image(*rsrc, difference,
                       TerminalProgressCallback("asp", "\t--> Differencing: "));
   }
+
+  tile_stats.stats(pix_box.size()).print(vw_out(), "");
 }
 
 // From a DEM, subtract a csv file. Reverse the sign is 'reverse' is true.
@@ -266,67 +541,63 @@ void dem2csv_diff(Options & opt, std::string const& dem_file,
     csv_llh.push_back(llh);
   }
 
-  // We will interpolate into the DEM to find the difference
-  ImageViewRef< PixelMask<double> > interp_dem
-    = interpolate(create_mask(dem, dem_nodata),
-		  BilinearInterpolation(), ConstantEdgeExtension());
-
-  // Save the diffs
-  int    count     = 0;
-  double diff_min  = std::numeric_limits<double>::max();
-  double diff_max  = -diff_min;
-  double diff_mean = 0.0;
-  double diff_std  = 0.0;
-
-  std::vector<Vector3> csv_diff;
-  std::vector<double> csv_errs;
+  // Find where the points fall in the DEM, and group them by DEM
+  // tile, so that each tile is read once, rather than going through
+  // the disk cache for each point.
+  int tile_size = 256;
+  std::vector<Vector2> csv_pix(csv_llh.size());
+  std::map<std::pair<int, int>, std::vector<size_t>> tile_points;
   for (size_t it = 0; it < csv_llh.size(); it++) {
-
-    Vector3 llh = csv_llh[it];
-    Vector2 ll  = subvector(llh, 0, 2);
-    Vector2 pix = dem_georef.lonlat_to_pixel(ll);
+    csv_pix[it] = dem_georef.lonlat_to_pixel(subvector(csv_llh[it], 0, 2));
     
     // Check for out of range
-    if (pix[0] < 0 || pix[0] > dem.cols() - 1) continue;
-    if (pix[1] < 0 || pix[1] > dem.rows() - 1) continue;
-    PixelMask<double> dem_ht = interp_dem(pix[0], pix[1]);
-    if (!is_valid(dem_ht))
-      continue;
-
-    double diff = dem_ht.child() - llh[2];
-    if (reverse) 
-      diff *= -1;
-    if (opt.use_absolute)
-      diff = std::abs(diff);
-
-    if (diff > diff_max) diff_max = diff;
-    if (diff < diff_min) diff_min = diff;
-
-    diff_mean += diff;
-    diff_std  += diff*diff;
-    count     += 1;
-    csv_diff.push_back(Vector3(ll[0], ll[1], diff));
-    csv_errs.push_back(diff);
+    Vector2 pix = csv_pix[it];
+    if (!(pix[0] >= 0 && pix[0] <= dem.cols() - 1)) continue;
+    if (!(pix[1] >= 0 && pix[1] <= dem.rows() - 1)) continue;
+    tile_points[std::make_pair(int(pix[0])/tile_size, int(pix[1])/tile_size)].push_back(it);
   }
 
-  if (count > 0) {
-    diff_mean /= count;
-    diff_std = diff_std/count - diff_mean*diff_mean;
-    if (diff_std < 0)
-      diff_std = 0; // just in case, for numerical noise
-    diff_std = std::sqrt(diff_std);
+  // Interpolate into the DEM to find the differences
+  std::vector<bool> is_valid_diff(csv_llh.size(), false);
+  std::vector<double> diffs(csv_llh.size(), 0.0);
+  for (auto const& tile_it: tile_points) {
+
+    // The tile with one more row and column, to interpolate at its edges
+    BBox2i box(tile_it.first.first * tile_size, tile_it.first.second * tile_size,
+               tile_size + 1, tile_size + 1);
+    box.crop(bounding_box(dem));
+    ImageView<double> dem_tile = crop(dem, box);
+    ImageViewRef< PixelMask<double> > interp_dem
+      = interpolate(create_mask(dem_tile, dem_nodata),
+                    BilinearInterpolation(), ConstantEdgeExtension());
+
+    for (size_t it: tile_it.second) {
+      Vector2 pix = csv_pix[it] - Vector2(box.min());
+      PixelMask<double> dem_ht = interp_dem(pix[0], pix[1]);
+      if (!is_valid(dem_ht))
+        continue;
+      
+      double diff = dem_ht.child() - csv_llh[it][2];
+      if (reverse) 
+        diff *= -1;
+      if (opt.use_absolute)
+        diff = std::abs(diff);
+      diffs[it] = diff;
+      is_valid_diff[it] = true;
+    }
+  }
+  
+  // Save the diffs, in the order of the input points
+  DiffStats stats(g_stats_bin_size);
+  std::vector<Vector3> csv_diff;
+  for (size_t it = 0; it < csv_llh.size(); it++) {
+    if (!is_valid_diff[it])
+      continue;
+    stats.add(diffs[it]);
+    csv_diff.push_back(Vector3(csv_llh[it][0], csv_llh[it][1], diffs[it]));
   }
 
-  double diff_median = 0.0;
-  std::sort(csv_errs.begin(), csv_errs.end());
-  if (csv_errs.size() > 0) 
-    diff_median = csv_errs[csv_errs.size()/2];
-
-  vw_out() << "Max difference:       " << diff_max    << std::endl;
-  vw_out() << "Min difference:       " << diff_min    << std::endl;
-  vw_out() << "Mean difference:      " << diff_mean   << std::endl;
-  vw_out() << "StdDev of difference: " << diff_std    << std::endl;
-  vw_out() << "Median difference:    " << diff_median << std::endl;
+  stats.print(vw_out(), "");
 
   std::string output_file = opt.output_prefix + "-diff.csv";
   vw_out() << "Writing difference file: " << output_file << "\n";
@@ -334,11 +605,7 @@ void dem2csv_diff(Options & opt, std::string const& dem_file,
   outfile.precision(16);
   outfile << "# longitude,latitude, height diff (m)" << std::endl;
   outfile << "# " << dem_georef.datum() << std::endl; // dem's datum
-  outfile << "# Max difference:       " << diff_max    << std::endl;
-  outfile << "# Min difference:       " << diff_min    << std::endl;
-  outfile << "# Mean difference:      " << diff_mean   << std::endl;
-  outfile << "# StdDev of difference: " << diff_std    << std::endl;
-  outfile << " # Median difference:   " << diff_median << std::endl;
+  stats.print(outfile, "# ");
   for (size_t it = 0; it < csv_diff.size(); it++) {
     Vector3 diff = csv_diff[it];
     outfile << diff[0] << "," << diff[1] << "," << diff[2] << std::endl;
@@ -32,6 +32,7 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/FootprintIndex.h>
 
 using namespace vw;
 namespace po = boost::program_options;
@@ -351,6 +352,7 @@ private:
   int            m_blend_radius;
   Vector2i const m_output_image_size;
   double         m_output_nodata_value;
+  asp::FootprintIndex m_index; // to find the images intersecting a tile
 
 public:
   ImageMosaicView(std::vector<ImageViewRef<T> > const& images,
@@ -362,7 +364,12 @@ public:
     m_images(images), m_transforms(transforms),
     m_bboxes(bboxes), m_blend_radius(blend_radius),
     m_output_image_size(output_image_size),
-    m_output_nodata_value(output_nodata_value){}
+    m_output_nodata_value(output_nodata_value){
+    std::vector<BBox2> footprints;
+    for (size_t i = 0; i < m_bboxes.size(); i++)
+      footprints.push_back(BBox2(m_bboxes[i]));
+    m_index = asp::FootprintIndex(footprints);
+  }
 
   typedef float pixel_type;
   typedef float result_type;
@@ -390,7 +397,9 @@ public:
 
     // Loop through the intersecting input images and paste them in
     //  to the output image.
-    for (size_t i=0; i<m_images.size(); ++i) {
+    std::vector<int> candidates = m_index.candidates(BBox2(bbox));
+    for (size_t cand = 0; cand < candidates.size(); ++cand) {
+      size_t i = candidates[cand];
 
       //std::cout << "i = " << i << std::endl;
       //std::cout << "bbox = " << bbox << std::endl;
@@ -431,11 +440,22 @@ public:
       BBox2i expanded_intersect = intersect;
       expanded_intersect.expand(m_blend_radius);
       
-      // Get the cropped piece of the transformed input image that we need
-      ImageView<T> trans_input = crop(transform(m_images[i], *temp,
-                                                ZeroEdgeExtension(),
-                                                BilinearInterpolation()),
-                                      expanded_intersect);
+      // Get the cropped piece of the transformed input image that we
+      // need. When the transform is a shift by whole pixels, as for the
+      // first image, that is just a crop of the input.
+      ImageView<T> trans_input;
+      Matrix3x3 M = affine2mat(*temp);
+      Vector2 shift(M(0, 2), M(1, 2));
+      if (M(0, 0) == 1 && M(0, 1) == 0 && M(1, 0) == 0 && M(1, 1) == 1 &&
+          shift == round(shift)) {
+        trans_input = crop(edge_extend(m_images[i], ZeroEdgeExtension()),
+                           expanded_intersect - Vector2i(shift));
+      } else {
+        trans_input = crop(transform(m_images[i], *temp,
+                                     ZeroEdgeExtension(),
+                                     BilinearInterpolation()),
+                           expanded_intersect);
+      }
       ImageView<double> input_weights;
       //  = grassfire(notnodata(apply_mask(trans_input,0), 0));
       bool fill_holes  = false; // Don't fill holes
@@ -129,6 +129,17 @@ private:
 };
   
   
+// Read the position and pose adjustment stored at the given location.
+template <typename T>
+void read_adjustment(const T* const camera, vw::Vector3 & position, vw::Quat & pose){
+  Vector3 axis_angle;
+  for (int b = 0; b < NUM_CAMERA_PARAMS/2; b++) {
+    position  [b] = (double)camera[b + 0];
+    axis_angle[b] = (double)camera[b + NUM_CAMERA_PARAMS/2];
+  }
+  pose = axis_angle_to_quaternion(axis_angle);
+}
+
 void populate_adjustements(std::vector<double> const& cameras_vec,
 			   int start_index, int end_index,
 			   std::vector<vw::Vector3> & position_adjustments,
@@ -145,47 +156,83 @@ void populate_adjustements(std::vector<double> const& cameras_vec,
   pose_adjustments.clear();
 
   for (int cam_index = start_index; cam_index < end_index; cam_index++) {
-    Vector3 position, pose;
-    for (int b = 0; b < NUM_CAMERA_PARAMS/2; b++) {
-      position[b] = cameras_vec[NUM_CAMERA_PARAMS * cam_index + b + 0];
-      pose[b]     = cameras_vec[NUM_CAMERA_PARAMS * cam_index + b + NUM_CAMERA_PARAMS/2];
-    }
-
+    Vector3 position;
+    Quat    pose;
+    read_adjustment(&cameras_vec[NUM_CAMERA_PARAMS * cam_index], position, pose);
     position_adjustments.push_back(position);
-    pose_adjustments.push_back(axis_angle_to_quaternion(pose));
+    pose_adjustments.push_back(pose);
   }
 }
 
+// The part of the adjustments of a camera a single observation depends
+// on. The projection involves the adjustments only near the observed
+// line, so the adjusted camera is made with a window of them rather
+// than all, with the window bounds chosen so that the interpolation
+// within it agrees with the one over all adjustments.
+struct JitterStencil {
+  int beg, end;                  // Window of adjustment indices into the cameras vector
+  vw::Vector2 adjustment_bounds; // The image lines of the first and last adjustment in it
+};
+
+// Find the window of adjustments to use for an observation whose
+// floated adjustments are between min_index and max_index. Pad by
+// more than the interpolation support, so that the projection can
+// wander a bit along-track without seeing the window ends.
+// If the time decreases with the line, the first adjustment is at
+// the last line.
+JitterStencil make_jitter_stencil(vw::Vector2 const& adjustment_bounds,
+                                  int start_index, int end_index,
+                                  int min_index, int max_index,
+                                  bool reversed){
+
+  const int margin = g_num_wts + 2;
+  JitterStencil stencil;
+  stencil.beg = std::max(min_index - margin, start_index);
+  stencil.end = std::min(max_index + 1 + margin, end_index);
+
+  int num_adj = end_index - start_index;
+  double dy   = (adjustment_bounds[1] - adjustment_bounds[0])/(num_adj - 1.0);
+  int lo      = stencil.beg     - start_index;
+  int hi      = stencil.end - 1 - start_index;
+  if (!reversed)
+    stencil.adjustment_bounds = Vector2(adjustment_bounds[0] + lo*dy,
+                                        adjustment_bounds[0] + hi*dy);
+  else
+    stencil.adjustment_bounds = Vector2(adjustment_bounds[1] - hi*dy,
+                                        adjustment_bounds[1] - lo*dy);
+
+  return stencil;
+}
+
 // A ceres cost function. We pass in the observation, the model, and
 // the current camera and point indices. The result is the residual,
 // the difference in the observation and the projection of the point
-// into the camera, normalized by pixel_sigma.
+// into the camera, normalized by pixel_sigma. The adjustments which
+// are not floated are read from the shared cameras vector, and only
+// those in the stencil of the observation are looked at.
 struct PiecewiseReprojectionError {
   PiecewiseReprojectionError(Vector2 const& observation, Vector2 const& pixel_sigma,
-			     Vector2 const& adjustment_bounds,
+			     JitterStencil const& stencil,
 			     std::vector<double> const& cameras_vec,
 			     boost::shared_ptr<vw::camera::CameraModel> cam,
 			     Vector2i const& image_size,
 			     std::string const& session,
-			     int start_index,
 			     int camera_index1, int camera_index2,
 			     int camera_index3, int camera_index4,
-			     int end_index,
 			     size_t ipt):
     m_observation(observation),
     m_pixel_sigma(pixel_sigma),
-    m_adjustment_bounds(adjustment_bounds),
+    m_stencil(stencil),
     m_cameras_vec(cameras_vec),
     m_cam(cam),
     m_image_size(image_size),
-    m_session(session),
-    m_start_index(start_index),
-    m_camera_index1(camera_index1),
-    m_camera_index2(camera_index2),
-    m_camera_index3(camera_index3),
-    m_camera_index4(camera_index4),
-    m_end_index(end_index),
-    m_ipt(ipt){}
+    m_is_dg(session == "dg" || session == "dgmaprpc"),
+    m_ipt(ipt){
+    m_camera_indices[0] = camera_index1;
+    m_camera_indices[1] = camera_index2;
+    m_camera_indices[2] = camera_index3;
+    m_camera_indices[3] = camera_index4;
+  }
 
   template <typename T>
   bool do_calc(const T* const camera1, const T* const camera2,
@@ -194,70 +241,54 @@ struct PiecewiseReprojectionError {
 
     try{
 
-      int num_cameras = m_cameras_vec.size();
-      std::vector<double> local_cameras_vec = m_cameras_vec;
-
-	// Copy the camera adjustments to local storage.  Update them
-	// with the latest value for the current camera being floated.
-
-      for (int i = 1; i <= 4; i++) {
-
-	int camera_index = -1;
-	const T * camera = NULL;
-	if (i == 1 && m_camera_index1 >= 0 && camera1 != NULL) {
-	  camera_index = m_camera_index1;
-	  camera       = camera1;
-	} else if (i == 2 && m_camera_index2 >= 0 && camera2 != NULL) {
-	  camera_index = m_camera_index2;
-	  camera       = camera2;
-	} else if (i == 3 && m_camera_index3 >= 0 && camera3 != NULL) {
-	  camera_index = m_camera_index3;
-	  camera       = camera3;
-	} else if (i == 4 && m_camera_index4 >= 0 && camera4 != NULL) {
-	  camera_index = m_camera_index4;
-	  camera       = camera4;
-	}
-
-	if (camera == NULL) continue;
-
-	VW_ASSERT(0 <= camera_index && camera_index < num_cameras,
-		  ArgumentErr() << "Out of bounds in the number of cameras");
-
-	VW_ASSERT(0 <= m_start_index && m_start_index <= camera_index
-		  && camera_index < m_end_index && m_end_index <= num_cameras,
-		  ArgumentErr() << "Book-keeping failure in camera indicies");
-
-	for (int p = 0; p < NUM_CAMERA_PARAMS; p++) {
-	  local_cameras_vec[NUM_CAMERA_PARAMS*camera_index + p] = camera[p];
-	}
+      int num_cameras = m_cameras_vec.size()/NUM_CAMERA_PARAMS;
+      VW_ASSERT(0 <= m_stencil.beg && m_stencil.beg < m_stencil.end
+		&& m_stencil.end <= num_cameras,
+		ArgumentErr() << "Book-keeping failure in camera indicies");
+
+      // Read the adjustments in the stencil, using the latest values
+      // for the ones being floated.
+      const T* floated[4] = {camera1, camera2, camera3, camera4};
+      int num_adj = m_stencil.end - m_stencil.beg;
+      std::vector<vw::Vector3> position_adjustments(num_adj);
+      std::vector<vw::Quat>    pose_adjustments(num_adj);
+      for (int k = 0; k < num_adj; k++) {
+        int camera_index = m_stencil.beg + k;
+        const T* camera = NULL;
+        for (int i = 0; i < 4; i++) {
+          if (m_camera_indices[i] == camera_index && floated[i] != NULL)
+            camera = floated[i];
+        }
+        if (camera != NULL)
+          read_adjustment(camera, position_adjustments[k], pose_adjustments[k]);
+        else
+          read_adjustment(&m_cameras_vec[NUM_CAMERA_PARAMS*camera_index],
+                          position_adjustments[k], pose_adjustments[k]);
       }
 
-      // Extract the adjustments specific to the current camera
-      std::vector<vw::Vector3> position_adjustments;
-      std::vector<vw::Quat>   pose_adjustments;
-      populate_adjustements(local_cameras_vec,
-			    m_start_index, m_end_index,
-			    position_adjustments, pose_adjustments);
-
-      // The adjusted camera has just the adjustments, it does not create a full
-      // copy of the camera.
-      int interp_type = stereo_settings().piecewise_adjustment_interp_type;
-
-      asp::AdjustedModelWrapper cam_wrapper(m_session, m_cam,
-                                            interp_type,
-                                            m_adjustment_bounds,
-                                            position_adjustments, pose_adjustments,
-                                            m_image_size);
-      
       // Copy the input data to structures expected by the BA model
       Vector3 point_vec;
       for (size_t p = 0; p < point_vec.size(); p++)
 	point_vec[p]  = (double)point[p];
 
-      // Project the current point into the current camera.  Note that
+      // The adjusted camera has just the adjustments, it does not create a full
+      // copy of the camera. Project the current point into it. Note that
       // we pass the observation as an initial guess, as the
       // prediction is hopefully not too far from it.
-      Vector2 prediction = cam_wrapper.point_to_pixel(point_vec, m_observation.y());
+      int interp_type = stereo_settings().piecewise_adjustment_interp_type;
+      Vector2 prediction;
+      if (m_is_dg) {
+        asp::AdjustedLinescanDGModel adj_cam(m_cam, interp_type, m_stencil.adjustment_bounds,
+                                             position_adjustments, pose_adjustments,
+                                             m_image_size);
+        prediction = adj_cam.point_to_pixel(point_vec, m_observation.y());
+      } else {
+        asp::PiecewiseAdjustedLinescanModel adj_cam(m_cam, interp_type,
+                                                    m_stencil.adjustment_bounds,
+                                                    position_adjustments, pose_adjustments,
+                                                    m_image_size);
+        prediction = adj_cam.point_to_pixel(point_vec, m_observation.y());
+      }
 
       // The error is the difference between the predicted and observed position,
       // normalized by sigma.
@@ -318,86 +349,60 @@ struct PiecewiseReprojectionError {
   // the client code.
   static ceres::CostFunction* Create(Vector2 const& observation,
 				     Vector2 const& pixel_sigma,
-				     Vector2 const& adjustment_bounds,
+				     JitterStencil const& stencil,
 				     std::vector<double> const& cameras_vec,
 				     boost::shared_ptr<vw::camera::CameraModel> cam,
 				     Vector2i const& image_size,
 				     std::string const& session,
-				     int start_index,
 				     int camera_index1,
 				     int camera_index2,
 				     int camera_index3,
 				     int camera_index4,
-				     int end_index,
 				     size_t ipt // point index
 				     ){
 
+    PiecewiseReprojectionError * error
+      = new PiecewiseReprojectionError(observation, pixel_sigma, stencil,
+                                       cameras_vec, cam, image_size, session,
+                                       camera_index1, camera_index2,
+                                       camera_index3, camera_index4,
+                                       ipt);
+
     if (camera_index2 < 0 && camera_index3 < 0 && camera_index4 < 0)
       return (new ceres::NumericDiffCostFunction<PiecewiseReprojectionError,
-	      ceres::CENTRAL, 2, NUM_CAMERA_PARAMS, NUM_POINT_PARAMS>
-	      (new PiecewiseReprojectionError(observation, pixel_sigma, adjustment_bounds,
-					      cameras_vec, cam, image_size, session,
-					      start_index,
-					      camera_index1, camera_index2,
-					      camera_index3, camera_index4,
-					      end_index,
-					      ipt)));
+	      ceres::CENTRAL, 2, NUM_CAMERA_PARAMS, NUM_POINT_PARAMS>(error));
 
     if (camera_index3 < 0 && camera_index4 < 0)
       return (new ceres::NumericDiffCostFunction<PiecewiseReprojectionError,
-	      ceres::CENTRAL, 2, NUM_CAMERA_PARAMS, NUM_CAMERA_PARAMS, NUM_POINT_PARAMS>
-	      (new PiecewiseReprojectionError(observation, pixel_sigma, adjustment_bounds,
-					      cameras_vec, cam, image_size, session,
-					      start_index,
-					      camera_index1, camera_index2,
-					      camera_index3, camera_index4,
-					      end_index,
-					      ipt)));
+	      ceres::CENTRAL, 2, NUM_CAMERA_PARAMS, NUM_CAMERA_PARAMS, NUM_POINT_PARAMS>(error));
 
     if (camera_index4 < 0)
       return (new ceres::NumericDiffCostFunction<PiecewiseReprojectionError,
 	      ceres::CENTRAL, 2, NUM_CAMERA_PARAMS, NUM_CAMERA_PARAMS,
-              NUM_CAMERA_PARAMS, NUM_POINT_PARAMS>
-	      (new PiecewiseReprojectionError(observation, pixel_sigma, adjustment_bounds,
-					      cameras_vec, cam, image_size, session,
-					      start_index,
-					      camera_index1, camera_index2,
-					      camera_index3, camera_index4,
-					      end_index,
-					      ipt)));
-
-    if (camera_index1 < 0 || camera_index2 < 0 || camera_index3 < 0)
+              NUM_CAMERA_PARAMS, NUM_POINT_PARAMS>(error));
+
+    if (camera_index1 < 0 || camera_index2 < 0 || camera_index3 < 0) {
+      delete error;
       vw_throw( ArgumentErr() << "Book-keeping failure in camera indices: "
 		<< camera_index1 << ' ' << camera_index2 << ' ' << camera_index3 << ".\n" );
-
+    }
 
     return (new ceres::NumericDiffCostFunction<PiecewiseReprojectionError,
 	    ceres::CENTRAL, 2, NUM_CAMERA_PARAMS, NUM_CAMERA_PARAMS,
-            NUM_CAMERA_PARAMS, NUM_CAMERA_PARAMS, NUM_POINT_PARAMS>
-	    (new PiecewiseReprojectionError(observation, pixel_sigma, adjustment_bounds,
-					    cameras_vec, cam, image_size, session,
-					    start_index,
-					    camera_index1, camera_index2,
-					    camera_index3, camera_index4,
-					    end_index,
-					    ipt)));
+            NUM_CAMERA_PARAMS, NUM_CAMERA_PARAMS, NUM_POINT_PARAMS>(error));
   }
 
   Vector2 m_observation;
   Vector2 m_pixel_sigma;
-  Vector2 m_adjustment_bounds;
+  JitterStencil m_stencil;
   std::vector<double> const& m_cameras_vec;  // alias
   boost::shared_ptr<vw::camera::CameraModel> m_cam;
   Vector2i m_image_size; // TODO: Group this with the above
-  std::string m_session;
-								   
-  // all adjustments for the current camera will be >= this
-  int m_start_index;
+  bool m_is_dg;
 
   // indices of the current adjustments
-  int m_camera_index1, m_camera_index2, m_camera_index3, m_camera_index4;
+  int m_camera_indices[4];
 
-  int m_end_index;    // all adjustment indices for current camera will be < this
   int m_ipt;          // index of the current 3D point in the vector of points
 };
 
@@ -484,7 +489,7 @@ void jitter_adjust(std::vector<std::string> const& image_files,
                    const& input_camera_models,
                    std::string const& out_prefix,
                    std::string const& session,
-                   std::string const& match_file,
+                   std::map< std::pair<int, int>, std::string> const& match_files,
                    int num_threads){
 
   vw_out() << "Performing piecewise adjustments to correct for jitter.\n";
@@ -493,11 +498,8 @@ void jitter_adjust(std::vector<std::string> const& image_files,
     vw_throw( ArgumentErr() << "Expecting as many images as cameras.\n" );
 
   int num_cameras = input_camera_models.size();
-  if (num_cameras != 2)
-    vw_throw( ArgumentErr() << "Can solve for jitter only for two cameras.\n" );
-
-  std::map< std::pair<int, int>, std::string> match_files;
-  match_files[std::pair<int, int>(0, 1)] = match_file;
+  if (num_cameras < 2)
+    vw_throw( ArgumentErr() << "Can solve for jitter only for two or more cameras.\n" );
 
   int min_matches = 30;   // TODO: Think more here
   double min_angle = 0.1; // in degrees
@@ -516,15 +518,29 @@ void jitter_adjust(std::vector<std::string> const& image_files,
 
   int num_points = cnet.size();
 
-  // Create the adjustment bounds based on percentiles of interest points.
-  std::vector<Vector2> adjustment_bounds;
-  adjustment_bounds.resize(num_cameras);
-  std::vector<ip::InterestPoint> ip0, ip1;
-  ip::read_binary_match_file(match_file, ip0, ip1);
-  adjustment_bounds[0]
-    = find_bounds_from_percentiles(ip0, stereo_settings().piecewise_adjustment_percentiles);
-  adjustment_bounds[1]
-    = find_bounds_from_percentiles(ip1, stereo_settings().piecewise_adjustment_percentiles);
+  // Create the adjustment bounds based on percentiles of interest
+  // points. Each image pools its interest points from all its matches.
+  std::vector< std::vector<ip::InterestPoint> > image_ip(num_cameras);
+  typedef std::map< std::pair<int, int>, std::string>::const_iterator match_iter;
+  for (match_iter it = match_files.begin(); it != match_files.end(); it++) {
+    int left_index = it->first.first, right_index = it->first.second;
+    VW_ASSERT(0 <= left_index  && left_index  < num_cameras &&
+              0 <= right_index && right_index < num_cameras,
+              ArgumentErr() << "Out of bounds in the number of cameras");
+    std::vector<ip::InterestPoint> left_ip, right_ip;
+    ip::read_binary_match_file(it->second, left_ip, right_ip);
+    image_ip[left_index ].insert(image_ip[left_index ].end(), left_ip.begin(),  left_ip.end());
+    image_ip[right_index].insert(image_ip[right_index].end(), right_ip.begin(), right_ip.end());
+  }
+  std::vector<Vector2> adjustment_bounds(num_cameras);
+  for (int icam = 0; icam < num_cameras; icam++) {
+    if (image_ip[icam].empty())
+      vw_throw( ArgumentErr() << "No matches for image " << image_files[icam]
+                << ". Cannot solve for its jitter.\n" );
+    adjustment_bounds[icam]
+      = find_bounds_from_percentiles(image_ip[icam],
+                                     stereo_settings().piecewise_adjustment_percentiles);
+  }
 
   for (int icam = 0; icam < num_cameras; icam++)
     vw_out() << "Placing first and last adjustment for image "
@@ -649,6 +665,14 @@ void jitter_adjust(std::vector<std::string> const& image_files,
                                           adjustment_bounds[icam],
                                           position_adjustments, pose_adjustments,
                                           image_size);
+
+    // See if the first adjustment is placed at the last line.
+    bool reversed = false;
+    if (session == "dg" || session == "dgmaprpc") {
+      DGCameraModel * dg_cam = get_dg_ptr(camera_models[icam]);
+      reversed = (dg_cam->get_time_at_line(adjustment_bounds[icam][1]) <
+                  dg_cam->get_time_at_line(adjustment_bounds[icam][0]));
+    }
     
     typedef CameraNode<JFeature>::iterator crn_iter;
     for (crn_iter fiter = crn[icam].begin(); fiter != crn[icam].end(); fiter++){
@@ -695,16 +719,20 @@ void jitter_adjust(std::vector<std::string> const& image_files,
 
       ceres::LossFunction* loss_function = get_jitter_loss_function();
 
+      int min_index = start_index + *std::min_element(indices.begin(), indices.end());
+      int max_index = start_index + *std::max_element(indices.begin(), indices.end());
+      JitterStencil stencil = make_jitter_stencil(adjustment_bounds[icam],
+                                                  start_index, end_index,
+                                                  min_index, max_index, reversed);
+
       ceres::CostFunction* cost_function
 	= PiecewiseReprojectionError::Create(observation, pixel_sigma,
-					     adjustment_bounds[icam],
+					     stencil,
 					     cameras_vec, camera_models[icam],
 					     sizes[icam],
 					     session,
-					     start_index,
 					     camera_index1, camera_index2,
 					     camera_index3, camera_index4,
-					     end_index,
 					     ipt);
       if      (camera_index2 < 0) {
 	problem.AddResidualBlock(cost_function, loss_function,
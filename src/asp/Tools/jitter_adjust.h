@@ -20,6 +20,7 @@
 #define __ASP_TOOLS_JITTERADJUST_H__
 
 #include <vw/Camera/CameraModel.h>
+#include <map>
 
 namespace asp{
 
@@ -28,7 +29,7 @@ namespace asp{
                      std::vector< boost::shared_ptr<vw::camera::CameraModel> > const& camera_models,
                      std::string const& out_prefix,
 		     std::string const& session,
-                     std::string const& match_file,
+                     std::map< std::pair<int, int>, std::string> const& match_files,
                      int num_threads);
 }
 
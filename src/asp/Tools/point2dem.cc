@@ -829,6 +829,34 @@ namespace asp{
 
 } // end namespace asp
 
+/// Remove a temporary file when going out of scope, also if an
+/// exception is thrown, unless it was already removed.
+class TmpFileRemover {
+  std::string m_file;
+public:
+  void set(std::string const& file) { m_file = file; }
+  void remove() {
+    if (m_file.empty())
+      return;
+    boost::system::error_code ec; // do not throw, as this is called from the destructor
+    fs::remove(m_file, ec);
+    m_file = "";
+  }
+  ~TmpFileRemover() { remove(); }
+};
+
+/// Add a texture to be rasterized as the next plane of the products,
+/// replacing the height while it is not needed as the first plane.
+template <class TextureT>
+void add_product_plane(asp::OrthoRasterizerView& rasterizer, bool & replace_height,
+                       TextureT texture) {
+  if (replace_height)
+    rasterizer.set_texture(texture);
+  else
+    rasterizer.add_texture(texture);
+  replace_height = false;
+}
+
 void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
                                Options& opt,
                                cartography::GeoReference& georef,
@@ -879,8 +907,79 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
     opt.rounding_error = 0.0;
   }
 
-  ImageViewRef< PixelGray<float> > rasterizer_fsaa
-    = generate_fsaa_raster( rasterizer, opt );
+  // The DEM, the intersection error, and the orthoimage are
+  // rasterized in a single pass over the point cloud, as planes of a
+  // temporary image, from which each product is then written. The
+  // orthoimage with hole-filling needs a different point image, so it
+  // gets its own pass at the end. The height is the first plane,
+  // unless no DEM is written, when the next plane replaces it.
+  rasterizer.set_texture(select_channel(rasterizer.get_point_image(), 2));
+  bool replace_height = opt.no_dem;
+  int  err_plane      = opt.no_dem ? 0 : 1;
+
+  // Stop the program if it is going to create too large a DEM, this
+  // will cause a crash. Check this before any rasterization is done.
+  Vector2i dem_size = bounding_box(generate_fsaa_raster(rasterizer, opt)).size();
+  if ( !opt.no_dem &&
+       ((dem_size[0] > opt.max_output_size[0]) || (dem_size[1] > opt.max_output_size[1])) )
+    vw_throw( ArgumentErr()
+              << "Requested DEM size is too large, max allowed output size is "
+              << opt.max_output_size << " pixels.\n" );
+
+  int num_error_planes = 0;
+  if ( opt.do_error ) {
+    int num_channels = asp::num_channels(opt.pointcloud_files);
+    if (num_channels == 4){
+      // The error is a scalar.
+      ImageViewRef<Vector4> point_disk_image
+        = asp::form_point_cloud_composite<Vector4>
+        (opt.pointcloud_files, ASP_MAX_SUBBLOCK_SIZE);
+      add_product_plane(rasterizer, replace_height, select_channel(point_disk_image, 3));
+      num_error_planes = 1;
+    }else if (num_channels == 6){
+      // The error is a 3D vector. Convert it to NED coordinate system, and rasterize it.
+      ImageViewRef<Vector6> point_disk_image = asp::form_point_cloud_composite<Vector6>
+        (opt.pointcloud_files, ASP_MAX_SUBBLOCK_SIZE);
+      ImageViewRef<Vector3> ned_err = asp::error_to_NED(point_disk_image, georef);
+      for (int ch_index = 0; ch_index < 3; ch_index++)
+        add_product_plane(rasterizer, replace_height, select_channel(ned_err, ch_index));
+      num_error_planes = 3;
+    }else{
+      // Note: We don't throw here. We still would like to write the
+      // DRG (below) even if we can't write the error image.
+      vw_out() << "The point cloud files must have an equal number of channels which "
+               << "must be 4 or 6 to be able to process the intersection error.\n";
+    }
+  }
+
+  bool ortho_in_shared_pass = (opt.do_ortho && opt.ortho_hole_fill_len <= 0);
+  if (ortho_in_shared_pass)
+    add_product_plane(rasterizer, replace_height,
+                      asp::form_point_cloud_composite< PixelGray<float> >
+                      (opt.texture_files, ASP_MAX_SUBBLOCK_SIZE));
+
+  // A single plane needs no temporary file, and is computed only if
+  // its product is written.
+  int num_planes = rasterizer.planes();
+  TmpFileRemover products_remover; // before the planes, so they are released first
+  std::vector< ImageViewRef< PixelGray<float> > > rasterized(num_planes);
+  if (num_planes == 1) {
+    rasterized[0] = rasterizer;
+  } else {
+    std::string products_file = opt.out_prefix + "-products.tmp.tif";
+    products_remover.set(products_file);
+    vw_out() << "Writing: " << products_file << "\n";
+    bool has_georef = false, has_nodata = false;
+    vw::cartography::block_write_gdal_image(products_file, rasterizer,
+                                            has_georef, georef,
+                                            has_nodata, opt.nodata_value, opt,
+                                            TerminalProgressCallback("asp", "\t--> Rasterizing: "));
+    DiskImageView<float> products(products_file);
+    for (int k = 0; k < num_planes; k++)
+      rasterized[k] = pixel_cast< PixelGray<float> >(select_plane(products, k));
+  }
+
+  ImageViewRef< PixelGray<float> > rasterizer_fsaa;
 
   // Write out the DEM. We've set the texture to be the height.
   Vector2 tile_size(vw_settings().default_tile_size(),
@@ -888,6 +987,7 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
   if ( !opt.no_dem ){
     Stopwatch sw2;
     sw2.start();
+    rasterizer_fsaa = generate_fsaa_raster( rasterized[0], opt );
     ImageViewRef< PixelGray<float> > dem
       = asp::round_image_pixels_skip_nodata(rasterizer_fsaa, opt.rounding_error,
                                             opt.nodata_value);
@@ -904,14 +1004,7 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
          opt.nodata_value);
     }
 
-    // Stop the program if it is going to create too large a DEM, this will cause a crash.
-    Vector2i dem_size = bounding_box(dem).size();
     vw_out()<< "Creating output file that is " << dem_size << " px.\n";
-    if ((dem_size[0] > opt.max_output_size[0]) || (dem_size[1] > opt.max_output_size[1]))
-      vw_throw( ArgumentErr()
-                << "Requested DEM size is too large, max allowed output size is "
-                << opt.max_output_size << " pixels.\n" );
-
     asp::save_image(opt, dem, georef, hole_fill_len, "DEM");
     sw2.stop();
     vw_out(DebugMessage,"asp") << "DEM render time: " << sw2.elapsed_seconds() << ".\n";
@@ -926,46 +1019,26 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
   }
 
   // Write triangulation error image if requested
-  if ( opt.do_error ) {
-    int num_channels = asp::num_channels(opt.pointcloud_files);
-
+  if ( num_error_planes == 1 ) {
     int hole_fill_len = 0;
-    if (num_channels == 4){
-      // The error is a scalar.
-      ImageViewRef<Vector4> point_disk_image
-        = asp::form_point_cloud_composite<Vector4>
-        (opt.pointcloud_files, ASP_MAX_SUBBLOCK_SIZE);
-      ImageViewRef<double> error_channel = select_channel(point_disk_image,3);
-      rasterizer.set_texture( error_channel );
-      rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
-      save_image(opt, asp::round_image_pixels_skip_nodata(rasterizer_fsaa,
-                                                          opt.rounding_error,
-                                                          opt.nodata_value),
-                 georef, hole_fill_len, "IntersectionErr");
-    }else if (num_channels == 6){
-      // The error is a 3D vector. Convert it to NED coordinate system, and rasterize it.
-      ImageViewRef<Vector6> point_disk_image = asp::form_point_cloud_composite<Vector6>
-        (opt.pointcloud_files, ASP_MAX_SUBBLOCK_SIZE);
-      ImageViewRef<Vector3> ned_err = asp::error_to_NED(point_disk_image, georef);
-      std::vector< ImageViewRef< PixelGray<float> > >  rasterized(3);
-      for (int ch_index = 0; ch_index < 3; ch_index++){
-        ImageViewRef<double> ch = select_channel(ned_err, ch_index);
-        rasterizer.set_texture(ch);
-        rasterizer_fsaa = generate_fsaa_raster( rasterizer, opt );
-        rasterized[ch_index] =
-          block_cache(rasterizer_fsaa, tile_size, opt.num_threads);
-      }
-      save_image(opt, asp::round_image_pixels_skip_nodata
-                              (asp::combine_channels(opt.nodata_value, rasterized[0], 
-                                                     rasterized[1], rasterized[2]),
-                               opt.rounding_error, opt.nodata_value),
-                 georef, hole_fill_len, "IntersectionErr");
-    }else{
-      // Note: We don't throw here. We still would like to write the
-      // DRG (below) even if we can't write the error image.
-      vw_out() << "The point cloud files must have an equal number of channels which "
-               << "must be 4 or 6 to be able to process the intersection error.\n";
+    rasterizer_fsaa = generate_fsaa_raster( rasterized[err_plane], opt );
+    save_image(opt, asp::round_image_pixels_skip_nodata(rasterizer_fsaa,
+                                                        opt.rounding_error,
+                                                        opt.nodata_value),
+               georef, hole_fill_len, "IntersectionErr");
+  }else if ( num_error_planes == 3 ) {
+    int hole_fill_len = 0;
+    std::vector< ImageViewRef< PixelGray<float> > > ned_rasterized(3);
+    for (int ch_index = 0; ch_index < 3; ch_index++){
+      rasterizer_fsaa = generate_fsaa_raster( rasterized[err_plane + ch_index], opt );
+      ned_rasterized[ch_index] =
+        block_cache(rasterizer_fsaa, tile_size, opt.num_threads);
     }
+    save_image(opt, asp::round_image_pixels_skip_nodata
+                            (asp::combine_channels(opt.nodata_value, ned_rasterized[0], 
+                                                   ned_rasterized[1], ned_rasterized[2]),
+                             opt.rounding_error, opt.nodata_value),
+               georef, hole_fill_len, "IntersectionErr");
   }
 
   // Write out a normalized version of the DEM, if requested (for debugging)
@@ -982,9 +1055,22 @@ void do_software_rasterization(asp::OrthoRasterizerView& rasterizer,
   }
 
   // Write DRG if the user requested and provided a texture file.
-  // This must be at the end, as we may be messing with the point
-  // image in irreversible ways.
-  if (opt.do_ortho) {
+  if (ortho_in_shared_pass) {
+    Stopwatch sw3;
+    sw3.start();
+    rasterizer_fsaa = generate_fsaa_raster(rasterized[num_planes - 1], opt);
+    asp::save_image(opt, rasterizer_fsaa, georef, 0, "DRG");
+    sw3.stop();
+    vw_out(DebugMessage,"asp") << "DRG render time: " << sw3.elapsed_seconds() << "\n";
+  }
+
+  // The products are all written, so the rasterized planes can go
+  rasterized.clear();
+  products_remover.remove();
+
+  // Write DRG with hole-filling in its own pass. This must be at the
+  // end, as we may be messing with the point image in irreversible ways.
+  if (opt.do_ortho && !ortho_in_shared_pass) {
 
     Stopwatch sw3;
     sw3.start();
@@ -1100,9 +1186,34 @@ void do_software_rasterization_multi_spacing(const ImageViewRef<Vector3>& proj_p
 
   std::string base_out_prefix = opt.out_prefix;
 
+  // With several spacings, reading, projecting, and filtering the
+  // cloud would be redone for each of them. Do it once and save the
+  // filtered points to a temporary file, which is then shared. The
+  // orthoimage hole-filling must start from filtered points as well,
+  // as outliers are removed before holes are filled, so the file is
+  // made for it also with one spacing.
+  bool ortho_hole_fill = (opt.do_ortho && opt.ortho_hole_fill_len > 0);
+  TmpFileRemover filtered_remover;
+  if (opt.dem_spacing.size() > 1 || ortho_hole_fill) {
+    std::string filtered_file = base_out_prefix + "-filtered-cloud.tmp.tif";
+    filtered_remover.set(filtered_file);
+    vw_out() << "Writing: " << filtered_file << "\n";
+    bool has_georef = false, has_nodata = false;
+    vw::cartography::block_write_gdal_image(filtered_file, asp::PointFilterView(rasterizer),
+                                            has_georef, georef, has_nodata,
+                                            opt.nodata_value, opt,
+                                            TerminalProgressCallback("asp", "\t--> Filtering: "));
+    rasterizer.set_filtered_point_image(DiskImageView<Vector3>(filtered_file));
+  }
+
+  // The orthoimage hole-filling replaces the point image, so
+  // restore it for each spacing.
+  ImageViewRef<Vector3> point_image = rasterizer.get_point_image();
+
   // Call the function for each dem spacing
   for (size_t i = 0; i < opt.dem_spacing.size(); i++) {
     double this_spacing = opt.dem_spacing[i];
+    rasterizer.set_point_image(point_image);
 
     // Required second init step for each spacing
     rasterizer.initialize_spacing(this_spacing);
@@ -31,6 +31,8 @@
 
 #include <vw/Cartography/PointImageManipulation.h>
 #include <vw/Core/Stopwatch.h>
+#include <vw/Core/ThreadPool.h>
+#include <vw/Image/UtilityViews.h>
 #include <vw/Math/Statistics.h>
 
 using namespace vw;
@@ -246,6 +248,82 @@ void find_error_image_and_do_stats(Options& opt, ImageViewRef<double> & error_im
            << opt.max_valid_triangulation_error << "." << std::endl;
 }
 
+// The points of one block of the cloud which are to be saved, and
+// their intensities, if these are to be saved.
+struct LasBlock {
+  std::vector<Vector3>       points;
+  std::vector<std::uint16_t> intensities;
+  long long int              num_total_points;
+  LasBlock(): num_total_points(0) {}
+};
+
+// Rasterize a block of the cloud and of the error image, and find the
+// points to save. This is where the reading, geodetic conversion and
+// projection happen, so blocks are processed in parallel, and only the
+// writing of the results is sequential.
+class LasBlockTask: public Task, private boost::noncopyable {
+  ImageViewRef<Vector3> const& m_point_image;
+  ImageViewRef<double>  const& m_error_image;
+  BBox2i                       m_block;
+  bool                         m_is_geodetic;
+  Options               const& m_opt;
+  LasBlock                   & m_result;
+public:
+  LasBlockTask(ImageViewRef<Vector3> const& point_image,
+               ImageViewRef<double>  const& error_image,
+               BBox2i const& block, bool is_geodetic,
+               Options const& opt, LasBlock & result):
+    m_point_image(point_image), m_error_image(error_image), m_block(block),
+    m_is_geodetic(is_geodetic), m_opt(opt), m_result(result) {}
+
+  void operator()() {
+
+    // The error image is empty if the cloud has no error channels
+    bool use_error = (m_error_image.cols() > 0 && m_error_image.rows() > 0 &&
+                      (m_opt.max_valid_triangulation_error > 0.0 ||
+                       m_opt.triangulation_error_factor > 0.0));
+    ImageView<Vector3> points = crop(m_point_image, m_block);
+    ImageView<double>  errors;
+    if (use_error)
+      errors = crop(m_error_image, m_block);
+    else
+      errors = constant_view(0.0, points.cols(), points.rows());
+
+    m_result.points.reserve(points.cols() * points.rows());
+    for (int row = 0; row < points.rows(); row++) {
+      for (int col = 0; col < points.cols(); col++) {
+
+        Vector3 const& point = points(col, row);
+
+        // Skip no-data points
+        bool is_good = ( (!m_is_geodetic && point != vw::Vector3()) ||
+                         (m_is_geodetic  && !boost::math::isnan(point.z())) );
+        if (!is_good) continue;
+
+        m_result.num_total_points++;
+
+        if (m_opt.max_valid_triangulation_error > 0.0 &&
+            errors(col, row) > m_opt.max_valid_triangulation_error)
+          continue;
+
+        m_result.points.push_back(point);
+
+        if (m_opt.triangulation_error_factor > 0.0) {
+          // Scale the triangulation error, clamp it, and save it as
+          // uint16.  The LAS 1.2 format has no fields (apart from the
+          // taken already x, y, and z) with 32-bit values, so uint16
+          // is all one can do.
+          double scaled_error = m_opt.triangulation_error_factor * errors(col, row);
+          scaled_error = round(scaled_error);
+          scaled_error = std::max(scaled_error, 0.0); // should not be necessary
+          scaled_error = std::min(scaled_error, double(std::numeric_limits<std::uint16_t>::max()));
+          m_result.intensities.push_back(std::uint16_t(scaled_error));
+        }
+      }
+    }
+  }
+};
+
 int main( int argc, char *argv[] ) {
   
   // TODO(oalexan1): need to understand what is the optimal strategy
@@ -337,48 +415,46 @@ int main( int argc, char *argv[] ) {
     TerminalProgressCallback tpc("asp", "\t--> ");
     long long int num_total_points = 0;
     long long int num_kept_points = 0;
-    
-    for (int row = 0; row < point_image.rows(); row++){
-      tpc.report_fractional_progress(row, point_image.rows());
-      for (int col = 0; col < point_image.cols(); col++){
-
-        Vector3 point = point_image(col, row);
-
-        // Skip no-data points
-        bool is_good = ( (!is_geodetic && point != vw::Vector3()) ||
-                         (is_geodetic  && !boost::math::isnan(point.z())) );
-        if (!is_good) continue;
-
-        num_total_points++;
-        
-        if (opt.max_valid_triangulation_error > 0.0 &&
-            error_image(col, row) > opt.max_valid_triangulation_error) 
-          continue;
 
-        num_kept_points++;
+    // Process the cloud in batches of blocks. The blocks in a batch
+    // are rasterized in parallel, then written in order, so the output
+    // does not depend on the number of threads.
+    int num_threads = vw_settings().default_num_threads();
+    int block_size  = opt.raster_tile_size[0];
+    std::vector<BBox2i> blocks = subdivide_bbox(point_image, block_size, block_size);
+    size_t batch_size = 2 * num_threads;
+    for (size_t beg = 0; beg < blocks.size(); beg += batch_size) {
+      tpc.report_fractional_progress(beg, blocks.size());
+      size_t end = std::min(beg + batch_size, blocks.size());
+
+      std::vector<LasBlock> las_blocks(end - beg);
+      FifoWorkQueue queue(num_threads);
+      for (size_t it = beg; it < end; it++) {
+        boost::shared_ptr<Task>
+          task(new LasBlockTask(point_image, error_image, blocks[it], is_geodetic,
+                                opt, las_blocks[it - beg]));
+        queue.add_task(task);
+      }
+      queue.join_all();
+
+      for (size_t it = 0; it < las_blocks.size(); it++) {
+        LasBlock const& las_block = las_blocks[it];
+        num_total_points += las_block.num_total_points;
+        num_kept_points  += las_block.points.size();
+        for (size_t pt = 0; pt < las_block.points.size(); pt++) {
+          Vector3 const& point = las_block.points[pt];
 #if 0
-        // For comparison later with las2txt.
-        std::cout.precision(16);
-        std::cout << "\npoint " << point[0] << ' ' << point[1] << ' '
-                  << point[2] << std::endl;
+          // For comparison later with las2txt.
+          std::cout.precision(16);
+          std::cout << "\npoint " << point[0] << ' ' << point[1] << ' '
+                    << point[2] << std::endl;
 #endif
-
-        liblas::Point las_point(&header);
-        las_point.SetCoordinates(point[0], point[1], point[2]);
-
-        if (opt.triangulation_error_factor > 0.0) {
-          // Scale the triangulation error, clamp it, and save it as
-          // uint16.  The LAS 1.2 format has no fields (apart from the
-          // taken already x, y, and z) with 32-bit values, so uint16
-          // is all one can do.
-          double scaled_error = opt.triangulation_error_factor * error_image(col, row);
-          scaled_error = round(scaled_error);
-          scaled_error = std::max(scaled_error, 0.0); // should not be necessary
-          scaled_error = std::min(scaled_error, double(std::numeric_limits<std::uint16_t>::max()));
-          las_point.SetIntensity(std::uint16_t(scaled_error));
+          liblas::Point las_point(&header);
+          las_point.SetCoordinates(point[0], point[1], point[2]);
+          if (opt.triangulation_error_factor > 0.0)
+            las_point.SetIntensity(las_block.intensities[pt]);
+          writer.WritePoint(las_point);
         }
-          
-        writer.WritePoint(las_point);
       }
     }
     tpc.report_finished();
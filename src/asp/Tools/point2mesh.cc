@@ -32,6 +32,7 @@
 #include <vw/Image/MaskViews.h>
 #include <asp/Core/PointUtils.h>
 #include <vw/Image/Manipulation.h>
+#include <vw/Image/BlockRasterize.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
 
@@ -97,16 +98,18 @@ inline bool is_valid_pt(Vector3 const& P) {
   return true;
 }
 
-// Add a given vertex to the .obj file unless already present
-inline void add_vertex(Vector3 const& V, std::pair<int, int> const& pix,
+// Add the vertex at the given pixel to the .obj file unless already
+// present. The vertex indices of the pixels in a row of the cloud are
+// kept in a vector, with 0 meaning the vertex was not added yet.
+inline void add_vertex(Vector3 const& V, int col, int row,
                        int cloud_cols, int cloud_rows,
                        std::ofstream & ofs,
-                       std::map<std::pair<int, int>, int> & pix_to_vertex,
+                       std::vector<int> & row_to_vertex,
                        int & vertex_count) {
-  if (pix_to_vertex.find(pix) == pix_to_vertex.end()) {
+  if (row_to_vertex[col] == 0) {
     ofs << "v " << V[0] << " " << V[1] << " " << V[2] << '\n';
 
-    double u = double(pix.first)/cloud_cols;
+    double u = double(col)/cloud_cols;
     
     // TODO(oalexan1). Study this. The second option looks more accurate.
     // In the second option the lower-left pixel (0, cloud_rows - 1)
@@ -115,18 +118,29 @@ inline void add_vertex(Vector3 const& V, std::pair<int, int> const& pix,
     // In some places on the net I even saw a subpixel shift of (0.5, 0.5)
     // which makes things even more complicated.
 #if 0
-    double v = double(pix.second)/cloud_rows;
+    double v = double(row)/cloud_rows;
     ofs << "vt " << u  << ' ' << 1.0 - v << std::endl;
 #else
-    double v = double(cloud_rows - 1 - pix.second)/cloud_rows;
-    ofs << "vt " << u  << ' ' << v << std::endl;
+    double v = double(cloud_rows - 1 - row)/cloud_rows;
+    ofs << "vt " << u  << ' ' << v << '\n';
 #endif
     
-    pix_to_vertex[pix] = vertex_count;
+    row_to_vertex[col] = vertex_count;
     vertex_count++;
   }
 }
 
+// Write a face given the indices of its vertices
+inline void add_face(int i0, int i1, int i2, std::ofstream & ofs) {
+  ofs << "f "
+      << i0 << "/" << i0 << " "
+      << i1 << "/" << i1 << " "
+      << i2 << "/" << i2 << '\n';
+}
+
+// Write the mesh while streaming the cloud in strips of rows. Each
+// face is written as soon as its vertices are, so only the vertex
+// indices of two rows of the cloud are kept in memory.
 void save_mesh(std::string const& output_prefix,
                std::string const& output_prefix_no_dir,
                ImageViewRef<Vector3> point_cloud,
@@ -141,69 +155,66 @@ void save_mesh(std::string const& output_prefix,
   // Some constants for the calculation in here
   int cloud_cols = point_cloud.cols();
   int cloud_rows = point_cloud.rows();
+  if (cloud_cols < 2 || cloud_rows < 2)
+    return;
   
-  TerminalProgressCallback vertex_progress("asp", "\tVertices:   ");
-  double vertex_progress_mult = 1.0/double(std::max(cloud_cols - 1, 1));
+  TerminalProgressCallback progress("asp", "\tMesh:   ");
+  double progress_mult = 1.0/double(std::max(cloud_rows - 1, 1));
 
-  // Make sure we we save a vertex only once even if we encounter it
-  // multiple times.
-  std::map<std::pair<int, int>, int> pix_to_vertex;
-    
-  std::vector<Vector3i> faces;
+  // Vertex indices of the pixels in the current row and in the one below
+  std::vector<int> upper_vertex(cloud_cols, 0), lower_vertex(cloud_cols, 0);
+
+  // Read the cloud in strips, in parallel. Consecutive strips share a row.
+  int tile_size  = vw_settings().default_tile_size();
+  int strip_rows = tile_size;
   int vertex_count = 1; // The obj spec calls for the starting vertex to have index 1.
-  for (int col = 0; col < cloud_cols - 1; col++) {
-    vertex_progress.report_progress(col*vertex_progress_mult);
+  for (int strip_beg = 0; strip_beg < cloud_rows - 1; strip_beg += strip_rows) {
+    int strip_end = std::min(strip_beg + strip_rows + 1, cloud_rows);
+    BBox2i strip_box(0, strip_beg, cloud_cols, strip_end - strip_beg);
+    ImageView<Vector3> strip
+      = block_rasterize(crop(point_cloud, strip_box), Vector2i(tile_size, tile_size),
+                        vw_settings().default_num_threads());
     
-    for (int row = 0; row < cloud_rows - 1; row++) {
-      // We have a square that needs to be split into two triangles.
-      // Here the image is viewed as having the origin on the upper-left,
-      // the column axis going right, and the row axis going down.
-      std::pair<int, int> pix_ul = std::make_pair(col,     row);
-      std::pair<int, int> pix_ur = std::make_pair(col + 1, row);
-      std::pair<int, int> pix_ll = std::make_pair(col,     row + 1);
-      std::pair<int, int> pix_lr = std::make_pair(col + 1, row + 1);
-      Vector3 UL = point_cloud(pix_ul.first, pix_ul.second);
-      Vector3 UR = point_cloud(pix_ur.first, pix_ur.second);
-      Vector3 LL = point_cloud(pix_ll.first, pix_ll.second);
-      Vector3 LR = point_cloud(pix_lr.first, pix_lr.second);
-
-      if (is_valid_pt(UL) && is_valid_pt(LL) && is_valid_pt(UR)) {
-
-        add_vertex(UL - C, pix_ul, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-        add_vertex(LL - C, pix_ll, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-        add_vertex(UR - C, pix_ur, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-
-        Vector3 face(pix_to_vertex[pix_ul], pix_to_vertex[pix_ll], pix_to_vertex[pix_ur]);
-        faces.push_back(face);
-      }
+    for (int row = strip_beg; row < strip_end - 1; row++) {
+      progress.report_progress(row*progress_mult);
+      int r = row - strip_beg; // row in the strip
       
-      if (is_valid_pt(UR) && is_valid_pt(LL) && is_valid_pt(LR)) {
-
-        add_vertex(UR - C, pix_ur, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-        add_vertex(LL - C, pix_ll, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-        add_vertex(LR - C, pix_lr, cloud_cols, cloud_rows, ofs, pix_to_vertex, vertex_count);
-
-        Vector3 face(pix_to_vertex[pix_ur], pix_to_vertex[pix_ll], pix_to_vertex[pix_lr]);
-        faces.push_back(face);
-      }
+      for (int col = 0; col < cloud_cols - 1; col++) {
+        // We have a square that needs to be split into two triangles.
+        // Here the image is viewed as having the origin on the upper-left,
+        // the column axis going right, and the row axis going down.
+        Vector3 const& UL = strip(col,     r);
+        Vector3 const& UR = strip(col + 1, r);
+        Vector3 const& LL = strip(col,     r + 1);
+        Vector3 const& LR = strip(col + 1, r + 1);
+
+        if (is_valid_pt(UL) && is_valid_pt(LL) && is_valid_pt(UR)) {
+          add_vertex(UL - C, col,     row,     cloud_cols, cloud_rows, ofs,
+                     upper_vertex, vertex_count);
+          add_vertex(LL - C, col,     row + 1, cloud_cols, cloud_rows, ofs,
+                     lower_vertex, vertex_count);
+          add_vertex(UR - C, col + 1, row,     cloud_cols, cloud_rows, ofs,
+                     upper_vertex, vertex_count);
+          add_face(upper_vertex[col], lower_vertex[col], upper_vertex[col + 1], ofs);
+        }
       
+        if (is_valid_pt(UR) && is_valid_pt(LL) && is_valid_pt(LR)) {
+          add_vertex(UR - C, col + 1, row,     cloud_cols, cloud_rows, ofs,
+                     upper_vertex, vertex_count);
+          add_vertex(LL - C, col,     row + 1, cloud_cols, cloud_rows, ofs,
+                     lower_vertex, vertex_count);
+          add_vertex(LR - C, col + 1, row + 1, cloud_cols, cloud_rows, ofs,
+                     lower_vertex, vertex_count);
+          add_face(upper_vertex[col + 1], lower_vertex[col], lower_vertex[col + 1], ofs);
+        }
+      }
+
+      // Move down a row. The vertices of the lower row are reused.
+      upper_vertex.swap(lower_vertex);
+      std::fill(lower_vertex.begin(), lower_vertex.end(), 0);
     }
   }
-  vertex_progress.report_finished();
-
-  TerminalProgressCallback face_progress("asp", "\tFaces:   ");
-  double face_progress_mult = 1.0/double(std::max(faces.size(), size_t(1)));
-  for (size_t face_iter = 0; face_iter < faces.size(); face_iter++) {
-    face_progress.report_progress(face_iter*face_progress_mult);
-
-    Vector3 const& F = faces[face_iter]; // alias
-    ofs << "f "
-        << F[0] << "/" << F[0] << " "
-        << F[1] << "/" << F[1] << " "
-        << F[2] << "/" << F[2]
-        << std::endl;
-  }
-  face_progress.report_finished();
+  progress.report_finished();
 }
 
 
@@ -1253,7 +1253,8 @@ struct Options : public vw::cartography::GdalWriteOptions {
     save_dem_with_nodata, use_approx_camera_models, use_approx_adjusted_camera_models,
     use_rpc_approximation, use_semi_approx,
     crop_input_images, float_dem_at_boundary, boundary_fix, fix_dem, 
-    float_reflectance_model, float_sun_position, query, save_sparingly, float_haze;
+    float_reflectance_model, float_sun_position, query, save_sparingly, float_haze,
+    check_gradients;
   double smoothness_weight, integrability_weight, smoothness_weight_pq, init_dem_height, nodata_val,
     initial_dem_constraint_weight, albedo_constraint_weight, camera_position_step_size,
     rpc_penalty_weight, rpc_max_error, unreliable_intensity_threshold, robust_threshold, shadow_threshold;
@@ -1279,6 +1280,7 @@ struct Options : public vw::cartography::GdalWriteOptions {
             float_dem_at_boundary(false), boundary_fix(false), fix_dem(false),
             float_reflectance_model(false), float_sun_position(false),
             query(false), save_sparingly(false), float_haze(false),
+            check_gradients(false),
             smoothness_weight(0), integrability_weight(0), smoothness_weight_pq(0),
             initial_dem_constraint_weight(0.0),
             albedo_constraint_weight(0.0),
@@ -1317,6 +1319,42 @@ double nonlin_reflectance(double reflectance, double exposure,
   vw_throw(ArgumentErr() << "Invalid value for the number of haze coefficients.\n");
   return 0;
 }
+
+// The derivatives of nonlin_reflectance() with respect to the
+// reflectance, the exposure, and the haze coefficients. The latter
+// are zero beyond num_haze_coeffs. The function is P/Q, with P
+// having the exposure and the even-indexed haze coefficients, and Q
+// the odd-indexed ones.
+void nonlin_reflectance_derivs(double reflectance, double exposure,
+                               double const* haze, int num_haze_coeffs,
+                               double & dN_dR, double & dN_dE, double * dN_dhaze){
+
+  if (num_haze_coeffs < 0 || num_haze_coeffs > (int)g_max_num_haze_coeffs)
+    vw_throw(ArgumentErr() << "Invalid value for the number of haze coefficients.\n");
+
+  double r = reflectance; // for short
+  double h[g_max_num_haze_coeffs];
+  for (int k = 0; k < (int)g_max_num_haze_coeffs; k++)
+    h[k] = (k < num_haze_coeffs) ? haze[k] : 0.0;
+
+  double P = h[4]*r*r*r + h[2]*r*r + exposure*r + h[0];
+  double Q = h[5]*r*r*r + h[3]*r*r + h[1]*r + 1.0;
+  double dP_dR = 3.0*h[4]*r*r + 2.0*h[2]*r + exposure;
+  double dQ_dR = 3.0*h[5]*r*r + 2.0*h[3]*r + h[1];
+  double N = P/Q;
+
+  dN_dR = (dP_dR - N*dQ_dR)/Q;
+  dN_dE = r/Q;
+
+  // The power of r multiplying each haze coefficient
+  double powers[g_max_num_haze_coeffs] = {1.0, r, r*r, r*r, r*r*r, r*r*r};
+  for (int k = 0; k < (int)g_max_num_haze_coeffs; k++) {
+    if (k >= num_haze_coeffs)
+      dN_dhaze[k] = 0.0;
+    else
+      dN_dhaze[k] = (k % 2 == 0) ? powers[k]/Q : -N*powers[k]/Q;
+  }
+}
                           
 enum {NO_REFL = 0, LAMBERT, LUNAR_LAMBERT, HAPKE, ARBITRARY_MODEL, CHARON};
 
@@ -2028,6 +2066,14 @@ void estimateHeightError(ImageView<double> const& dem,
   }
 }
 
+// The derivatives of the reflectance with respect to the heights of
+// the left, right, bottom, and top grid points. These only change the
+// normal, so, unlike the center height, they do not move the point
+// being projected into the camera.
+struct ReflectanceDerivs {
+  double dR_dh[4];
+};
+
 bool computeReflectanceAndIntensity(double left_h, double center_h, double right_h,
                                     double bottom_h, double top_h,
                                     bool use_pq, double p, double q, // dem partial derivatives
@@ -2049,7 +2095,8 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
                                     double             & weight,
                                     const double       * reflectance_model_coeffs,
                                     SlopeErrEstim      * slopeErrEstim = NULL,
-                                    HeightErrEstim     * heightErrEstim = NULL) {
+                                    HeightErrEstim     * heightErrEstim = NULL,
+                                    ReflectanceDerivs  * reflectanceDerivs = NULL) {
 
   // Set output values
   reflectance = 0.0; reflectance.invalidate();
@@ -2170,10 +2217,11 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
     return false;
   }
 
+  bool inShadow = false;
   if (model_shadows) {
-    bool inShadow = isInShadow(col, row, local_model_params.sunPosition,
-                               dem, max_dem_height, gridx, gridy,
-                               geo);
+    inShadow = isInShadow(col, row, local_model_params.sunPosition,
+                          dem, max_dem_height, gridx, gridy,
+                          geo);
 
     if (inShadow) {
       // The reflectance is valid, it is just zero
@@ -2182,6 +2230,54 @@ bool computeReflectanceAndIntensity(double left_h, double center_h, double right
     }
   }
 
+  if (reflectanceDerivs != NULL) {
+
+    for (int k = 0; k < 4; k++)
+      reflectanceDerivs->dR_dh[k] = 0.0;
+
+    if (!inShadow && !use_pq) {
+
+      // The gradient of the reflectance with respect to the normal. That
+      // is the sun direction for Lambertian, else use central differences,
+      // as the reflectance is cheap to evaluate once the point is projected.
+      Vector3 dR_dnormal;
+      if (global_params.reflectanceType == LAMBERT) {
+        dR_dnormal = normalize(local_model_params.sunPosition - base);
+      } else {
+        double eps = 1e-6, phase = 0.0;
+        for (int i = 0; i < 3; i++) {
+          Vector3 plus = normal, minus = normal;
+          plus[i] += eps;
+          minus[i] -= eps;
+          dR_dnormal[i]
+            = (ComputeReflectance(cameraPosition, plus, base, local_model_params,
+                                  global_params, phase, reflectance_model_coeffs) -
+               ComputeReflectance(cameraPosition, minus, base, local_model_params,
+                                  global_params, phase, reflectance_model_coeffs))/(2.0*eps);
+        }
+      }
+
+      // A height change moves a point along the geodetic normal at its
+      // lon-lat. That changes dx or dy, hence the cross product c below,
+      // and normal = -c/|c| changes by -(I - n n^T) dc / |c|.
+      Vector2 neighbors[4] = {Vector2(col-1, row), Vector2(col+1, row),
+                              Vector2(col, row+1), Vector2(col, row-1)};
+      Vector3 c = cross_prod(dx, dy);
+      double c_norm = norm_2(c);
+      for (int k = 0; k < 4; k++) {
+        Vector2 ll = geo.pixel_to_lonlat(neighbors[k]) * (M_PI/180.0);
+        Vector3 up(cos(ll[1])*cos(ll[0]), cos(ll[1])*sin(ll[0]), sin(ll[1]));
+        Vector3 dc;
+        if      (k == 0) dc = -cross_prod(up, dy); // left
+        else if (k == 1) dc =  cross_prod(up, dy); // right
+        else if (k == 2) dc =  cross_prod(dx, up); // bottom
+        else             dc = -cross_prod(dx, up); // top
+        Vector3 dnormal = -(dc - normal*dot_prod(normal, dc))/c_norm;
+        reflectanceDerivs->dR_dh[k] = dot_prod(dR_dnormal, dnormal);
+      }
+    }
+  }
+
   if (slopeErrEstim != NULL && is_valid(intensity) && is_valid(reflectance)) {
     
     int image_iter = slopeErrEstim->image_iter;
@@ -2755,6 +2851,117 @@ public:
   }
 };
 
+// The quantities an intensity residual is made of, which are needed
+// to find its derivatives.
+struct IntensityTerms {
+  bool valid; // If false, the residual is zero and does not depend on the terms
+  double reflectance, intensity, weight;
+  ReflectanceDerivs derivs;
+};
+
+// How IntensityCostFunction finds the derivatives for a parameter block.
+enum IntensityBlockRole {EXPOSURE_BLOCK, HAZE_BLOCK,
+                         LEFT_BLOCK, RIGHT_BLOCK, BOTTOM_BLOCK, TOP_BLOCK, // as in ReflectanceDerivs
+                         ALBEDO_BLOCK, NUMERIC_BLOCK};
+
+// An intensity residual which finds its own derivatives, rather than
+// differencing the full residual, with its camera projection and
+// image interpolation, twice per parameter. The residual is
+//   weight * (intensity - albedo * nonlin_reflectance(reflectance, exposure, haze)).
+// The derivatives with respect to exposure, haze, and albedo are
+// analytic. The four neighbor heights only change the normal, and
+// their derivatives are analytic up to the gradient of the
+// reflectance with respect to the normal. The center height, the
+// camera adjustments, and the reflectance model coefficients move the
+// projected point or change the model, so they are still differenced.
+template <class ErrorT>
+class IntensityCostFunction: public ceres::CostFunction {
+public:
+  IntensityCostFunction(ErrorT * error): m_error(error) {
+    set_num_residuals(1);
+    for (int b = 0; b < ErrorT::NUM_BLOCKS; b++)
+      mutable_parameter_block_sizes()->push_back(ErrorT::block_size(b));
+  }
+
+  virtual bool Evaluate(double const* const* parameters, double* residuals,
+                        double** jacobians) const {
+
+    IntensityTerms terms;
+    m_error->eval(parameters, residuals, &terms);
+    if (jacobians == NULL)
+      return true;
+
+    double const* exposure = m_error->exposure(parameters);
+    double const* haze     = m_error->haze(parameters);
+    double        albedo   = m_error->albedo(parameters)[0];
+    double N = 0, dN_dR = 0, dN_dE = 0, dN_dhaze[g_max_num_haze_coeffs];
+    if (terms.valid) {
+      N = nonlin_reflectance(terms.reflectance, exposure[0], haze, g_opt->num_haze_coeffs);
+      nonlin_reflectance_derivs(terms.reflectance, exposure[0], haze, g_opt->num_haze_coeffs,
+                                dN_dR, dN_dE, dN_dhaze);
+    }
+    double w = terms.weight;
+
+    for (int b = 0; b < ErrorT::NUM_BLOCKS; b++) {
+      if (jacobians[b] == NULL)
+        continue;
+      int role = ErrorT::block_role(b);
+      int size = ErrorT::block_size(b);
+      double * J = jacobians[b];
+
+      if (role == NUMERIC_BLOCK) {
+        numeric_derivs(parameters, b, J);
+        continue;
+      }
+      if (!terms.valid) {
+        std::fill(J, J + size, 0.0);
+        continue;
+      }
+      
+      switch (role) {
+      case EXPOSURE_BLOCK:
+        J[0] = -w*albedo*dN_dE;
+        break;
+      case HAZE_BLOCK:
+        for (int k = 0; k < size; k++)
+          J[k] = -w*albedo*dN_dhaze[k];
+        break;
+      case ALBEDO_BLOCK:
+        J[0] = -w*N;
+        break;
+      default: // a neighbor height
+        J[0] = -w*albedo*dN_dR*terms.derivs.dR_dh[role - LEFT_BLOCK];
+      }
+    }
+
+    return true;
+  }
+
+private:
+
+  // Central differences of the full residual, with the same step as
+  // ceres::NumericDiffCostFunction.
+  void numeric_derivs(double const* const* parameters, int b, double * J) const {
+
+    std::vector<double const*> perturbed(parameters, parameters + ErrorT::NUM_BLOCKS);
+    std::vector<double> block(parameters[b], parameters[b] + ErrorT::block_size(b));
+    perturbed[b] = &block[0];
+    for (size_t c = 0; c < block.size(); c++) {
+      double x     = block[c];
+      double delta = 1e-6 * ((x == 0.0) ? 1.0 : std::abs(x));
+      double plus = 0, minus = 0;
+      block[c] = x + delta;
+      m_error->eval(&perturbed[0], &plus, NULL);
+      block[c] = x - delta;
+      m_error->eval(&perturbed[0], &minus, NULL);
+      block[c] = x;
+      J[c] = (plus - minus)/(2.0*delta);
+    }
+  }
+
+  boost::shared_ptr<ErrorT> m_error;
+};
+
 // See SmoothnessError() for the definitions of bottom, top, etc.
 template <typename F, typename G>
 inline bool
@@ -2785,11 +2992,14 @@ calc_intensity_residual(const F* const exposure,
                         MaskedImgT                        const & m_image,          // alias
                         DoubleImgT                        const & m_blend_weight,   // alias
                         boost::shared_ptr<CameraModel>    const & m_camera,         // alias
-                        F* residuals) {
+                        F* residuals,
+                        IntensityTerms * terms = NULL) {
   
   // Default residuals. Using here 0 rather than some big number tuned out to
   // work better than the alternative.
   residuals[0] = F(0.0);
+  if (terms != NULL)
+    terms->valid = false;
   try{
 
     // Initialize this variable to something for now, it does not
@@ -2850,7 +3060,8 @@ calc_intensity_residual(const F* const exposure,
                                      m_model_params,  m_global_params,
                                      m_crop_box, m_image, m_blend_weight, camera,
                                      scaled_sun_posn,
-                                     reflectance, intensity, weight, reflectance_model_coeffs);
+                                     reflectance, intensity, weight, reflectance_model_coeffs,
+                                     NULL, NULL, (terms != NULL) ? &terms->derivs : NULL);
       
     if (g_opt->unreliable_intensity_threshold > 0){
       if (is_valid(intensity) && intensity.child() <= g_opt->unreliable_intensity_threshold &&
@@ -2860,10 +3071,17 @@ calc_intensity_residual(const F* const exposure,
       }
     }
       
-    if (success && is_valid(intensity) && is_valid(reflectance))
+    if (success && is_valid(intensity) && is_valid(reflectance)) {
       residuals[0] = weight*( intensity - albedo[0] *
                               nonlin_reflectance(reflectance.child(), exposure[0],
                                                  haze, g_opt->num_haze_coeffs) );
+      if (terms != NULL) {
+        terms->valid       = true;
+        terms->reflectance = reflectance.child();
+        terms->intensity   = intensity.child();
+        terms->weight      = weight;
+      }
+    }
     
 
   } catch (const camera::PointToPixelErr& e) {
@@ -2919,7 +3137,8 @@ struct IntensityError {
                   const F* const camera_adjustments,
                   //const F* const scaled_sun_posn,
                   const F* const reflectance_model_coeffs,
-                  F* residuals) const {
+                  F* residuals,
+                  IntensityTerms * terms = NULL) const {
 
     // For this error we do not use p and q, hence just use a placeholder.
     bool use_pq = false;
@@ -2945,7 +3164,28 @@ struct IntensityError {
                                    m_image,           // alias
                                    m_blend_weight,    // alias
                                    m_camera,          // alias
-                                   residuals);
+                                   residuals, terms);
+  }
+
+  // The interface used by IntensityCostFunction
+  static const int NUM_BLOCKS = 10;
+  static int block_size(int b) {
+    static const int sizes[NUM_BLOCKS] = {1, g_max_num_haze_coeffs, 1, 1, 1, 1, 1, 1, 6,
+                                          g_num_model_coeffs};
+    return sizes[b];
+  }
+  static int block_role(int b) {
+    static const int roles[NUM_BLOCKS] = {EXPOSURE_BLOCK, HAZE_BLOCK, LEFT_BLOCK,
+                                          NUMERIC_BLOCK, RIGHT_BLOCK, BOTTOM_BLOCK, TOP_BLOCK,
+                                          ALBEDO_BLOCK, NUMERIC_BLOCK, NUMERIC_BLOCK};
+    return roles[b];
+  }
+  double const* exposure(double const* const* p) const { return p[0]; }
+  double const* haze    (double const* const* p) const { return p[1]; }
+  double const* albedo  (double const* const* p) const { return p[7]; }
+  bool eval(double const* const* p, double * residuals, IntensityTerms * terms) const {
+    return (*this)(p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7], p[8], p[9],
+                   residuals, terms);
   }
 
   // Factory to hide the construction of the CostFunction object from
@@ -2964,8 +3204,7 @@ struct IntensityError {
                                      DoubleImgT const& blend_weight,
                                      double * scaled_sun_posn, 
                                      boost::shared_ptr<CameraModel> const& camera){
-    return (new ceres::NumericDiffCostFunction<IntensityError,
-            ceres::CENTRAL, 1, 1, g_max_num_haze_coeffs, 1, 1, 1, 1, 1, 1, 6, g_num_model_coeffs>
+    return (new IntensityCostFunction<IntensityError>
             (new IntensityError(col, row, dem, geo,
                                 model_shadows,
                                 camera_position_step_size,
@@ -3034,7 +3273,8 @@ struct IntensityErrorFloatDemOnly {
                   const F* const right,
                   const F* const bottom,
                   const F* const top,
-                  F* residuals) const {
+                  F* residuals,
+                  IntensityTerms * terms = NULL) const {
 
     // For this error we do not use p and q, hence just use a placeholder.
     bool use_pq = false;
@@ -3059,7 +3299,22 @@ struct IntensityErrorFloatDemOnly {
                                    m_image,           // alias
                                    m_blend_weight,    // alias
                                    m_camera,          // alias
-                                   residuals);
+                                   residuals, terms);
+  }
+
+  // The interface used by IntensityCostFunction
+  static const int NUM_BLOCKS = 5;
+  static int block_size(int b) { return 1; }
+  static int block_role(int b) {
+    static const int roles[NUM_BLOCKS] = {LEFT_BLOCK, NUMERIC_BLOCK, RIGHT_BLOCK,
+                                          BOTTOM_BLOCK, TOP_BLOCK};
+    return roles[b];
+  }
+  double const* exposure(double const* const* p) const { return m_exposure; }
+  double const* haze    (double const* const* p) const { return m_haze; }
+  double const* albedo  (double const* const* p) const { return &m_albedo; }
+  bool eval(double const* const* p, double * residuals, IntensityTerms * terms) const {
+    return (*this)(p[0], p[1], p[2], p[3], p[4], residuals, terms);
   }
 
   // Factory to hide the construction of the CostFunction object from
@@ -3083,8 +3338,7 @@ struct IntensityErrorFloatDemOnly {
                                      DoubleImgT const& blend_weight,
                                      double * scaled_sun_posn, 
                                      boost::shared_ptr<CameraModel> const& camera){
-    return (new ceres::NumericDiffCostFunction<IntensityErrorFloatDemOnly,
-            ceres::CENTRAL, 1, 1, 1, 1, 1, 1>
+    return (new IntensityCostFunction<IntensityErrorFloatDemOnly>
             (new IntensityErrorFloatDemOnly(col, row, dem,
                                             albedo, reflectance_model_coeffs,
                                             exposure, haze, camera_adjustments,
@@ -3234,6 +3488,8 @@ struct IntensityErrorFixedMost {
 
 // A variant of the intensity error when we float the partial derviatives
 // in x and in y of the dem, which we call p and q.  
+// Unlike IntensityError, this one is still differenced as a whole by
+// Ceres. It is only used with the integrability constraint.
 struct IntensityErrorPQ {
   IntensityErrorPQ(int col, int row,
                    ImageView<double> const& dem,
@@ -3363,10 +3619,10 @@ struct SmoothnessError {
 
     // Normalize by grid size seems to make the functional less
     // sensitive to the actual grid size used.
-    residuals[0] = (left[0] + right[0] - 2*center[0])/m_gridx/m_gridx;   // u_xx
+    residuals[0] = (left[0] + right[0] - 2.0*center[0])/m_gridx/m_gridx;   // u_xx
     residuals[1] = (br[0] + tl[0] - bl[0] - tr[0] )/4.0/m_gridx/m_gridy; // u_xy
     residuals[2] = residuals[1];                                         // u_yx
-    residuals[3] = (bottom[0] + top[0] - 2*center[0])/m_gridy/m_gridy;   // u_yy
+    residuals[3] = (bottom[0] + top[0] - 2.0*center[0])/m_gridy/m_gridy;   // u_yy
     
     for (int i = 0; i < 4; i++)
       residuals[i] *= m_smoothness_weight;
@@ -3378,8 +3634,7 @@ struct SmoothnessError {
   // the client code.
   static ceres::CostFunction* Create(double smoothness_weight,
                                      double gridx, double gridy){
-    return (new ceres::NumericDiffCostFunction<SmoothnessError,
-            ceres::CENTRAL, 4, 1, 1, 1, 1, 1, 1, 1, 1, 1>
+    return (new ceres::AutoDiffCostFunction<SmoothnessError, 4, 1, 1, 1, 1, 1, 1, 1, 1, 1>
             (new SmoothnessError(smoothness_weight, gridx, gridy)));
   }
 
@@ -3412,8 +3667,7 @@ struct SmoothnessErrorPQ {
   // the client code.
   static ceres::CostFunction* Create(double smoothness_weight_pq,
                                      double gridx, double gridy){
-    return (new ceres::NumericDiffCostFunction<SmoothnessErrorPQ,
-            ceres::CENTRAL, 4, 2, 2, 2, 2>
+    return (new ceres::AutoDiffCostFunction<SmoothnessErrorPQ, 4, 2, 2, 2, 2>
             (new SmoothnessErrorPQ(smoothness_weight_pq, gridx, gridy)));
   }
 
@@ -3450,8 +3704,7 @@ struct IntegrabilityError {
   // the client code.
   static ceres::CostFunction* Create(double integrability_weight,
                                      double gridx, double gridy){
-    return (new ceres::NumericDiffCostFunction<IntegrabilityError,
-            ceres::CENTRAL, 2, 1, 1, 1, 1, 2>
+    return (new ceres::AutoDiffCostFunction<IntegrabilityError, 2, 1, 1, 1, 1, 2>
             (new IntegrabilityError(integrability_weight, gridx, gridy)));
   }
 
@@ -3474,8 +3727,7 @@ struct HeightChangeError {
   // the client code.
   static ceres::CostFunction* Create(double orig_height,
                                      double initial_dem_constraint_weight){
-    return (new ceres::NumericDiffCostFunction<HeightChangeError,
-            ceres::CENTRAL, 1, 1>
+    return (new ceres::AutoDiffCostFunction<HeightChangeError, 1, 1>
             (new HeightChangeError(orig_height, initial_dem_constraint_weight)));
   }
 
@@ -3497,8 +3749,7 @@ struct AlbedoChangeError {
   // the client code.
   static ceres::CostFunction* Create(double initial_albedo,
                                      double albedo_constraint_weight){
-    return (new ceres::NumericDiffCostFunction<AlbedoChangeError,
-            ceres::CENTRAL, 1, 1>
+    return (new ceres::AutoDiffCostFunction<AlbedoChangeError, 1, 1>
             (new AlbedoChangeError(initial_albedo, albedo_constraint_weight)));
   }
 
@@ -3766,6 +4017,8 @@ void handle_arguments(int argc, char *argv[], Options& opt) {
      "Select the stereo session type to use for processing. Usually the program can select this automatically by the file extension, except for xml cameras. See the doc for options.")
     ("save-sparingly",   po::bool_switch(&opt.save_sparingly)->default_value(false)->implicit_value(true),
      "Avoid saving any results except the adjustments and the DEM, as that's a lot of files.")
+    ("check-gradients",   po::bool_switch(&opt.check_gradients)->default_value(false)->implicit_value(true),
+     "Compare the derivatives of the cost functions with numerical ones at each iteration and stop if they disagree. Very slow, for debugging only.")
     ("camera-position-step-size", po::value(&opt.camera_position_step_size)->default_value(1.0),
      "Larger step size will result in more aggressiveness in varying the camera position if it is being floated (which may result in a better solution or in divergence).");
 
@@ -4564,6 +4817,7 @@ void run_sfs_level(// Fixed inputs
   options.minimizer_progress_to_stdout = 1;
   options.num_threads = opt.num_threads;
   options.linear_solver_type = ceres::SPARSE_SCHUR;
+  options.check_gradients = opt.check_gradients;
 
   // Use a callback function at every iteration
   SfsCallback callback;
@@ -4773,6 +5027,9 @@ block_write_gdal_image(out_dem_file, apply_mask(dem, dem_nodata_val),
   
 #endif
 
+// The unit tests include this file to reach the cost functions, and
+// bring their own main().
+#ifndef ASP_SFS_NO_MAIN
 int main(int argc, char* argv[]) {
   
   Stopwatch sw_total;
@@ -5862,3 +6119,4 @@ int main(int argc, char* argv[]) {
   vw_out() << "Total elapsed time: " << sw_total.elapsed_seconds() << " s." << std::endl;
  
 }
+#endif // ASP_SFS_NO_MAIN
@@ -41,9 +41,11 @@
 #include <vw/Image/InpaintView.h>
 #include <vw/Image/Algorithms2.h>
 #include <vw/Image/Filter.h>
+#include <vw/Image/BlockRasterize.h>
 #include <vw/Cartography/GeoTransform.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/Common.h>
+#include <asp/Core/DistanceTransform.h>
 
 #include <boost/math/special_functions/fpclassify.hpp>
 #include <boost/math/special_functions/erf.hpp>
@@ -74,10 +76,139 @@ struct Options: vw::cartography::GdalWriteOptions {
              shadow_blend_length(0.0), min_blend_size(0.0) {}
 };
 
+// Classification of pixels in the maximally lit image mosaic
+enum LitCode {SHADOW_PIX = 0, LIT_PIX = 1, BOUNDARY_PIX = 2};
+
+// Mark each pixel as lit or in shadow, with small shadowed areas
+// counting as lit, and flag the pixels at the light-shadow boundary.
+// These are the lit pixels next to shadowed ones and vice-versa, so
+// the boundary is two pixels wide. Both are local properties, found
+// tile by tile, with a margin to see the full extent of small holes.
+class LitBoundaryView: public ImageViewBase<LitBoundaryView>{
+  
+  ImageViewRef<float> m_image_mosaic;
+  int m_margin;
+  Options const& m_opt;
+  
+  typedef uint8 PixelT;
+  
+public:
+  LitBoundaryView(ImageViewRef<float> image_mosaic, int margin, Options const& opt):
+    m_image_mosaic(image_mosaic), m_margin(margin), m_opt(opt) {}
+
+  typedef PixelT pixel_type;
+  typedef PixelT result_type;
+  typedef ProceduralPixelAccessor<LitBoundaryView> pixel_accessor;
+  
+  inline int32 cols() const { return m_image_mosaic.cols(); }
+  inline int32 rows() const { return m_image_mosaic.rows(); }
+  inline int32 planes() const { return 1; }
+  
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+  
+  inline pixel_type operator()( double/*i*/, double/*j*/, int32/*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "LitBoundaryView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+  
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    BBox2i biased_box = bbox;
+    biased_box.expand(m_margin);
+    biased_box.crop(bounding_box(m_image_mosaic));
+
+    ImageView<float> image_mosaic_crop = crop(m_image_mosaic, biased_box);
+    
+    // The mask of lit pixels
+    ImageView< PixelMask<float> > mask = create_mask_less_or_equal(image_mosaic_crop,
+                                                                   m_opt.image_threshold);
+
+    // Fill small holes, as we don't blend in those
+    ImageView< PixelMask<float> > filled_mask
+      = vw::copy(vw::fill_holes_grass(mask, m_opt.min_blend_size));
+
+    // A pixel is at the boundary if it is lit, after filling small
+    // holes, and has a shadowed neighbor, or if it is in shadow,
+    // before filling holes, and has a lit neighbor. The image border
+    // does not count as boundary.
+    int nbr_col[4] = {-1, 1, 0, 0};
+    int nbr_row[4] = {0, 0, -1, 1};
+    ImageView<pixel_type> tile(bbox.width(), bbox.height());
+    for (int col = 0; col < bbox.width(); col++) {
+      for (int row = 0; row < bbox.height(); row++) {
+        int c = col + bbox.min().x() - biased_box.min().x();
+        int r = row + bbox.min().y() - biased_box.min().y();
+
+        bool lit = is_valid(filled_mask(c, r));
+        bool near_shadow = !lit, near_lit = is_valid(mask(c, r));
+        for (int it = 0; it < 4; it++) {
+          int c2 = c + nbr_col[it], r2 = r + nbr_row[it];
+          if (c2 < 0 || r2 < 0 || c2 >= mask.cols() || r2 >= mask.rows())
+            continue;
+          near_shadow = near_shadow || !is_valid(filled_mask(c2, r2));
+          near_lit    = near_lit    || is_valid(mask(c2, r2));
+        }
+
+        tile(col, row) = (lit ? LIT_PIX : SHADOW_PIX) |
+          ((near_shadow && near_lit) ? BOUNDARY_PIX : 0);
+      }
+    }
+    
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
+                             cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
+// Find the signed Euclidean distance to the light-shadow boundary,
+// positive in the lit region, clamped at the lit and shadow blending
+// lengths. This is done once for the whole image, so it does not
+// depend on how the image is split into tiles.
+void signed_dist_to_boundary(ImageViewRef<float> image_mosaic, Options const& opt,
+                             ImageView<float> & dist_to_bd) {
+
+  vw_out() << "Finding the distance to the light-shadow boundary." << std::endl;
+  
+  int num_threads = opt.num_threads;
+  if (num_threads <= 0)
+    num_threads = vw_settings().default_num_threads();
+
+  // The classification is local, so it is done in blocks
+  int margin = 2*(int)ceil(opt.min_blend_size) + 2;
+  int block_size = 256 + 2 * margin;
+  ImageView<uint8> lit_code
+    = block_rasterize(LitBoundaryView(image_mosaic, margin, opt),
+                      Vector2i(block_size, block_size), num_threads);
+
+  ImageView<uint8> boundary(lit_code.cols(), lit_code.rows());
+  for (int col = 0; col < lit_code.cols(); col++) {
+    for (int row = 0; row < lit_code.rows(); row++) {
+      boundary(col, row) = ((lit_code(col, row) & BOUNDARY_PIX) != 0);
+    }
+  }
+  
+  double max_dist = std::max(opt.lit_blend_length, opt.shadow_blend_length);
+  asp::euclidean_distance_transform(boundary, max_dist, dist_to_bd, num_threads);
+
+  for (int col = 0; col < dist_to_bd.cols(); col++) {
+    for (int row = 0; row < dist_to_bd.rows(); row++) {
+      if (lit_code(col, row) & LIT_PIX)
+        dist_to_bd(col, row) = std::min(double(dist_to_bd(col, row)), opt.lit_blend_length);
+      else
+        dist_to_bd(col, row) = -std::min(double(dist_to_bd(col, row)), opt.shadow_blend_length);
+    }
+  }
+}
+
 // The workhorse of this code, do the blending
 class SfsBlendView: public ImageViewBase<SfsBlendView>{
   
-  ImageViewRef<float> m_sfs_dem, m_lola_dem, m_image_mosaic;
+  ImageViewRef<float> m_sfs_dem, m_lola_dem, m_dist_to_bd;
   float m_sfs_nodata, m_lola_nodata, m_weight_nodata;
   int m_extra;
   bool m_save_weight;
@@ -87,10 +218,10 @@ class SfsBlendView: public ImageViewBase<SfsBlendView>{
   
 public:
   SfsBlendView(ImageViewRef<float> sfs_dem, ImageViewRef<float> lola_dem,
-               ImageViewRef<float> image_mosaic,
+               ImageViewRef<float> dist_to_bd,
                float sfs_nodata, float lola_nodata, float weight_nodata, int extra,
                bool save_weight, Options const& opt):
-    m_sfs_dem(sfs_dem), m_lola_dem(lola_dem), m_image_mosaic(image_mosaic),
+    m_sfs_dem(sfs_dem), m_lola_dem(lola_dem), m_dist_to_bd(dist_to_bd),
     m_sfs_nodata(sfs_nodata), m_lola_nodata(lola_nodata),
     m_weight_nodata(weight_nodata), m_extra(extra),
     m_save_weight(save_weight), m_opt(opt) {}
@@ -120,106 +251,9 @@ public:
     // Make crops in memory (from references)
     ImageView<pixel_type> sfs_dem_crop = crop(m_sfs_dem, biased_box);
     ImageView<pixel_type> lola_dem_crop = crop(m_lola_dem, biased_box);
-    ImageView<pixel_type> image_mosaic_crop = crop(m_image_mosaic, biased_box);
-
-    // The mask of lit pixels
-    ImageView< PixelMask<pixel_type> > mask = create_mask_less_or_equal(image_mosaic_crop,
-                                                                        m_opt.image_threshold);
-    
-    // The mask of unlit pixels
-    ImageView< PixelMask<pixel_type> > inv_mask = vw::copy(mask);
-    for (int col = 0; col < inv_mask.cols(); col++) {
-      for (int row = 0; row < inv_mask.rows(); row++) {
-        if (is_valid(mask(col, row))) {
-          inv_mask(col, row) = 0;
-          inv_mask(col, row).invalidate();
-        } else {
-          inv_mask(col, row) = 1;
-          inv_mask(col, row).validate();
-        }
-      }
-    }
-    
-    // The grassfire weight positive in the lit region, with zero at the light-shadow
-    // boundary
-    bool no_zero_at_border = true; // don't decrease the weights to zero at image border
-
-    // Fill small holes that we don't blend in those, then compute the distance
-    // to the remaining holes
-    ImageView<pixel_type> lit_grass_dist
-      = vw::grassfire(vw::copy(vw::fill_holes_grass(mask, m_opt.min_blend_size)),
-                      no_zero_at_border);
-
-    // The grassfire weights are positive in the shadow region, with
-    // zero at the light-shadow boundary
-    ImageView<pixel_type> shadow_grass_dist = vw::grassfire(inv_mask, no_zero_at_border);
-
-    // Find the clamped signed distance to the boundary. Note that our
-    // boundary is in fact two pixel wide at the light-shadow
-    // interface, given how lit_grass_dist and shadow_grass_dist are
-    // defined as the negation of each other. The boundary is the set
-    // of pixels where both of these are <= 1.
-    ImageView<float> dist_to_bd;
-    dist_to_bd.set_size(sfs_dem_crop.cols(), sfs_dem_crop.rows());
-    for (int col = 0; col < sfs_dem_crop.cols(); col++) {
-      
-      for (int row = 0; row < sfs_dem_crop.rows(); row++) {
 
-        if (lit_grass_dist(col, row) > 1.5*m_opt.lit_blend_length) {
-          // Too far in the lit region
-          dist_to_bd(col, row) = m_opt.lit_blend_length; // clamp at the blending length
-          continue;
-        }
-        
-        if (shadow_grass_dist(col, row) > 1.5*m_opt.shadow_blend_length) {
-          // Too far in the shadow region
-          dist_to_bd(col, row) = -m_opt.shadow_blend_length;
-          continue;
-        }
-        
-        // Find the shortest Euclidean distance to the no-data region.
-        double max_dist = std::max(m_opt.lit_blend_length, m_opt.shadow_blend_length);
-        double signed_dist = 0.0;
-        if (lit_grass_dist(col, row) > 0) {
-          signed_dist = m_opt.lit_blend_length;
-        } else if (shadow_grass_dist(col, row) > 0) {
-          signed_dist = -m_opt.shadow_blend_length;
-        }
-        
-        for (int col2 = std::max(0.0, col - max_dist);
-             col2 <= std::min(sfs_dem_crop.cols() - 1.0, col + max_dist);
-             col2++) {
-
-          // Estimate the range of rows for the circle with given radius
-          // at given col value.
-          double ht_val = ceil(sqrt(double(max_dist * max_dist) -
-                                    double((col - col2) * (col - col2))));
-          
-          for (int row2 = std::max(0.0, row - ht_val);
-               row2 <= std::min(sfs_dem_crop.rows() - 1.0, row + ht_val);
-               row2++) {
-
-            if (lit_grass_dist(col2, row2) > 1 || shadow_grass_dist(col2, row2) > 1) 
-              continue; // not at the boundary
-
-            // See if the current point is closer than anything so far
-            double curr_dist = sqrt( double(col - col2) * (col - col2) +
-                                     double(row - row2) * (row - row2) );
-            if (lit_grass_dist(col, row) > 0) {
-              if (curr_dist < signed_dist) 
-                signed_dist = curr_dist;
-            } else if (shadow_grass_dist(col, row) > 0) {
-              if (curr_dist < -signed_dist) 
-                signed_dist = -curr_dist;
-            }
-            
-          }
-        }
-
-        // The closest we've got
-        dist_to_bd(col, row) = signed_dist;
-      }
-    }
+    // The clamped signed distance to the light-shadow boundary
+    ImageView<float> dist_to_bd = crop(m_dist_to_bd, biased_box);
 
     // Apply the blur
     if (m_opt.weight_blur_sigma > 0)
@@ -537,9 +571,14 @@ int main(int argc, char *argv[]) {
     else
       vw_throw(ArgumentErr() << "The maximally-lit mosaic does not have a no-data value.");
     
+    // The distance to the light-shadow boundary, found once over the
+    // whole image, and used for both the DEM and the weight.
+    ImageView<float> dist_to_bd;
+    signed_dist_to_boundary(image_mosaic, opt, dist_to_bd);
+    
     // When processing the DEM tile by tile, need to see further in
-    // each tile because of blending and blurring
-    int extra = 2*opt.lit_blend_length + 2*opt.shadow_blend_length + opt.min_blend_size;
+    // each tile because of blurring
+    int extra = 0;
     if (opt.weight_blur_sigma > 0)
       extra += vw::compute_kernel_size(opt.weight_blur_sigma);
 
@@ -555,7 +594,7 @@ int main(int argc, char *argv[]) {
     bool save_weight = false;
     asp::save_with_temp_big_blocks(block_size,
                                    opt.output_dem,
-                                   SfsBlendView(sfs_dem, lola_dem, image_mosaic,
+                                   SfsBlendView(sfs_dem, lola_dem, dist_to_bd,
                                                 sfs_nodata, lola_nodata, weight_nodata,
                                                 extra, save_weight, opt),
                                    has_georef, sfs_georef,
@@ -568,7 +607,7 @@ int main(int argc, char *argv[]) {
     save_weight = true;
     asp::save_with_temp_big_blocks(block_size,
                                    opt.output_weight,
-                                   SfsBlendView(sfs_dem, lola_dem, image_mosaic,
+                                   SfsBlendView(sfs_dem, lola_dem, dist_to_bd,
                                                 sfs_nodata, lola_nodata, weight_nodata,
                                                 extra, save_weight, opt),
                                    has_georef, sfs_georef,
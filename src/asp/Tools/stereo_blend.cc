@@ -36,6 +36,7 @@
 
 #include <vw/Image/ImageMath.h>
 #include <vw/Stereo/DisparityMap.h>
+#include <vw/Core/ThreadPool.h>
 #include <asp/Tools/stereo.h>
 #include <boost/filesystem.hpp>
 
@@ -83,8 +84,23 @@ BBox2i bbox_from_folder(std::string const& s) {
   return BBox2i(x, y, width, height);
 }
 
-// Load an image and form its weights
-bool load_image_and_weights(std::string const& file_path,
+// Verify that the disparity has float pixels, as expected. Blending
+// is done either after algorithms which are not the old ASP block
+// matching (ASP_BM), when the disparity pixels are always float, or
+// with local epipolar alignment, when the resulting disparity has
+// float pixels even when ASP_BM is used.
+void check_float_disparity(std::string const& file_path) {
+  boost::shared_ptr<DiskImageResource> rsrc(DiskImageResourcePtr(file_path));
+  ChannelTypeEnum disp_data_type = rsrc->channel_type();
+  if (disp_data_type != VW_CHANNEL_FLOAT32)
+    vw_throw(ArgumentErr() << "Error: stereo_blend should only be called with float images.");
+}
+
+// Load an image and form its weights. Only the region 'roi' of the
+// image, which is the part overlapping with the main tile, is kept,
+// with the weights computed over it. The weights still depend on the
+// whole image.
+bool load_image_and_weights(std::string const& file_path, BBox2i const& roi,
                             DispImageType & image, WeightsType & weights) {
   // Verify image exists
   if (file_path == "")
@@ -92,23 +108,13 @@ bool load_image_and_weights(std::string const& file_path,
 
   vw_out() << "Reading: " << file_path << std::endl;
 
-  // Verify that the disparity has float pixels, as expected. Blending
-  // is done either after algorithms which are not the old ASP block
-  // matching (ASP_BM), when the disparity pixels are always float, or
-  // with local epipolar alignment, when the resulting disparity has
-  // float pixels even when ASP_BM is used.
-  boost::shared_ptr<DiskImageResource> rsrc(DiskImageResourcePtr(file_path));
-  ChannelTypeEnum disp_data_type = rsrc->channel_type();
-  if (disp_data_type != VW_CHANNEL_FLOAT32)
-    vw_throw(ArgumentErr() << "Error: stereo_blend should only be called with float images.");
-  
   // Load the image from disk
-  image = DiskImageType(file_path);
+  DispImageType full_image = DiskImageType(file_path);
   
-  // Compute the desired weights. Strictly speaking we need to compute the weights
-  // only on the portion of the image that we will use for blending, but weights
-  // computation is a cheap operation comparing to I/O time.
-  centerline_weights(image, weights);
+  // Compute the desired weights only on the portion of the image
+  // that we will use for blending.
+  centerline_weights(full_image, weights, roi);
+  image = crop(full_image, roi);
 
 #if 0
   // For debugging
@@ -121,6 +127,23 @@ bool load_image_and_weights(std::string const& file_path,
   return true;
 }
 
+/// Load a tile and its weights in a thread, so that the main tile and
+/// its neighbors are read and processed concurrently.
+class LoadTileTask: public vw::Task, private boost::noncopyable {
+  std::string     m_file_path;
+  BBox2i          m_roi;
+  DispImageType & m_image;   // alias
+  WeightsType   & m_weights; // alias
+public:
+  LoadTileTask(std::string const& file_path, BBox2i const& roi,
+               DispImageType & image, WeightsType & weights):
+    m_file_path(file_path), m_roi(roi), m_image(image), m_weights(weights) {}
+
+  void operator()() {
+    load_image_and_weights(m_file_path, m_roi, m_image, m_weights);
+  }
+};
+
 struct BlendOptions {
   std::string main_path;    // the path to the main disparity to blend
   BBox2i      main_roi;     // the main region of interest without padding
@@ -281,13 +304,10 @@ bool invalid_image(DispImageType const& image) {
 DispImageType tile_blend(ASPGlobalOptions const& opt,
                          BlendOptions & blend_opt) {
 
-  const bool debug = true;
-
   // While all the main tile and neighbor tiles have padding, we will save
   // the blended main tile without padding.
 
-  // Start the output image as invalid and zero. It will be used to
-  // accumulate the weighted disparities.
+  // Start the output image as invalid and zero.
   DispImageType output_image(blend_opt.main_roi.width(), blend_opt.main_roi.height()); 
   for (int col = 0; col < output_image.cols(); col++) {
     for (int row = 0; row < output_image.rows(); row++) {
@@ -295,84 +315,98 @@ DispImageType tile_blend(ASPGlobalOptions const& opt,
       output_image(col, row).invalidate();
     }
   }
+
+  // The main tile better exist
+  if (blend_opt.main_path == "") 
+    vw_throw(ArgumentErr() << "stereo_blend: main tile is missing.");
   
-  // Accumulate here the weights
-  WeightsType output_weights(blend_opt.main_roi.width(), blend_opt.main_roi.height());
-  for (int col = 0; col < output_weights.cols(); col++) {
-    for (int row = 0; row < output_weights.rows(); row++) {
-      output_weights(col, row) = 0.0; 
+  // Find the tiles to blend and the region of each overlapping with
+  // the main tile without its padding, in the full image coordinates.
+  // Index 0 is the main tile, and the rest are the neighbors. A
+  // neighbor which does not overlap with the main tile, such as when
+  // there is no padding, is not read at all.
+  std::vector<std::string> paths;
+  std::vector<BBox2i>      padded_boxes, overlaps;
+  paths.push_back(blend_opt.main_path);
+  padded_boxes.push_back(blend_opt.padded_main);
+  overlaps.push_back(blend_opt.main_roi);
+  for (int i = 0; i < NUM_NEIGHBORS; i++) {
+    if (blend_opt.neib_path[i] == "")
+      continue; // no neighbor in that direction
+    BBox2i overlap = blend_opt.padded_neib[i];
+    overlap.crop(blend_opt.main_roi);
+    if (overlap.empty())
+      continue; // Nothing to blend
+    paths.push_back(blend_opt.neib_path[i]);
+    padded_boxes.push_back(blend_opt.padded_neib[i]);
+    overlaps.push_back(overlap);
+  }
+  
+  // Read the tiles in parallel. Each keeps only its overlap region.
+  int num_tiles = paths.size();
+  std::vector<DispImageType> images(num_tiles);
+  std::vector<WeightsType>   weights(num_tiles);
+  {
+    for (int i = 0; i < num_tiles; i++) 
+      check_float_disparity(paths[i]);
+    FifoWorkQueue queue(vw_settings().default_num_threads());
+    for (int i = 0; i < num_tiles; i++) {
+      boost::shared_ptr<LoadTileTask>
+        task(new LoadTileTask(paths[i], overlaps[i] - padded_boxes[i].min(),
+                              images[i], weights[i]));
+      queue.add_task(task);
     }
+    queue.join_all();
   }
 
-  // Add the contribution from the main tile and neighboring tiles. Note
-  // that i = -1 corresponds to the main tile.
-  for (int i = -1; i < NUM_NEIGHBORS; i++) {
-
-    DispImageType image;
-    WeightsType weights;
-    BBox2i padded_box;
+  // If there are no valid pixels in the main tile without its padding,
+  // return an invalid blended tile.
+  if (invalid_image(images[0]))
+    return output_image;
+
+  // Accumulate here the weighted disparities and the weights. The
+  // accumulation is done in double precision.
+  int out_cols = output_image.cols(), out_rows = output_image.rows();
+  WeightsType sum_x(out_cols, out_rows), sum_y(out_cols, out_rows);
+  WeightsType output_weights(out_cols, out_rows);
+  fill(sum_x, 0.0);
+  fill(sum_y, 0.0);
+  fill(output_weights, 0.0);
+
+  // Add the contribution from the main tile and neighboring tiles.
+  // Iterate only over the overlap with the main tile, in row-major
+  // order, and without branches in the inner loop, so that the
+  // compiler can vectorize it.
+  for (int i = 0; i < num_tiles; i++) {
     
-    if (i == -1) {
-      // Main tile
-      // The main tile better exist
-      bool ans = load_image_and_weights(blend_opt.main_path, image, weights);
-      if (!ans) 
-        vw_throw(ArgumentErr() << "stereo_blend: main tile is missing.");
-
-      padded_box = blend_opt.padded_main;
-      
-      // If there are no valid pixels in the main tile without its padding,
-      // return an invalid blended tile.
-      if (invalid_image(crop(image, blend_opt.main_roi - blend_opt.padded_main.min())))
-        return output_image;
-      
-    } else {
-      // A neighboring tile
-      bool ans = load_image_and_weights(blend_opt.neib_path[i], image, weights);
-      if (!ans)
-        continue; // Nothing to blend
-
-      padded_box = blend_opt.padded_neib[i];
-    }
-
-    // Do the blending, either with the main or neighboring tiles
-    for (int col = 0; col < output_image.cols(); col++) {
-      for (int row = 0; row < output_image.rows(); row++) {
-
-        // Convert the given pixel to the coordinate system of the full image
-        Vector2 pix = Vector2(col, row) + blend_opt.main_roi.min();
-
-        // Convert the pixel to the coordinate system of the current padded tile
-        pix = pix - padded_box.min();
+    DispImageType const& image = images[i];
+    WeightsType   const& wts   = weights[i];
+    Vector2i start = overlaps[i].min() - blend_opt.main_roi.min();
 
-        // Padded tiles can overlap only partially with the central region of the main
-        // tile. If not in the overlap region, skip the work.
-        if (!vw::bounding_box(image).contains(pix)) 
-          continue;
-
-        if (!is_valid(image(pix[0], pix[1])) || weights(pix[0], pix[1]) <= 0.0) 
-          continue; // No useful info
-
-        output_image(col, row).validate();
-        output_image(col, row)   += weights(pix[0], pix[1]) * image(pix[0], pix[1]);
-        output_weights(col, row) += weights(pix[0], pix[1]);
+    for (int row = 0; row < image.rows(); row++) {
+      PixelMask<Vector2f> const* image_ptr = &image(0, row);
+      double              const* wts_ptr   = &wts(0, row);
+      double * x_ptr = &sum_x(start.x(), start.y() + row);
+      double * y_ptr = &sum_y(start.x(), start.y() + row);
+      double * w_ptr = &output_weights(start.x(), start.y() + row);
+      for (int col = 0; col < image.cols(); col++) {
+        bool   use = (is_valid(image_ptr[col]) && wts_ptr[col] > 0.0);
+        double wt  = use ? wts_ptr[col] : 0.0;
+        x_ptr[col] += use ? wt * image_ptr[col].child()[0] : 0.0;
+        y_ptr[col] += use ? wt * image_ptr[col].child()[1] : 0.0;
+        w_ptr[col] += wt;
       }
     }
   }
   
   // Normalize
-  for (int col = 0; col < output_image.cols(); col++) {
-    for (int row = 0; row < output_image.rows(); row++) {
-      
-      if (!is_valid(output_image(col, row)))
-        continue;
-      
-      if (output_weights(col, row) <= 0) {
-        output_image(col, row).invalidate();
-        continue;
-      }
-      
-      output_image(col, row) /= output_weights(col, row);
+  for (int row = 0; row < out_rows; row++) {
+    for (int col = 0; col < out_cols; col++) {
+      double wt = output_weights(col, row);
+      if (wt <= 0)
+        continue; // No useful info
+      output_image(col, row) = PixelMask<Vector2f>(Vector2f(sum_x(col, row) / wt,
+                                                            sum_y(col, row) / wt));
     }
   }
   
@@ -1215,6 +1215,16 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
     write_nodata = false; // To avoid warnings from the tif reader in msmw
   }
 
+  // The ASP and OpenCV algorithms work on the locally aligned images
+  // in memory. Only external programs need them on disk, unless
+  // debugging.
+  vw::stereo::CorrelationAlgorithm stereo_alg
+    = asp::stereo_alg_to_num(stereo_settings().stereo_algorithm);
+  bool in_process = (stereo_alg < vw::stereo::VW_CORRELATION_OTHER ||
+                     alg_name == "opencv_bm" || alg_name == "opencv_sgbm");
+  bool write_aligned_images = (!in_process || stereo_settings().stereo_debug);
+  ImageView<float> left_aligned_image, right_aligned_image;
+
   try {
     boost::shared_ptr<camera::CameraModel> left_camera_model, right_camera_model;
     opt.session->camera_models(left_camera_model, right_camera_model);
@@ -1222,13 +1232,14 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
     local_alignment(// Inputs
                     opt, opt.session->name(),
                     max_tile_size, tile_crop_win,
-                    write_nodata,
+                    write_aligned_images, write_nodata,
                     left_camera_model.get(),
                     right_camera_model.get(),
                     datum,
                     // Outputs
                     left_trans_crop_win, right_trans_crop_win,
                     left_local_mat, right_local_mat,
+                    left_aligned_image, right_aligned_image,
                     left_aligned_file, right_aligned_file,  
                     min_disp, max_disp);
 
@@ -1242,19 +1253,17 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
   vw_out() << "Min and max disparities: " << min_disp << ' ' << max_disp << ".\n";
   
   vw::ImageView<PixelMask<Vector2f>> unaligned_disp_2d;
-  vw::stereo::CorrelationAlgorithm stereo_alg
-    = asp::stereo_alg_to_num(stereo_settings().stereo_algorithm);
   
   if (stereo_alg < vw::stereo::VW_CORRELATION_OTHER) {
 
     // ASP algorithms
 
-    // Mask the locally alignment images which were written with NaN nodata.
+    // Mask the locally aligned images, which have NaN nodata.
     float nan  = std::numeric_limits<float>::quiet_NaN();
     ImageView<PixelMask<PixelGray<float>>> left_image
-      = vw::create_mask(DiskImageView<PixelGray<float>>(left_aligned_file), nan);
+      = vw::create_mask(pixel_cast<PixelGray<float>>(left_aligned_image), nan);
     ImageView<PixelMask<PixelGray<float>>> right_image
-      = vw::create_mask(DiskImageView<PixelGray<float>>(right_aligned_file), nan);
+      = vw::create_mask(pixel_cast<PixelGray<float>>(right_aligned_image), nan);
     
     ImageView<vw::uint8> left_mask
       = channel_cast_rescale<vw::uint8>(select_channel(left_image, 1));
@@ -1383,11 +1392,14 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
     if (fs::exists(mask_file)) 
       fs::remove(mask_file);  
     
+    // The OpenCV algorithms need not save the disparity, unless debugging
+    std::string opencv_disp_file = stereo_settings().stereo_debug ? aligned_disp_file : "";
+    
     if (alg_name == "opencv_bm") {
       // Call the OpenCV BM algorithm
       std::string mode = "bm";
       int dummy_p1 = -1, dummy_p2 = -1; // Only needed for SGBM
-      call_opencv_bm_or_sgbm(left_aligned_file, right_aligned_file,
+      call_opencv_bm_or_sgbm(left_aligned_image, right_aligned_image,
                              mode,
                              atoi(option_map["-block_size"].c_str()),  
                              min_disp, max_disp,  
@@ -1398,14 +1410,14 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
                              atoi(option_map["-disp12_diff"].c_str()),  
                              atoi(option_map["-texture_thresh"].c_str()),
                              dummy_p1, dummy_p2,
-                             opt, aligned_disp_file,  
+                             opt, opencv_disp_file,  
                              // Output
                              aligned_disp);
 
     } else if (alg_name == "opencv_sgbm") {
       // Call the OpenCV SGBM algorithm
       int dummy_texture_thresh = -1; // only needed for BM
-      call_opencv_bm_or_sgbm(left_aligned_file, right_aligned_file,
+      call_opencv_bm_or_sgbm(left_aligned_image, right_aligned_image,
                              option_map["-mode"],
                              atoi(option_map["-block_size"].c_str()),  
                              min_disp, max_disp,  
@@ -1417,7 +1429,7 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
                              dummy_texture_thresh,
                              atoi(option_map["-P1"].c_str()),  
                              atoi(option_map["-P2"].c_str()),  
-                             opt, aligned_disp_file,  
+                             opt, opencv_disp_file,  
                              // Output
                              aligned_disp);
     } else {
@@ -1508,10 +1520,9 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
     }
 
     try {
-      // Sanity check. Temporarily load the left image.
-      DiskImageView<float> left_image(left_aligned_file);
-      if (aligned_disp.cols() != left_image.cols() || 
-          aligned_disp.rows() != left_image.rows() ) 
+      // Sanity check
+      if (aligned_disp.cols() != left_aligned_image.cols() || 
+          aligned_disp.rows() != left_aligned_image.rows() ) 
         vw_throw(ArgumentErr() << "Expecting that the 1D disparity " << aligned_disp_file
                  << " would have the same dimensions as the left image " << left_aligned_file
                  << ".\n");
@@ -1528,9 +1539,9 @@ void stereo_correlation_1D(ASPGlobalOptions& opt) {
       // Wipe disparities which map to an invalid pixel
       float nan  = std::numeric_limits<float>::quiet_NaN();
       ImageView<PixelMask<PixelGray<float>>> left_masked_image
-        = vw::create_mask(DiskImageView<PixelGray<float>>(left_aligned_file), nan);
+        = vw::create_mask(pixel_cast<PixelGray<float>>(left_aligned_image), nan);
       ImageView<PixelMask<PixelGray<float>>> right_masked_image
-        = vw::create_mask(DiskImageView<PixelGray<float>>(right_aligned_file), nan);
+        = vw::create_mask(pixel_cast<PixelGray<float>>(right_aligned_image), nan);
       
       // invalid value for a PixelMask
       PixelMask<PixelGray<float>> nodata_mask = PixelMask<PixelGray<float>>(); 
@@ -26,8 +26,10 @@
 #include <vw/Image/BlobIndex.h>
 #include <vw/Image/ErodeView.h>
 #include <vw/Image/InpaintView.h>
+#include <vw/Image/BlockRasterize.h>
 
 #include <asp/Core/ThreadedEdgeMask.h>
+#include <asp/Core/MedianFilter.h>
 #include <asp/Sessions/StereoSession.h>
 #include <asp/Gotcha/CBatchProc.h>
 
@@ -40,11 +42,91 @@ using namespace asp;
 using namespace std;
 
 
+/// Standard deviation of the image intensity in a window of given size
+/// around each pixel, with the window clipped at the image boundary.
+/// It is found from integral images of the intensity and its square,
+/// so the cost per pixel does not depend on the window size.
+template <class ImageT>
+class TextureMeasureView: public ImageViewBase<TextureMeasureView<ImageT> >{
+  ImageT m_img;
+  int    m_kernel_size;
+
+public:
+  TextureMeasureView(ImageViewBase<ImageT> const& img, int kernel_size):
+    m_img(img.impl()), m_kernel_size(kernel_size) {}
+
+  // Image View interface
+  typedef float                                       pixel_type;
+  typedef pixel_type                                  result_type;
+  typedef ProceduralPixelAccessor<TextureMeasureView> pixel_accessor;
+
+  inline int32 cols  () const { return m_img.cols(); }
+  inline int32 rows  () const { return m_img.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double /*i*/, double /*j*/, int32 /*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "TextureMeasureView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+
+    int half = m_kernel_size/2;
+    BBox2i bbox2 = bbox;
+    bbox2.expand(half);
+    bbox2.crop(bounding_box(m_img));
+    ImageView<float> input_tile = select_channel(crop(m_img, bbox2), 0);
+
+    // Integral images, with an extra leading row and column of zeros
+    int nc = bbox2.width(), nr = bbox2.height(); // shorten
+    ImageView<double> sum(nc+1, nr+1), sum2(nc+1, nr+1);
+    fill(sum, 0.0);
+    fill(sum2, 0.0);
+    for (int row = 0; row < nr; row++) {
+      double row_sum = 0.0, row_sum2 = 0.0;
+      for (int col = 0; col < nc; col++) {
+        double val = input_tile(col, row);
+        row_sum  += val;
+        row_sum2 += val*val;
+        sum (col+1, row+1) = sum (col+1, row) + row_sum;
+        sum2(col+1, row+1) = sum2(col+1, row) + row_sum2;
+      }
+    }
+
+    ImageView<pixel_type> texture(bbox.width(), bbox.height());
+    for (int row = 0; row < bbox.height(); row++) {
+      for (int col = 0; col < bbox.width(); col++) {
+        // The window in tile coordinates, clipped to the tile
+        int c0 = std::max(col + bbox.min().x() - half,     bbox2.min().x()) - bbox2.min().x();
+        int r0 = std::max(row + bbox.min().y() - half,     bbox2.min().y()) - bbox2.min().y();
+        int c1 = std::min(col + bbox.min().x() + half + 1, bbox2.max().x()) - bbox2.min().x();
+        int r1 = std::min(row + bbox.min().y() + half + 1, bbox2.max().y()) - bbox2.min().y();
+        double count = double(c1 - c0) * (r1 - r0);
+        double s  = sum (c1, r1) - sum (c0, r1) - sum (c1, r0) + sum (c0, r0);
+        double s2 = sum2(c1, r1) - sum2(c0, r1) - sum2(c1, r0) + sum2(c0, r0);
+        double mean = s / count;
+        texture(col, row) = std::sqrt(std::max(s2 / count - mean*mean, 0.0));
+      }
+    }
+
+    return prerasterize_type(texture, -bbox.min().x(), -bbox.min().y(),
+                             cols(), rows() );
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+
 /// Apply a set of smoothing filters to the subpixel disparity results.
 template <class ImageT, class DispImageT>
 class TextureAwareDisparityFilter: public ImageViewBase<TextureAwareDisparityFilter<ImageT, DispImageT> >{
-  ImageT     m_img;
-  DispImageT m_disp_img;
+  ImageViewRef<float> m_texture;
+  DispImageT          m_disp_img;
   
   int   m_median_filter_size;     ///< Step 1: Apply a median filter of this size
   int   m_texture_smooth_range;   ///< Step 2: Compute texture measure of input image with this kernel size
@@ -58,12 +140,17 @@ public:
                                int   texture_smooth_range,
                                float texture_max,
                                int   max_smooth_kernel_size):
-    m_img(img.impl()), m_disp_img(disp_img.impl()),
+    m_disp_img(disp_img.impl()),
     m_median_filter_size(median_filter_size),
     m_texture_smooth_range(texture_smooth_range),
     m_texture_max(texture_max),
-    m_max_smooth_kernel_size(max_smooth_kernel_size)
-     {}
+    m_max_smooth_kernel_size(max_smooth_kernel_size) {
+    // The texture measure is cached, so it is computed only once per
+    // tile, rather than again on the padding of each disparity tile.
+    int tile_size = vw_settings().default_tile_size();
+    m_texture = block_cache(TextureMeasureView<ImageT>(img, texture_smooth_range),
+                            Vector2i(tile_size, tile_size), 0);
+  }
 
   // Image View interface
   typedef typename DispImageT::pixel_type pixel_type;
@@ -84,35 +171,70 @@ public:
   typedef CropView<ImageView<pixel_type> > prerasterize_type;
   inline prerasterize_type prerasterize(BBox2i const& bbox) const {
 
-    // Figure out the largest kernel expansion we need to support the filtering
-    int max_half_kernel = m_texture_smooth_range;
-    if (m_max_smooth_kernel_size > max_half_kernel)
-      max_half_kernel = m_max_smooth_kernel_size;
-    max_half_kernel += m_median_filter_size; // Don't forget we apply two kernels in succession
-    max_half_kernel /= 2;
-
-    // Rasterize both input image regions
+    // The smoothing needs the median-filtered disparity this far beyond
+    // the tile, and the median filter needs the input that much further.
+    // The texture is only needed on the tile itself.
+    int smooth_half = m_max_smooth_kernel_size/2;
     BBox2i bbox2 = bbox;
-    bbox2.expand(max_half_kernel);
-    bbox2.crop(bounding_box(m_img)); // Restrict to valid input area
-    ImageView<typename ImageT::pixel_type> input_tile      = crop(m_img,      bbox2);
-    ImageView<pixel_type                 > input_disp_tile = crop(m_disp_img, bbox2);
-
-    ImageView<float> texture_image;
-    vw::stereo::texture_measure(input_tile, texture_image, m_texture_smooth_range);
-    //write_image( "texture_image.tif", texture_image );
-
+    bbox2.expand(m_median_filter_size/2 + smooth_half);
+    bbox2.crop(bounding_box(m_disp_img)); // Restrict to valid input area
+    ImageView<pixel_type> input_disp_tile = crop(m_disp_img, bbox2);
+    ImageView<float>      texture_tile    = crop(m_texture,  bbox);
 
     ImageView<pixel_type > disp_tile_median;
-    vw::stereo::disparity_median_filter(input_disp_tile, disp_tile_median, m_median_filter_size);
-    
-    ImageView<pixel_type > disp_tile_filtered;
-    vw::stereo::texture_preserving_disparity_filter(disp_tile_median, disp_tile_filtered, texture_image, 
-                                                    m_texture_max, m_max_smooth_kernel_size);
+    asp::disparity_percentile_filter(input_disp_tile, disp_tile_median, m_median_filter_size);
+
+    // Integral images of the valid disparities and of their count, with
+    // an extra leading row and column of zeros.
+    const int num_channels = CompoundNumChannels<typename pixel_type::child_type>::value;
+    int nc = bbox2.width(), nr = bbox2.height(); // shorten
+    ImageView<Vector<double, num_channels> > sum(nc+1, nr+1);
+    ImageView<int> count(nc+1, nr+1);
+    fill(sum, Vector<double, num_channels>());
+    fill(count, 0);
+    for (int row = 0; row < nr; row++) {
+      Vector<double, num_channels> row_sum;
+      int row_count = 0;
+      for (int col = 0; col < nc; col++) {
+        if (is_valid(disp_tile_median(col, row))) {
+          for (int ch = 0; ch < num_channels; ch++)
+            row_sum[ch] += disp_tile_median(col, row).child()[ch];
+          row_count++;
+        }
+        sum  (col+1, row+1) = sum  (col+1, row) + row_sum;
+        count(col+1, row+1) = count(col+1, row) + row_count;
+      }
+    }
+
+    // Smooth each valid disparity with the mean over a box whose size
+    // grows from zero at m_texture_max to m_max_smooth_kernel_size where
+    // there is no texture.
+    ImageView<pixel_type> disp_tile_filtered(bbox.width(), bbox.height());
+    for (int row = 0; row < bbox.height(); row++) {
+      for (int col = 0; col < bbox.width(); col++) {
+        int tc = col + bbox.min().x() - bbox2.min().x(); // tile coordinates
+        int tr = row + bbox.min().y() - bbox2.min().y();
+        pixel_type disp = disp_tile_median(tc, tr);
+        disp_tile_filtered(col, row) = disp;
+
+        float texture = texture_tile(col, row);
+        if (!is_valid(disp) || smooth_half <= 0 || texture >= m_texture_max)
+          continue;
+        int half = int(round(smooth_half * (1.0 - texture / m_texture_max)));
+        if (half <= 0)
+          continue;
+
+        int c0 = std::max(tc - half, 0), c1 = std::min(tc + half + 1, nc);
+        int r0 = std::max(tr - half, 0), r1 = std::min(tr + half + 1, nr);
+        int n = count(c1, r1) - count(c0, r1) - count(c1, r0) + count(c0, r0);
+        Vector<double, num_channels> s = sum(c1, r1) - sum(c0, r1) - sum(c1, r0) + sum(c0, r0);
+        for (int ch = 0; ch < num_channels; ch++)
+          disp_tile_filtered(col, row).child()[ch] = s[ch] / n;
+      }
+    }
 
-    // Fake the bounds on the returned image region
     return prerasterize_type(disp_tile_filtered,
-                             -bbox2.min().x(), -bbox2.min().y(),
+                             -bbox.min().x(), -bbox.min().y(),
                              cols(), rows() );
   }
 
@@ -18,7 +18,6 @@
 
 /// \file stereo_pprc.cc
 ///
-#include <vw/Image/AntiAliasing.h>
 #include <vw/Image/BlobIndex.h>
 #include <vw/Image/InpaintView.h>
 #include <vw/Image/WindowAlgorithms.h>
@@ -82,6 +81,153 @@ BlobHolder::mask_and_fill_holes( ImageViewRef< PixelGray<float> > const& img,
 }
 
 
+/// Build a box-filtered, subsampled version of a masked image from
+/// tiles that are being streamed through memory for another purpose,
+/// so the image need not be read again just to make a preview. Each
+/// full-resolution pixel goes to the preview pixel its center falls
+/// in. Tiles may be added from several threads in any order.
+class PreviewAccumulator {
+  Vector2i          m_full_size, m_sub_size;
+  ImageView<double> m_sum, m_count, m_total;
+  Mutex             m_mutex;
+
+  int bin(int i, int full, int sub) const {
+    return std::min(sub - 1, int((i + 0.5) * double(sub) / double(full)));
+  }
+
+public:
+  PreviewAccumulator(Vector2i const& full_size, Vector2i const& sub_size):
+    m_full_size(full_size), m_sub_size(sub_size) {
+    m_sum.set_size  (sub_size.x(), sub_size.y());
+    m_count.set_size(sub_size.x(), sub_size.y());
+    m_total.set_size(sub_size.x(), sub_size.y());
+    fill(m_sum, 0.0);
+    fill(m_count, 0.0);
+    fill(m_total, 0.0);
+  }
+
+  /// Add a tile whose upper-left corner is at the given position in
+  /// the full-resolution image.
+  void add(ImageView< PixelMask< PixelGray<float> > > const& tile, Vector2i const& corner) {
+    if (tile.cols() <= 0 || tile.rows() <= 0)
+      return;
+
+    // Accumulate locally first, to hold the lock only briefly
+    int c0 = bin(corner.x(),                  m_full_size.x(), m_sub_size.x());
+    int c1 = bin(corner.x() + tile.cols() - 1, m_full_size.x(), m_sub_size.x());
+    int r0 = bin(corner.y(),                  m_full_size.y(), m_sub_size.y());
+    int r1 = bin(corner.y() + tile.rows() - 1, m_full_size.y(), m_sub_size.y());
+    ImageView<double> sum(c1 - c0 + 1, r1 - r0 + 1), count(c1 - c0 + 1, r1 - r0 + 1),
+      total(c1 - c0 + 1, r1 - r0 + 1);
+    fill(sum, 0.0);
+    fill(count, 0.0);
+    fill(total, 0.0);
+    for (int row = 0; row < tile.rows(); row++) {
+      int r = bin(corner.y() + row, m_full_size.y(), m_sub_size.y()) - r0;
+      for (int col = 0; col < tile.cols(); col++) {
+        int c = bin(corner.x() + col, m_full_size.x(), m_sub_size.x()) - c0;
+        total(c, r) += 1.0;
+        if (!is_valid(tile(col, row)))
+          continue;
+        sum  (c, r) += tile(col, row).child().v();
+        count(c, r) += 1.0;
+      }
+    }
+
+    Mutex::Lock lock(m_mutex);
+    for (int r = 0; r < sum.rows(); r++) {
+      for (int c = 0; c < sum.cols(); c++) {
+        m_sum  (c0 + c, r0 + r) += sum  (c, r);
+        m_count(c0 + c, r0 + r) += count(c, r);
+        m_total(c0 + c, r0 + r) += total(c, r);
+      }
+    }
+  }
+
+  /// The preview. As when resampling a masked image, a pixel is valid
+  /// only if all the pixels that went into it were valid. Each
+  /// full-resolution pixel must have been added exactly once, so a
+  /// tile that was skipped or rasterized twice is an error.
+  ImageView< PixelMask< PixelGray<float> > > result() const {
+
+    // The number of full-resolution columns and rows in each bin
+    std::vector<double> bin_cols(m_sub_size.x(), 0.0), bin_rows(m_sub_size.y(), 0.0);
+    for (int col = 0; col < m_full_size.x(); col++)
+      bin_cols[bin(col, m_full_size.x(), m_sub_size.x())] += 1.0;
+    for (int row = 0; row < m_full_size.y(); row++)
+      bin_rows[bin(row, m_full_size.y(), m_sub_size.y())] += 1.0;
+
+    ImageView< PixelMask< PixelGray<float> > > preview(m_sub_size.x(), m_sub_size.y());
+    for (int row = 0; row < preview.rows(); row++) {
+      for (int col = 0; col < preview.cols(); col++) {
+        if (m_total(col, row) != bin_cols[col] * bin_rows[row])
+          vw_throw(LogicErr() << "Subsampled image pixel (" << col << ", " << row
+                   << ") was made from " << m_total(col, row) << " pixels instead of "
+                   << bin_cols[col] * bin_rows[row] << ".\n");
+        if (m_count(col, row) > 0 && m_count(col, row) == m_total(col, row)) {
+          preview(col, row) = PixelGray<float>(m_sum(col, row) / m_count(col, row));
+        } else {
+          preview(col, row) = PixelGray<float>(0);
+          preview(col, row).invalidate();
+        }
+      }
+    }
+    return preview;
+  }
+};
+
+/// Rasterizes the mask of an image, as uint8 with 0 for invalid
+/// pixels. As each tile is produced, the image is masked with it and
+/// added to a preview, so writing the mask also makes the subsampled
+/// image in the same pass over the data. Each tile must be rasterized
+/// exactly once, which PreviewAccumulator::result() verifies.
+template <class ImageT, class MaskT>
+class MaskAndPreviewView: public ImageViewBase< MaskAndPreviewView<ImageT, MaskT> > {
+  ImageT               m_image;
+  MaskT                m_mask;
+  PreviewAccumulator & m_preview;
+
+public:
+  MaskAndPreviewView(ImageT const& image, MaskT const& mask, PreviewAccumulator & preview):
+    m_image(image), m_mask(mask), m_preview(preview) {}
+
+  typedef uint8 pixel_type;
+  typedef uint8 result_type;
+  typedef ProceduralPixelAccessor<MaskAndPreviewView> pixel_accessor;
+
+  inline int32 cols  () const { return m_mask.cols(); }
+  inline int32 rows  () const { return m_mask.rows(); }
+  inline int32 planes() const { return 1; }
+
+  inline pixel_accessor origin() const { return pixel_accessor( *this, 0, 0 ); }
+
+  inline pixel_type operator()( double/*i*/, double/*j*/, int32/*p*/ = 0 ) const {
+    vw_throw(NoImplErr() << "MaskAndPreviewView::operator()(...) is not implemented");
+    return pixel_type();
+  }
+
+  typedef CropView<ImageView<pixel_type> > prerasterize_type;
+  inline prerasterize_type prerasterize(BBox2i const& bbox) const {
+    ImageView< PixelMask<uint8> >   mask_tile  = crop(m_mask,  bbox);
+    ImageView< PixelGray<float> >   image_tile = crop(m_image, bbox);
+    ImageView< PixelMask< PixelGray<float> > > masked_tile = copy_mask(image_tile, mask_tile);
+    m_preview.add(masked_tile, bbox.min());
+    ImageView<pixel_type> tile = apply_mask(mask_tile);
+    return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(), cols(), rows());
+  }
+
+  template <class DestT>
+  inline void rasterize(DestT const& dest, BBox2i bbox) const {
+    vw::rasterize(prerasterize(bbox), dest, bbox);
+  }
+};
+template <class ImageT, class MaskT>
+MaskAndPreviewView<ImageT, MaskT>
+mask_and_preview(ImageViewBase<ImageT> const& image, ImageViewBase<MaskT> const& mask,
+                 PreviewAccumulator & preview) {
+  return MaskAndPreviewView<ImageT, MaskT>(image.impl(), mask.impl(), preview);
+}
+
 /// Instead of writing L.tif and R.tif, just create sym links from
 /// input left and right images. Creating symbolic links can be tricky.
 void create_sym_links(string const& left_input_file,
@@ -167,27 +313,43 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
 
   string left_mask_file  = opt.out_prefix+"-lMask.tif";
   string right_mask_file = opt.out_prefix+"-rMask.tif";
-  
-  // Also need to rebuild if the inputs changed after the mask files were produced.
+  string lsub  = opt.out_prefix+"-L_sub.tif";
+  string rsub  = opt.out_prefix+"-R_sub.tif";
+  string lmsub = opt.out_prefix+"-lMask_sub.tif";
+  string rmsub = opt.out_prefix+"-rMask_sub.tif";
+
+  // The masks and the subsampled images are made together in one
+  // pass over the images, so they are reused or rebuilt together.
+  // Need to rebuild if the inputs changed after these were produced.
   std::vector<std::string> in_file_list;
   in_file_list.push_back(opt.in_file1);
   in_file_list.push_back(opt.in_file2);
   in_file_list.push_back(opt.cam_file1);
   in_file_list.push_back(opt.cam_file2);
-  bool inputs_changed = (!is_latest_timestamp(left_mask_file,  in_file_list ) ||
-                         !is_latest_timestamp(right_mask_file, in_file_list)  );
+  bool inputs_changed = (!is_latest_timestamp(left_mask_file,  in_file_list) ||
+                         !is_latest_timestamp(right_mask_file, in_file_list) ||
+                         !is_latest_timestamp(lsub,            in_file_list) ||
+                         !is_latest_timestamp(rsub,            in_file_list) ||
+                         !is_latest_timestamp(lmsub,           in_file_list) ||
+                         !is_latest_timestamp(rmsub,           in_file_list));
 
   bool rebuild = crop_left || crop_right || inputs_changed;
   try {
     // If files do not exist, create them. Also if they exist
     // but are invalid. The second check gives an ugly verbose
     // message, hence first check for existence with boost.
-    if (!fs::exists(left_mask_file) || !fs::exists(right_mask_file)){
+    if (!fs::exists(left_mask_file) || !fs::exists(right_mask_file) ||
+        !fs::exists(lsub)           || !fs::exists(rsub)            ||
+        !fs::exists(lmsub)          || !fs::exists(rmsub)){
       rebuild = true;
     }else{
       vw_log().console_log().rule_set().add_rule(-1,"fileio");
-      DiskImageView<PixelGray<uint8> > testa(left_mask_file );
-      DiskImageView<PixelGray<uint8> > testb(right_mask_file);
+      DiskImageView<PixelGray<uint8> > testa (left_mask_file );
+      DiskImageView<PixelGray<uint8> > testb (right_mask_file);
+      DiskImageView<PixelGray<float> > testl (lsub );
+      DiskImageView<PixelGray<float> > testr (rsub );
+      DiskImageView<uint8>             testlm(lmsub);
+      DiskImageView<uint8>             testrm(rmsub);
       vw_settings().reload_config();
     }
   } catch (vw::IOErr const& e) {
@@ -197,6 +359,9 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
     // Throws on a corrupted file.
     vw_settings().reload_config();
     rebuild = true;
+  } catch (vw::Exception const& e) {
+    vw_settings().reload_config();
+    rebuild = true;
   }
 
   cartography::GeoReference left_georef, right_georef;
@@ -209,10 +374,10 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
 
 
   if (!rebuild) {
-    vw_out() << "\t--> Using cached masks.\n";
+    vw_out() << "\t--> Using cached masks and subsampled images.\n";
   }else{
 
-    vw_out() << "\t--> Generating image masks... \n";
+    vw_out() << "\t--> Generating image masks and subsampled images... \n";
 
     Stopwatch sw;
     sw.start();
@@ -326,6 +491,24 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
       }
     }
 
+    // The subsampled images will be used later for auto search range
+    // detection. They are accumulated from the same tiles that are
+    // read to write the masks, so the images are read only once.
+    double s = 1500.0;
+    float  sub_scale = sqrt(s * s / (float(left_image.cols ()) * float(left_image.rows ())))
+                     + sqrt(s * s / (float(right_image.cols()) * float(right_image.rows())));
+    sub_scale /= 2;
+    if ( sub_scale > 0.6 ) // ???
+      sub_scale = 0.6;
+
+    Vector2i left_sub_size (std::max(1, int(round(sub_scale * left_image.cols()))),
+                            std::max(1, int(round(sub_scale * left_image.rows()))));
+    Vector2i right_sub_size(std::max(1, int(round(sub_scale * right_image.cols()))),
+                            std::max(1, int(round(sub_scale * right_image.rows()))));
+    PreviewAccumulator left_preview (bounding_box(left_image ).size(), left_sub_size );
+    PreviewAccumulator right_preview(bounding_box(right_image).size(), right_sub_size);
+    vw_out() << "\t--> Subsampling by " << sub_scale << " while writing the masks.\n";
+
     // Intersect the left mask with the warped version of the right
     // mask, and vice-versa to reduce noise, if the images
     // are map-projected.
@@ -346,14 +529,19 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
                ),
                bounding_box(left_mask));
 
+      ImageViewRef< PixelMask<uint8> > left_final_mask
+        = intersect_mask(left_mask, warped_right_mask);
+      ImageViewRef< PixelMask<uint8> > right_final_mask
+        = intersect_mask(right_mask, warped_left_mask);
+
       vw::cartography::block_write_gdal_image(left_mask_file,
-                                  apply_mask(intersect_mask(left_mask, warped_right_mask)),
+                                  mask_and_preview(left_image, left_final_mask, left_preview),
                                   has_left_georef, left_georef,
                                   has_nodata, output_nodata,
                                   opt, TerminalProgressCallback("asp", "\t    Mask L: ")
                                   );
       vw::cartography::block_write_gdal_image(right_mask_file,
-                                  apply_mask(intersect_mask(right_mask, warped_left_mask)),
+                                  mask_and_preview(right_image, right_final_mask, right_preview),
                                   has_right_georef, right_georef,
                                   has_nodata, output_nodata,
                                   opt, TerminalProgressCallback("asp", "\t    Mask R: "));
@@ -362,11 +550,13 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
       // TODO: Even so, the trick above with intersecting the masks will still work,
       // if the images are map-projected (such as with cam2map-ed cubes),
       // but this would require careful research.
-      vw::cartography::block_write_gdal_image(left_mask_file, apply_mask(left_mask),
+      vw::cartography::block_write_gdal_image(left_mask_file,
+                                   mask_and_preview(left_image, left_mask, left_preview),
                                    has_left_georef, left_georef,
                                    has_nodata, output_nodata,
                                    opt, TerminalProgressCallback("asp", "\t Mask L: ") );
-      vw::cartography::block_write_gdal_image( right_mask_file, apply_mask(right_mask),
+      vw::cartography::block_write_gdal_image(right_mask_file,
+                                   mask_and_preview(right_image, right_mask, right_preview),
                                    has_right_georef, right_georef,
                                    has_nodata, output_nodata,
                                    opt, TerminalProgressCallback("asp", "\t Mask R: ") );
@@ -375,103 +565,10 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
     sw.stop();
     vw_out(DebugMessage,"asp") << "Mask creation elapsed time: "
                                << sw.elapsed_seconds() << " s." << endl;
-  } // End creating masks
-
-
-  string lsub  = opt.out_prefix+"-L_sub.tif";
-  string rsub  = opt.out_prefix+"-R_sub.tif";
-  string lmsub = opt.out_prefix+"-lMask_sub.tif";
-  string rmsub = opt.out_prefix+"-rMask_sub.tif";
-
-  inputs_changed = (!is_latest_timestamp(lsub,  in_file_list ) ||
-                    !is_latest_timestamp(rsub,  in_file_list)  ||
-                    !is_latest_timestamp(lmsub, in_file_list ) ||
-                    !is_latest_timestamp(rmsub, in_file_list )  );
-
-  // We must always redo the subsampling if we are allowed to crop the images
-  rebuild = crop_left || crop_right || inputs_changed;
-
-  try {
-    // First try to see if the subsampled images exist.
-    if (!fs::exists(lsub)  || !fs::exists(rsub) ||
-        !fs::exists(lmsub) || !fs::exists(rmsub)){
-      rebuild = true;
-    }else{
-      // This confusing try catch is to see if the subsampled images actually have content.
-      DiskImageView<PixelGray<float> > testl (lsub );
-      DiskImageView<PixelGray<float> > testr (rsub );
-      DiskImageView<uint8>             testlm(lmsub);
-      DiskImageView<uint8>             testrm(rmsub);
-      vw_out() << "\t--> Using cached subsampled images.\n";
-    }
-  } catch (vw::Exception const& e) {
-    rebuild = true;
-  }
-
-  if (rebuild) {
-    // Produce subsampled images, these will be used later for auto
-    // search range detection.
-    double s = 1500.0;
-    float  sub_scale = sqrt(s * s / (float(left_image.cols ()) * float(left_image.rows ())))
-                     + sqrt(s * s / (float(right_image.cols()) * float(right_image.rows())));
-    sub_scale /= 2;
-    if ( sub_scale > 0.6 ) // ???
-      sub_scale = 0.6;
 
-    // Solving for the number of threads and the tile size to use for
-    // subsampling while only using 500 MiB of memory. (The cache code
-    // is a little slow on releasing so it will probably use 1.5GiB
-    // memory during subsampling) Also tile size must be a power of 2
-    // and greater than or equal to 64 px.
-    uint32 sub_threads = vw_settings().default_num_threads() + 1;
-    uint32 tile_power  = 0;
-    while (tile_power < 6 && sub_threads > 1) {
-      sub_threads--;
-      tile_power = boost::numeric_cast<uint32>
-        (log10(500e6*sub_scale*sub_scale/(4.0*float(sub_threads)))/(2*log10(2)));
-    }
-    uint32 sub_tile_size = 1u << tile_power;
-    if (sub_tile_size > vw_settings().default_tile_size())
-      sub_tile_size = vw_settings().default_tile_size();
-    Vector2 sub_tile_size_vec(sub_tile_size, sub_tile_size);
-    vw_out() << "\t--> Creating previews. Subsampling by " << sub_scale
-             << " by using a tile of size " << sub_tile_size << " and "
-             << sub_threads << " threads.\n";
-
-    // Resample the images and the masks. We must use the masks when
-    // resampling the images to interpolate correctly around invalid pixels.
-
-    DiskImageView<uint8> left_mask(left_mask_file), right_mask(right_mask_file);
-    // Below we use ImageView instead of ImageViewRef as the output
-    // images are small.  Using an ImageViewRef would make the
-    // subsampling operations happen twice, once for L_sub.tif and
-    // second time for lMask_sub.tif.
-    ImageView< PixelMask < PixelGray<float> > > left_sub_image, right_sub_image;
-    if ( sub_scale > 0.5 ) {
-      // When we are near the pixel input to output ratio, standard
-      // interpolation gives the best possible results.
-      left_sub_image  = block_rasterize(resample(copy_mask(left_image,  create_mask(left_mask)),
-                                                 sub_scale), 
-                                        sub_tile_size_vec, sub_threads);
-      right_sub_image = block_rasterize(resample(copy_mask(right_image, create_mask(right_mask)),
-                                                 sub_scale), 
-                                        sub_tile_size_vec, sub_threads);
-    } else {
-      // When we heavily reduce the image size, super sampling seems
-      // like the best approach. The method below should be equivalent.
-      left_sub_image
-        = block_rasterize
-        (cache_tile_aware_render(resample_aa(copy_mask(left_image,create_mask(left_mask)),
-                                             sub_scale),
-                                 Vector2i(256,256) * sub_scale),
-         sub_tile_size_vec, sub_threads);
-      right_sub_image
-        = block_rasterize
-        (cache_tile_aware_render(resample_aa(copy_mask(right_image,create_mask(right_mask)),
-                                             sub_scale),
-                                 Vector2i(256,256) * sub_scale),
-         sub_tile_size_vec, sub_threads);
-    }
+    // These are small, so they are kept in memory
+    ImageView< PixelMask < PixelGray<float> > > left_sub_image  = left_preview.result();
+    ImageView< PixelMask < PixelGray<float> > > right_sub_image = right_preview.result();
 
     // Enforce no predictor in compression, it works badly with sub-images
     vw::cartography::GdalWriteOptions opt_nopred = opt;
@@ -513,7 +610,7 @@ void stereo_preprocessing(bool adjust_left_image_size, ASPGlobalOptions& opt) {
         has_right_georef, right_sub_georef,
         has_nodata, output_nodata,
         opt_nopred, TerminalProgressCallback("asp", "\t    Sub R Mask: ") );
-  } // End try/catch to see if the subsampled images have content
+  } // End creating masks and subsampled images
 
   if (skip_img_norm && stereo_settings().subpixel_mode == 2){
     // If image normalization is not done, we still need to compute the image
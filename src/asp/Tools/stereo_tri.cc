@@ -928,7 +928,23 @@ namespace asp{
     bool has_nodata = false;
     double nodata = -std::numeric_limits<float>::max(); // smallest float
 
-    if (opt.session->supports_multi_threading()){
+    if (stereo_settings().compact_point_cloud &&
+        opt.session->supports_multi_threading()){
+      asp::block_write_compact_gdal_image
+        (point_cloud_file, shift,
+         stereo_settings().point_cloud_rounding_error,
+         point_cloud,
+         has_georef, georef, has_nodata, nodata,
+         opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
+    }else if (stereo_settings().compact_point_cloud){
+      // ISIS does not support multi-threading
+      asp::write_compact_gdal_image
+        (point_cloud_file, shift,
+         stereo_settings().point_cloud_rounding_error,
+         point_cloud,
+         has_georef, georef, has_nodata, nodata,
+         opt, TerminalProgressCallback("asp", "\t--> Triangulating: "));
+    }else if (opt.session->supports_multi_threading()){
       asp::block_write_approx_gdal_image
         (point_cloud_file, shift,
          stereo_settings().point_cloud_rounding_error,
@@ -1165,9 +1181,11 @@ void stereo_triangulation(string const& output_prefix,
       int num_threads = opt_vec[0].num_threads;
       if (opt_vec[0].session->name() == "isis" || opt_vec[0].session->name() == "isismapisis")
         num_threads = 1;
+      std::map< std::pair<int, int>, std::string> match_files;
+      match_files[std::pair<int, int>(0, 1)] = match_file;
       asp::jitter_adjust(image_files, camera_files, cameras,
                          output_prefix, opt_vec[0].session->name(),
-                         match_file,  num_threads);
+                         match_files,  num_threads);
       //asp::ccd_adjust(image_files, camera_files, cameras, output_prefix,
       //                match_file,  num_threads);
     }
@@ -0,0 +1,140 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+#include <asp/Tools/bundle_adjust.h>
+
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/shared_ptr.hpp>
+#include <cmath>
+
+using namespace vw;
+using namespace vw::camera;
+using namespace asp;
+
+namespace {
+  // A uniform number in [0, 1), the same on all platforms
+  double uniform(boost::mt19937 & gen) {
+    return gen() / 4294967296.0;
+  }
+}
+
+// PinholeReprojectionError must agree with BaReprojectionError, which
+// lets Ceres difference the full camera, in the residuals and in the
+// derivatives with respect to every parameter block.
+TEST( BundleAdjustCostFunctions, PinholeJacobiansMatchNumeric ) {
+
+  // A pinhole camera in pixel units, with noticeable lens distortion
+  Vector<double> lens_params(4);
+  lens_params[0] = -0.12;
+  lens_params[1] =  0.03;
+  lens_params[2] =  2e-3;
+  lens_params[3] = -1e-3;
+  TsaiLensDistortion distortion(lens_params);
+  boost::shared_ptr<PinholeModel>
+    pinhole(new PinholeModel(Vector3(), vw::math::identity_matrix<3>(),
+                             800.0, 800.0, 320.0, 240.0, &distortion, 1.0));
+  boost::shared_ptr<PinholeBundleModel> wrapper(new PinholeBundleModel(pinhole));
+
+  // Different sigmas, to check that each residual is scaled by its own
+  Vector2 pixel_sigma(1.0, 2.0);
+
+  std::vector<int> block_sizes = wrapper->get_block_sizes();
+  int num_blocks = block_sizes.size();
+  ASSERT_EQ(5, num_blocks);
+  ASSERT_EQ(4, block_sizes[4]);
+
+  boost::mt19937 gen(7);
+  double max_lens_deriv = 0.0;
+  int num_trials = 20;
+  for (int trial = 0; trial < num_trials; trial++) {
+
+    // The camera position and a small rotation. The intrinsics are
+    // scale factors, so keep them near one.
+    std::vector<double> point(3), pose(6), center(2), focus(1), lens(4);
+    for (int i = 0; i < 3; i++) {
+      pose[i]     = 2.0*uniform(gen) - 1.0;
+      pose[3 + i] = 0.4*(uniform(gen) - 0.5);
+    }
+    for (int i = 0; i < 2; i++)
+      center[i] = 1.0 + 0.1*(uniform(gen) - 0.5);
+    focus[0] = 1.0 + 0.1*(uniform(gen) - 0.5);
+    for (int i = 0; i < 4; i++)
+      lens[i] = 1.0 + 0.4*(uniform(gen) - 0.5);
+
+    // A point in front of the camera, far enough off-axis for the
+    // distortion to matter
+    double cam_x = 6.0*uniform(gen) - 3.0, cam_y = 6.0*uniform(gen) - 3.0;
+    double cam_z = 8.0 + 4.0*uniform(gen);
+    CameraAdjustment adjustment(&pose[0]);
+    Vector3 xyz = adjustment.position()
+      + adjustment.pose().rotation_matrix()*Vector3(cam_x, cam_y, cam_z);
+    for (int i = 0; i < 3; i++)
+      point[i] = xyz[i];
+
+    double obs_x = 320.0 + 100.0*(uniform(gen) - 0.5), obs_y = 240.0 + 100.0*(uniform(gen) - 0.5);
+    Vector2 observation(obs_x, obs_y);
+
+    std::vector<double const*> params(num_blocks);
+    params[0] = &point[0];
+    params[1] = &pose[0];
+    params[2] = &center[0];
+    params[3] = &focus[0];
+    params[4] = &lens[0];
+
+    boost::shared_ptr<ceres::CostFunction>
+      analytic(PinholeReprojectionError::Create(observation, pixel_sigma, wrapper));
+    boost::shared_ptr<ceres::CostFunction>
+      numeric(BaReprojectionError::Create(observation, pixel_sigma, wrapper));
+
+    std::vector< std::vector<double> > analytic_jac(num_blocks), numeric_jac(num_blocks);
+    std::vector<double*> analytic_ptrs(num_blocks), numeric_ptrs(num_blocks);
+    for (int b = 0; b < num_blocks; b++) {
+      analytic_jac[b].resize(PIXEL_SIZE*block_sizes[b]);
+      numeric_jac [b].resize(PIXEL_SIZE*block_sizes[b]);
+      analytic_ptrs[b] = &analytic_jac[b][0];
+      numeric_ptrs [b] = &numeric_jac [b][0];
+    }
+
+    double analytic_res[PIXEL_SIZE], numeric_res[PIXEL_SIZE];
+    ASSERT_TRUE(analytic->Evaluate(&params[0], analytic_res, &analytic_ptrs[0]));
+    ASSERT_TRUE(numeric ->Evaluate(&params[0], numeric_res,  &numeric_ptrs [0]));
+
+    for (size_t r = 0; r < PIXEL_SIZE; r++) {
+      // Make sure the point projected, rather than getting the placeholder value
+      ASSERT_LT(std::abs(numeric_res[r]), 0.1*g_big_pixel_value) << "Trial " << trial;
+      EXPECT_NEAR(numeric_res[r], analytic_res[r], 1e-8*std::max(1.0, std::abs(numeric_res[r])))
+        << "Trial " << trial;
+    }
+
+    // Block 0 is the point, 1 the camera position and rotation, then
+    // the center, focus, and lens distortion.
+    for (int b = 0; b < num_blocks; b++) {
+      for (size_t k = 0; k < numeric_jac[b].size(); k++) {
+        double expected = numeric_jac[b][k];
+        EXPECT_NEAR(expected, analytic_jac[b][k], 1e-4*std::max(1.0, std::abs(expected)))
+          << "Trial " << trial << ", block " << b << ", entry " << k;
+        if (b == 4)
+          max_lens_deriv = std::max(max_lens_deriv, std::abs(expected));
+      }
+    }
+  }
+
+  // The lens distortion must have had an effect for its block to be checked
+  EXPECT_GT(max_lens_deriv, 0.1);
+}
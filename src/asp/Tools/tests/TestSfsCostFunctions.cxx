@@ -0,0 +1,272 @@
+// __BEGIN_LICENSE__
+//  Copyright (c) 2009-2013, United States Government as represented by the
+//  Administrator of the National Aeronautics and Space Administration. All
+//  rights reserved.
+//
+//  The NGT platform is licensed under the Apache License, Version 2.0 (the
+//  "License"); you may not use this file except in compliance with the
+//  License. You may obtain a copy of the License at
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+// __END_LICENSE__
+
+
+#include <test/Helpers.h>
+
+// The cost functions live in the tool itself
+#define ASP_SFS_NO_MAIN
+#include <asp/Tools/sfs.cc>
+
+#include <boost/shared_ptr.hpp>
+#include <cmath>
+#include <sstream>
+
+using namespace vw;
+using namespace asp;
+
+namespace {
+
+  // A small DEM seen from above by a pinhole camera, with all that an
+  // intensity residual needs. The cost functions keep references to
+  // these, so this must outlive them.
+  struct SfsScene {
+    ImageView<double> dem;
+    cartography::GeoReference geo;
+    boost::shared_ptr<CameraModel> camera;
+    MaskedImgT image;
+    DoubleImgT blend_weight;
+    BBox2i crop_box;
+    ModelParams model_params;
+    double max_dem_height, gridx, gridy;
+    double scaled_sun_posn[3];
+
+    SfsScene(): max_dem_height(0.0), gridx(30.0), gridy(30.0) {
+
+      geo.set_geographic();
+      geo.set_well_known_geogcs("D_MOON");
+      Matrix3x3 affine;
+      affine(0,0) = 0.001;  // about 30 meters per pixel
+      affine(1,1) = -0.001;
+      affine(2,2) = 1;
+      affine(0,2) = 10;     // 10 deg east
+      affine(1,2) = 5;      // 5 deg north
+      geo.set_transform(affine);
+
+      // Keep the heights away from zero, so that the numerical steps,
+      // which are relative, are not lost in the Cartesian coordinates.
+      dem.set_size(9, 9);
+      for (int row = 0; row < dem.rows(); row++)
+        for (int col = 0; col < dem.cols(); col++)
+          dem(col, row) = 1000.0 + 20.0*sin(0.5*col)*cos(0.4*row) + 3.0*col - 2.0*row;
+
+      // Look at the DEM center from a bit to the side, so that the
+      // emission and incidence angles differ
+      cartography::Datum const& datum = geo.datum();
+      Vector2 lonlat  = geo.pixel_to_lonlat(Vector2(4, 4));
+      Vector3 ground  = datum.geodetic_to_cartesian(Vector3(lonlat[0], lonlat[1], 1000.0));
+      Vector3 cam_ctr = datum.geodetic_to_cartesian(Vector3(lonlat[0] + 0.05, lonlat[1] - 0.03,
+                                                            20000.0));
+      Vector3 z = normalize(ground - cam_ctr);
+      Vector3 x = normalize(cross_prod(z, Vector3(0, 0, 1)));
+      Vector3 y = cross_prod(z, x);
+      Matrix3x3 rotation;
+      for (int i = 0; i < 3; i++) {
+        rotation(i, 0) = x[i];
+        rotation(i, 1) = y[i];
+        rotation(i, 2) = z[i];
+      }
+      NullLensDistortion no_distortion;
+      boost::shared_ptr<CameraModel>
+        pinhole(new PinholeModel(cam_ctr, rotation, 2000.0, 2000.0, 50.0, 50.0,
+                                 &no_distortion, 1.0));
+      camera.reset(new AdjustedCameraModel(pinhole));
+
+      // A smooth image and blending weight around where the DEM projects
+      ImageView< PixelMask<float> > img(100, 100);
+      ImageView<double> weight(100, 100);
+      for (int row = 0; row < img.rows(); row++) {
+        for (int col = 0; col < img.cols(); col++) {
+          img(col, row) = PixelMask<float>(0.3 + 0.002*col + 0.001*row
+                                           + 0.05*sin(0.1*col)*cos(0.15*row));
+          weight(col, row) = 0.7 + 0.2*sin(0.05*col + 0.07*row);
+        }
+      }
+      image        = img;
+      blend_weight = weight;
+      crop_box     = BBox2i(0, 0, img.cols(), img.rows());
+
+      // The sun is high and to the east
+      Vector3 up   = normalize(ground);
+      Vector3 east = normalize(cross_prod(Vector3(0, 0, 1), up));
+      model_params.sunPosition = ground + 1.5e11*normalize(up + 0.8*east);
+      for (int i = 0; i < 3; i++)
+        scaled_sun_posn[i] = 1.0;
+    }
+  };
+
+  // Typical coefficients for each reflectance model. The ones a model
+  // does not use are kept away from zero as well.
+  std::vector<double> model_coeffs(int reflectance_type) {
+    std::vector<double> coeffs(g_num_model_coeffs);
+    for (size_t k = 0; k < coeffs.size(); k++)
+      coeffs[k] = 1e-3*(k + 1);
+
+    double lunar[4] = {1.0, -0.019, 0.000242, -0.00000146};
+    double scale[4] = {1.0, 1e-3, 1e-5, 1e-7};
+    double hapke[5] = {0.68, 0.17, 0.62, 0.52, 0.52}; // omega, b, c, B0, h
+    if (reflectance_type == LUNAR_LAMBERT) {
+      for (int k = 0; k < 4; k++)
+        coeffs[k] = lunar[k];
+    } else if (reflectance_type == ARBITRARY_MODEL) {
+      for (int k = 0; k < 4; k++) {
+        coeffs[k]      = lunar[k];
+        coeffs[k + 4]  = scale[k];
+        coeffs[k + 8]  = lunar[k];
+        coeffs[k + 12] = scale[k];
+      }
+    } else if (reflectance_type == HAPKE) {
+      for (int k = 0; k < 5; k++)
+        coeffs[k] = hapke[k];
+    } else if (reflectance_type == CHARON) {
+      coeffs[0] = 0.7;  // albedo
+      coeffs[1] = 0.63; // phase function
+    }
+    return coeffs;
+  }
+
+  // Evaluate both cost functions at the same parameters, and check
+  // that the residuals and all derivatives agree.
+  void expect_same_derivatives(ceres::CostFunction const& analytic,
+                               ceres::CostFunction const& numeric,
+                               double const* const* params,
+                               std::string const& label) {
+
+    std::vector<int> sizes = numeric.parameter_block_sizes();
+    ASSERT_EQ(int(sizes.size()), int(analytic.parameter_block_sizes().size())) << label;
+    ASSERT_EQ(1, analytic.num_residuals()) << label;
+
+    std::vector< std::vector<double> > analytic_jac(sizes.size()), numeric_jac(sizes.size());
+    std::vector<double*> analytic_ptrs(sizes.size()), numeric_ptrs(sizes.size());
+    for (size_t b = 0; b < sizes.size(); b++) {
+      ASSERT_EQ(sizes[b], analytic.parameter_block_sizes()[b]) << label;
+      analytic_jac[b].resize(sizes[b]);
+      numeric_jac [b].resize(sizes[b]);
+      analytic_ptrs[b] = &analytic_jac[b][0];
+      numeric_ptrs [b] = &numeric_jac [b][0];
+    }
+
+    double analytic_res = 0.0, numeric_res = 0.0;
+    ASSERT_TRUE(analytic.Evaluate(params, &analytic_res, &analytic_ptrs[0])) << label;
+    ASSERT_TRUE(numeric .Evaluate(params, &numeric_res,  &numeric_ptrs [0])) << label;
+
+    // A zero residual means the grid point was not seen in the image
+    ASSERT_NE(0.0, numeric_res) << label;
+    EXPECT_NEAR(numeric_res, analytic_res, 1e-12) << label;
+
+    for (size_t b = 0; b < sizes.size(); b++) {
+      for (int k = 0; k < sizes[b]; k++) {
+        double expected = numeric_jac[b][k];
+        EXPECT_NEAR(expected, analytic_jac[b][k], 1e-6 + 1e-4*std::abs(expected))
+          << label << ", block " << b << ", entry " << k;
+      }
+    }
+  }
+}
+
+// The intensity residuals find most of their derivatives themselves.
+// They must agree with what Ceres gets by differencing the same
+// residuals, for every reflectance model and number of haze
+// coefficients, both when the exposure, haze, and albedo are floated
+// along with the DEM and when only the DEM is.
+TEST( SfsCostFunctions, IntensityDerivativesMatchNumeric ) {
+
+  SfsScene scene;
+  Options opt;
+  g_opt = &opt;
+
+  bool   model_shadows = false;
+  double camera_position_step_size = 1.0;
+  int    col = 4, row = 4;
+  ImageView<double> & dem = scene.dem; // alias
+
+  int reflectance_types[] = {LAMBERT, LUNAR_LAMBERT, HAPKE, ARBITRARY_MODEL, CHARON};
+  for (int t = 0; t < 5; t++) {
+
+    GlobalParams global_params;
+    global_params.reflectanceType = reflectance_types[t];
+    global_params.phaseCoeffC1    = 0.3;
+    global_params.phaseCoeffC2    = 0.1;
+    std::vector<double> coeffs = model_coeffs(reflectance_types[t]);
+
+    for (int num_haze = 0; num_haze <= int(g_max_num_haze_coeffs); num_haze++) {
+
+      opt.num_haze_coeffs = num_haze;
+      std::ostringstream label;
+      label << "Reflectance type " << reflectance_types[t] << ", haze coeffs " << num_haze;
+
+      // The camera adjustments are small but nonzero, as the numerical
+      // steps are relative
+      double exposure = 1.3, albedo = 0.8;
+      double haze[g_max_num_haze_coeffs] = {0.02, 0.1, 0.05, 0.03, 0.01, 0.02};
+      double adjustments[6] = {1e-7, -2e-7, 1.5e-7, 1e-5, -2e-5, 1e-5};
+
+      // Everything floated
+      double const* params[IntensityError::NUM_BLOCKS]
+        = {&exposure, haze, &dem(col-1, row), &dem(col, row), &dem(col+1, row),
+           &dem(col, row+1), &dem(col, row-1), &albedo, adjustments, &coeffs[0]};
+      ceres::CostFunction * analytic
+        = IntensityError::Create(col, row, dem, scene.geo, model_shadows,
+                                 camera_position_step_size, scene.max_dem_height,
+                                 scene.gridx, scene.gridy, global_params,
+                                 scene.model_params, scene.crop_box, scene.image,
+                                 scene.blend_weight, scene.scaled_sun_posn, scene.camera);
+      ceres::CostFunction * numeric
+        = new ceres::NumericDiffCostFunction<IntensityError, ceres::CENTRAL, 1, 1,
+                                             g_max_num_haze_coeffs, 1, 1, 1, 1, 1, 1, 6,
+                                             g_num_model_coeffs>
+        (new IntensityError(col, row, dem, scene.geo, model_shadows,
+                            camera_position_step_size, scene.max_dem_height,
+                            scene.gridx, scene.gridy, global_params,
+                            scene.model_params, scene.crop_box, scene.image,
+                            scene.blend_weight, scene.scaled_sun_posn, scene.camera));
+      expect_same_derivatives(*analytic, *numeric, params, label.str());
+      delete analytic;
+      delete numeric;
+
+      // Only the DEM floated
+      double const* dem_params[IntensityErrorFloatDemOnly::NUM_BLOCKS]
+        = {&dem(col-1, row), &dem(col, row), &dem(col+1, row),
+           &dem(col, row+1), &dem(col, row-1)};
+      analytic
+        = IntensityErrorFloatDemOnly::Create(col, row, dem, albedo, &coeffs[0],
+                                             &exposure, haze, adjustments,
+                                             scene.geo, model_shadows,
+                                             camera_position_step_size, scene.max_dem_height,
+                                             scene.gridx, scene.gridy, global_params,
+                                             scene.model_params, scene.crop_box, scene.image,
+                                             scene.blend_weight, scene.scaled_sun_posn,
+                                             scene.camera);
+      numeric
+        = new ceres::NumericDiffCostFunction<IntensityErrorFloatDemOnly, ceres::CENTRAL,
+                                             1, 1, 1, 1, 1, 1>
+        (new IntensityErrorFloatDemOnly(col, row, dem, albedo, &coeffs[0],
+                                        &exposure, haze, adjustments,
+                                        scene.geo, model_shadows,
+                                        camera_position_step_size, scene.max_dem_height,
+                                        scene.gridx, scene.gridy, global_params,
+                                        scene.model_params, scene.crop_box, scene.image,
+                                        scene.blend_weight, scene.scaled_sun_posn,
+                                        scene.camera));
+      expect_same_derivatives(*analytic, *numeric, dem_params, label.str() + ", DEM only");
+      delete analytic;
+      delete numeric;
+    }
+  }
+
+  g_opt = NULL;
+}
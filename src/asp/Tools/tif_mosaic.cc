@@ -25,6 +25,7 @@
 #include <asp/Core/Common.h>
 #include <asp/Core/Macros.h>
 #include <asp/Core/InterestPointMatching.h>
+#include <asp/Core/FootprintIndex.h>
 
 using namespace vw;
 namespace po = boost::program_options;
@@ -238,6 +239,7 @@ private:
   std::vector<ImageData> m_img_data;
   double m_scale;
   double m_output_nodata_value;
+  asp::FootprintIndex m_index; // to find the images intersecting a tile
 
 public:
   TifMosaicView(int dst_cols, int dst_rows, std::vector<ImageData> & img_data,
@@ -245,7 +247,12 @@ public:
     m_dst_cols((int)(scale*dst_cols)),
     m_dst_rows((int)(scale*dst_rows)),
     m_img_data(img_data), m_scale(scale),
-    m_output_nodata_value(output_nodata_value){}
+    m_output_nodata_value(output_nodata_value){
+    std::vector<BBox2> footprints;
+    for (size_t k = 0; k < m_img_data.size(); k++)
+      footprints.push_back(m_img_data[k].dst_box);
+    m_index = asp::FootprintIndex(footprints);
+  }
 
   typedef float      pixel_type;
   typedef pixel_type result_type;
@@ -280,12 +287,16 @@ public:
     typedef ImageView<masked_pixel_type> ImageT;
     typedef InterpolationView<ImageT, BilinearInterpolation> InterpT;
 
-    std::vector<BBox2i>  src_vec(m_img_data.size());  // Effective area of image tile
-    std::vector<InterpT> crop_vec(m_img_data.size(),
-                                  InterpT(ImageT())); // Image data but expanded a bit for interpolation's sake
+    // Only the images whose footprints are near the tile are considered.
+    // They are kept in increasing order, as later images are on top.
+    std::vector<int> candidates = m_index.candidates(BBox2(scaled_box));
+    std::vector<BBox2i>  src_vec;  // Effective area of image tile
+    std::vector<InterpT> crop_vec; // Image data but expanded a bit for interpolation's sake
+    std::vector<Matrix3x3> inv_vec; // Transform from destination to source pixels
     int extra = BilinearInterpolation::pixel_buffer;
     // Loop through the input images
-    for (int k = 0; k < (int)m_img_data.size(); k++){
+    for (size_t c = 0; c < candidates.size(); c++){
+      int k = candidates[c];
       BBox2 box = m_img_data[k].dst_box;
       box.crop(scaled_box);
       if (box.empty())
@@ -296,46 +307,64 @@ public:
       box.crop(bounding_box(m_img_data[k].src_img));
       if (box.empty())
         continue;
-      src_vec[k] = ( box ); // Recording active area of the tile
+      src_vec.push_back( box ); // Recording active area of the tile
       box.expand( extra );  // Expanding to help interpolation
-      crop_vec[k] =
-        InterpT(create_mask_less_or_equal
-                (crop(edge_extend(m_img_data[k].src_img, ConstantEdgeExtension()),
-                      box),
-                 m_img_data[k].nodata_value));
+      crop_vec.push_back
+        (InterpT(create_mask_less_or_equal
+                 (crop(edge_extend(m_img_data[k].src_img, ConstantEdgeExtension()),
+                       box),
+                  m_img_data[k].nodata_value)));
+      inv_vec.push_back(inverse(affine2mat(m_img_data[k].transform)));
     }
+    int num_active = src_vec.size();
 
     ImageView<pixel_type> tile(bbox.width(), bbox.height());
     fill( tile, m_output_nodata_value );
 
-    // TODO: Replace this code with the resample_aa function??
+    // The transforms here only scale and translate, so the source column
+    // depends only on the output column and the source row only on the
+    // output row. Find those once per tile rather than for each pixel.
+    // Fall back to the full transform if an image is rotated.
+    std::vector< std::vector<double> > src_cols(num_active), src_rows(num_active);
+    std::vector<bool> is_separable(num_active);
+    for (int j = 0; j < num_active; j++){
+      Matrix3x3 const& T = inv_vec[j];
+      is_separable[j] = (T(0, 1) == 0 && T(1, 0) == 0);
+      if (!is_separable[j])
+        continue;
+      src_cols[j].resize(bbox.width());
+      src_rows[j].resize(bbox.height());
+      for (int col = 0; col < bbox.width(); col++)
+        src_cols[j][col] = T(0, 0)*(col + bbox.min().x())/m_scale + T(0, 2);
+      for (int row = 0; row < bbox.height(); row++)
+        src_rows[j][row] = T(1, 1)*(row + bbox.min().y())/m_scale + T(1, 2);
+    }
 
-    // TODO: This could possibly be performed entirely with a
-    // TransformView and apply_mask.
-    // -- or --
-    // Since we have no rotations, we can assume whole lines will come
-    // from a single image
-    
     // Loop through the output image tile
     for (int row = 0; row < bbox.height(); row++){
       for (int col = 0; col < bbox.width(); col++){
 
-        Vector2 dst_pix = Vector2(col + bbox.min().x(),
-                                  row + bbox.min().y())/m_scale;
-
         // See which src image we end up in. Start from the later
         // images, as those are on top. Stop when we find an image
         // with a valid pixel at given location.
-        for (int k = (int)m_img_data.size()-1; k >= 0; k--){
-          Vector2 src_pix = m_img_data[k].transform.reverse(dst_pix);
-          if (!src_vec[k].contains(src_pix))
+        for (int j = num_active-1; j >= 0; j--){
+          Vector2 src_pix;
+          if (is_separable[j]) {
+            src_pix = Vector2(src_cols[j][col], src_rows[j][row]);
+          } else {
+            Vector2 dst_pix = Vector2(col + bbox.min().x(),
+                                      row + bbox.min().y())/m_scale;
+            src_pix = Vector2(inv_vec[j](0, 0)*dst_pix[0] + inv_vec[j](0, 1)*dst_pix[1] + inv_vec[j](0, 2),
+                              inv_vec[j](1, 0)*dst_pix[0] + inv_vec[j](1, 1)*dst_pix[1] + inv_vec[j](1, 2));
+          }
+          if (!src_vec[j].contains(src_pix))
             continue;
 
-          // Go to the coordinate system of image crop_vec[k]. Note that
+          // Go to the coordinate system of image crop_vec[j]. Note that
           // we add back the 'extra' number used in expanding the image earlier.
-          src_pix += elem_diff(extra, src_vec[k].min());
+          src_pix += elem_diff(extra, src_vec[j].min());
 
-          masked_pixel_type r = crop_vec[k](src_pix[0], src_pix[1] );
+          masked_pixel_type r = crop_vec[j](src_pix[0], src_pix[1] );
           if (is_valid(r)){
             tile(col, row) = r.child();
             break;
@@ -538,6 +538,66 @@ void get_offsets(int tdi, bool is_wv01, bool is_forward,
   }
 }
 
+// Resample the region 'bbox' of the given image, with the output pixel
+// (col, row) being the bilinear interpolation of the input at
+// (col + shift_x[col], row + shift_y[col]). The input is extended
+// with its edge values. As the shifts depend only on the column, the
+// interpolation indices and weights are found once per column, and
+// the tile is traversed row by row reading straight from the
+// buffer. This gives the same result as an InterpolationView with
+// BilinearInterpolation and ConstantEdgeExtension, but much faster.
+template <class ImageT>
+ImageView<typename ImageT::pixel_type>
+shift_columns(ImageT const& img, BBox2i const& bbox,
+              std::vector<double> const& shift_x,
+              std::vector<double> const& shift_y) {
+
+  typedef typename ImageT::pixel_type PixelT;
+  
+  // Need to see a bit more of the input image for the purpose
+  // of interpolation.
+  int max_offset = 5; // CCD offsets are always under 1 pix
+  int bias = BilinearInterpolation::pixel_buffer + max_offset;
+  BBox2i biased_box = bbox;
+  biased_box.expand(bias);
+  biased_box.crop(bounding_box(img));
+  
+  ImageView<PixelT> cropped_img = crop(img, biased_box);
+  int in_cols = cropped_img.cols(), in_rows = cropped_img.rows();
+  int num_cols = bbox.width(), num_rows = bbox.height();
+
+  // The interpolation table. Column indices are clamped to the
+  // cropped image, while the row offsets are applied and clamped
+  // later, per row.
+  std::vector<int>    col0(num_cols), col1(num_cols), row_offset(num_cols);
+  std::vector<double> wx(num_cols), wy(num_cols);
+  for (int col = 0; col < num_cols; col++) {
+    double x = col + bbox.min().x() - biased_box.min().x() + shift_x[col + bbox.min().x()];
+    double y = bbox.min().y() - biased_box.min().y() + shift_y[col + bbox.min().x()];
+    int x0 = (int)floor(x), y0 = (int)floor(y);
+    wx[col]         = x - x0;
+    wy[col]         = y - y0;
+    col0[col]       = std::min(std::max(x0,     0), in_cols - 1);
+    col1[col]       = std::min(std::max(x0 + 1, 0), in_cols - 1);
+    row_offset[col] = y0;
+  }
+  
+  ImageView<PixelT> tile(num_cols, num_rows);
+  for (int row = 0; row < num_rows; row++) {
+    for (int col = 0; col < num_cols; col++) {
+      int r0 = std::min(std::max(row + row_offset[col],     0), in_rows - 1);
+      int r1 = std::min(std::max(row + row_offset[col] + 1, 0), in_rows - 1);
+      double x_wt = wx[col], y_wt = wy[col];
+      tile(col, row) = PixelT((1.0 - y_wt) * ((1.0 - x_wt) * cropped_img(col0[col], r0) +
+                                              x_wt         * cropped_img(col1[col], r0)) +
+                              y_wt         * ((1.0 - x_wt) * cropped_img(col0[col], r1) +
+                                              x_wt         * cropped_img(col1[col], r1)));
+    }
+  }
+
+  return tile;
+}
+
 // Apply WorldView corrections to each vertical block as high as the image
 // corresponding to one CCD sensor.
 template <class ImageT>
@@ -547,6 +607,7 @@ class WVPerBlockCorrectView: public ImageViewBase<WVPerBlockCorrectView<ImageT>>
   bool m_is_wv01, m_is_forward;
   double m_pitch_ratio;
   std::vector<double> m_posx, m_ccdx, m_posy, m_ccdy;
+  std::vector<double> m_shift_x, m_shift_y; // per-column shifts
   
   typedef typename ImageT::pixel_type PixelT;
 
@@ -567,6 +628,21 @@ public:
               m_posy.size() == m_ccdy.size(),
               ArgumentErr() << "wv_correct: Expecting the arrays of positions "
               << "and offsets to have the same sizes.");
+
+    // Accumulate the corrections up to each column. This is done
+    // once here rather than for each column of each tile.
+    m_shift_x.resize(m_img.cols(), 0.0);
+    m_shift_y.resize(m_img.cols(), 0.0);
+    for (int col = 0; col < m_img.cols(); col++){
+      for (size_t t = 0; t < m_ccdx.size(); t++){
+        if (m_posx[t] < col)
+          m_shift_x[col] -= m_ccdx[t];
+      }
+      for (size_t t = 0; t < m_ccdy.size(); t++){
+        if (m_posy[t] < col)
+          m_shift_y[col] -= m_ccdy[t];
+      }
+    }
   }
   
   typedef PixelT pixel_type;
@@ -586,49 +662,7 @@ public:
 
   typedef CropView<ImageView<pixel_type> > prerasterize_type;
   inline prerasterize_type prerasterize(BBox2i const& bbox) const {
-
-    // Need to see a bit more of the input image for the purpose
-    // of interpolation.
-    int max_offset = 5; // CCD offsets are always under 1 pix
-    int bias = BilinearInterpolation::pixel_buffer + max_offset;
-    BBox2i biased_box = bbox;
-    biased_box.expand(bias);
-    biased_box.crop(bounding_box(m_img));
-    
-    ImageView<result_type> cropped_img = crop(m_img, biased_box);
-    InterpolationView<EdgeExtensionView< ImageView<result_type>,
-      ConstantEdgeExtension >, BilinearInterpolation> interp_img
-      = interpolate(cropped_img, BilinearInterpolation(),
-                    ConstantEdgeExtension());
-
-    
-    ImageView<result_type> tile(bbox.width(), bbox.height());
-    for (int col = bbox.min().x(); col < bbox.max().x(); col++){
-
-      // Accumulate the corrections up to the current column
-      double valx = 0, valy = 0;
-      if (m_ccdx.size() > 0){
-        valx = 0.0;
-        for (size_t t = 0; t < m_ccdx.size(); t++){
-          if (m_posx[t] < col){
-            valx -= m_ccdx[t];
-          }
-        }
-        valy = 0.0;
-        for (size_t t = 0; t < m_ccdy.size(); t++){
-          if (m_posy[t] < col){
-            valy -= m_ccdy[t];
-          }
-        }
-      }
-      
-      for (int row = bbox.min().y(); row < bbox.max().y(); row++){
-        tile(col - bbox.min().x(), row - bbox.min().y() )
-          = interp_img(col - biased_box.min().x() + valx,
-                       row - biased_box.min().y() + valy);
-      }
-    }
-    
+    ImageView<result_type> tile = shift_columns(m_img, bbox, m_shift_x, m_shift_y);
     return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
                              cols(), rows() );
   }
@@ -651,6 +685,7 @@ template <class ImageT>
 class WVPerColumnCorrectView: public ImageViewBase< WVPerColumnCorrectView<ImageT> >{
   ImageT m_img;
   std::vector<double> m_dx, m_dy;
+  std::vector<double> m_shift_x, m_shift_y; // per-column shifts
   typedef typename ImageT::pixel_type PixelT;
 
 public:
@@ -676,6 +711,13 @@ public:
       // vw_throw( ArgumentErr() << "Expecting as many corrections as columns.\n" );
     }
 
+    // The corrections are subtracted from the pixel positions
+    m_shift_x.resize(m_dx.size());
+    m_shift_y.resize(m_dy.size());
+    for (size_t col = 0; col < m_dx.size(); col++) {
+      m_shift_x[col] = -m_dx[col];
+      m_shift_y[col] = -m_dy[col];
+    }
   }
   
   typedef PixelT pixel_type;
@@ -695,32 +737,8 @@ public:
 
   typedef CropView<ImageView<pixel_type> > prerasterize_type;
   inline prerasterize_type prerasterize(BBox2i const& bbox) const {
-    // Need to see a bit more of the input image for the purpose
-    // of interpolation.
-    int max_offset = 5; // CCD offsets are always under 1 pix
-    int bias = BilinearInterpolation::pixel_buffer + max_offset;
-    BBox2i biased_box = bbox;
-    biased_box.expand(bias);
-    biased_box.crop(bounding_box(m_img));
-    
-    ImageView<result_type> cropped_img = crop(m_img, biased_box);
-    InterpolationView<EdgeExtensionView< ImageView<result_type>,
-      ConstantEdgeExtension >, BilinearInterpolation> interp_img
-      = interpolate(cropped_img, BilinearInterpolation(),
-                    ConstantEdgeExtension());
-
-    
-    ImageView<result_type> tile(bbox.width(), bbox.height());
-
-    for (int col = bbox.min().x(); col < bbox.max().x(); col++) {
-      for (int row = bbox.min().y(); row < bbox.max().y(); row++) {
-        // Note that the same correction is used for an entire column
-        tile(col - bbox.min().x(), row - bbox.min().y() )
-          = interp_img(col - biased_box.min().x() - m_dx[col],
-                       row - biased_box.min().y() - m_dy[col]);
-      }
-    }
-
+    // Note that the same correction is used for an entire column
+    ImageView<result_type> tile = shift_columns(m_img, bbox, m_shift_x, m_shift_y);
     return prerasterize_type(tile, -bbox.min().x(), -bbox.min().y(),
                              cols(), rows() );
   }